@@ -47,9 +47,28 @@ union any_object {
 
 DEFINE_ALLOCATOR(blob, struct blob)
 DEFINE_ALLOCATOR(tree, struct tree)
-DEFINE_ALLOCATOR(commit, struct commit)
+DEFINE_ALLOCATOR(raw_commit, struct commit)
 DEFINE_ALLOCATOR(tag, struct tag)
 DEFINE_ALLOCATOR(object, union any_object)
+DEFINE_ALLOCATOR(commit_list, struct commit_list)
+
+static unsigned int commit_count;
+
+/*
+ * Every commit gets a unique, dense index so that per-command data can
+ * live in a commit-slab side table instead of in struct commit.
+ */
+unsigned int alloc_commit_index(void)
+{
+	return commit_count++;
+}
+
+void *alloc_commit_node(void)
+{
+	struct commit *c = alloc_raw_commit_node();
+	c->index = alloc_commit_index();
+	return c;
+}
 
 static void report(const char *name, unsigned int count, size_t size)
 {
@@ -64,6 +83,8 @@ void alloc_report(void)
 {
 	REPORT(blob);
 	REPORT(tree);
-	REPORT(commit);
+	report("commit", raw_commit_allocs,
+	       raw_commit_allocs * sizeof(struct commit) >> 10);
 	REPORT(tag);
+	REPORT(commit_list);
 }
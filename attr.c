@@ -12,6 +12,7 @@
 #include "exec_cmd.h"
 #include "attr.h"
 #include "dir.h"
+#include "hash.h"
 
 const char git_attr__true[] = "(builtin)true";
 const char git_attr__false[] = "\0(builtin)false";
@@ -128,6 +129,9 @@ struct attr_state {
  * In either case, num_attr is the number of attributes affected by
  * this rule, and state is an array listing them.  The attributes are
  * listed as they appear in the file (macros unexpanded).
+ *
+ * pos is the position of the rule in its attr_stack, and next_same
+ * the rule before it that is found under the same hash there.
  */
 struct match_attr {
 	union {
@@ -135,7 +139,10 @@ struct match_attr {
 		struct git_attr *attr;
 	} u;
 	char is_macro;
+	char nodir;	/* the pattern has no slash */
 	unsigned num_attr;
+	unsigned pos;
+	struct match_attr *next_same;
 	struct attr_state state[FLEX_ARRAY];
 };
 
@@ -272,16 +279,83 @@ static struct match_attr *parse_attr_line(const char *line, const char *src,
  * current directory, and then scan the list backwards to find the first match.
  * This is exactly the same as what excluded() does in dir.c to deal with
  * .gitignore
+ *
+ * Most patterns are the name of one file ("Makefile") or one path
+ * ("/doc/Makefile"), and each element keeps these in hash tables, by
+ * the basename and by the path relative to its directory.  Only the
+ * other ones (those with wildcards) are matched against every path.
  */
 
 static struct attr_stack {
 	struct attr_stack *prev;
 	char *origin;
+	unsigned originlen;
 	unsigned num_matches;
 	unsigned alloc;
 	struct match_attr **attrs;
+	struct hash_table basenames;	/* of patterns without a slash */
+	struct hash_table paths;	/* of patterns with one */
+	unsigned *globs;		/* the positions of the others */
+	unsigned globs_nr, globs_alloc;
+	unsigned *macros;		/* the positions of the macros */
+	unsigned macros_nr, macros_alloc;
 } *attr_stack;
 
+static unsigned hash_attr_path(const char *path, int len)
+{
+	unsigned hash = 0x123;
+
+	while (len--) {
+		/* folded, so that it works the same with ignore_case */
+		unsigned char c = tolower(*path++);
+		hash = hash * 101 + c;
+	}
+	return hash;
+}
+
+static int has_wildcard(const char *pattern)
+{
+	for (; *pattern; pattern++)
+		if (is_glob_special(*pattern))
+			return 1;
+	return 0;
+}
+
+static void hash_match_attr(struct hash_table *table, struct match_attr *a,
+			    const char *key)
+{
+	void **pos = insert_hash(hash_attr_path(key, strlen(key)), a, table);
+
+	if (pos) {
+		a->next_same = *pos;
+		*pos = a;
+	}
+}
+
+/* Put the rule that was just added to "res" where fill() will find it */
+static void index_match_attr(struct attr_stack *res, struct match_attr *a)
+{
+	const char *pattern;
+
+	if (a->is_macro) {
+		ALLOC_GROW(res->macros, res->macros_nr + 1, res->macros_alloc);
+		res->macros[res->macros_nr++] = a->pos;
+		return;
+	}
+	pattern = a->u.pattern;
+	a->nodir = !strchr(pattern, '/');
+	if (has_wildcard(pattern)) {
+		ALLOC_GROW(res->globs, res->globs_nr + 1, res->globs_alloc);
+		res->globs[res->globs_nr++] = a->pos;
+	} else if (a->nodir) {
+		hash_match_attr(&res->basenames, a, pattern);
+	} else {
+		if (*pattern == '/')
+			pattern++;
+		hash_match_attr(&res->paths, a, pattern);
+	}
+}
+
 static void free_attr_elem(struct attr_stack *e)
 {
 	int i;
@@ -302,6 +376,10 @@ static void free_attr_elem(struct attr_stack *e)
 		free(a);
 	}
 	free(e->attrs);
+	free_hash(&e->basenames);
+	free_hash(&e->paths);
+	free(e->globs);
+	free(e->macros);
 	free(e);
 }
 
@@ -327,7 +405,9 @@ static void handle_attr_line(struct attr_stack *res,
 				      sizeof(struct match_attr *) *
 				      res->alloc);
 	}
+	a->pos = res->num_matches;
 	res->attrs[res->num_matches++] = a;
+	index_match_attr(res, a);
 }
 
 static struct attr_stack *read_attr_from_array(const char **list)
@@ -475,8 +555,19 @@ static void debug_set(const char *what, const char *match, struct git_attr *attr
 #define debug_set(a,b,c,d) do { ; } while (0)
 #endif
 
+/*
+ * The path check_all_attr was last collected for, and how many
+ * attributes there were then; a caller often asks about one path
+ * several times in a row (e.g. diff, for the driver, the whitespace
+ * rules and the conversion), and the stack it was collected from stays
+ * the same until another path is asked about, or the stack is dropped.
+ */
+static struct strbuf collected_path = STRBUF_INIT;
+static int collected_attr_nr = -1;
+
 static void drop_attr_stack(void)
 {
+	collected_attr_nr = -1;
 	while (attr_stack) {
 		struct attr_stack *elem = attr_stack;
 		attr_stack = elem->prev;
@@ -628,6 +719,7 @@ static void prepare_attr_stack(const char *path)
 			strbuf_addstr(&pathbuf, GITATTRIBUTES_FILE);
 			elem = read_attr(pathbuf.buf, 0);
 			strbuf_setlen(&pathbuf, cp - path);
+			elem->originlen = pathbuf.len;
 			elem->origin = strbuf_detach(&pathbuf, NULL);
 			elem->prev = attr_stack;
 			attr_stack = elem;
@@ -645,13 +737,13 @@ static void prepare_attr_stack(const char *path)
 }
 
 static int path_matches(const char *pathname, int pathlen,
-			const char *pattern,
+			const char *basename, const struct match_attr *a,
 			const char *base, int baselen)
 {
-	if (!strchr(pattern, '/')) {
+	const char *pattern = a->u.pattern;
+
+	if (a->nodir) {
 		/* match basename */
-		const char *basename = strrchr(pathname, '/');
-		basename = basename ? basename + 1 : pathname;
 		return (fnmatch_icase(pattern, basename, 0) == 0);
 	}
 	/*
@@ -693,17 +785,46 @@ static int fill_one(const char *what, struct match_attr *a, int rem)
 	return rem;
 }
 
-static int fill(const char *path, int pathlen, struct attr_stack *stk, int rem)
+/*
+ * Apply the rules of "stk" that match the path, the last one first.
+ * They are the ones found under the basename and under the path in
+ * the hash tables, and the matching wildcard ones, merged by position.
+ */
+static int fill(const char *path, int pathlen, const char *basename,
+		struct attr_stack *stk, int rem)
 {
-	int i;
 	const char *base = stk->origin ? stk->origin : "";
+	int baselen = stk->originlen;
+	const char *relpath = path + (baselen ? baselen + 1 : 0);
+	struct match_attr *by_basename, *by_path;
+	int glob = stk->globs_nr - 1;
 
-	for (i = stk->num_matches - 1; 0 < rem && 0 <= i; i--) {
-		struct match_attr *a = stk->attrs[i];
-		if (a->is_macro)
-			continue;
-		if (path_matches(path, pathlen,
-				 a->u.pattern, base, strlen(base)))
+	if (pathlen < baselen)
+		return rem;
+	by_basename = lookup_hash(hash_attr_path(basename, strlen(basename)),
+				  &stk->basenames);
+	by_path = lookup_hash(hash_attr_path(relpath, strlen(relpath)),
+			      &stk->paths);
+
+	while (0 < rem) {
+		struct match_attr *a = NULL;
+
+		if (0 <= glob)
+			a = stk->attrs[stk->globs[glob]];
+		if (by_basename && (!a || a->pos < by_basename->pos))
+			a = by_basename;
+		if (by_path && (!a || a->pos < by_path->pos))
+			a = by_path;
+		if (!a)
+			break;
+		if (a == by_basename)
+			by_basename = a->next_same;
+		else if (a == by_path)
+			by_path = a->next_same;
+		else
+			glob--;
+
+		if (path_matches(path, pathlen, basename, a, base, baselen))
 			rem = fill_one("fill", a, rem);
 	}
 	return rem;
@@ -719,10 +840,8 @@ static int macroexpand_one(int attr_nr, int rem)
 		return rem;
 
 	for (stk = attr_stack; !a && stk; stk = stk->prev)
-		for (i = stk->num_matches - 1; !a && 0 <= i; i--) {
-			struct match_attr *ma = stk->attrs[i];
-			if (!ma->is_macro)
-				continue;
+		for (i = stk->macros_nr - 1; !a && 0 <= i; i--) {
+			struct match_attr *ma = stk->attrs[stk->macros[i]];
 			if (ma->u.attr->attr_nr == attr_nr)
 				a = ma;
 		}
@@ -740,16 +859,26 @@ static int macroexpand_one(int attr_nr, int rem)
 static void collect_all_attrs(const char *path)
 {
 	struct attr_stack *stk;
+	const char *basename;
 	int i, pathlen, rem;
 
+	if (collected_attr_nr == attr_nr && !strcmp(collected_path.buf, path))
+		return;
+
 	prepare_attr_stack(path);
 	for (i = 0; i < attr_nr; i++)
 		check_all_attr[i].value = ATTR__UNKNOWN;
 
 	pathlen = strlen(path);
+	basename = strrchr(path, '/');
+	basename = basename ? basename + 1 : path;
 	rem = attr_nr;
 	for (stk = attr_stack; 0 < rem && stk; stk = stk->prev)
-		rem = fill(path, pathlen, stk, rem);
+		rem = fill(path, pathlen, basename, stk, rem);
+
+	strbuf_reset(&collected_path);
+	strbuf_addstr(&collected_path, path);
+	collected_attr_nr = attr_nr;
 }
 
 int git_check_attr(const char *path, int num, struct git_attr_check *check)
@@ -11,6 +11,7 @@
 #include "bisect.h"
 #include "sha1-array.h"
 #include "argv-array.h"
+#include "commit-slab.h"
 
 static struct sha1_array good_revs;
 static struct sha1_array skipped_revs;
@@ -21,9 +22,9 @@ static const char *argv_checkout[] = {"checkout", "-q", NULL, "--", NULL};
 static const char *argv_show_branch[] = {"show-branch", NULL, NULL};
 static const char *argv_update_ref[] = {"update-ref", "--no-deref", "BISECT_HEAD", NULL, NULL};
 
-/* bits #0-15 in revision.h */
-
-#define COUNTED		(1u<<16)
+/* commits already counted by count_distance() */
+define_commit_slab(counted_slab, unsigned char);
+static struct counted_slab counted_commits;
 
 /*
  * This is a truly stupid algorithm, but it's only
@@ -40,11 +41,12 @@ static int count_distance(struct commit_list *entry)
 		struct commit *commit = entry->item;
 		struct commit_list *p;
 
-		if (commit->object.flags & (UNINTERESTING | COUNTED))
+		if ((commit->object.flags & UNINTERESTING) ||
+		    *counted_slab_at(&counted_commits, commit))
 			break;
 		if (!(commit->object.flags & TREESAME))
 			nr++;
-		commit->object.flags |= COUNTED;
+		*counted_slab_at(&counted_commits, commit) = 1;
 		p = commit->parents;
 		entry = p;
 		if (p) {
@@ -63,7 +65,7 @@ static void clear_distance(struct commit_list *list)
 {
 	while (list) {
 		struct commit *commit = list->item;
-		commit->object.flags &= ~COUNTED;
+		*counted_slab_at(&counted_commits, commit) = 0;
 		list = list->next;
 	}
 }
@@ -137,7 +139,7 @@ static void show_list(const char *debug, int counted, int nr,
 		fprintf(stderr, "%c%c%c ",
 			(flags & TREESAME) ? ' ' : 'T',
 			(flags & UNINTERESTING) ? 'U' : ' ',
-			(flags & COUNTED) ? 'C' : ' ');
+			*counted_slab_at(&counted_commits, commit) ? 'C' : ' ');
 		if (commit->util)
 			fprintf(stderr, "%3d", weight(p));
 		else
@@ -363,6 +365,7 @@ struct commit_list *find_bisection(struct commit_list *list,
 	struct commit_list *p, *best, *next, *last;
 	int *weights;
 
+	init_counted_slab(&counted_commits);
 	show_list("bisection 2 entry", 0, 0, list);
 
 	/*
@@ -391,6 +394,7 @@ struct commit_list *find_bisection(struct commit_list *list,
 
 	/* Do the real work of finding bisection commit. */
 	best = do_find_bisection(list, nr, weights, find_all);
+	clear_counted_slab(&counted_commits);
 	if (best) {
 		if (!find_all)
 			best->next = NULL;
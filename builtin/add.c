@@ -417,7 +417,7 @@ int cmd_add(int argc, const char **argv, const char *prefix)
 	}
 	pathspec = validate_pathspec(argc, argv, prefix);
 
-	if (read_cache() < 0)
+	if (read_cache_preload(pathspec) < 0)
 		die(_("index file corrupt"));
 	treat_gitlinks(pathspec);
 
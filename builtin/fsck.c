@@ -664,15 +664,14 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 
 		prepare_packed_git();
 
-		if (show_progress) {
-			for (p = packed_git; p; p = p->next) {
-				if (open_pack_index(p))
-					continue;
-				total += p->num_objects;
-			}
-
-			progress = start_progress("Checking objects", total);
+		for (p = packed_git; p; p = p->next) {
+			if (open_pack_index(p))
+				continue;
+			total += p->num_objects;
 		}
+		presize_object_hash(total);
+		if (show_progress)
+			progress = start_progress("Checking objects", total);
 		for (p = packed_git; p; p = p->next) {
 			/* verify gives error messages itself */
 			if (verify_pack(p, fsck_obj_buffer,
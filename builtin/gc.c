@@ -27,6 +27,7 @@ static int pack_refs = 1;
 static int aggressive_window = 250;
 static int gc_auto_threshold = 6700;
 static int gc_auto_pack_limit = 50;
+static int gc_auto_geometric;
 static const char *prune_expire = "2.weeks.ago";
 
 static struct argv_array pack_refs_cmd = ARGV_ARRAY_INIT;
@@ -56,6 +57,10 @@ static int gc_config(const char *var, const char *value, void *cb)
 		gc_auto_pack_limit = git_config_int(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "gc.autogeometric")) {
+		gc_auto_geometric = git_config_int(var, value);
+		return 0;
+	}
 	if (!strcmp(var, "gc.pruneexpire")) {
 		if (value && strcmp(value, "now")) {
 			unsigned long now = approxidate("now");
@@ -156,12 +161,21 @@ static int need_to_gc(void)
 	 * packs, we run "repack -d -l".  If there are too many packs,
 	 * we run "repack -A -d -l".  Otherwise we tell the caller
 	 * there is no need.
+	 *
+	 * With gc.autogeometric, either case runs "repack
+	 * --geometric=<n> -d -l" instead, which rolls the loose
+	 * objects and the smaller packs up and leaves the large ones
+	 * alone.
 	 */
-	if (too_many_packs())
-		add_repack_all_option();
-	else if (!too_many_loose_objects())
+	if (too_many_packs()) {
+		if (gc_auto_geometric <= 1)
+			add_repack_all_option();
+	} else if (!too_many_loose_objects())
 		return 0;
 
+	if (gc_auto_geometric > 1)
+		argv_array_pushf(&repack, "--geometric=%d", gc_auto_geometric);
+
 	if (run_hook(NULL, "pre-auto-gc", NULL))
 		return 0;
 	return 1;
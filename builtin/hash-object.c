@@ -38,20 +38,143 @@ static void hash_object(const char *path, const char *type, int write_object,
 
 static int no_filters;
 
+/*
+ * Small blobs named on stdin are read a batch at a time and hashed
+ * together with hash_sha1_files(); anything else flushes the batch and
+ * goes through hash_object() on its own, so the names still come out
+ * in the order of the paths.
+ */
+#define HASH_BATCH 32
+#define HASH_BATCH_MAX_SIZE (64 * 1024)
+
+struct hash_batch {
+	struct hash_batch_item item[HASH_BATCH];
+	char *path[HASH_BATCH];
+	struct strbuf data[HASH_BATCH];
+	int nr;
+};
+
+static void flush_hash_batch(struct hash_batch *b, int write_objects)
+{
+	int i;
+
+	hash_sha1_files(b->item, b->nr);
+	for (i = 0; i < b->nr; i++) {
+		struct hash_batch_item *item = &b->item[i];
+
+		if (write_objects &&
+		    write_hashed_sha1_file(item->buf, item->len, item->type,
+					   item->sha1))
+			die("Unable to add %s to database", b->path[i]);
+		printf("%s\n", sha1_to_hex(item->sha1));
+		free(b->path[i]);
+		strbuf_reset(&b->data[i]);
+	}
+	maybe_flush_or_die(stdout, "hash to stdout");
+	b->nr = 0;
+}
+
+/* Returns 0 if "path" is not a small regular file */
+static int add_to_hash_batch(struct hash_batch *b, const char *path,
+			     int write_objects)
+{
+	struct strbuf *data = &b->data[b->nr];
+	struct strbuf nbuf = STRBUF_INIT;
+	struct stat st;
+
+	if (lstat(path, &st) || !S_ISREG(st.st_mode) ||
+	    st.st_size > HASH_BATCH_MAX_SIZE)
+		return 0;
+	if (strbuf_read_file(data, path, st.st_size) != st.st_size)
+		die_errno("Cannot read '%s'", path);
+	if (!no_filters &&
+	    convert_to_git(path, data->buf, data->len, &nbuf,
+			   write_objects ? safe_crlf : SAFE_CRLF_FALSE))
+		strbuf_swap(data, &nbuf);
+	strbuf_release(&nbuf);
+
+	b->item[b->nr].buf = data->buf;
+	b->item[b->nr].len = data->len;
+	b->item[b->nr].type = blob_type;
+	b->path[b->nr] = xstrdup(path);
+	if (++b->nr == HASH_BATCH)
+		flush_hash_batch(b, write_objects);
+	return 1;
+}
+
+static struct strbuf paths_in = STRBUF_INIT;
+static size_t paths_in_pos;
+
+/*
+ * Read the next path with read(2) rather than stdio, so that we know
+ * when we are about to wait for more input: callers like Git.pm write
+ * one path and wait for its name before writing the next, so the batch
+ * is flushed before we block.
+ */
+static int read_path(struct strbuf *line, struct hash_batch *b,
+		     int write_objects)
+{
+	for (;;) {
+		char *start = paths_in.buf + paths_in_pos;
+		char *eol = memchr(start, '\n', paths_in.len - paths_in_pos);
+		ssize_t n;
+
+		if (eol) {
+			strbuf_reset(line);
+			strbuf_add(line, start, eol - start);
+			paths_in_pos += eol - start + 1;
+			return 0;
+		}
+		strbuf_remove(&paths_in, 0, paths_in_pos);
+		paths_in_pos = 0;
+
+		if (b->nr)
+			flush_hash_batch(b, write_objects);
+		strbuf_grow(&paths_in, 8192);
+		n = xread(0, paths_in.buf + paths_in.len, 8192);
+		if (n < 0)
+			die_errno("could not read paths from stdin");
+		if (!n) {
+			if (!paths_in.len)
+				return EOF;
+			strbuf_reset(line);
+			strbuf_addbuf(line, &paths_in);
+			strbuf_reset(&paths_in);
+			return 0;
+		}
+		strbuf_setlen(&paths_in, paths_in.len + n);
+	}
+}
+
 static void hash_stdin_paths(const char *type, int write_objects)
 {
 	struct strbuf buf = STRBUF_INIT, nbuf = STRBUF_INIT;
+	struct hash_batch batch;
+	int i, batched = type_from_string(type) == OBJ_BLOB;
+
+	memset(&batch, 0, sizeof(batch));
+	for (i = 0; i < HASH_BATCH; i++)
+		strbuf_init(&batch.data[i], 0);
 
-	while (strbuf_getline(&buf, stdin, '\n') != EOF) {
+	while (read_path(&buf, &batch, write_objects) != EOF) {
 		if (buf.buf[0] == '"') {
 			strbuf_reset(&nbuf);
 			if (unquote_c_style(&nbuf, buf.buf, NULL))
 				die("line is badly quoted");
 			strbuf_swap(&buf, &nbuf);
 		}
+		if (batched && add_to_hash_batch(&batch, buf.buf, write_objects))
+			continue;
+		if (batch.nr)
+			flush_hash_batch(&batch, write_objects);
 		hash_object(buf.buf, type, write_objects,
 		    no_filters ? NULL : buf.buf);
 	}
+	if (batch.nr)
+		flush_hash_batch(&batch, write_objects);
+	for (i = 0; i < HASH_BATCH; i++)
+		strbuf_release(&batch.data[i]);
+	strbuf_release(&paths_in);
 	strbuf_release(&buf);
 	strbuf_release(&nbuf);
 }
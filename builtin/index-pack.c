@@ -23,6 +23,7 @@ struct object_entry {
 	enum object_type real_type;
 	unsigned delta_depth;
 	int base_object_no;
+	unsigned resolved_early:1; /* by the first pass workers */
 };
 
 union delta_base {
@@ -74,6 +75,7 @@ static int nr_objects;
 static int nr_deltas;
 static int nr_resolved_deltas;
 static int nr_threads;
+static int first_pass_threads;
 
 static int from_stdin;
 static int strict;
@@ -401,17 +403,23 @@ static void *unpack_entry_data(unsigned long offset, unsigned long size,
 	char hdr[32];
 	int hdrlen;
 
-	if (!is_delta_type(type)) {
-		hdrlen = sprintf(hdr, "%s %lu", typename(type), size) + 1;
-		git_SHA1_Init(&c);
-		git_SHA1_Update(&c, hdr, hdrlen);
-	} else
-		sha1 = NULL;
 	if (type == OBJ_BLOB && size > big_file_threshold)
 		buf = fixed_buf;
 	else
 		buf = xmalloc(size);
 
+	/*
+	 * Deltas are hashed once resolved, and objects we keep in core
+	 * are hashed by the first pass workers when there are some.
+	 */
+	if (is_delta_type(type) || (first_pass_threads && buf != fixed_buf))
+		sha1 = NULL;
+	if (sha1) {
+		hdrlen = sprintf(hdr, "%s %lu", typename(type), size) + 1;
+		git_SHA1_Init(&c);
+		git_SHA1_Update(&c, hdr, hdrlen);
+	}
+
 	memset(&stream, 0, sizeof(stream));
 	git_inflate_init(&stream);
 	stream.next_out = buf;
@@ -788,6 +796,29 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
  * delta_base_cache_limit, just like in find_unresolved_deltas(), we
  * just need to make sure the last node is not freed.
  */
+/*
+ * Get the content of an object that is either not a delta or was
+ * resolved by the first pass, going through its base objects.
+ */
+static void *get_resolved_data(struct object_entry *obj, unsigned long *size)
+{
+	void *base, *raw, *data;
+	unsigned long base_size;
+
+	if (!is_delta_type(obj->type)) {
+		*size = obj->size;
+		return get_data_from_pack(obj);
+	}
+	base = get_resolved_data(objects + obj->base_object_no, &base_size);
+	raw = get_data_from_pack(obj);
+	data = patch_delta(base, base_size, raw, obj->size, size);
+	free(raw);
+	free(base);
+	if (!data)
+		bad_object(obj->idx.offset, _("failed to apply delta"));
+	return data;
+}
+
 static void *get_base_data(struct base_data *c)
 {
 	if (!c->data) {
@@ -795,14 +826,13 @@ static void *get_base_data(struct base_data *c)
 		struct base_data **delta = NULL;
 		int delta_nr = 0, delta_alloc = 0;
 
-		while (is_delta_type(c->obj->type) && !c->data) {
+		while (is_delta_type(c->obj->type) && !c->data && c->base) {
 			ALLOC_GROW(delta, delta_nr + 1, delta_alloc);
 			delta[delta_nr++] = c;
 			c = c->base;
 		}
 		if (!delta_nr) {
-			c->data = get_data_from_pack(obj);
-			c->size = obj->size;
+			c->data = get_resolved_data(obj, &c->size);
 			get_thread_data()->base_cache_used += c->size;
 			prune_base_data(c);
 		}
@@ -877,6 +907,14 @@ static struct base_data *find_unresolved_deltas_1(struct base_data *base,
 		link_base_data(prev_base, base);
 	}
 
+	/* children the first pass resolved are bases of their own */
+	while (base->ref_first <= base->ref_last &&
+	       objects[deltas[base->ref_first].obj_no].resolved_early)
+		base->ref_first++;
+	while (base->ofs_first <= base->ofs_last &&
+	       objects[deltas[base->ofs_first].obj_no].resolved_early)
+		base->ofs_first++;
+
 	if (base->ref_first <= base->ref_last) {
 		struct object_entry *child = objects + deltas[base->ref_first].obj_no;
 		struct base_data *result = alloc_base_data();
@@ -954,7 +992,8 @@ static void *threaded_second_pass(void *data)
 		work_lock();
 		display_progress(progress, nr_resolved_deltas);
 		while (nr_dispatched < nr_objects &&
-		       is_delta_type(objects[nr_dispatched].type))
+		       is_delta_type(objects[nr_dispatched].type) &&
+		       !objects[nr_dispatched].resolved_early)
 			nr_dispatched++;
 		if (nr_dispatched >= nr_objects) {
 			work_unlock();
@@ -969,6 +1008,287 @@ static void *threaded_second_pass(void *data)
 }
 #endif
 
+#ifndef NO_PTHREADS
+/*
+ * During the first pass, the main thread reads the pack and inflates
+ * it, which it has to do to find where each object ends.  The rest of
+ * the work on the objects it keeps in core is left to first_pass_threads
+ * workers: non-delta objects are hashed and checked, and OFS_DELTA
+ * objects are resolved right away when the content of their base is
+ * still at hand, so that most of the second pass is done while the
+ * pack is still arriving.
+ *
+ * first_pass_todo holds the objects that wait for a worker;
+ * first_pass_bytes counts the data queued or being worked on, which
+ * we keep under FIRST_PASS_MEMORY unless a single object is larger
+ * than that.
+ */
+struct first_pass_item {
+	struct object_entry *obj;
+	void *data;
+	int base_no;		/* base of an OFS_DELTA, or -1 */
+};
+
+#define FIRST_PASS_TODO_SIZE 256
+#define FIRST_PASS_MEMORY (32 * 1024 * 1024)
+static struct first_pass_item first_pass_todo[FIRST_PASS_TODO_SIZE];
+static int first_pass_start, first_pass_nr, first_pass_finished;
+static unsigned long first_pass_bytes;
+static pthread_cond_t first_pass_added;
+static pthread_cond_t first_pass_taken;
+static pthread_cond_t first_pass_done;
+
+/*
+ * first_pass_busy[i] is set while object i is queued or being worked
+ * on, so that a delta against it can wait for its content.
+ */
+static unsigned char *first_pass_busy;
+
+/*
+ * Recently hashed or resolved objects, kept as bases for the deltas
+ * that follow them, oldest first.  early_base_slot maps an object
+ * number to its entry, or -1.  An entry with users cannot be evicted.
+ */
+struct early_base {
+	int obj_no;
+	void *data;
+	unsigned long size;
+	int users;
+};
+
+#define EARLY_BASE_SLOTS 1024
+static struct early_base early_base[EARLY_BASE_SLOTS];
+static int early_base_head, early_base_nr;
+static unsigned long early_base_used;
+static int *early_base_slot;
+
+static void evict_early_base(void)
+{
+	struct early_base *b = &early_base[early_base_head];
+
+	early_base_slot[b->obj_no] = -1;
+	early_base_used -= b->size;
+	free(b->data);
+	b->data = NULL;
+	early_base_head = (early_base_head + 1) % EARLY_BASE_SLOTS;
+	early_base_nr--;
+}
+
+/* Called with work_mutex held; takes ownership of data. */
+static void add_early_base(int obj_no, void *data, unsigned long size)
+{
+	struct early_base *b;
+
+	while (early_base_nr &&
+	       (early_base_nr == EARLY_BASE_SLOTS ||
+		early_base_used + size > delta_base_cache_limit) &&
+	       !early_base[early_base_head].users)
+		evict_early_base();
+	if (early_base_nr == EARLY_BASE_SLOTS ||
+	    early_base_used + size > delta_base_cache_limit) {
+		free(data);
+		return;
+	}
+	b = &early_base[(early_base_head + early_base_nr++) % EARLY_BASE_SLOTS];
+	b->obj_no = obj_no;
+	b->data = data;
+	b->size = size;
+	b->users = 0;
+	early_base_used += size;
+	early_base_slot[obj_no] = b - early_base;
+}
+
+/*
+ * Resolve a delta whose base preceded it in the pack, if the base
+ * content is still cached.  Returns the resolved data, or NULL when
+ * the delta is left to the second pass.
+ */
+static void *resolve_early(struct object_entry *delta_obj, void *delta_data,
+			   int base_no, unsigned long *size)
+{
+	struct object_entry *base_obj = objects + base_no;
+	struct early_base *b = NULL;
+	void *result;
+
+	work_lock();
+	while (first_pass_busy[base_no])
+		pthread_cond_wait(&first_pass_done, &work_mutex);
+	if (early_base_slot[base_no] >= 0) {
+		b = &early_base[early_base_slot[base_no]];
+		b->users++;
+	}
+	work_unlock();
+	if (!b)
+		return NULL;
+
+	result = patch_delta(b->data, b->size, delta_data, delta_obj->size, size);
+	work_lock();
+	b->users--;
+	work_unlock();
+	if (!result)
+		bad_object(delta_obj->idx.offset, _("failed to apply delta"));
+
+	delta_obj->real_type = base_obj->real_type;
+	delta_obj->delta_depth = base_obj->delta_depth + 1;
+	delta_obj->base_object_no = base_no;
+	hash_sha1_file(result, *size, typename(delta_obj->real_type),
+		       delta_obj->idx.sha1);
+	sha1_object(result, NULL, *size, delta_obj->real_type,
+		    delta_obj->idx.sha1);
+	delta_obj->resolved_early = 1;
+	counter_lock();
+	nr_resolved_deltas++;
+	if (deepest_delta < delta_obj->delta_depth)
+		deepest_delta = delta_obj->delta_depth;
+	counter_unlock();
+	return result;
+}
+
+static void *threaded_first_pass(void *data)
+{
+	set_thread_data(data);
+	for (;;) {
+		struct first_pass_item item;
+		void *content;
+		unsigned long size;
+		int obj_no;
+
+		work_lock();
+		while (!first_pass_nr && !first_pass_finished)
+			pthread_cond_wait(&first_pass_added, &work_mutex);
+		if (!first_pass_nr) {
+			work_unlock();
+			break;
+		}
+		item = first_pass_todo[first_pass_start];
+		first_pass_start = (first_pass_start + 1) % FIRST_PASS_TODO_SIZE;
+		first_pass_nr--;
+		pthread_cond_signal(&first_pass_taken);
+		work_unlock();
+
+		obj_no = item.obj - objects;
+		if (item.base_no >= 0) {
+			content = resolve_early(item.obj, item.data,
+						item.base_no, &size);
+			free(item.data);
+		} else {
+			content = item.data;
+			size = item.obj->size;
+			hash_sha1_file(content, size, typename(item.obj->type),
+				       item.obj->idx.sha1);
+			sha1_object(content, NULL, size, item.obj->type,
+				    item.obj->idx.sha1);
+		}
+
+		work_lock();
+		if (content)
+			add_early_base(obj_no, content, size);
+		first_pass_busy[obj_no] = 0;
+		pthread_cond_broadcast(&first_pass_done);
+		first_pass_bytes -= item.obj->size;
+		pthread_cond_signal(&first_pass_taken);
+		work_unlock();
+	}
+	return NULL;
+}
+
+static void queue_first_pass(struct object_entry *obj, void *data, int base_no)
+{
+	struct first_pass_item *item;
+
+	work_lock();
+	while (first_pass_nr == FIRST_PASS_TODO_SIZE ||
+	       (first_pass_bytes &&
+		first_pass_bytes + obj->size > FIRST_PASS_MEMORY))
+		pthread_cond_wait(&first_pass_taken, &work_mutex);
+	item = &first_pass_todo[(first_pass_start + first_pass_nr) %
+				FIRST_PASS_TODO_SIZE];
+	item->obj = obj;
+	item->data = data;
+	item->base_no = base_no;
+	first_pass_nr++;
+	first_pass_bytes += obj->size;
+	first_pass_busy[obj - objects] = 1;
+	pthread_cond_signal(&first_pass_added);
+	work_unlock();
+}
+
+static void start_first_pass_threads(void)
+{
+	int i;
+
+	if (nr_threads <= 1 && !getenv("GIT_FORCE_THREADS"))
+		return;
+	init_thread();
+	pthread_cond_init(&first_pass_added, NULL);
+	pthread_cond_init(&first_pass_taken, NULL);
+	pthread_cond_init(&first_pass_done, NULL);
+	first_pass_start = first_pass_nr = first_pass_finished = 0;
+	first_pass_bytes = 0;
+	first_pass_busy = xcalloc(nr_objects, 1);
+	early_base_slot = xmalloc(nr_objects * sizeof(*early_base_slot));
+	for (i = 0; i < nr_objects; i++)
+		early_base_slot[i] = -1;
+	early_base_head = early_base_nr = 0;
+	early_base_used = 0;
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&thread_data[i].thread, NULL,
+					 threaded_first_pass, thread_data + i);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	first_pass_threads = nr_threads;
+}
+
+static void finish_first_pass_threads(void)
+{
+	int i;
+
+	if (!first_pass_threads)
+		return;
+	work_lock();
+	first_pass_finished = 1;
+	pthread_cond_broadcast(&first_pass_added);
+	work_unlock();
+	for (i = 0; i < first_pass_threads; i++)
+		pthread_join(thread_data[i].thread, NULL);
+	first_pass_threads = 0;
+	while (early_base_nr)
+		evict_early_base();
+	free(early_base_slot);
+	free(first_pass_busy);
+	pthread_cond_destroy(&first_pass_added);
+	pthread_cond_destroy(&first_pass_taken);
+	pthread_cond_destroy(&first_pass_done);
+	cleanup_thread();
+}
+
+/*
+ * Find the object that starts at offset ofs among the first nr ones;
+ * they are sorted by offset since we read them in order.
+ */
+static int find_object_at(off_t ofs, int nr)
+{
+	int lo = 0, hi = nr;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		if (objects[mi].idx.offset == ofs)
+			return mi;
+		if (objects[mi].idx.offset < ofs)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return -1;
+}
+#else
+#define start_first_pass_threads()	(void)0
+#define finish_first_pass_threads()	(void)0
+#define queue_first_pass(obj, data, base)	(void)0
+#define find_object_at(ofs, nr)		-1
+#endif
+
 /*
  * First pass:
  * - find locations of all objects;
@@ -985,6 +1305,7 @@ static void parse_pack_objects(unsigned char *sha1)
 		progress = start_progress(
 				from_stdin ? _("Receiving objects") : _("Indexing objects"),
 				nr_objects);
+	start_first_pass_threads();
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
 		void *data = unpack_raw_entry(obj, &delta->base, obj->idx.sha1);
@@ -992,17 +1313,28 @@ static void parse_pack_objects(unsigned char *sha1)
 		if (is_delta_type(obj->type)) {
 			nr_deltas++;
 			delta->obj_no = i;
+			if (first_pass_threads && obj->type == OBJ_OFS_DELTA) {
+				int base_no = find_object_at(delta->base.offset, i);
+				if (base_no >= 0) {
+					queue_first_pass(obj, data, base_no);
+					data = NULL;
+				}
+			}
 			delta++;
 		} else if (!data) {
 			/* large blobs, check later */
 			obj->real_type = OBJ_BAD;
 			nr_delays++;
+		} else if (first_pass_threads) {
+			queue_first_pass(obj, data, -1);
+			data = NULL;
 		} else
 			sha1_object(data, NULL, obj->size, obj->type, obj->idx.sha1);
 		free(data);
 		display_progress(progress, i+1);
 	}
 	objects[i].idx.offset = consumed_bytes;
+	finish_first_pass_threads();
 	stop_progress(&progress);
 
 	/* Check pack integrity */
@@ -1074,7 +1406,7 @@ static void resolve_deltas(void)
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
 
-		if (is_delta_type(obj->type))
+		if (is_delta_type(obj->type) && !obj->resolved_early)
 			continue;
 		resolve_base(obj);
 		display_progress(progress, nr_resolved_deltas);
@@ -1598,6 +1930,8 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	curr_pack = open_pack_file(pack_name);
 	parse_pack_header();
 	objects = xcalloc(nr_objects + 1, sizeof(struct object_entry));
+	if (strict)
+		presize_object_hash(nr_objects);
 	deltas = xcalloc(nr_objects, sizeof(struct delta_entry));
 	parse_pack_objects(pack_sha1);
 	resolve_deltas();
@@ -310,8 +310,7 @@ static int cmd_log_walk(struct rev_info *rev)
 			free(commit->buffer);
 			commit->buffer = NULL;
 		}
-		free_commit_list(commit->parents);
-		commit->parents = NULL;
+		free_commit_parents(commit);
 		if (saved_nrl < rev->diffopt.needed_rename_limit)
 			saved_nrl = rev->diffopt.needed_rename_limit;
 		if (rev->diffopt.degraded_cc_to_c)
@@ -248,6 +248,9 @@ static void show_files(struct dir_struct *dir)
 				continue;
 			if (ce_skip_worktree(ce))
 				continue;
+			/* preload_index() found it there and unchanged */
+			if (ce_uptodate(ce))
+				continue;
 			err = lstat(ce->name, &st);
 			if (show_deleted && err)
 				show_ce_entry(tag_removed, ce);
@@ -577,6 +580,8 @@ int cmd_ls_files(int argc, const char **argv, const char *cmd_prefix)
 
 	if (max_prefix)
 		prune_cache(max_prefix);
+	if (show_deleted || show_modified)
+		preload_index(&the_index, pathspec);
 	if (with_tree) {
 		/*
 		 * Basic sanity check; show-stages and show-unmerged
@@ -18,6 +18,7 @@
 #include "refs.h"
 #include "streaming.h"
 #include "thread-utils.h"
+#include "string-list.h"
 
 static const char *pack_usage[] = {
 	N_("git pack-objects --stdout [options...] [< ref-list | < object-list]"),
@@ -49,6 +50,7 @@ struct object_entry {
 	unsigned char no_try_delta;
 	unsigned char tagged; /* near the very tip of refs */
 	unsigned char filled; /* assigned write-order */
+	unsigned char reuse_verbatim; /* copied with the start of in_pack */
 };
 
 /*
@@ -68,6 +70,7 @@ static unsigned long unpack_unreachable_expiration;
 static int local;
 static int incremental;
 static int ignore_packed_keep;
+static struct string_list keep_pack_list = STRING_LIST_INIT_NODUP;
 static int allow_ofs_delta;
 static struct pack_idx_option pack_idx_opts;
 static const char *base_name;
@@ -88,6 +91,11 @@ static unsigned long cache_max_small_delta_size = 1000;
 
 static unsigned long window_memory_limit = 0;
 
+static int allow_pack_reuse = 1;
+static struct packed_git *reuse_packfile;
+static off_t reuse_packfile_end;
+static uint32_t reuse_packfile_objects;
+
 /*
  * The object names in objects array are hashed with this hashtable,
  * to help looking up the entry by object name.
@@ -240,9 +248,338 @@ static void copy_pack_data(struct sha1file *f,
 	}
 }
 
+/*
+ * Decide whether the in-pack representation of an object can be copied
+ * as-is, given whether its delta (if any) can be used in this pack.
+ */
+static int can_reuse_object(struct object_entry *entry, int usable_delta)
+{
+	if (!reuse_object)
+		return 0;	/* explicit */
+	else if (!entry->in_pack)
+		return 0;	/* can't reuse what we don't have */
+	else if (entry->type == OBJ_REF_DELTA || entry->type == OBJ_OFS_DELTA)
+				/* check_object() decided it for us ... */
+		return usable_delta;
+				/* ... but pack split may override that */
+	else if (entry->type != entry->in_pack_type)
+		return 0;	/* pack has delta which is unusable */
+	else if (entry->delta)
+		return 0;	/* we want to pack afresh */
+	else
+		return 1;	/* we have it in-pack undeltified,
+				 * and we do not need to deltify it.
+				 */
+}
+
+/*
+ * An object the write phase has to deflate afresh.  The main thread
+ * reads the data and queues the job; a worker computes the delta when
+ * it was not cached and deflates the result into 'buf'.
+ */
+struct compress_job {
+	struct object_entry *entry;
+	enum object_type type;
+	void *buf;
+	unsigned long size;	/* uncompressed size */
+	void *base_buf;		/* delta base, if the delta must be computed */
+	unsigned long base_size;
+	unsigned long datalen;	/* compressed size */
+	unsigned long queued;	/* bytes read for this job */
+	char done;
+};
+
+#ifndef NO_PTHREADS
+
+/*
+ * When the pack is written without a size limit, the order in which
+ * write_one() emits objects is known in advance.  Objects that are not
+ * reused from an existing pack are then compressed by write_threads
+ * workers while the main thread is still writing the ones before them.
+ *
+ * In the range [compress_done, compress_start) of compress_todo are
+ * jobs being (or already) compressed that the writer has not picked
+ * up yet; [compress_start, compress_end) are waiting for a worker.
+ * The ranges are modulo COMPRESS_TODO_SIZE.
+ */
+#define COMPRESS_TODO_SIZE 128
+#define COMPRESS_QUEUE_MEMORY (64 * 1024 * 1024)
+static struct compress_job compress_todo[COMPRESS_TODO_SIZE];
+static int compress_start, compress_end, compress_done;
+static unsigned long compress_queued_bytes;
+static int all_compress_added;
+
+static int write_threads;
+static pthread_t *compress_threads;
+static pthread_t write_main_thread;
+static pthread_mutex_t compress_mutex;
+static pthread_cond_t cond_compress_add;
+static pthread_cond_t cond_compress_result;
+
+static struct object_entry **write_seq;
+static uint32_t write_seq_nr, write_seq_pos;
+
+static try_to_free_t old_write_try_to_free_routine;
+
+/*
+ * The pack windows are only ever touched by the main thread during
+ * the write phase; a worker running out of memory must not unmap them
+ * under its feet.
+ */
+static void try_to_free_from_writer(size_t size)
+{
+	if (pthread_equal(pthread_self(), write_main_thread))
+		release_pack_memory(size, -1);
+}
+
+static void add_to_write_seq(struct object_entry *e, unsigned char *state)
+{
+	unsigned char *s = &state[e - objects];
+
+	/* mirror write_one(): 1 is "base being written", 2 is "written" */
+	if (*s || e->preferred_base || e->reuse_verbatim)
+		return;
+	if (e->delta) {
+		*s = 1;
+		add_to_write_seq(e->delta, state);
+	}
+	*s = 2;
+	write_seq[write_seq_nr++] = e;
+}
+
+static void compute_write_seq(struct object_entry **write_order)
+{
+	unsigned char *state = xcalloc(nr_objects, 1);
+	uint32_t i;
+
+	write_seq = xmalloc(nr_objects * sizeof(*write_seq));
+	write_seq_nr = write_seq_pos = 0;
+	for (i = 0; i < nr_objects; i++)
+		add_to_write_seq(write_order[i], state);
+	free(state);
+}
+
+static void *run_compress(void *arg)
+{
+	for (;;) {
+		struct compress_job *job;
+
+		pthread_mutex_lock(&compress_mutex);
+		while (compress_start == compress_end && !all_compress_added)
+			pthread_cond_wait(&cond_compress_add, &compress_mutex);
+		if (compress_start == compress_end) {
+			pthread_mutex_unlock(&compress_mutex);
+			break;
+		}
+		job = &compress_todo[compress_start];
+		compress_start = (compress_start + 1) % COMPRESS_TODO_SIZE;
+		pthread_mutex_unlock(&compress_mutex);
+
+		if (job->base_buf) {
+			unsigned long delta_size;
+			void *delta_buf = diff_delta(job->base_buf, job->base_size,
+						     job->buf, job->size,
+						     &delta_size, 0);
+			free(job->buf);
+			free(job->base_buf);
+			job->base_buf = NULL;
+			job->buf = delta_buf;
+			job->size = delta_size;
+			if (delta_buf && delta_size != job->entry->delta_size) {
+				free(delta_buf);
+				job->buf = NULL;
+			}
+		}
+		if (job->buf)
+			job->datalen = do_compress(&job->buf, job->size);
+
+		pthread_mutex_lock(&compress_mutex);
+		job->done = 1;
+		pthread_cond_broadcast(&cond_compress_result);
+		pthread_mutex_unlock(&compress_mutex);
+	}
+	return NULL;
+}
+
+/*
+ * Read the data of the next object in write order that needs to be
+ * deflated and hand it to the workers.  Returns 0 when the queue is
+ * full.
+ */
+static int queue_compress_job(void)
+{
+	struct object_entry *e;
+	struct compress_job *job;
+	unsigned long size;
+	enum object_type type;
+	void *buf, *base_buf = NULL;
+	unsigned long base_size = 0;
+
+	if ((compress_end + 1) % COMPRESS_TODO_SIZE == compress_done)
+		return 0;
+	if (compress_queued_bytes > COMPRESS_QUEUE_MEMORY &&
+	    compress_done != compress_end)
+		return 0;
+
+	e = write_seq[write_seq_pos++];
+	if (can_reuse_object(e, !!e->delta))
+		return 1;
+
+	if (!e->delta) {
+		if (e->type == OBJ_BLOB && e->size > big_file_threshold)
+			return 1; /* streamed by write_no_reuse_object() */
+		buf = read_sha1_file(e->idx.sha1, &type, &size);
+		if (!buf)
+			die(_("unable to read %s"), sha1_to_hex(e->idx.sha1));
+	} else if (e->delta_data) {
+		if (e->z_delta_size)
+			return 1; /* already compressed by find_deltas() */
+		buf = e->delta_data;
+		size = e->delta_size;
+		e->delta_data = NULL;
+		type = OBJ_REF_DELTA;
+	} else {
+		buf = read_sha1_file(e->idx.sha1, &type, &size);
+		if (!buf)
+			die("unable to read %s", sha1_to_hex(e->idx.sha1));
+		base_buf = read_sha1_file(e->delta->idx.sha1, &type, &base_size);
+		if (!base_buf)
+			die("unable to read %s", sha1_to_hex(e->delta->idx.sha1));
+		type = OBJ_REF_DELTA;
+	}
+
+	pthread_mutex_lock(&compress_mutex);
+	job = &compress_todo[compress_end];
+	job->entry = e;
+	job->type = type;
+	job->buf = buf;
+	job->size = size;
+	job->base_buf = base_buf;
+	job->base_size = base_size;
+	job->done = 0;
+	job->queued = size + base_size;
+	compress_queued_bytes += job->queued;
+	compress_end = (compress_end + 1) % COMPRESS_TODO_SIZE;
+	pthread_cond_signal(&cond_compress_add);
+	pthread_mutex_unlock(&compress_mutex);
+	return 1;
+}
+
+static void fill_compress_queue(void)
+{
+	if (!write_threads)
+		return;
+	while (write_seq_pos < write_seq_nr && queue_compress_job())
+		; /* nothing */
+}
+
+/*
+ * Return the compressed data for 'entry' if it was queued, waiting for
+ * a worker to finish it.  The caller owns the job's buffer, and must
+ * call release_compressed_object() once done with it.
+ */
+static struct compress_job *get_compressed_object(struct object_entry *entry)
+{
+	struct compress_job *job;
+
+	if (!write_threads || compress_done == compress_end ||
+	    compress_todo[compress_done].entry != entry)
+		return NULL;
+	job = &compress_todo[compress_done];
+	pthread_mutex_lock(&compress_mutex);
+	while (!job->done)
+		pthread_cond_wait(&cond_compress_result, &compress_mutex);
+	pthread_mutex_unlock(&compress_mutex);
+	if (!job->buf)
+		die("delta size changed");
+	return job;
+}
+
+static void release_compressed_object(struct compress_job *job)
+{
+	pthread_mutex_lock(&compress_mutex);
+	compress_queued_bytes -= job->queued;
+	job->entry = NULL;
+	job->buf = NULL;
+	compress_done = (compress_done + 1) % COMPRESS_TODO_SIZE;
+	pthread_mutex_unlock(&compress_mutex);
+}
+
+static void start_write_threads(struct object_entry **write_order)
+{
+	int i, ret;
+
+	write_threads = 0;
+	if (pack_size_limit)
+		return; /* pack splits change what gets written as delta */
+	if (!delta_search_threads)	/* --threads=0 means autodetect */
+		delta_search_threads = online_cpus();
+	if (delta_search_threads <= 1)
+		return;
+
+	compute_write_seq(write_order);
+	compress_start = compress_end = compress_done = 0;
+	compress_queued_bytes = 0;
+	all_compress_added = 0;
+	pthread_mutex_init(&compress_mutex, NULL);
+	pthread_cond_init(&cond_compress_add, NULL);
+	pthread_cond_init(&cond_compress_result, NULL);
+	write_main_thread = pthread_self();
+	old_write_try_to_free_routine =
+		set_try_to_free_routine(try_to_free_from_writer);
+
+	compress_threads = xcalloc(delta_search_threads,
+				   sizeof(*compress_threads));
+	for (i = 0; i < delta_search_threads; i++) {
+		ret = pthread_create(&compress_threads[i], NULL,
+				     run_compress, NULL);
+		if (ret)
+			die("unable to create thread: %s", strerror(ret));
+	}
+	write_threads = delta_search_threads;
+}
+
+static void finish_write_threads(void)
+{
+	int i;
+
+	if (!write_threads)
+		return;
+	pthread_mutex_lock(&compress_mutex);
+	all_compress_added = 1;
+	pthread_cond_broadcast(&cond_compress_add);
+	pthread_mutex_unlock(&compress_mutex);
+	for (i = 0; i < write_threads; i++)
+		pthread_join(compress_threads[i], NULL);
+
+	/* Jobs the writer did not consume, e.g. after a recursive delta. */
+	for (; compress_done != compress_end;
+	     compress_done = (compress_done + 1) % COMPRESS_TODO_SIZE) {
+		free(compress_todo[compress_done].buf);
+		free(compress_todo[compress_done].base_buf);
+	}
+
+	set_try_to_free_routine(old_write_try_to_free_routine);
+	pthread_cond_destroy(&cond_compress_result);
+	pthread_cond_destroy(&cond_compress_add);
+	pthread_mutex_destroy(&compress_mutex);
+	free(compress_threads);
+	free(write_seq);
+	write_threads = 0;
+}
+
+#else
+#define start_write_threads(wo)		(void)0
+#define finish_write_threads()		(void)0
+#define fill_compress_queue()		(void)0
+#define get_compressed_object(e)	NULL
+#define release_compressed_object(j)	(void)0
+#endif
+
 /* Return 0 if we will bust the pack-size limit */
 static unsigned long write_no_reuse_object(struct sha1file *f, struct object_entry *entry,
-					   unsigned long limit, int usable_delta)
+					   unsigned long limit, int usable_delta,
+					   struct compress_job *job)
 {
 	unsigned long size, datalen;
 	unsigned char header[10], dheader[10];
@@ -251,7 +588,20 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 	void *buf;
 	struct git_istream *st = NULL;
 
-	if (!usable_delta) {
+	if (job) {
+		buf = job->buf;
+		size = job->size;
+		datalen = job->datalen;
+		type = job->type;
+		release_compressed_object(job);
+		if (!usable_delta) {
+			free(entry->delta_data);
+			entry->delta_data = NULL;
+			entry->z_delta_size = 0;
+		} else
+			type = (allow_ofs_delta && entry->delta->idx.offset) ?
+				OBJ_OFS_DELTA : OBJ_REF_DELTA;
+	} else if (!usable_delta) {
 		if (entry->type == OBJ_BLOB &&
 		    entry->size > big_file_threshold &&
 		    (st = open_istream(entry->idx.sha1, &type, &size, NULL)) != NULL)
@@ -281,7 +631,9 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
 	}
 
-	if (st)	/* large blob case, just assume we don't compress well */
+	if (job)
+		; /* compressed ahead by a worker */
+	else if (st)	/* large blob case, just assume we don't compress well */
 		datalen = size;
 	else if (entry->z_delta_size)
 		datalen = entry->z_delta_size;
@@ -373,7 +725,7 @@ static unsigned long write_reuse_object(struct sha1file *f, struct object_entry
 	    check_pack_crc(p, &w_curs, offset, datalen, revidx->nr)) {
 		error("bad packed object CRC for %s", sha1_to_hex(entry->idx.sha1));
 		unuse_pack(&w_curs);
-		return write_no_reuse_object(f, entry, limit, usable_delta);
+		return write_no_reuse_object(f, entry, limit, usable_delta, NULL);
 	}
 
 	offset += entry->in_pack_header_size;
@@ -383,7 +735,7 @@ static unsigned long write_reuse_object(struct sha1file *f, struct object_entry
 	    check_pack_inflate(p, &w_curs, offset, datalen, entry->size)) {
 		error("corrupt packed object for %s", sha1_to_hex(entry->idx.sha1));
 		unuse_pack(&w_curs);
-		return write_no_reuse_object(f, entry, limit, usable_delta);
+		return write_no_reuse_object(f, entry, limit, usable_delta, NULL);
 	}
 
 	if (type == OBJ_OFS_DELTA) {
@@ -429,6 +781,7 @@ static unsigned long write_object(struct sha1file *f,
 {
 	unsigned long limit, len;
 	int usable_delta, to_reuse;
+	struct compress_job *job;
 
 	if (!pack_to_stdout)
 		crc32_begin(f);
@@ -456,25 +809,20 @@ static unsigned long write_object(struct sha1file *f,
 	else
 		usable_delta = 0;	/* base could end up in another pack */
 
-	if (!reuse_object)
-		to_reuse = 0;	/* explicit */
-	else if (!entry->in_pack)
-		to_reuse = 0;	/* can't reuse what we don't have */
-	else if (entry->type == OBJ_REF_DELTA || entry->type == OBJ_OFS_DELTA)
-				/* check_object() decided it for us ... */
-		to_reuse = usable_delta;
-				/* ... but pack split may override that */
-	else if (entry->type != entry->in_pack_type)
-		to_reuse = 0;	/* pack has delta which is unusable */
-	else if (entry->delta)
-		to_reuse = 0;	/* we want to pack afresh */
-	else
-		to_reuse = 1;	/* we have it in-pack undeltified,
-				 * and we do not need to deltify it.
-				 */
+	to_reuse = can_reuse_object(entry, usable_delta);
+
+	fill_compress_queue();
+	job = get_compressed_object(entry);
+	if (job && (to_reuse ||
+		    usable_delta != (job->type == OBJ_REF_DELTA))) {
+		/* a recursive delta was broken since the job was queued */
+		free(job->buf);
+		release_compressed_object(job);
+		job = NULL;
+	}
 
 	if (!to_reuse)
-		len = write_no_reuse_object(f, entry, limit, usable_delta);
+		len = write_no_reuse_object(f, entry, limit, usable_delta, job);
 	else
 		len = write_reuse_object(f, entry, limit, usable_delta);
 	if (!len)
@@ -495,6 +843,38 @@ enum write_one_status {
 	WRITE_ONE_RECURSIVE = 2 /* already scheduled to be written */
 };
 
+/*
+ * Copy the objects get_object_details() found reusable at the start of
+ * reuse_packfile.  They follow the pack header in both packs, so they
+ * keep their offsets and the OFS_DELTA references between them stay
+ * valid.
+ */
+static off_t write_reused_pack(struct sha1file *f)
+{
+	struct pack_window *w_curs = NULL;
+	off_t from = sizeof(struct pack_header);
+	uint32_t i;
+
+	copy_pack_data(f, reuse_packfile, &w_curs, from,
+		       reuse_packfile_end - from);
+	unuse_pack(&w_curs);
+
+	for (i = 0; i < nr_objects; i++) {
+		struct object_entry *e = &objects[i];
+		if (!e->reuse_verbatim)
+			continue;
+		e->idx.offset = e->in_pack_offset;
+		written_list[nr_written++] = &e->idx;
+		written++;
+		reused++;
+		if (e->delta) {
+			written_delta++;
+			reused_delta++;
+		}
+	}
+	return reuse_packfile_end;
+}
+
 static enum write_one_status write_one(struct sha1file *f,
 				       struct object_entry *e,
 				       off_t *offset)
@@ -725,6 +1105,7 @@ static void write_pack_file(void)
 		progress_state = start_progress("Writing objects", nr_result);
 	written_list = xmalloc(nr_objects * sizeof(*written_list));
 	write_order = compute_write_order();
+	start_write_threads(write_order);
 
 	do {
 		unsigned char sha1[20];
@@ -734,11 +1115,16 @@ static void write_pack_file(void)
 			f = sha1fd_throughput(1, "<stdout>", progress_state);
 		else
 			f = create_tmp_packfile(&pack_tmp_name);
+		sha1file_background(f);
 
 		offset = write_pack_header(f, nr_remaining);
 		if (!offset)
 			die_errno("unable to write pack header");
 		nr_written = 0;
+		if (reuse_packfile) {
+			offset = write_reused_pack(f);
+			display_progress(progress_state, written);
+		}
 		for (; i < nr_objects; i++) {
 			struct object_entry *e = write_order[i];
 			if (write_one(f, e, &offset) == WRITE_ONE_BREAK)
@@ -804,6 +1190,7 @@ static void write_pack_file(void)
 		nr_remaining -= nr_written;
 	} while (nr_remaining && i < nr_objects);
 
+	finish_write_threads();
 	free(written_list);
 	free(write_order);
 	stop_progress(&progress_state);
@@ -1397,6 +1784,87 @@ static int pack_offset_sort(const void *_a, const void *_b)
 			(a->in_pack_offset > b->in_pack_offset);
 }
 
+static int can_reuse_verbatim(struct object_entry *entry)
+{
+	if (entry->preferred_base)
+		return 0;
+	switch (entry->in_pack_type) {
+	case OBJ_OFS_DELTA:
+		if (!allow_ofs_delta)
+			return 0;
+		/* fallthrough */
+	case OBJ_REF_DELTA:
+		/* the base must be copied before us, as part of the run */
+		return entry->type == entry->in_pack_type &&
+		       entry->delta && entry->delta->reuse_verbatim;
+	default:
+		return entry->type == entry->in_pack_type;
+	}
+}
+
+static void set_reuse_verbatim(struct object_entry **list, uint32_t nr, int v)
+{
+	while (nr--)
+		list[nr]->reuse_verbatim = v;
+}
+
+/*
+ * When serving a clone or a large fetch from a well packed repository,
+ * most of the output is an existing pack that is wanted as a whole.
+ * Find the longest run of objects at the start of an existing pack
+ * that are all wanted and can all be reused as they are; that run is
+ * copied to the output in one go, and skips the delta search.
+ */
+static void find_reuse_region(struct object_entry **sorted_by_offset)
+{
+	uint32_t i, j;
+	struct object_entry **best = NULL;
+
+	reuse_packfile = NULL;
+	reuse_packfile_objects = 0;
+	if (!allow_pack_reuse || !pack_to_stdout || pack_size_limit ||
+	    !reuse_object)
+		return;
+
+	for (i = 0; i < nr_objects; i = j) {
+		struct packed_git *p = sorted_by_offset[i]->in_pack;
+		struct revindex_entry *revidx;
+		uint32_t n;
+
+		for (j = i; j < nr_objects && sorted_by_offset[j]->in_pack == p; j++)
+			; /* nothing */
+		if (!p ||
+		    sorted_by_offset[i]->in_pack_offset != sizeof(struct pack_header))
+			continue;
+
+		revidx = find_pack_revindex(p, sizeof(struct pack_header));
+		for (n = 0; i + n < j; n++) {
+			struct object_entry *e = sorted_by_offset[i + n];
+			if (e->in_pack_offset != revidx[n].offset ||
+			    !can_reuse_verbatim(e))
+				break;
+			e->reuse_verbatim = 1;
+		}
+
+		if (n <= reuse_packfile_objects) {
+			set_reuse_verbatim(sorted_by_offset + i, n, 0);
+			continue;
+		}
+		if (best)
+			set_reuse_verbatim(best, reuse_packfile_objects, 0);
+		best = sorted_by_offset + i;
+		reuse_packfile = p;
+		reuse_packfile_objects = n;
+		reuse_packfile_end = revidx[n].offset;
+	}
+
+	if (reuse_packfile)
+		trace_printf("pack-objects: reusing %"PRIu32" objects "
+			     "(%"PRIuMAX" bytes) from %s\n",
+			     reuse_packfile_objects,
+			     (uintmax_t)reuse_packfile_end, reuse_packfile->pack_name);
+}
+
 static void get_object_details(void)
 {
 	uint32_t i;
@@ -1414,6 +1882,7 @@ static void get_object_details(void)
 			entry->no_try_delta = 1;
 	}
 
+	find_reuse_region(sorted_by_offset);
 	free(sorted_by_offset);
 }
 
@@ -1690,7 +2159,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		}
 		entry = *list++;
 		(*list_size)--;
-		if (!entry->preferred_base) {
+		if (!entry->preferred_base && !entry->reuse_verbatim) {
 			(*processed)++;
 			display_progress(progress_state, *processed);
 		}
@@ -1708,9 +2177,10 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		}
 
 		/* We do not compute delta to *create* objects we are not
-		 * going to pack.
+		 * going to pack, nor to change objects we copy verbatim;
+		 * they only serve as bases.
 		 */
-		if (entry->preferred_base)
+		if (entry->preferred_base || entry->reuse_verbatim)
 			goto next;
 
 		/*
@@ -1746,7 +2216,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		 * If we decided to cache the delta data, then it is best
 		 * to compress it right away.  First because we have to do
 		 * it anyway, and doing it here while we're threaded will
-		 * save a lot of time in the non threaded write phase,
+		 * save a lot of time in the write phase,
 		 * as well as allow for caching more deltas within
 		 * the same cache size limit.
 		 * ...
@@ -1836,6 +2306,10 @@ struct thread_params {
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
 	unsigned *processed;
+	/* statistics, reported with GIT_TRACE */
+	unsigned nr_objects;
+	uint64_t weight;
+	unsigned nr_steals;
 };
 
 static pthread_cond_t progress_cond;
@@ -1892,11 +2366,61 @@ static void *threaded_find_deltas(void *arg)
 	return NULL;
 }
 
+/*
+ * Work is balanced by weight rather than by number of objects: the
+ * cost of searching a delta for an object grows with its size, so a
+ * segment holding a few large blobs can take longer than one holding
+ * thousands of small trees.  delta_weight[i] is the total size of the
+ * first i objects of the list handed to ll_find_deltas().
+ */
+static uint64_t *delta_weight;
+static struct object_entry **delta_list_base;
+
+static uint64_t segment_weight(struct object_entry **list, unsigned size)
+{
+	unsigned start = list - delta_list_base;
+	return delta_weight[start + size] - delta_weight[start];
+}
+
+/*
+ * Find the first index in [lo, hi) at which the weight from the start of
+ * the whole list reaches 'target'.
+ */
+static unsigned weight_position(unsigned lo, unsigned hi, uint64_t target)
+{
+	while (lo < hi) {
+		unsigned mi = lo + (hi - lo) / 2;
+		if (delta_weight[mi] < target)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return lo;
+}
+
+/*
+ * Can the unprocessed tail of this segment be split off and given to
+ * an idle thread?  Short segments give poor deltas, so we normally
+ * want at least two windows worth of objects, but a few big objects
+ * are worth moving to another thread anyway.
+ */
+static int can_steal_from(struct thread_params *p, int window,
+			  uint64_t big_weight)
+{
+	if (p->remaining > 2*window)
+		return 1;
+	return p->remaining >= 2 &&
+	       segment_weight(p->list + p->list_size - p->remaining,
+			      p->remaining) > big_weight;
+}
+
 static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 			   int window, int depth, unsigned *processed)
 {
 	struct thread_params *p;
 	int i, ret, active_threads = 0;
+	unsigned start;
+	uint64_t total_weight, big_weight;
 
 	init_threaded_search();
 
@@ -1912,12 +2436,29 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 				delta_search_threads);
 	p = xcalloc(delta_search_threads, sizeof(*p));
 
-	/* Partition the work amongst work threads. */
-	for (i = 0; i < delta_search_threads; i++) {
-		unsigned sub_size = list_size / (delta_search_threads - i);
+	delta_list_base = list;
+	delta_weight = xmalloc((list_size + 1) * sizeof(*delta_weight));
+	delta_weight[0] = 0;
+	for (start = 0; start < list_size; start++)
+		delta_weight[start + 1] = delta_weight[start] +
+					  list[start]->size;
+	total_weight = delta_weight[list_size];
+	big_weight = total_weight / (4 * delta_search_threads);
+
+	/* Partition the work amongst work threads, by weight. */
+	for (i = start = 0; i < delta_search_threads; i++) {
+		unsigned end, sub_size;
+
+		if (i + 1 < delta_search_threads)
+			end = weight_position(start, list_size, total_weight /
+					      delta_search_threads * (i + 1));
+		else
+			end = list_size;
+		sub_size = end - start;
 
 		/* don't use too small segments or no deltas will be found */
-		if (sub_size < 2*window && i+1 < delta_search_threads)
+		if (sub_size < 2*window && i+1 < delta_search_threads &&
+		    segment_weight(list, sub_size) <= big_weight)
 			sub_size = 0;
 
 		p[i].window = window;
@@ -1927,7 +2468,7 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 		p[i].data_ready = 0;
 
 		/* try to split chunks on "path" boundaries */
-		while (sub_size && sub_size < list_size &&
+		while (sub_size && sub_size < list_size - start &&
 		       list[sub_size]->hash &&
 		       list[sub_size]->hash == list[sub_size-1]->hash)
 			sub_size++;
@@ -1935,9 +2476,11 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 		p[i].list = list;
 		p[i].list_size = sub_size;
 		p[i].remaining = sub_size;
+		p[i].nr_objects = sub_size;
+		p[i].weight = segment_weight(list, sub_size);
 
 		list += sub_size;
-		list_size -= sub_size;
+		start += sub_size;
 	}
 
 	/* Start work threads. */
@@ -1955,15 +2498,16 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 
 	/*
 	 * Now let's wait for work completion.  Each time a thread is done
-	 * with its work, we steal half of the remaining work from the
-	 * thread with the largest number of unprocessed objects and give
+	 * with its work, we steal the unprocessed tail of the thread with
+	 * the largest remaining weight, about half of that weight, and give
 	 * it to that newly idle thread.  This ensure good load balancing
 	 * until the remaining object list segments are simply too short
-	 * to be worth splitting anymore.
+	 * or too light to be worth splitting anymore.
 	 */
 	while (active_threads) {
 		struct thread_params *target = NULL;
 		struct thread_params *victim = NULL;
+		uint64_t victim_weight = 0;
 		unsigned sub_size = 0;
 
 		progress_lock();
@@ -1976,13 +2520,30 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 			pthread_cond_wait(&progress_cond, &progress_mutex);
 		}
 
-		for (i = 0; i < delta_search_threads; i++)
-			if (p[i].remaining > 2*window &&
-			    (!victim || victim->remaining < p[i].remaining))
+		for (i = 0; i < delta_search_threads; i++) {
+			uint64_t w;
+			if (!can_steal_from(&p[i], window, big_weight))
+				continue;
+			w = segment_weight(p[i].list + p[i].list_size -
+					   p[i].remaining, p[i].remaining);
+			if (!victim || victim_weight < w) {
 				victim = &p[i];
+				victim_weight = w;
+			}
+		}
 		if (victim) {
-			sub_size = victim->remaining / 2;
-			list = victim->list + victim->list_size - sub_size;
+			unsigned end = victim->list + victim->list_size -
+				       delta_list_base;
+			unsigned cur = end - victim->remaining;
+			unsigned split;
+
+			/* leave the victim at least the object after its current one */
+			split = weight_position(cur + 1, end,
+						delta_weight[end] - victim_weight / 2);
+			if (split == end)
+				split = end - 1;
+			sub_size = end - split;
+			list = delta_list_base + split;
 			while (sub_size && list[0]->hash &&
 			       list[0]->hash == list[-1]->hash) {
 				list++;
@@ -1992,15 +2553,22 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 				/*
 				 * It is possible for some "paths" to have
 				 * so many objects that no hash boundary
-				 * might be found.  Let's just steal the
-				 * exact half in that case.
+				 * might be found.  Cut at the split point
+				 * itself in that case, which still hands
+				 * over about half of the remaining weight
+				 * but breaks that path in two.
 				 */
-				sub_size = victim->remaining / 2;
-				list -= sub_size;
+				sub_size = end - split;
+				list = delta_list_base + split;
 			}
 			target->list = list;
 			victim->list_size -= sub_size;
 			victim->remaining -= sub_size;
+			victim->nr_objects -= sub_size;
+			victim->weight -= segment_weight(list, sub_size);
+			target->nr_objects += sub_size;
+			target->weight += segment_weight(list, sub_size);
+			target->nr_steals++;
 		}
 		target->list_size = sub_size;
 		target->remaining = sub_size;
@@ -2020,6 +2588,14 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 		}
 	}
 	cleanup_threaded_search();
+
+	for (i = 0; i < delta_search_threads; i++)
+		trace_printf("pack-objects: delta thread %d: %u objects, "
+			     "%"PRIuMAX" bytes, %u steals\n", i,
+			     p[i].nr_objects, (uintmax_t)p[i].weight,
+			     p[i].nr_steals);
+	free(delta_weight);
+	delta_weight = NULL;
 	free(p);
 }
 
@@ -2078,7 +2654,9 @@ static void prepare_pack(int window, int depth)
 		if (entry->no_try_delta)
 			continue;
 
-		if (!entry->preferred_base) {
+		if (entry->reuse_verbatim)
+			; /* only a candidate base */
+		else if (!entry->preferred_base) {
 			nr_deltas++;
 			if (entry->type < 0)
 				die("unable to get type of object %s",
@@ -2153,6 +2731,10 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 #endif
 		return 0;
 	}
+	if (!strcmp(k, "pack.allowpackreuse")) {
+		allow_pack_reuse = git_config_bool(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.indexversion")) {
 		pack_idx_opts.version = git_config_int(k, v);
 		if (pack_idx_opts.version > 2)
@@ -2194,12 +2776,9 @@ static void read_object_list_from_stdin(void)
 	}
 }
 
-#define OBJECT_ADDED (1u<<20)
-
 static void show_commit(struct commit *commit, void *data)
 {
 	add_object_entry(commit->object.sha1, OBJ_COMMIT, NULL, 0);
-	commit->object.flags |= OBJECT_ADDED;
 }
 
 static void show_object(struct object *obj,
@@ -2210,7 +2789,6 @@ static void show_object(struct object *obj,
 
 	add_preferred_base_object(name);
 	add_object_entry(obj->sha1, obj->type, name, 0);
-	obj->flags |= OBJECT_ADDED;
 
 	/*
 	 * We will have generated the hash from the name,
@@ -2226,7 +2804,7 @@ static void show_edge(struct commit *commit)
 
 struct in_pack_object {
 	off_t offset;
-	struct object *object;
+	unsigned char sha1[20];
 };
 
 struct in_pack {
@@ -2235,10 +2813,10 @@ struct in_pack {
 	struct in_pack_object *array;
 };
 
-static void mark_in_pack_object(struct object *object, struct packed_git *p, struct in_pack *in_pack)
+static void mark_in_pack_object(const unsigned char *sha1, struct packed_git *p, struct in_pack *in_pack)
 {
-	in_pack->array[in_pack->nr].offset = find_pack_entry_one(object->sha1, p);
-	in_pack->array[in_pack->nr].object = object;
+	in_pack->array[in_pack->nr].offset = find_pack_entry_one(sha1, p);
+	hashcpy(in_pack->array[in_pack->nr].sha1, sha1);
 	in_pack->nr++;
 }
 
@@ -2256,7 +2834,7 @@ static int ofscmp(const void *a_, const void *b_)
 	else if (a->offset > b->offset)
 		return 1;
 	else
-		return hashcmp(a->object->sha1, b->object->sha1);
+		return hashcmp(a->sha1, b->sha1);
 }
 
 static void add_objects_in_unpacked_packs(struct rev_info *revs)
@@ -2269,7 +2847,6 @@ static void add_objects_in_unpacked_packs(struct rev_info *revs)
 
 	for (p = packed_git; p; p = p->next) {
 		const unsigned char *sha1;
-		struct object *o;
 
 		if (!p->pack_local || p->pack_keep)
 			continue;
@@ -2280,22 +2857,24 @@ static void add_objects_in_unpacked_packs(struct rev_info *revs)
 			   in_pack.nr + p->num_objects,
 			   in_pack.alloc);
 
+		/*
+		 * The packing list tells which objects the walk has
+		 * already added; an object that is in several packs
+		 * may be marked more than once, but add_object_entry()
+		 * takes it only once.
+		 */
 		for (i = 0; i < p->num_objects; i++) {
 			sha1 = nth_packed_object_sha1(p, i);
-			o = lookup_unknown_object(sha1);
-			if (!(o->flags & OBJECT_ADDED))
-				mark_in_pack_object(o, p, &in_pack);
-			o->flags |= OBJECT_ADDED;
+			if (!locate_object_entry(sha1))
+				mark_in_pack_object(sha1, p, &in_pack);
 		}
 	}
 
 	if (in_pack.nr) {
 		qsort(in_pack.array, in_pack.nr, sizeof(in_pack.array[0]),
 		      ofscmp);
-		for (i = 0; i < in_pack.nr; i++) {
-			struct object *o = in_pack.array[i].object;
-			add_object_entry(o->sha1, o->type, "", 0);
-		}
+		for (i = 0; i < in_pack.nr; i++)
+			add_object_entry(in_pack.array[i].sha1, OBJ_NONE, "", 0);
 	}
 	free(in_pack.array);
 }
@@ -2323,6 +2902,34 @@ static int has_sha1_pack_kept_or_nonlocal(const unsigned char *sha1)
 	return 0;
 }
 
+/*
+ * Treat the packs named on the command line as if they had a .keep
+ * file: "git repack --geometric" uses this to leave the larger packs
+ * of the progression alone while it rolls up the smaller ones.
+ */
+static void mark_keep_packs(struct string_list *names)
+{
+	struct packed_git *p;
+	struct strbuf buf = STRBUF_INIT;
+
+	for (p = packed_git; p; p = p->next) {
+		const char *base = strrchr(p->pack_name, '/');
+
+		base = base ? base + 1 : p->pack_name;
+		strbuf_reset(&buf);
+		strbuf_addstr(&buf, base);
+		if (unsorted_string_list_has_string(names, buf.buf))
+			p->pack_keep = 1;
+		else if (suffixcmp(buf.buf, ".pack") == 0) {
+			strbuf_setlen(&buf, buf.len - 5);
+			if (unsorted_string_list_has_string(names, buf.buf))
+				p->pack_keep = 1;
+		}
+	}
+	strbuf_release(&buf);
+	ignore_packed_keep = 1;
+}
+
 static void loosen_unused_packed_objects(struct rev_info *revs)
 {
 	struct packed_git *p;
@@ -2380,6 +2987,8 @@ static void get_object_list(int ac, const char **av)
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	mark_edges_uninteresting(revs.commits, &revs, show_edge);
+	revs.traverse_threads = delta_search_threads ?
+		delta_search_threads : online_cpus();
 	traverse_commit_list(&revs, show_commit, show_object, NULL);
 
 	if (keep_unreachable)
@@ -2502,10 +3111,14 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("create thin packs")),
 		OPT_BOOL(0, "honor-pack-keep", &ignore_packed_keep,
 			 N_("ignore packs that have companion .keep file")),
+		OPT_STRING_LIST(0, "keep-pack", &keep_pack_list, N_("name"),
+				N_("ignore this pack")),
 		OPT_INTEGER(0, "compression", &pack_compression_level,
 			    N_("pack compression level")),
 		OPT_SET_INT(0, "keep-true-parents", &grafts_replace_parents,
 			    N_("do not hide commits by grafts"), 0),
+		OPT_BOOL(0, "compact-commits", &compact_commits,
+			 N_("use less memory for the commits walked with --revs")),
 		OPT_END(),
 	};
 
@@ -2576,6 +3189,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		progress = 2;
 
 	prepare_packed_git();
+	if (keep_pack_list.nr)
+		mark_keep_packs(&keep_pack_list);
 
 	if (progress)
 		progress_state = start_progress("Counting objects", 0);
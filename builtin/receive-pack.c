@@ -830,8 +830,10 @@ static const char *unpack(int err_fd)
 		child.err = err_fd;
 		child.git_cmd = 1;
 		code = run_command(&child);
-		if (!code)
+		if (!code) {
+			reprepare_packed_git();
 			return NULL;
+		}
 		return "unpack-objects abnormal exit";
 	} else {
 		const char *keeper[7];
@@ -43,7 +43,8 @@ static const char rev_list_usage[] =
 "  special purpose:\n"
 "    --bisect\n"
 "    --bisect-vars\n"
-"    --bisect-all"
+"    --bisect-all\n"
+"    --compact-commits"
 ;
 
 static void finish_commit(struct commit *commit, void *data);
@@ -104,6 +105,8 @@ static void show_commit(struct commit *commit, void *data)
 	else
 		putchar('\n');
 
+	if (revs->verbose_header && compact_commits)
+		load_commit_buffer(commit);
 	if (revs->verbose_header && commit->buffer) {
 		struct strbuf buf = STRBUF_INIT;
 		struct pretty_print_context ctx = {0};
@@ -166,10 +169,8 @@ static void show_commit(struct commit *commit, void *data)
 
 static void finish_commit(struct commit *commit, void *data)
 {
-	if (commit->parents) {
-		free_commit_list(commit->parents);
-		commit->parents = NULL;
-	}
+	if (commit->parents)
+		free_commit_parents(commit);
 	free(commit->buffer);
 	commit->buffer = NULL;
 }
@@ -349,6 +350,14 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 			revs.show_decorations = 1;
 			continue;
 		}
+		if (!strcmp(arg, "--compact-commits")) {
+			compact_commits = 1;
+			continue;
+		}
+		if (!prefixcmp(arg, "--threads=")) {
+			revs.traverse_threads = atoi(arg + 10);
+			continue;
+		}
 		if (!strcmp(arg, "--bisect-vars")) {
 			bisect_list = 1;
 			bisect_show_vars = 1;
@@ -30,6 +30,7 @@ typedef struct git_zstream {
 void git_inflate_init(git_zstream *);
 void git_inflate_init_gzip_only(git_zstream *);
 void git_inflate_end(git_zstream *);
+void git_inflate_copy(git_zstream *dst, git_zstream *src);
 int git_inflate(git_zstream *, int flush);
 
 void git_deflate_init(git_zstream *, int level);
@@ -129,6 +130,7 @@ struct cache_entry {
 	unsigned int ce_size;
 	unsigned int ce_flags;
 	unsigned int ce_namelen;
+	unsigned int index;	/* position in the split index base, plus one */
 	unsigned char sha1[20];
 	struct cache_entry *next;
 	struct cache_entry *dir_next;
@@ -162,6 +164,9 @@ struct cache_entry {
 #define CE_UNPACKED          (1 << 24)
 #define CE_NEW_SKIP_WORKTREE (1 << 25)
 
+/* the file system monitor saw no change since the path was last checked */
+#define CE_FSMONITOR_VALID   (1 << 26)
+
 /*
  * Extended on-disk flags
  */
@@ -257,16 +262,25 @@ static inline unsigned int canon_mode(unsigned int mode)
 
 #define cache_entry_size(len) (offsetof(struct cache_entry,name) + (len) + 1)
 
+struct split_index;
+struct untracked_cache;
 struct index_state {
 	struct cache_entry **cache;
 	unsigned int version;
 	unsigned int cache_nr, cache_alloc, cache_changed;
 	struct string_list *resolve_undo;
 	struct cache_tree *cache_tree;
+	struct split_index *split_index;
+	struct untracked_cache *untracked;
+	uint64_t fsmonitor_last_update;
+	unsigned int *fsmonitor_dirty;
+	unsigned int fsmonitor_dirty_nr, fsmonitor_dirty_alloc;
 	struct cache_time timestamp;
 	unsigned name_hash_initialized : 1,
-		 initialized : 1;
+		 initialized : 1,
+		 fsmonitor_answered : 1;
 	struct hash_table name_hash;
+	unsigned char sha1[20];
 };
 
 extern struct index_state the_index;
@@ -434,6 +448,7 @@ extern int init_db(const char *template_dir, unsigned int flags);
 /* Initialize and use the cache information */
 extern int read_index(struct index_state *);
 extern int read_index_preload(struct index_state *, const char **pathspec);
+extern void preload_index(struct index_state *, const char **pathspec);
 extern int read_index_from(struct index_state *, const char *path);
 extern int is_index_unborn(struct index_state *);
 extern int read_index_unmerged(struct index_state *);
@@ -473,6 +488,7 @@ extern int index_name_is_other(const struct index_state *, const char *, int);
 #define CE_MATCH_IGNORE_SKIP_WORKTREE	04
 extern int ie_match_stat(const struct index_state *, struct cache_entry *, struct stat *, unsigned int);
 extern int ie_modified(const struct index_state *, struct cache_entry *, struct stat *, unsigned int);
+extern int is_racy_timestamp(const struct index_state *, struct cache_entry *);
 
 struct pathspec {
 	const char **raw; /* get_pathspec() result, not freed by free_pathspec() */
@@ -525,6 +541,7 @@ extern int hold_locked_index(struct lock_file *, int);
 extern int commit_locked_index(struct lock_file *);
 extern void set_alternate_index_output(const char *);
 extern int close_lock_file(struct lock_file *);
+extern const char *lock_file_name(int fd);
 extern void rollback_lock_file(struct lock_file *);
 extern int delete_ref(const char *, const unsigned char *sha1, int delopt);
 
@@ -550,10 +567,18 @@ extern size_t packed_git_window_size;
 extern size_t packed_git_limit;
 extern size_t delta_base_cache_limit;
 extern unsigned long big_file_threshold;
+extern int loose_object_cache;
 extern unsigned long pack_size_limit_cfg;
 extern int read_replace_refs;
 extern int fsync_object_files;
 extern int core_preload_index;
+extern int core_hash_thread;
+extern int core_split_index;
+extern int split_index_max_change;
+extern int core_untracked_cache;
+extern const char *core_fsmonitor;
+extern int checkout_threads;
+extern int index_threads;
 extern int core_apply_sparse_checkout;
 extern int precomposed_unicode;
 
@@ -741,7 +766,18 @@ static inline const unsigned char *lookup_replace_object(const unsigned char *sh
 /* Read and unpack a sha1 file into memory, write memory to a sha1 file */
 extern int sha1_object_info(const unsigned char *, unsigned long *);
 extern int hash_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *sha1);
+
+/* hash_sha1_file() for many objects, several of them at a time */
+struct hash_batch_item {
+	const void *buf;
+	unsigned long len;
+	const char *type;
+	unsigned char sha1[20];
+};
+extern void hash_sha1_files(struct hash_batch_item *item, int nr);
 extern int write_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *return_sha1);
+/* The same for an object whose name was computed already, as by hash_sha1_files() */
+extern int write_hashed_sha1_file(const void *buf, unsigned long len, const char *type, const unsigned char *sha1);
 extern int pretend_sha1_file(void *, unsigned long, enum object_type, unsigned char *);
 extern int force_object_loose(const unsigned char *sha1, time_t mtime);
 extern void *map_sha1_file(const unsigned char *sha1, unsigned long *size);
@@ -761,6 +797,7 @@ extern int move_temp_to_file(const char *tmpfile, const char *filename);
 extern int has_sha1_pack(const unsigned char *sha1);
 extern int has_sha1_file(const unsigned char *sha1);
 extern int has_loose_object_nonlocal(const unsigned char *sha1);
+extern void add_to_loose_object_cache(const unsigned char *sha1);
 
 extern int has_pack_index(const unsigned char *sha1);
 
@@ -869,6 +906,20 @@ extern int df_name_compare(const char *name1, int len1, int mode1, const char *n
 extern int cache_name_compare(const char *name1, int len1, const char *name2, int len2);
 extern int cache_name_stage_compare(const char *name1, int len1, int stage1, const char *name2, int len2, int stage2);
 
+/*
+ * Read all the objects in "list" and hand each of them to "fn", in no
+ * particular order.  "buf" is owned by the callback and is NULL (with
+ * type OBJ_BAD) for a missing object.  A non-zero return from the
+ * callback stops the iteration and is returned.
+ */
+struct sha1_array;
+struct packed_git;
+typedef int (*read_batch_fn)(const unsigned char *sha1, enum object_type type,
+			     unsigned long size, void *buf, void *cb_data);
+extern int read_sha1_batch(struct sha1_array *list, read_batch_fn fn, void *cb_data);
+/* The same for all the objects in "p", and only as they are found there */
+extern int read_pack_batch(struct packed_git *p, read_batch_fn fn, void *cb_data);
+
 extern void *read_object_with_reference(const unsigned char *sha1,
 					const char *required_type,
 					unsigned long *size,
@@ -936,6 +987,12 @@ struct checkout {
 };
 
 extern int checkout_entry(struct cache_entry *ce, const struct checkout *state, char *topath);
+/*
+ * Clear the way for checking out "ce" and create its leading directories,
+ * without writing it.  Returns 1 if it still has to be written out, 0 if
+ * the work tree already has it, and -1 on error.
+ */
+extern int prepare_checkout_entry(struct cache_entry *ce, const struct checkout *state);
 
 struct cache_def {
 	char path[PATH_MAX + 1];
@@ -952,8 +1009,10 @@ extern int has_dirs_only_path(const char *name, int len, int prefix_len);
 extern void schedule_dir_for_removal(const char *name, int len);
 extern void remove_scheduled_dirs(void);
 
+struct loose_object_cache;
 extern struct alternate_object_database {
 	struct alternate_object_database *next;
+	struct loose_object_cache *loose_cache;
 	char *name;
 	char base[FLEX_ARRAY]; /* more */
 } *alt_odb_list;
@@ -1067,6 +1126,17 @@ extern void *unpack_entry(struct packed_git *, off_t, enum object_type *, unsign
 extern unsigned long unpack_object_header_buffer(const unsigned char *buf, unsigned long len, enum object_type *type, unsigned long *sizep);
 extern unsigned long get_size_from_delta(struct packed_git *, struct pack_window **, off_t);
 extern int unpack_object_header(struct packed_git *, struct pack_window **, off_t *, unsigned long *);
+extern off_t get_delta_base(struct packed_git *, struct pack_window **, off_t *, enum object_type, off_t);
+extern void *unpack_compressed_entry(struct packed_git *, struct pack_window **, off_t, unsigned long);
+
+/*
+ * Let several threads read objects: once enabled, each of them must
+ * hold the object read lock around any call into the object store.
+ */
+extern void enable_obj_read_lock(void);
+extern void disable_obj_read_lock(void);
+extern void obj_read_lock(void);
+extern void obj_read_unlock(void);
 
 struct object_info {
 	/* Request */
@@ -1203,7 +1273,9 @@ void decode_64(struct strbuf *buf);
 extern void *alloc_blob_node(void);
 extern void *alloc_tree_node(void);
 extern void *alloc_commit_node(void);
+extern unsigned int alloc_commit_index(void);
 extern void *alloc_tag_node(void);
+extern void *alloc_commit_list_node(void);
 extern void *alloc_object_node(void);
 extern void alloc_report(void);
 
@@ -1215,6 +1287,7 @@ extern void trace_argv_printf(const char **argv, const char *format, ...);
 extern void trace_repo_setup(const char *prefix);
 extern int trace_want(const char *key);
 extern void trace_strbuf(const char *key, const struct strbuf *buf);
+extern uint64_t getnanotime(void);
 
 void packet_trace_identity(const char *prog);
 
@@ -0,0 +1,87 @@
+#ifndef COMMIT_SLAB_H
+#define COMMIT_SLAB_H
+
+/*
+ * define_commit_slab(slabname, elemtype) defines a side table that
+ * associates a value of type "elemtype" with each commit, indexed by
+ * commit->index, so that per-command data does not need a field in
+ * struct commit.  It declares:
+ *
+ *   struct slabname;
+ *   void init_slabname(struct slabname *s);
+ *   void init_slabname_with_stride(struct slabname *s, unsigned stride);
+ *   elemtype *slabname_at(struct slabname *s, const struct commit *c);
+ *   void clear_slabname(struct slabname *s);
+ *
+ * With a stride, each commit gets an array of "stride" elements.
+ * Storage is allocated lazily, one slab of COMMIT_SLAB_SIZE commits
+ * at a time, and is zero-initialized; clear_slabname() frees it.
+ */
+
+/* allocate ~512kB at once, allowing for malloc overhead */
+#ifndef COMMIT_SLAB_SIZE
+#define COMMIT_SLAB_SIZE (512*1024-32)
+#endif
+
+#define define_commit_slab(slabname, elemtype) 				\
+									\
+struct slabname {							\
+	unsigned slab_size;						\
+	unsigned stride;						\
+	unsigned slab_count;						\
+	elemtype **slab;						\
+};									\
+									\
+static inline void init_ ##slabname## _with_stride(struct slabname *s,	\
+						   unsigned stride)	\
+{									\
+	unsigned int elem_size;						\
+	if (!stride)							\
+		stride = 1;						\
+	s->stride = stride;						\
+	elem_size = sizeof(elemtype) * stride;				\
+	s->slab_size = COMMIT_SLAB_SIZE / elem_size;			\
+	if (!s->slab_size)						\
+		s->slab_size = 1;					\
+	s->slab_count = 0;						\
+	s->slab = NULL;							\
+}									\
+									\
+static inline void init_ ##slabname(struct slabname *s)		\
+{									\
+	init_ ##slabname## _with_stride(s, 1);				\
+}									\
+									\
+static inline void clear_ ##slabname(struct slabname *s)		\
+{									\
+	unsigned int i;							\
+	for (i = 0; i < s->slab_count; i++)				\
+		free(s->slab[i]);					\
+	s->slab_count = 0;						\
+	free(s->slab);							\
+	s->slab = NULL;							\
+}									\
+									\
+static inline elemtype *slabname## _at(struct slabname *s,		\
+				       const struct commit *c)		\
+{									\
+	unsigned int nth_slab, nth_slot;				\
+									\
+	nth_slab = c->index / s->slab_size;				\
+	nth_slot = c->index % s->slab_size;				\
+									\
+	if (s->slab_count <= nth_slab) {				\
+		unsigned int i;						\
+		s->slab = xrealloc(s->slab,				\
+				   (nth_slab + 1) * sizeof(*s->slab));	\
+		for (i = s->slab_count; i <= nth_slab; i++)		\
+			s->slab[i] = NULL;				\
+		s->slab_count = nth_slab + 1;				\
+	}								\
+	if (!s->slab[nth_slab])						\
+		s->slab[nth_slab] = xcalloc(s->slab_size,		\
+					    sizeof(**s->slab) * s->stride); \
+	return &s->slab[nth_slab][nth_slot * s->stride];		\
+}
+
+#endif /* COMMIT_SLAB_H */
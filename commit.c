@@ -8,10 +8,12 @@
 #include "notes.h"
 #include "gpg-interface.h"
 #include "mergesort.h"
+#include "commit-slab.h"
 
 static struct commit_extra_header *read_commit_extra_header_lines(const char *buf, size_t len, const char **);
 
 int save_commit_buffer = 1;
+int compact_commits;
 
 const char *commit_type = "commit";
 
@@ -60,8 +62,10 @@ struct commit *lookup_commit(const unsigned char *sha1)
 	struct object *obj = lookup_object(sha1);
 	if (!obj)
 		return create_object(sha1, OBJ_COMMIT, alloc_commit_node());
-	if (!obj->type)
+	if (!obj->type) {
 		obj->type = OBJ_COMMIT;
+		((struct commit *)obj)->index = alloc_commit_index();
+	}
 	return check_commit(obj, sha1, 0);
 }
 
@@ -251,6 +255,20 @@ int unregister_shallow(const unsigned char *sha1)
 	return 0;
 }
 
+static struct commit_list **append_parent(struct commit *parent,
+					  struct commit_list **pptr)
+{
+	struct commit_list *new_list;
+
+	if (!compact_commits)
+		return &commit_list_insert(parent, pptr)->next;
+	new_list = alloc_commit_list_node();
+	new_list->item = parent;
+	new_list->next = *pptr;
+	*pptr = new_list;
+	return &new_list->next;
+}
+
 int parse_commit_buffer(struct commit *item, const void *buffer, unsigned long size)
 {
 	const char *tail = buffer;
@@ -289,7 +307,7 @@ int parse_commit_buffer(struct commit *item, const void *buffer, unsigned long s
 			continue;
 		new_parent = lookup_commit(parent);
 		if (new_parent)
-			pptr = &commit_list_insert(new_parent, pptr)->next;
+			pptr = append_parent(new_parent, pptr);
 	}
 	if (graft) {
 		int i;
@@ -298,7 +316,7 @@ int parse_commit_buffer(struct commit *item, const void *buffer, unsigned long s
 			new_parent = lookup_commit(graft->parent[i]);
 			if (!new_parent)
 				continue;
-			pptr = &commit_list_insert(new_parent, pptr)->next;
+			pptr = append_parent(new_parent, pptr);
 		}
 	}
 	item->date = parse_commit_date(bufptr, tail);
@@ -327,7 +345,7 @@ int parse_commit(struct commit *item)
 			     sha1_to_hex(item->object.sha1));
 	}
 	ret = parse_commit_buffer(item, buffer, size);
-	if (save_commit_buffer && !ret) {
+	if (save_commit_buffer && !compact_commits && !ret) {
 		item->buffer = buffer;
 		return 0;
 	}
@@ -335,6 +353,29 @@ int parse_commit(struct commit *item)
 	return ret;
 }
 
+/*
+ * Read the buffer of a commit that was parsed without keeping it.
+ */
+int load_commit_buffer(struct commit *commit)
+{
+	enum object_type type;
+	unsigned long size;
+
+	if (commit->buffer)
+		return 0;
+	commit->buffer = read_sha1_file(commit->object.sha1, &type, &size);
+	if (!commit->buffer)
+		return error("Could not read %s",
+			     sha1_to_hex(commit->object.sha1));
+	if (type != OBJ_COMMIT) {
+		free(commit->buffer);
+		commit->buffer = NULL;
+		return error("Object %s not a commit",
+			     sha1_to_hex(commit->object.sha1));
+	}
+	return 0;
+}
+
 int find_commit_subject(const char *commit_buffer, const char **subject)
 {
 	const char *eol;
@@ -380,6 +421,17 @@ void free_commit_list(struct commit_list *list)
 	}
 }
 
+/*
+ * The parents of a commit parsed with compact_commits live in the
+ * arena, which is never freed.
+ */
+void free_commit_parents(struct commit *commit)
+{
+	if (!compact_commits)
+		free_commit_list(commit->parents);
+	commit->parents = NULL;
+}
+
 struct commit_list * commit_list_insert_by_date(struct commit *item, struct commit_list **list)
 {
 	struct commit_list **pp = list;
@@ -497,6 +549,9 @@ struct commit *pop_commit(struct commit_list **stack)
 	return item;
 }
 
+/* count number of children that have not been emitted */
+define_commit_slab(indegree_slab, int);
+
 /*
  * Performs an in-place topological sort on the list supplied.
  */
@@ -505,15 +560,18 @@ void sort_in_topological_order(struct commit_list ** list, int lifo)
 	struct commit_list *next, *orig = *list;
 	struct commit_list *work, **insert;
 	struct commit_list **pptr;
+	struct indegree_slab indegree;
 
 	if (!orig)
 		return;
 	*list = NULL;
 
+	init_indegree_slab(&indegree);
+
 	/* Mark them and clear the indegree */
 	for (next = orig; next; next = next->next) {
 		struct commit *commit = next->item;
-		commit->indegree = 1;
+		*(indegree_slab_at(&indegree, commit)) = 1;
 	}
 
 	/* update the indegree */
@@ -521,9 +579,10 @@ void sort_in_topological_order(struct commit_list ** list, int lifo)
 		struct commit_list * parents = next->item->parents;
 		while (parents) {
 			struct commit *parent = parents->item;
+			int *pi = indegree_slab_at(&indegree, parent);
 
-			if (parent->indegree)
-				parent->indegree++;
+			if (*pi)
+				(*pi)++;
 			parents = parents->next;
 		}
 	}
@@ -540,7 +599,7 @@ void sort_in_topological_order(struct commit_list ** list, int lifo)
 	for (next = orig; next; next = next->next) {
 		struct commit *commit = next->item;
 
-		if (commit->indegree == 1)
+		if (*(indegree_slab_at(&indegree, commit)) == 1)
 			insert = &commit_list_insert(commit, insert)->next;
 	}
 
@@ -561,8 +620,9 @@ void sort_in_topological_order(struct commit_list ** list, int lifo)
 		commit = work_item->item;
 		for (parents = commit->parents; parents ; parents = parents->next) {
 			struct commit *parent = parents->item;
+			int *pi = indegree_slab_at(&indegree, parent);
 
-			if (!parent->indegree)
+			if (!*pi)
 				continue;
 
 			/*
@@ -570,7 +630,7 @@ void sort_in_topological_order(struct commit_list ** list, int lifo)
 			 * when all their children have been emitted thereby
 			 * guaranteeing topological order.
 			 */
-			if (--parent->indegree == 1) {
+			if (--(*pi) == 1) {
 				if (!lifo)
 					commit_list_insert_by_date(parent, &work);
 				else
@@ -581,10 +641,12 @@ void sort_in_topological_order(struct commit_list ** list, int lifo)
 		 * work_item is a commit all of whose children
 		 * have already been emitted. we can emit it now.
 		 */
-		commit->indegree = 0;
+		*(indegree_slab_at(&indegree, commit)) = 0;
 		*pptr = work_item;
 		pptr = &work_item->next;
 	}
+
+	clear_indegree_slab(&indegree);
 }
 
 /* merge-base stuff */
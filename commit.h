@@ -14,7 +14,7 @@ struct commit_list {
 struct commit {
 	struct object object;
 	void *util;
-	unsigned int indegree;
+	unsigned int index;
 	unsigned long date;
 	struct commit_list *parents;
 	struct tree *tree;
@@ -22,6 +22,16 @@ struct commit {
 };
 
 extern int save_commit_buffer;
+
+/*
+ * With compact_commits, parse_commit() takes the parent lists from an
+ * arena instead of allocating each node on its own, and does not keep
+ * the commit buffer.  Such parent lists must be dropped with
+ * free_commit_parents(), and load_commit_buffer() reads the buffer
+ * back when it is needed.
+ */
+extern int compact_commits;
+
 extern const char *commit_type;
 
 /* While we can decorate any object with a name, it's only used for commits.. */
@@ -61,6 +71,8 @@ struct commit_list *commit_list_insert_by_date(struct commit *item,
 void commit_list_sort_by_date(struct commit_list **list);
 
 void free_commit_list(struct commit_list *list);
+void free_commit_parents(struct commit *commit);
+int load_commit_buffer(struct commit *commit);
 
 /* Commit formats */
 enum cmit_fmt {
@@ -662,6 +662,11 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.looseobjectcache")) {
+		loose_object_cache = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.packedgitlimit")) {
 		packed_git_limit = git_config_ulong(var, value);
 		return 0;
@@ -743,6 +748,31 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.hashthread")) {
+		core_hash_thread = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.splitindex")) {
+		core_split_index = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.untrackedcache")) {
+		core_untracked_cache = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.checkoutthreads")) {
+		checkout_threads = git_config_int(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.indexthreads")) {
+		index_threads = git_config_int(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.createobject")) {
 		if (!strcmp(value, "rename"))
 			object_creation_mode = OBJECT_CREATION_USES_RENAMES;
@@ -879,6 +909,14 @@ int git_default_config(const char *var, const char *value, void *dummy)
 		pack_size_limit_cfg = git_config_ulong(var, value);
 		return 0;
 	}
+
+	if (!strcmp(var, "splitindex.maxpercentchange")) {
+		split_index_max_change = git_config_int(var, value);
+		if (split_index_max_change < 0 || 100 < split_index_max_change)
+			return error("splitIndex.maxPercentChange must be "
+				     "between 0 and 100");
+		return 0;
+	}
 	/* Add other config variables here and to Documentation/config.txt. */
 	return 0;
 }
@@ -0,0 +1,445 @@
+/*
+ * A core.fsmonitor hook for Linux, built on inotify.
+ *
+ * Run as "git-fsmonitor-inotify 1 <nanoseconds>" from the top of the
+ * work tree, it asks a daemon watching the work tree which paths changed
+ * since then.  When no daemon is running, it starts one and answers "/",
+ * i.e. "anything may have changed".
+ *
+ * The daemon remembers when it saw each change, and answers "/" for any
+ * time before it started watching, or before it lost events.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/inotify.h>
+
+#define SOCKET_NAME "fsmonitor-inotify.sock"
+
+/* forget the oldest half of the changes when there are more */
+#define MAX_CHANGES 65536
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | \
+		    IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | \
+		    IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+struct change {
+	uint64_t time;
+	char *path;
+};
+
+static struct change *changes;
+static int changes_nr, changes_alloc;
+
+/* the directory watched by each watch descriptor, "" for the top */
+static char **watch_path;
+static int watch_alloc;
+
+static int inotify_fd;
+static uint64_t forget_before;
+static char socket_path[4096];
+
+static void die(const char *msg)
+{
+	fprintf(stderr, "fatal: %s: %s\n", msg, strerror(errno));
+	exit(128);
+}
+
+static void *xrealloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+	if (!ptr)
+		die("out of memory");
+	return ptr;
+}
+
+static char *xstrdup(const char *s)
+{
+	char *ret = strdup(s);
+	if (!ret)
+		die("out of memory");
+	return ret;
+}
+
+static uint64_t getnanotime(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+}
+
+static char *join_path(const char *dir, const char *name)
+{
+	size_t len = strlen(dir);
+	char *ret = xrealloc(NULL, len + strlen(name) + 2);
+
+	if (len)
+		sprintf(ret, "%s/%s", dir, name);
+	else
+		strcpy(ret, name);
+	return ret;
+}
+
+static void record_change(char *path)
+{
+	/* a write usually comes as several events in a row */
+	if (changes_nr && !strcmp(changes[changes_nr - 1].path, path)) {
+		changes[changes_nr - 1].time = getnanotime();
+		free(path);
+		return;
+	}
+	if (changes_nr == MAX_CHANGES) {
+		int i, keep = MAX_CHANGES / 2;
+
+		forget_before = changes[changes_nr - keep - 1].time + 1;
+		for (i = 0; i < changes_nr - keep; i++)
+			free(changes[i].path);
+		memmove(changes, changes + changes_nr - keep,
+			keep * sizeof(*changes));
+		changes_nr = keep;
+	}
+	if (changes_nr == changes_alloc) {
+		changes_alloc = changes_alloc ? changes_alloc * 2 : 256;
+		changes = xrealloc(changes, changes_alloc * sizeof(*changes));
+	}
+	changes[changes_nr].time = getnanotime();
+	changes[changes_nr].path = path;
+	changes_nr++;
+}
+
+/*
+ * Watch "path" and the directories below it.  With "record", the paths
+ * found are recorded as changed, as they appeared after the caller was
+ * told about the directory.
+ */
+static void watch_tree(const char *path, int record)
+{
+	DIR *dir;
+	struct dirent *de;
+	int wd;
+
+	wd = inotify_add_watch(inotify_fd, *path ? path : ".", WATCH_MASK);
+	if (wd < 0) {
+		/* gone already, or out of watches; either way we cannot tell */
+		if (errno != ENOENT && errno != ENOTDIR)
+			forget_before = getnanotime();
+		return;
+	}
+	if (wd >= watch_alloc) {
+		int old = watch_alloc;
+
+		watch_alloc = wd * 2 + 16;
+		watch_path = xrealloc(watch_path,
+				      watch_alloc * sizeof(*watch_path));
+		memset(watch_path + old, 0,
+		       (watch_alloc - old) * sizeof(*watch_path));
+	}
+	free(watch_path[wd]);
+	watch_path[wd] = xstrdup(path);
+
+	dir = opendir(*path ? path : ".");
+	if (!dir)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		char *sub;
+		struct stat st;
+
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..") ||
+		    (!*path && !strcmp(de->d_name, ".git")))
+			continue;
+		sub = join_path(path, de->d_name);
+		if (!lstat(sub, &st) && S_ISDIR(st.st_mode))
+			watch_tree(sub, record);
+		if (record)
+			record_change(sub);
+		else
+			free(sub);
+	}
+	closedir(dir);
+}
+
+static void read_events(void)
+{
+	char buf[65536]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+	for (;;) {
+		ssize_t len = read(inotify_fd, buf, sizeof(buf));
+		char *p;
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return;
+			die("unable to read inotify events");
+		}
+		for (p = buf; p < buf + len; ) {
+			struct inotify_event *ev = (struct inotify_event *)p;
+			const char *dir;
+
+			p += sizeof(*ev) + ev->len;
+			if (ev->mask & IN_Q_OVERFLOW) {
+				forget_before = getnanotime();
+				continue;
+			}
+			if (ev->wd < 0 || ev->wd >= watch_alloc ||
+			    !watch_path[ev->wd])
+				continue;
+			dir = watch_path[ev->wd];
+			if (ev->mask & IN_IGNORED) {
+				free(watch_path[ev->wd]);
+				watch_path[ev->wd] = NULL;
+				continue;
+			}
+			if (!ev->len) {
+				/* the directory itself went away */
+				if (*dir)
+					record_change(xstrdup(dir));
+				continue;
+			}
+			if (!*dir && !strcmp(ev->name, ".git"))
+				continue;
+			if ((ev->mask & (IN_CREATE | IN_MOVED_TO)) &&
+			    (ev->mask & IN_ISDIR)) {
+				char *sub = join_path(dir, ev->name);
+				watch_tree(sub, 1);
+				free(sub);
+			}
+			record_change(join_path(dir, ev->name));
+		}
+	}
+}
+
+static void write_all(int fd, const char *buf, size_t len)
+{
+	while (len) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return;
+		buf += n;
+		len -= n;
+	}
+}
+
+/* Answer one "<nanoseconds>\n" or "quit\n" request; 0 means quit */
+static int serve(int fd)
+{
+	char req[64];
+	size_t len = 0;
+	uint64_t since;
+	int i;
+
+	while (len < sizeof(req) - 1) {
+		ssize_t n = read(fd, req + len, sizeof(req) - 1 - len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		len += n;
+		if (memchr(req, '\n', len))
+			break;
+	}
+	req[len] = '\0';
+	if (!strcmp(req, "quit\n"))
+		return 0;
+
+	read_events();
+	since = strtoull(req, NULL, 10);
+	if (!since || since < forget_before) {
+		write_all(fd, "/", 2);
+		return 1;
+	}
+	for (i = changes_nr - 1; i >= 0 && changes[i].time >= since; i--)
+		; /* find the oldest change since then */
+	for (i++; i < changes_nr; i++)
+		write_all(fd, changes[i].path, strlen(changes[i].path) + 1);
+	return 1;
+}
+
+static void cleanup(int sig)
+{
+	unlink(socket_path);
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+static void run_daemon(int listen_fd)
+{
+	struct pollfd pfd[2];
+
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0)
+		die("unable to initialize inotify");
+	watch_tree("", 0);
+	forget_before = getnanotime();
+
+	signal(SIGINT, cleanup);
+	signal(SIGTERM, cleanup);
+	signal(SIGHUP, cleanup);
+	signal(SIGPIPE, SIG_IGN);
+
+	pfd[0].fd = inotify_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = listen_fd;
+	pfd[1].events = POLLIN;
+	for (;;) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			die("poll failed");
+		}
+		if (pfd[0].revents)
+			read_events();
+		if (pfd[1].revents) {
+			int fd = accept(listen_fd, NULL, NULL);
+			int more;
+
+			if (fd < 0)
+				continue;
+			more = serve(fd);
+			close(fd);
+			if (!more)
+				break;
+		}
+		/* stop when the repository goes away */
+		if (access(socket_path, F_OK))
+			break;
+	}
+	unlink(socket_path);
+}
+
+static void start_daemon(void)
+{
+	struct sockaddr_un sa;
+	int fd, devnull;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, socket_path);
+
+	/* a socket nobody listens on is left over from a dead daemon */
+	unlink(socket_path);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		die("unable to create socket");
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+	    listen(fd, 16) < 0) {
+		/* somebody else got there first */
+		close(fd);
+		return;
+	}
+
+	switch (fork()) {
+	case -1:
+		die("unable to fork");
+	case 0:
+		break;
+	default:
+		close(fd);
+		return;
+	}
+	setsid();
+	if (fork())
+		_exit(0);
+	devnull = open("/dev/null", O_RDWR);
+	if (devnull >= 0) {
+		dup2(devnull, 0);
+		dup2(devnull, 1);
+		dup2(devnull, 2);
+		if (devnull > 2)
+			close(devnull);
+	}
+	run_daemon(fd);
+	exit(0);
+}
+
+static int connect_daemon(void)
+{
+	struct sockaddr_un sa;
+	int fd;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, socket_path);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		die("unable to create socket");
+	if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: git-fsmonitor-inotify 1 <nanoseconds>\n"
+		"   or: git-fsmonitor-inotify --stop\n");
+	exit(129);
+}
+
+int main(int argc, char **argv)
+{
+	const char *git_dir = getenv("GIT_DIR");
+	char buf[4096];
+	ssize_t len;
+	int fd;
+
+	if (!git_dir)
+		git_dir = ".git";
+	if (strlen(git_dir) + strlen(SOCKET_NAME) + 2 >
+	    sizeof(((struct sockaddr_un *)0)->sun_path)) {
+		errno = ENAMETOOLONG;
+		die(git_dir);
+	}
+	sprintf(socket_path, "%s/%s", git_dir, SOCKET_NAME);
+
+	if (argc == 2 && !strcmp(argv[1], "--stop")) {
+		fd = connect_daemon();
+		if (fd >= 0) {
+			write_all(fd, "quit\n", 5);
+			close(fd);
+		}
+		return 0;
+	}
+	if (argc != 3 || strcmp(argv[1], "1"))
+		usage();
+
+	signal(SIGPIPE, SIG_IGN);
+	fd = connect_daemon();
+	if (fd < 0) {
+		start_daemon();
+		fwrite("/", 1, 2, stdout);
+		return 0;
+	}
+	write_all(fd, argv[2], strlen(argv[2]));
+	write_all(fd, "\n", 1);
+	while ((len = read(fd, buf, sizeof(buf))) != 0) {
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			die("unable to read from the daemon");
+		}
+		fwrite(buf, 1, len, stdout);
+	}
+	close(fd);
+	return 0;
+}
@@ -3,6 +3,8 @@
 #include "run-command.h"
 #include "quote.h"
 #include "sigchain.h"
+#include "pkt-line.h"
+#include "sideband.h"
 
 /*
  * convert.c - convert a file when checking it out and checking it in.
@@ -13,15 +15,6 @@
  * translation when the "text" attribute or "auto_crlf" option is set.
  */
 
-enum crlf_action {
-	CRLF_GUESS = -1,
-	CRLF_BINARY = 0,
-	CRLF_TEXT,
-	CRLF_INPUT,
-	CRLF_CRLF,
-	CRLF_AUTO
-};
-
 struct text_stat {
 	/* NUL, CR, LF and CRLF counts */
 	unsigned nul, cr, lf, crlf;
@@ -32,48 +25,182 @@ struct text_stat {
 	unsigned printable, nonprintable;
 };
 
+static inline void gather_one(const char *buf, unsigned long size,
+			      unsigned long i, struct text_stat *stats,
+			      unsigned *last_trailing_space)
+{
+	unsigned char c = buf[i];
+
+	if (32 < c && c < 127) {
+		stats->trailing_space = *last_trailing_space;
+		stats->printable++;
+		return;
+	}
+	if (c == '\r') {
+		stats->cr++;
+		if (i+1 < size && buf[i+1] == '\n')
+			stats->crlf++;
+		return;
+	}
+	if (c == '\n') {
+		*last_trailing_space = stats->trailing_space;
+		stats->lf++;
+		return;
+	}
+	if (c == 127)
+		/* DEL */
+		stats->nonprintable++;
+	else if (c <= 32) {
+		switch (c) {
+		case '\t': case ' ':
+			stats->trailing_space++;
+			/* fall through */
+			/* BS, ESC and FF */
+		case '\b': case '\033': case '\014':
+			stats->printable++;
+			break;
+		case 0:
+			stats->nul++;
+			/* fall through */
+		default:
+			stats->nonprintable++;
+		}
+	} else {
+		/* non-ASCII */
+		stats->trailing_space = *last_trailing_space;
+		stats->printable++;
+	}
+}
+
+/*
+ * Most text files hold nothing but printable characters, blanks and
+ * line ends, and for those gather_stats() checks that a machine word
+ * at a time, finds the line ends with memchr(), and only looks at the
+ * bytes before each of them.  Other files are gone through a line at
+ * a time, and only the lines with anything else in them byte by byte.
+ */
+#define ONES_BYTES (~0UL / 255)
+#define HIGH_BYTES (ONES_BYTES * 128)
+
+/* Is any byte of "x" below "n"?  (n <= 128) */
+#define has_byte_below(x, n) (((x) - ONES_BYTES * (n)) & ~(x) & HIGH_BYTES)
+/* Is any byte of "x" above "n"?  (n <= 127) */
+#define has_byte_above(x, n) ((((x) + ONES_BYTES * (127 - (n))) | (x)) & HIGH_BYTES)
+
+/* The high bit of each byte of "x" that is "c", and only of those */
+static inline unsigned long bytes_equal(unsigned long x, unsigned char c)
+{
+	unsigned long y = x ^ (ONES_BYTES * c);
+	return ~(((y & ~HIGH_BYTES) + ~HIGH_BYTES) | y) & HIGH_BYTES;
+}
+
+/*
+ * Is it all printable ASCII, spaces and tabs, and CRs and LFs if
+ * "eols" is set?
+ */
+static int is_plain_text(const char *buf, unsigned long size, int eols)
+{
+	unsigned long i = 0;
+
+	for (; i + sizeof(unsigned long) <= size; i += sizeof(unsigned long)) {
+		unsigned long word, allowed;
+
+		memcpy(&word, buf + i, sizeof(word));
+		/* make them look printable, e.g. 0x09 | 0x20 is ')' */
+		allowed = bytes_equal(word, '\t');
+		if (eols)
+			allowed |= bytes_equal(word, '\n') | bytes_equal(word, '\r');
+		word |= allowed >> 2;
+		if (has_byte_below(word, ' ') || has_byte_above(word, 126))
+			return 0;
+	}
+	for (; i < size; i++) {
+		unsigned char c = buf[i];
+		if (c == '\t' || (eols && (c == '\n' || c == '\r')))
+			continue;
+		if (c < ' ' || 126 < c)
+			return 0;
+	}
+	return 1;
+}
+
+/* How many blanks there are at the end, not counting CRs among them */
+static unsigned trailing_blanks(const char *buf, unsigned long size)
+{
+	unsigned blanks = 0;
+
+	while (size--) {
+		if (buf[size] == ' ' || buf[size] == '\t')
+			blanks++;
+		else if (buf[size] != '\r')
+			break;
+	}
+	return blanks;
+}
+
+/*
+ * The stats of a buffer is_plain_text() with "eols" is true for.  The
+ * blanks at the end of a line add to trailing_space, except for those
+ * of a line with nothing but blanks, CRs and all, so it is the sum of
+ * what trailing_blanks() gives for each line.
+ */
+static void gather_plain_stats(const char *buf, unsigned long size,
+			       struct text_stat *stats)
+{
+	const char *p = buf, *end = buf + size, *nl;
+
+	while ((nl = memchr(p, '\n', end - p)) != NULL) {
+		stats->lf++;
+		if (p < nl && nl[-1] == '\r')
+			stats->crlf++;
+		stats->trailing_space += trailing_blanks(p, nl - p);
+		p = nl + 1;
+	}
+	stats->trailing_space += trailing_blanks(p, end - p);
+	for (p = buf; (p = memchr(p, '\r', end - p)) != NULL; p++)
+		stats->cr++;
+	stats->printable = size - stats->lf - stats->cr;
+}
+
 static void gather_stats(const char *buf, unsigned long size, struct text_stat *stats)
 {
-	unsigned long i;
+	const char *p = buf, *end = buf + size;
 	unsigned last_trailing_space = 0;
 
 	memset(stats, 0, sizeof(*stats));
 
-	for (i = 0; i < size; i++) {
-		unsigned char c = buf[i];
-		if (c == '\r') {
-			stats->cr++;
-			if (i+1 < size && buf[i+1] == '\n')
-				stats->crlf++;
-			continue;
-		}
-		if (c == '\n') {
-			last_trailing_space = stats->trailing_space;
-			stats->lf++;
-			continue;
-		}
-		if (c == 127)
-			/* DEL */
-			stats->nonprintable++;
-		else if (c <= 32) {
-			switch (c) {
-			case '\t': case ' ':
-				stats->trailing_space++;
-				/* fall through */
-				/* BS, ESC and FF */
-			case '\b': case '\033': case '\014':
-				stats->printable++;
-				break;
-			case 0:
-				stats->nul++;
-				/* fall through */
-			default:
-				stats->nonprintable++;
-			}
+	if (is_plain_text(buf, size, 1)) {
+		gather_plain_stats(buf, size, stats);
+		return;
+	}
+
+	while (p < end) {
+		const char *nl = memchr(p, '\n', end - p);
+		const char *eol = nl ? nl : end;
+		int cr = nl && p < eol && eol[-1] == '\r';
+		unsigned long len = eol - p - cr;
+
+		if (is_plain_text(p, len, 0)) {
+			unsigned blanks = trailing_blanks(p, len);
+
+			stats->printable += len;
+			if (blanks == len)
+				stats->trailing_space += blanks;
+			else
+				stats->trailing_space = last_trailing_space + blanks;
+			stats->cr += cr;
+			stats->crlf += cr;
 		} else {
-			stats->trailing_space = last_trailing_space;
-			stats->printable++;
+			unsigned long i;
+			for (i = p - buf; i < eol - buf; i++)
+				gather_one(buf, size, i, stats, &last_trailing_space);
 		}
+
+		if (!nl)
+			break;
+		last_trailing_space = stats->trailing_space;
+		stats->lf++;
+		p = nl + 1;
 	}
 
 	/* If file ends with EOF then don't count this EOF as non-printable. */
@@ -81,6 +208,23 @@ static void gather_stats(const char *buf, unsigned long size, struct text_stat *
 		stats->nonprintable--;
 }
 
+/*
+ * Count only the LFs, and the CRLFs among them, as that is all
+ * crlf_to_worktree() needs to know when it does not guess.
+ */
+static void count_eols(const char *buf, unsigned long size, struct text_stat *stats)
+{
+	const char *nl, *p = buf, *end = buf + size;
+
+	memset(stats, 0, sizeof(*stats));
+	while ((nl = memchr(p, '\n', end - p)) != NULL) {
+		stats->lf++;
+		if (nl > buf && nl[-1] == '\r')
+			stats->crlf++;
+		p = nl + 1;
+	}
+}
+
 /*
  * The same heuristics as diff.c::mmfile_is_binary()
  */
@@ -260,12 +404,20 @@ static int crlf_to_git(const char *path, const char *src, size_t len,
 		strbuf_grow(buf, len - buf->len);
 	dst = buf->buf;
 	if (stats.cr == stats.crlf && !stats.trailing_space) {
-		/* Optimised version for the common case. */
-		do {
-			unsigned char c = *src++;
-			if (c != '\r')
-				*dst++ = c;
-		} while (--len);
+		/*
+		 * Optimised version for the common case: every CR is
+		 * followed by an LF, and is dropped.
+		 */
+		const char *end = src + len;
+
+		while (src < end) {
+			const char *cr = memchr(src, '\r', end - src);
+			size_t n = (cr ? cr : end) - src;
+
+			memmove(dst, src, n);
+			dst += n;
+			src += n + !!cr;
+		}
 	} else {
 		do {
 			unsigned char c = *src++;
@@ -295,7 +447,10 @@ static int crlf_to_worktree(const char *path, const char *src, size_t len,
 	if (!len || output_eol(crlf_action) != EOL_CRLF)
 		return 0;
 
-	gather_stats(src, len, &stats);
+	if (crlf_action == CRLF_AUTO || crlf_action == CRLF_GUESS)
+		gather_stats(src, len, &stats);
+	else
+		count_eols(src, len, &stats);
 
 	/* No LF? Nothing to convert, regardless. */
 	if (!stats.lf)
@@ -407,8 +562,9 @@ static int filter_buffer(int in, int out, void *data)
 	return (write_err || status);
 }
 
-static int apply_filter(const char *path, const char *src, size_t len,
-                        struct strbuf *dst, const char *cmd)
+static int apply_single_file_filter(const char *path, const char *src,
+				    size_t len, struct strbuf *dst,
+				    const char *cmd)
 {
 	/*
 	 * Create a pipeline to have the command filter the buffer's
@@ -421,12 +577,6 @@ static int apply_filter(const char *path, const char *src, size_t len,
 	struct async async;
 	struct filter_params params;
 
-	if (!cmd)
-		return 0;
-
-	if (!dst)
-		return 1;
-
 	memset(&async, 0, sizeof(async));
 	async.proc = filter_buffer;
 	async.data = &params;
@@ -460,14 +610,235 @@ static int apply_filter(const char *path, const char *src, size_t len,
 	return ret;
 }
 
+/*
+ * A filter driver with "filter.<driver>.process" is started once, and
+ * converts all the files the git command asks it to in turn, until git
+ * exits; see "Long Running Filter Process" in gitattributes(5) for the
+ * protocol.  A filter that breaks it is stopped, and started again for
+ * the next file.
+ */
+#define CAP_CLEAN    (1u<<0)
+#define CAP_SMUDGE   (1u<<1)
+
+static struct filter_process {
+	struct filter_process *next;
+	const char *cmd;
+	unsigned int supported;		/* CAP_* it agreed to */
+	struct child_process process;
+	const char *argv[2];
+} *filter_processes;
+
+static char filter_line[LARGE_PACKET_MAX];
+
+/* Read a text packet, without its LF; 0 is a flush packet */
+static int read_filter_line(struct filter_process *fp)
+{
+	int len = packet_read_gently(fp->process.out, filter_line,
+				     sizeof(filter_line));
+
+	if (len > 0 && filter_line[len - 1] == '\n')
+		filter_line[--len] = '\0';
+	return len;
+}
+
+/* Read a list of "key=value" up to a flush packet, noting the status */
+static int read_filter_status(struct filter_process *fp, struct strbuf *status)
+{
+	int len;
+
+	while ((len = read_filter_line(fp)) > 0)
+		if (!prefixcmp(filter_line, "status=")) {
+			strbuf_reset(status);
+			strbuf_addstr(status, filter_line + strlen("status="));
+		}
+	return len;
+}
+
+static void stop_filter_process(struct filter_process *fp)
+{
+	struct filter_process **p;
+
+	for (p = &filter_processes; *p; p = &(*p)->next)
+		if (*p == fp) {
+			*p = fp->next;
+			break;
+		}
+	close(fp->process.in);
+	close(fp->process.out);
+	finish_command(&fp->process);
+	free(fp);
+}
+
+static void stop_filter_processes(void)
+{
+	while (filter_processes)
+		stop_filter_process(filter_processes);
+}
+
+static int filter_handshake(struct filter_process *fp)
+{
+	static const struct {
+		const char *name;
+		unsigned int cap;
+	} caps[] = {
+		{ "clean", CAP_CLEAN },
+		{ "smudge", CAP_SMUDGE },
+	};
+	int fd = fp->process.in, i, len;
+
+	if (packet_write_gently(fd, "git-filter-client\n") ||
+	    packet_write_gently(fd, "version=2\n") ||
+	    packet_flush_gently(fd))
+		return -1;
+
+	if (read_filter_line(fp) <= 0 || strcmp(filter_line, "git-filter-server"))
+		return error("unexpected line '%s', expected git-filter-server",
+			     filter_line);
+	len = read_filter_line(fp);
+	if (len <= 0 || strcmp(filter_line, "version=2"))
+		return error("unexpected line '%s', expected version=2",
+			     filter_line);
+	while ((len = read_filter_line(fp)) > 0)
+		; /* nothing else is known about the server */
+	if (len < 0)
+		return -1;
+
+	for (i = 0; i < ARRAY_SIZE(caps); i++)
+		if (packet_write_gently(fd, "capability=%s\n", caps[i].name))
+			return -1;
+	if (packet_flush_gently(fd))
+		return -1;
+	while ((len = read_filter_line(fp)) > 0) {
+		if (prefixcmp(filter_line, "capability="))
+			continue;
+		for (i = 0; i < ARRAY_SIZE(caps); i++)
+			if (!strcmp(filter_line + strlen("capability="),
+				    caps[i].name))
+				fp->supported |= caps[i].cap;
+	}
+	return len;
+}
+
+static struct filter_process *start_filter_process(const char *cmd)
+{
+	static int stop_registered;
+	struct filter_process *fp;
+	int err;
+
+	for (fp = filter_processes; fp; fp = fp->next)
+		if (!strcmp(fp->cmd, cmd))
+			return fp;
+
+	fp = xcalloc(1, sizeof(*fp));
+	fp->cmd = cmd;
+	fp->argv[0] = cmd;
+	fp->process.argv = fp->argv;
+	fp->process.use_shell = 1;
+	fp->process.in = -1;
+	fp->process.out = -1;
+	fp->process.clean_on_exit = 1;
+
+	fflush(NULL);
+	if (start_command(&fp->process)) {
+		error("cannot fork to run external filter '%s'", cmd);
+		free(fp);
+		return NULL;
+	}
+	fp->next = filter_processes;
+	filter_processes = fp;
+	if (!stop_registered) {
+		atexit(stop_filter_processes);
+		stop_registered = 1;
+	}
+
+	sigchain_push(SIGPIPE, SIG_IGN);
+	err = filter_handshake(fp);
+	sigchain_pop(SIGPIPE);
+	if (err) {
+		error("initialization for external filter '%s' failed", cmd);
+		stop_filter_process(fp);
+		return NULL;
+	}
+	return fp;
+}
+
+static int apply_multi_file_filter(const char *path, const char *src, size_t len,
+				   struct strbuf *dst, const char *cmd,
+				   unsigned int wanted_capability)
+{
+	struct filter_process *fp;
+	struct strbuf nbuf = STRBUF_INIT;
+	struct strbuf status = STRBUF_INIT;
+	int fd, err, ret = 0;
+
+	fp = start_filter_process(cmd);
+	if (!fp)
+		return 0;	/* error was already reported */
+	if (!(fp->supported & wanted_capability))
+		return 0;
+	fd = fp->process.in;
+
+	sigchain_push(SIGPIPE, SIG_IGN);
+	err = packet_write_gently(fd, "command=%s\n",
+			wanted_capability == CAP_CLEAN ? "clean" : "smudge") ||
+		packet_write_gently(fd, "pathname=%s\n", path) ||
+		packet_flush_gently(fd) ||
+		write_packetized_from_buf(src, len, fd) ||
+		read_filter_status(fp, &status);
+	if (!err && !strcmp(status.buf, "success"))
+		err = read_packetized_to_strbuf(fp->process.out, &nbuf) < 0 ||
+			read_filter_status(fp, &status);
+	sigchain_pop(SIGPIPE);
+
+	if (err) {
+		error("external filter '%s' failed", cmd);
+		stop_filter_process(fp);
+	} else if (!strcmp(status.buf, "success")) {
+		strbuf_swap(dst, &nbuf);
+		ret = 1;
+	} else if (!strcmp(status.buf, "abort")) {
+		/* it will not do that for anybody else either */
+		fp->supported &= ~wanted_capability;
+	} else if (!status.len) {
+		error("external filter '%s' sent no status for '%s'",
+		      cmd, path);
+	}
+	strbuf_release(&nbuf);
+	strbuf_release(&status);
+	return ret;
+}
+
 static struct convert_driver {
 	const char *name;
 	struct convert_driver *next;
 	const char *smudge;
 	const char *clean;
+	const char *process;
 	int required;
 } *user_convert, **user_convert_tail;
 
+static int apply_filter(const char *path, const char *src, size_t len,
+			struct strbuf *dst, struct convert_driver *drv,
+			unsigned int wanted_capability)
+{
+	const char *cmd = NULL;
+
+	if (!drv)
+		return 0;
+	if (!drv->process)
+		cmd = wanted_capability == CAP_CLEAN ? drv->clean : drv->smudge;
+	if (!cmd && !drv->process)
+		return 0;
+
+	if (!dst)
+		return 1;
+
+	if (cmd)
+		return apply_single_file_filter(path, src, len, dst, cmd);
+	return apply_multi_file_filter(path, src, len, dst, drv->process,
+				       wanted_capability);
+}
+
 static int read_convert_config(const char *var, const char *value, void *cb)
 {
 	const char *ep, *name;
@@ -495,8 +866,8 @@ static int read_convert_config(const char *var, const char *value, void *cb)
 	ep++;
 
 	/*
-	 * filter.<name>.smudge and filter.<name>.clean specifies
-	 * the command line:
+	 * filter.<name>.smudge, filter.<name>.clean and filter.<name>.process
+	 * specify the command line:
 	 *
 	 *	command-line
 	 *
@@ -509,6 +880,9 @@ static int read_convert_config(const char *var, const char *value, void *cb)
 	if (!strcmp("clean", ep))
 		return git_config_string(&drv->clean, var, value);
 
+	if (!strcmp("process", ep))
+		return git_config_string(&drv->process, var, value);
+
 	if (!strcmp("required", ep)) {
 		drv->required = git_config_bool(var, value);
 		return 0;
@@ -748,19 +1122,12 @@ static enum crlf_action input_crlf_action(enum crlf_action text_attr, enum eol e
 	return text_attr;
 }
 
-struct conv_attrs {
-	struct convert_driver *drv;
-	enum crlf_action crlf_action;
-	enum eol eol_attr;
-	int ident;
-};
-
 static const char *conv_attr_name[] = {
 	"crlf", "ident", "filter", "eol", "text",
 };
 #define NUM_CONV_ATTRS ARRAY_SIZE(conv_attr_name)
 
-static void convert_attrs(struct conv_attrs *ca, const char *path)
+void convert_attrs(struct conv_attrs *ca, const char *path)
 {
 	int i;
 	static struct git_attr_check ccheck[NUM_CONV_ATTRS];
@@ -791,17 +1158,14 @@ int convert_to_git(const char *path, const char *src, size_t len,
                    struct strbuf *dst, enum safe_crlf checksafe)
 {
 	int ret = 0;
-	const char *filter = NULL;
 	int required = 0;
 	struct conv_attrs ca;
 
 	convert_attrs(&ca, path);
-	if (ca.drv) {
-		filter = ca.drv->clean;
+	if (ca.drv)
 		required = ca.drv->required;
-	}
 
-	ret |= apply_filter(path, src, len, dst, filter);
+	ret |= apply_filter(path, src, len, dst, ca.drv, CAP_CLEAN);
 	if (!ret && required)
 		die("%s: clean filter '%s' failed", path, ca.drv->name);
 
@@ -818,22 +1182,22 @@ int convert_to_git(const char *path, const char *src, size_t len,
 	return ret | ident_to_git(path, src, len, dst, ca.ident);
 }
 
-static int convert_to_working_tree_internal(const char *path, const char *src,
+static int convert_to_working_tree_internal(const struct conv_attrs *ca,
+					    const char *path, const char *src,
 					    size_t len, struct strbuf *dst,
 					    int normalizing)
 {
 	int ret = 0, ret_filter = 0;
-	const char *filter = NULL;
+	int filter = 0;
 	int required = 0;
-	struct conv_attrs ca;
+	enum crlf_action crlf_action;
 
-	convert_attrs(&ca, path);
-	if (ca.drv) {
-		filter = ca.drv->smudge;
-		required = ca.drv->required;
+	if (ca->drv) {
+		filter = ca->drv->smudge || ca->drv->process;
+		required = ca->drv->required;
 	}
 
-	ret |= ident_to_worktree(path, src, len, dst, ca.ident);
+	ret |= ident_to_worktree(path, src, len, dst, ca->ident);
 	if (ret) {
 		src = dst->buf;
 		len = dst->len;
@@ -843,29 +1207,42 @@ static int convert_to_working_tree_internal(const char *path, const char *src,
 	 * is a smudge filter.  The filter might expect CRLFs.
 	 */
 	if (filter || !normalizing) {
-		ca.crlf_action = input_crlf_action(ca.crlf_action, ca.eol_attr);
-		ret |= crlf_to_worktree(path, src, len, dst, ca.crlf_action);
+		crlf_action = input_crlf_action(ca->crlf_action, ca->eol_attr);
+		ret |= crlf_to_worktree(path, src, len, dst, crlf_action);
 		if (ret) {
 			src = dst->buf;
 			len = dst->len;
 		}
 	}
 
-	ret_filter = apply_filter(path, src, len, dst, filter);
+	ret_filter = apply_filter(path, src, len, dst, ca->drv, CAP_SMUDGE);
 	if (!ret_filter && required)
-		die("%s: smudge filter %s failed", path, ca.drv->name);
+		die("%s: smudge filter %s failed", path, ca->drv->name);
 
 	return ret | ret_filter;
 }
 
 int convert_to_working_tree(const char *path, const char *src, size_t len, struct strbuf *dst)
 {
-	return convert_to_working_tree_internal(path, src, len, dst, 0);
+	struct conv_attrs ca;
+
+	convert_attrs(&ca, path);
+	return convert_to_working_tree_internal(&ca, path, src, len, dst, 0);
+}
+
+int convert_to_working_tree_ca(const struct conv_attrs *ca, const char *path,
+			       const char *src, size_t len, struct strbuf *dst)
+{
+	return convert_to_working_tree_internal(ca, path, src, len, dst, 0);
 }
 
 int renormalize_buffer(const char *path, const char *src, size_t len, struct strbuf *dst)
 {
-	int ret = convert_to_working_tree_internal(path, src, len, dst, 1);
+	struct conv_attrs ca;
+	int ret;
+
+	convert_attrs(&ca, path);
+	ret = convert_to_working_tree_internal(&ca, path, src, len, dst, 1);
 	if (ret) {
 		src = dst->buf;
 		len = dst->len;
@@ -1305,7 +1682,7 @@ struct stream_filter *get_stream_filter(const char *path, const unsigned char *s
 
 	convert_attrs(&ca, path);
 
-	if (ca.drv && (ca.drv->smudge || ca.drv->clean))
+	if (ca.drv && (ca.drv->process || ca.drv->smudge || ca.drv->clean))
 		return filter;
 
 	if (ca.ident)
@@ -33,11 +33,41 @@ enum eol {
 
 extern enum eol core_eol;
 
+enum crlf_action {
+	CRLF_GUESS = -1,
+	CRLF_BINARY = 0,
+	CRLF_TEXT,
+	CRLF_INPUT,
+	CRLF_CRLF,
+	CRLF_AUTO
+};
+
+struct convert_driver;
+
+/* How a path is converted, from its attributes */
+struct conv_attrs {
+	struct convert_driver *drv;
+	enum crlf_action crlf_action;
+	enum eol eol_attr;
+	int ident;
+};
+
+extern void convert_attrs(struct conv_attrs *ca, const char *path);
+
 /* returns 1 if *dst was used */
 extern int convert_to_git(const char *path, const char *src, size_t len,
 			  struct strbuf *dst, enum safe_crlf checksafe);
 extern int convert_to_working_tree(const char *path, const char *src,
 				   size_t len, struct strbuf *dst);
+/*
+ * Like convert_to_working_tree(), with the attributes looked up by an
+ * earlier convert_attrs().  Attribute lookups may only be done by one
+ * thread, but without a filter driver or "ident", the conversion itself
+ * can be run by any thread.
+ */
+extern int convert_to_working_tree_ca(const struct conv_attrs *ca,
+				      const char *path, const char *src,
+				      size_t len, struct strbuf *dst);
 extern int renormalize_buffer(const char *path, const char *src, size_t len,
 			      struct strbuf *dst);
 static inline int would_convert_to_git(const char *path, const char *src,
@@ -10,8 +10,17 @@
 #include "cache.h"
 #include "progress.h"
 #include "csum-file.h"
+#include "thread-utils.h"
 
-static void flush(struct sha1file *f, void *buf, unsigned int count)
+/*
+ * Check and write out "count" bytes.  This is the part of flushing
+ * that can be handed to the background thread; the caller takes care
+ * of updating f->total and the throughput display.
+ *
+ * A gentle sha1file does not die when the write fails, but remembers
+ * the error for sha1close() to return, and writes nothing after it.
+ */
+static void write_out(struct sha1file *f, void *buf, unsigned int count)
 {
 	if (0 <= f->check_fd && count)  {
 		unsigned char check_buffer[8192];
@@ -25,27 +34,236 @@ static void flush(struct sha1file *f, void *buf, unsigned int count)
 			die("sha1 file '%s' validation error", f->name);
 	}
 
+	if (f->write_errno)
+		return;
 	for (;;) {
 		int ret = xwrite(f->fd, buf, count);
 		if (ret > 0) {
-			f->total += ret;
-			display_throughput(f->tp, f->total);
 			buf = (char *) buf + ret;
 			count -= ret;
 			if (count)
 				continue;
 			return;
 		}
+		if (f->gentle) {
+			f->write_errno = ret ? errno : ENOSPC;
+			return;
+		}
 		if (!ret)
 			die("sha1 file '%s' write error. Out of diskspace", f->name);
 		die_errno("sha1 file '%s' write error", f->name);
 	}
 }
 
+static void flush(struct sha1file *f, void *buf, unsigned int count)
+{
+	write_out(f, buf, count);
+	f->total += count;
+	display_throughput(f->tp, f->total);
+}
+
+#ifndef NO_PTHREADS
+
+/*
+ * In background mode, sha1write() copies the data into one of a few
+ * large slots and hands full slots to a thread that hashes and writes
+ * them, so that producing the data, hashing it and write(2) overlap.
+ * The thread is only started once the first slot fills up; smaller
+ * files are hashed and written inline when they are closed.
+ */
+#define BG_SLOTS 4
+#define BG_SLOT_SIZE (128 * 1024)
+
+struct sha1file_bg {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int started;
+	int done;
+
+	unsigned char *slot[BG_SLOTS];
+	unsigned int len[BG_SLOTS];
+	unsigned int head;	/* oldest queued slot */
+	unsigned int nr;	/* number of queued slots */
+	unsigned int cur;	/* slot being filled by sha1write() */
+	unsigned int fill;	/* bytes in the current slot */
+};
+
+static void *bg_thread(void *data)
+{
+	struct sha1file *f = data;
+	struct sha1file_bg *bg = f->bg;
+
+	pthread_mutex_lock(&bg->mutex);
+	for (;;) {
+		unsigned int i;
+
+		while (!bg->nr && !bg->done)
+			pthread_cond_wait(&bg->cond, &bg->mutex);
+		if (!bg->nr)
+			break;
+		i = bg->head;
+		pthread_mutex_unlock(&bg->mutex);
+
+		git_SHA1_Update(&f->ctx, bg->slot[i], bg->len[i]);
+		write_out(f, bg->slot[i], bg->len[i]);
+
+		pthread_mutex_lock(&bg->mutex);
+		bg->head = (i + 1) % BG_SLOTS;
+		bg->nr--;
+		pthread_cond_broadcast(&bg->cond);
+	}
+	pthread_mutex_unlock(&bg->mutex);
+	return NULL;
+}
+
+/* Queue the current slot and wait until another one is free */
+static void bg_queue(struct sha1file *f)
+{
+	struct sha1file_bg *bg = f->bg;
+	unsigned int count = bg->fill;
+
+	if (!count)
+		return;
+	if (!bg->started) {
+		int err = pthread_create(&bg->thread, NULL, bg_thread, f);
+		if (err)
+			die("unable to start hashing thread: %s", strerror(err));
+		bg->started = 1;
+	}
+	pthread_mutex_lock(&bg->mutex);
+	bg->len[bg->cur] = count;
+	bg->nr++;
+	pthread_cond_broadcast(&bg->cond);
+	while (bg->nr == BG_SLOTS)
+		pthread_cond_wait(&bg->cond, &bg->mutex);
+	bg->cur = (bg->head + bg->nr) % BG_SLOTS;
+	pthread_mutex_unlock(&bg->mutex);
+	bg->fill = 0;
+
+	f->total += count;
+	display_throughput(f->tp, f->total);
+}
+
+/* Wait until everything queued so far has been hashed and written */
+static void bg_drain(struct sha1file *f)
+{
+	struct sha1file_bg *bg = f->bg;
+
+	if (!bg->started)
+		return;
+	pthread_mutex_lock(&bg->mutex);
+	while (bg->nr)
+		pthread_cond_wait(&bg->cond, &bg->mutex);
+	pthread_mutex_unlock(&bg->mutex);
+}
+
+static void bg_flush(struct sha1file *f)
+{
+	struct sha1file_bg *bg = f->bg;
+
+	if (!bg->started) {
+		unsigned char *buf = bg->slot[bg->cur];
+		if (bg->fill) {
+			git_SHA1_Update(&f->ctx, buf, bg->fill);
+			flush(f, buf, bg->fill);
+			bg->fill = 0;
+		}
+		return;
+	}
+	bg_queue(f);
+	bg_drain(f);
+}
+
+/* Forget the slot being filled, for sha1file_truncate() */
+static void bg_discard(struct sha1file *f)
+{
+	bg_drain(f);
+	f->bg->fill = 0;
+}
+
+static void bg_write(struct sha1file *f, void *buf, unsigned int count)
+{
+	struct sha1file_bg *bg = f->bg;
+
+	while (count) {
+		unsigned left = BG_SLOT_SIZE - bg->fill;
+		unsigned nr = count > left ? left : count;
+
+		if (f->do_crc)
+			f->crc32 = crc32(f->crc32, buf, nr);
+		memcpy(bg->slot[bg->cur] + bg->fill, buf, nr);
+		bg->fill += nr;
+		count -= nr;
+		buf = (char *) buf + nr;
+		if (bg->fill == BG_SLOT_SIZE)
+			bg_queue(f);
+	}
+}
+
+static void bg_finish(struct sha1file *f)
+{
+	struct sha1file_bg *bg = f->bg;
+	int i;
+
+	bg_flush(f);
+	if (bg->started) {
+		pthread_mutex_lock(&bg->mutex);
+		bg->done = 1;
+		pthread_cond_broadcast(&bg->cond);
+		pthread_mutex_unlock(&bg->mutex);
+		pthread_join(bg->thread, NULL);
+	}
+	pthread_mutex_destroy(&bg->mutex);
+	pthread_cond_destroy(&bg->cond);
+	for (i = 0; i < BG_SLOTS; i++)
+		free(bg->slot[i]);
+	free(bg);
+	f->bg = NULL;
+}
+
+void sha1file_background(struct sha1file *f)
+{
+	struct sha1file_bg *bg;
+	int i;
+
+	if (f->bg || f->offset)
+		return;
+	if (core_hash_thread < 0)
+		core_hash_thread = online_cpus() > 1;
+	if (!core_hash_thread)
+		return;
+
+	bg = xcalloc(1, sizeof(*bg));
+	pthread_mutex_init(&bg->mutex, NULL);
+	pthread_cond_init(&bg->cond, NULL);
+	for (i = 0; i < BG_SLOTS; i++)
+		bg->slot[i] = xmalloc(BG_SLOT_SIZE);
+	f->bg = bg;
+}
+
+#else
+
+#define bg_flush(f)		(void)0
+#define bg_discard(f)		(void)0
+#define bg_write(f, buf, count)	(void)0
+#define bg_finish(f)		(void)0
+
+void sha1file_background(struct sha1file *f)
+{
+}
+
+#endif
+
 void sha1flush(struct sha1file *f)
 {
 	unsigned offset = f->offset;
 
+	if (f->bg) {
+		bg_flush(f);
+		return;
+	}
+
 	if (offset) {
 		git_SHA1_Update(&f->ctx, f->buffer, offset);
 		flush(f, f->buffer, offset);
@@ -55,22 +273,31 @@ void sha1flush(struct sha1file *f)
 
 int sha1close(struct sha1file *f, unsigned char *result, unsigned int flags)
 {
-	int fd;
+	int fd, err;
 
+	if (f->bg)
+		bg_finish(f);
 	sha1flush(f);
 	git_SHA1_Final(f->buffer, &f->ctx);
 	if (result)
 		hashcpy(result, f->buffer);
-	if (flags & (CSUM_CLOSE | CSUM_FSYNC)) {
-		/* write checksum and close fd */
+	if (flags & (CSUM_CLOSE | CSUM_FSYNC | CSUM_HASH_IN_STREAM))
 		flush(f, f->buffer, 20);
+	if (flags & (CSUM_CLOSE | CSUM_FSYNC)) {
 		if (flags & CSUM_FSYNC)
 			fsync_or_die(f->fd, f->name);
-		if (close(f->fd))
-			die_errno("%s: sha1 file error on close", f->name);
+		if (close(f->fd)) {
+			if (!f->gentle)
+				die_errno("%s: sha1 file error on close", f->name);
+			if (!f->write_errno)
+				f->write_errno = errno;
+		}
 		fd = 0;
 	} else
 		fd = f->fd;
+	err = f->write_errno;
+	if (err)
+		fd = -1;
 	if (0 <= f->check_fd) {
 		char discard;
 		int cnt = read_in_full(f->check_fd, &discard, 1);
@@ -83,11 +310,17 @@ int sha1close(struct sha1file *f, unsigned char *result, unsigned int flags)
 			die_errno("%s: sha1 file error on close", f->name);
 	}
 	free(f);
+	if (fd < 0)
+		errno = err;
 	return fd;
 }
 
 int sha1write(struct sha1file *f, void *buf, unsigned int count)
 {
+	if (f->bg) {
+		bg_write(f, buf, count);
+		return 0;
+	}
 	while (count) {
 		unsigned offset = f->offset;
 		unsigned left = sizeof(f->buffer) - offset;
@@ -124,6 +357,13 @@ struct sha1file *sha1fd(int fd, const char *name)
 	return sha1fd_throughput(fd, name, NULL);
 }
 
+struct sha1file *sha1fd_gently(int fd, const char *name)
+{
+	struct sha1file *f = sha1fd(fd, name);
+	f->gentle = 1;
+	return f;
+}
+
 struct sha1file *sha1fd_check(const char *name)
 {
 	int sink, check;
@@ -154,6 +394,9 @@ struct sha1file *sha1fd_throughput(int fd, const char *name, struct progress *tp
 	f->tp = tp;
 	f->name = name;
 	f->do_crc = 0;
+	f->gentle = 0;
+	f->write_errno = 0;
+	f->bg = NULL;
 	git_SHA1_Init(&f->ctx);
 	return f;
 }
@@ -169,6 +412,8 @@ int sha1file_truncate(struct sha1file *f, struct sha1file_checkpoint *checkpoint
 {
 	off_t offset = checkpoint->offset;
 
+	if (f->bg)
+		bg_discard(f);
 	if (ftruncate(f->fd, offset) ||
 	    lseek(f->fd, offset, SEEK_SET) != offset)
 		return -1;
@@ -2,6 +2,7 @@
 #define CSUM_FILE_H
 
 struct progress;
+struct sha1file_bg;
 
 /* A SHA1-protected file */
 struct sha1file {
@@ -14,6 +15,9 @@ struct sha1file {
 	const char *name;
 	int do_crc;
 	uint32_t crc32;
+	int gentle;
+	int write_errno;	/* with gentle, the first write error */
+	struct sha1file_bg *bg;
 	unsigned char buffer[8192];
 };
 
@@ -29,13 +33,17 @@ extern int sha1file_truncate(struct sha1file *, struct sha1file_checkpoint *);
 /* sha1close flags */
 #define CSUM_CLOSE	1
 #define CSUM_FSYNC	2
+#define CSUM_HASH_IN_STREAM	4
 
 extern struct sha1file *sha1fd(int fd, const char *name);
 extern struct sha1file *sha1fd_check(const char *name);
 extern struct sha1file *sha1fd_throughput(int fd, const char *name, struct progress *tp);
+/* sha1close() returns -1 with errno set on write errors, instead of dying */
+extern struct sha1file *sha1fd_gently(int fd, const char *name);
 extern int sha1close(struct sha1file *, unsigned char *, unsigned int);
 extern int sha1write(struct sha1file *, void *, unsigned int);
 extern void sha1flush(struct sha1file *f);
+extern void sha1file_background(struct sha1file *f);
 extern void crc32_begin(struct sha1file *);
 extern uint32_t crc32_end(struct sha1file *);
 
@@ -14,6 +14,10 @@
 #include "git-compat-util.h"
 #include "delta.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /* maximum hash entry list for the same hash bucket */
 #define HASH_LIMIT 64
 
@@ -112,6 +116,74 @@ static const unsigned int U[256] = {
 	0x133eb0ac, 0x6d8b90a1, 0x450d4467, 0x3bb8646a
 };
 
+/*
+ * Count how many bytes at the start of a and b are equal, looking at no
+ * more than size bytes.  This is where create_delta() spends its time
+ * once a hash hit is found, so compare a vector or a word at a time
+ * and only fall back to single bytes to locate the first difference.
+ */
+static inline unsigned int match_forward(const unsigned char *a,
+					 const unsigned char *b,
+					 unsigned int size)
+{
+	unsigned int n = 0;
+
+#ifdef __SSE2__
+	while (size - n >= 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + n));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + n));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xffff)
+			break;
+		n += 16;
+	}
+#else
+	while (size - n >= sizeof(unsigned long)) {
+		unsigned long x, y;
+		memcpy(&x, a + n, sizeof(x));
+		memcpy(&y, b + n, sizeof(y));
+		if (x != y)
+			break;
+		n += sizeof(unsigned long);
+	}
+#endif
+	while (n < size && a[n] == b[n])
+		n++;
+	return n;
+}
+
+/*
+ * Same as match_forward(), but count the equal bytes just before a and
+ * b, walking towards lower addresses.
+ */
+static inline unsigned int match_backward(const unsigned char *a,
+					  const unsigned char *b,
+					  unsigned int size)
+{
+	unsigned int n = 0;
+
+#ifdef __SSE2__
+	while (size - n >= 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a - n - 16));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b - n - 16));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xffff)
+			break;
+		n += 16;
+	}
+#else
+	while (size - n >= sizeof(unsigned long)) {
+		unsigned long x, y;
+		memcpy(&x, a - n - sizeof(x), sizeof(x));
+		memcpy(&y, b - n - sizeof(y), sizeof(y));
+		if (x != y)
+			break;
+		n += sizeof(unsigned long);
+	}
+#endif
+	while (n < size && *(a - n - 1) == *(b - n - 1))
+		n++;
+	return n;
+}
+
 struct index_entry {
 	const unsigned char *ptr;
 	unsigned int val;
@@ -382,8 +454,7 @@ create_delta(const struct delta_index *index,
 					ref_size = top - src;
 				if (ref_size <= msize)
 					break;
-				while (ref_size-- && *src++ == *ref)
-					ref++;
+				ref += match_forward(src, ref, ref_size);
 				if (msize < ref - entry->ptr) {
 					/* this is our best match so far */
 					msize = ref - entry->ptr;
@@ -409,17 +480,17 @@ create_delta(const struct delta_index *index,
 			unsigned char *op;
 
 			if (inscnt) {
-				while (moff && ref_data[moff-1] == data[-1]) {
-					/* we can match one byte back */
-					msize++;
-					moff--;
-					data--;
-					outpos--;
-					if (--inscnt)
-						continue;
+				/* see how many of the inserted bytes match too */
+				unsigned int back = moff < inscnt ? moff : inscnt;
+				back = match_backward(ref_data + moff, data, back);
+				msize += back;
+				moff -= back;
+				data -= back;
+				outpos -= back;
+				inscnt -= back;
+				if (!inscnt) {
 					outpos--;  /* remove count slot */
 					inscnt--;  /* make it -1 */
-					break;
 				}
 				out[outpos - inscnt - 1] = inscnt;
 				inscnt = 0;
@@ -196,6 +196,10 @@ int run_diff_files(struct rev_info *revs, unsigned int option)
 		if (ce_uptodate(ce) || ce_skip_worktree(ce))
 			continue;
 
+		/* The file system monitor saw no change to it */
+		if (ce->ce_flags & CE_FSMONITOR_VALID)
+			continue;
+
 		/* If CE_VALID is set, don't look at workdir for file removal */
 		changed = (ce->ce_flags & CE_VALID) ? 0 : check_removed(ce, &st);
 		if (changed) {
@@ -15,6 +15,7 @@
 #include "sigchain.h"
 #include "submodule.h"
 #include "ll-merge.h"
+#include "sha1-array.h"
 
 #ifdef NO_FAST_WORKING_DIRECTORY
 #define FAST_WORKING_DIRECTORY 0
@@ -2727,6 +2728,94 @@ int diff_populate_filespec(struct diff_filespec *s, int size_only)
 	return 0;
 }
 
+struct populate_batch {
+	struct diff_filespec **specs;
+	int nr;
+	int nr_read;
+	unsigned long left;
+};
+
+static int populate_batch_cmp(const void *a_, const void *b_)
+{
+	const struct diff_filespec *a = *(const struct diff_filespec **)a_;
+	const struct diff_filespec *b = *(const struct diff_filespec **)b_;
+	return hashcmp(a->sha1, b->sha1);
+}
+
+static int populate_batch_one(const unsigned char *sha1,
+			      enum object_type type, unsigned long size,
+			      void *buf, void *cb_data)
+{
+	struct populate_batch *pb = cb_data;
+	struct diff_filespec *s = NULL;
+	int lo = 0, hi = pb->nr;
+
+	while (lo < hi) {
+		int mi = (lo + hi) / 2;
+		int cmp = hashcmp(pb->specs[mi]->sha1, sha1);
+		if (!cmp) {
+			s = pb->specs[mi];
+			break;
+		}
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+
+	/* anything unexpected is left to diff_populate_filespec() */
+	if (!s || type != OBJ_BLOB || s->data || pb->left < size) {
+		free(buf);
+		return 0;
+	}
+	s->data = buf;
+	s->size = size;
+	s->should_free = 1;
+	pb->left -= size;
+	pb->nr_read++;
+	return 0;
+}
+
+/*
+ * Read the contents of the filespecs that come from the object
+ * database in one batch with read_sha1_batch(), keeping at most
+ * "max_bytes" of them.  The ones that are not read here are read by
+ * diff_populate_filespec() as usual.
+ */
+void diff_populate_filespecs(struct diff_filespec **specs, int nr,
+			     unsigned long max_bytes)
+{
+	struct populate_batch pb;
+	struct sha1_array list = SHA1_ARRAY_INIT;
+	int i;
+
+	pb.specs = xmalloc(nr * sizeof(*pb.specs));
+	pb.nr = 0;
+	pb.nr_read = 0;
+	pb.left = max_bytes;
+	for (i = 0; i < nr; i++) {
+		struct diff_filespec *s = specs[i];
+
+		if (!DIFF_FILE_VALID(s) || !S_ISREG(s->mode) ||
+		    !s->sha1_valid || s->data || s->cnt_data ||
+		    reuse_worktree_file(s->path, s->sha1, 0))
+			continue;
+		pb.specs[pb.nr++] = s;
+	}
+	qsort(pb.specs, pb.nr, sizeof(*pb.specs), populate_batch_cmp);
+	for (i = 0; i < pb.nr; i++)
+		if (!i || hashcmp(pb.specs[i - 1]->sha1, pb.specs[i]->sha1))
+			sha1_array_append(&list, pb.specs[i]->sha1);
+
+	if (list.nr) {
+		read_sha1_batch(&list, populate_batch_one, &pb);
+		trace_printf("diff: %d of %d blobs read in a batch\n",
+			     pb.nr_read, list.nr);
+	}
+	sha1_array_clear(&list);
+	free(pb.specs);
+}
+
 void diff_free_filespec_blob(struct diff_filespec *s)
 {
 	if (s->should_free)
@@ -58,6 +58,7 @@ extern void fill_filespec(struct diff_filespec *, const unsigned char *,
 			  int, unsigned short);
 
 extern int diff_populate_filespec(struct diff_filespec *, int);
+extern void diff_populate_filespecs(struct diff_filespec **, int, unsigned long);
 extern void diff_free_filespec_data(struct diff_filespec *);
 extern void diff_free_filespec_blob(struct diff_filespec *);
 extern int diff_filespec_is_binary(struct diff_filespec *);
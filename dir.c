@@ -8,14 +8,19 @@
 #include "cache.h"
 #include "dir.h"
 #include "refs.h"
+#include "string-list.h"
+#include "varint.h"
 
 struct path_simplify {
 	int len;
 	const char *path;
 };
 
+struct untracked_cache_dir;
+
 static int read_directory_recursive(struct dir_struct *dir, const char *path, int len,
-	int check_only, const struct path_simplify *simplify);
+	int check_only, const struct path_simplify *simplify,
+	struct untracked_cache_dir *untracked);
 static int get_dtype(struct dirent *de, const char *path, int len);
 
 /* helper string functions with support for the ignore_case flag */
@@ -308,6 +313,176 @@ static int no_wildcard(const char *string)
 	return string[simple_length(string)] == '\0';
 }
 
+/*
+ * The last pattern of a list that matches a path decides its fate, so
+ * excluded_from_list() looks for the matching pattern with the highest
+ * position.  Rather than trying all of them, it looks most of them up
+ * in hash tables, by the literal text a path has to have to match:
+ *
+ *  - exact basenames ("foo.o") by the basename;
+ *  - "*<literal>" ones ("*.o") by the end of the path;
+ *  - other basename globs ("foo*.c") by the head of the basename;
+ *  - patterns with a slash ("/build", "doc/api-*.txt") by the head of the
+ *    path, i.e. the directory the pattern came from followed by the
+ *    pattern up to its first wildcard.
+ *
+ * A table knows the lengths of the literals in it, and a path is looked
+ * up once per length.  Only the patterns without any such literal
+ * ("*~", "[Mm]akefile") are tried one by one, and of all of them, only
+ * those after the best match found so far are tried.
+ *
+ * Patterns are only added at the end of a list and removed from its
+ * end, so a hash chain stays sorted by decreasing position.
+ */
+struct exclude_bucket {
+	struct exclude *last;
+};
+
+#define EXCLUDE_HASH_INIT 0x123
+
+static unsigned int hash_exclude_name(unsigned int hash,
+				      const char *name, int len)
+{
+	while (len--) {
+		/* folded, so that it works the same with ignore_case */
+		unsigned char c = tolower(*name++);
+		hash = hash * 101 + c;
+	}
+	return hash;
+}
+
+/*
+ * Which table of "el" the pattern "x" goes in, and the hash and length
+ * of the literal it is found by; NULL if it has to be tried anyway.
+ */
+static struct exclude_table *exclude_table_for(struct exclude_list *el,
+					       const struct exclude *x,
+					       unsigned int *hash, int *len)
+{
+	const char *pattern = x->pattern;
+	int prefix = x->nowildcardlen;
+
+	if (x->flags & EXC_FLAG_NODIR) {
+		if (prefix == x->patternlen) {
+			*len = prefix;
+			*hash = hash_exclude_name(EXCLUDE_HASH_INIT, pattern, *len);
+			return &el->basenames;
+		}
+		if (x->flags & EXC_FLAG_ENDSWITH) {
+			*len = x->patternlen - 1;
+			*hash = hash_exclude_name(EXCLUDE_HASH_INIT, pattern + 1, *len);
+			return &el->endswith;
+		}
+		if (!prefix)
+			return NULL;
+		*len = prefix;
+		*hash = hash_exclude_name(EXCLUDE_HASH_INIT, pattern, *len);
+		return &el->basename_prefix;
+	}
+
+	if (*pattern == '/') {
+		pattern++;
+		prefix--;
+	}
+	*len = x->baselen + prefix;
+	if (!*len)
+		return NULL;
+	*hash = hash_exclude_name(EXCLUDE_HASH_INIT, x->base, x->baselen);
+	*hash = hash_exclude_name(*hash, pattern, prefix);
+	return &el->path_prefix;
+}
+
+static struct exclude_table_len *find_table_len(struct exclude_table *table,
+						int len)
+{
+	int i;
+
+	for (i = 0; i < table->lens_nr; i++)
+		if (table->lens[i].len == len)
+			return &table->lens[i];
+	return NULL;
+}
+
+static void hash_exclude(struct exclude_table *table, struct exclude *x,
+			 unsigned int hash, int len)
+{
+	struct exclude_bucket *b = lookup_hash(hash, &table->hash);
+	struct exclude_table_len *l = find_table_len(table, len);
+
+	if (!b) {
+		b = xcalloc(1, sizeof(*b));
+		insert_hash(hash, b, &table->hash);
+	}
+	x->next_same = b->last;
+	b->last = x;
+
+	if (!l) {
+		ALLOC_GROW(table->lens, table->lens_nr + 1, table->lens_alloc);
+		l = &table->lens[table->lens_nr++];
+		l->len = len;
+		l->nr = 0;
+	}
+	l->nr++;
+}
+
+static void unhash_exclude(struct exclude_table *table, struct exclude *x,
+			   unsigned int hash, int len)
+{
+	struct exclude_bucket *b = lookup_hash(hash, &table->hash);
+	struct exclude_table_len *l = find_table_len(table, len);
+
+	if (b && b->last == x)
+		b->last = x->next_same;
+	if (l && !--l->nr)
+		*l = table->lens[--table->lens_nr];
+}
+
+static int free_exclude_bucket(void *b, void *data)
+{
+	free(b);
+	return 0;
+}
+
+static void free_exclude_table(struct exclude_table *table)
+{
+	for_each_hash(&table->hash, free_exclude_bucket, NULL);
+	free_hash(&table->hash);
+	free(table->lens);
+	table->lens = NULL;
+	table->lens_nr = table->lens_alloc = 0;
+}
+
+static void add_exclude_to_matcher(struct exclude_list *el, struct exclude *x)
+{
+	struct exclude_table *table;
+	unsigned int hash;
+	int len;
+
+	table = exclude_table_for(el, x, &hash, &len);
+	if (table) {
+		hash_exclude(table, x, hash, len);
+		return;
+	}
+	ALLOC_GROW(el->others, el->others_nr + 1, el->others_alloc);
+	el->others[el->others_nr++] = x->pos;
+}
+
+/* Remove the last pattern of the list */
+static void pop_exclude(struct exclude_list *el)
+{
+	struct exclude *x = el->excludes[--el->nr];
+	struct exclude_table *table;
+	unsigned int hash;
+	int len;
+
+	table = exclude_table_for(el, x, &hash, &len);
+	if (table)
+		unhash_exclude(table, x, hash, len);
+	else if (el->others_nr && el->others[el->others_nr - 1] == x->pos)
+		el->others_nr--;
+	free(x);
+}
+
 void add_exclude(const char *string, const char *base,
 		 int baselen, struct exclude_list *which)
 {
@@ -345,7 +520,9 @@ void add_exclude(const char *string, const char *base,
 	if (*string == '*' && no_wildcard(string+1))
 		x->flags |= EXC_FLAG_ENDSWITH;
 	ALLOC_GROW(which->excludes, which->nr + 1, which->alloc);
+	x->pos = which->nr;
 	which->excludes[which->nr++] = x;
+	add_exclude_to_matcher(which, x);
 }
 
 static void *read_skip_worktree_file_from_index(const char *path, size_t *size)
@@ -381,6 +558,14 @@ void free_excludes(struct exclude_list *el)
 
 	el->nr = 0;
 	el->excludes = NULL;
+
+	free_exclude_table(&el->basenames);
+	free_exclude_table(&el->endswith);
+	free_exclude_table(&el->basename_prefix);
+	free_exclude_table(&el->path_prefix);
+	free(el->others);
+	el->others = NULL;
+	el->others_nr = el->others_alloc = 0;
 }
 
 int add_excludes_from_file_to_list(const char *fname,
@@ -469,7 +654,7 @@ static void prep_exclude(struct dir_struct *dir, const char *base, int baselen)
 			break;
 		dir->exclude_stack = stk->prev;
 		while (stk->exclude_ix < el->nr)
-			free(el->excludes[--el->nr]);
+			pop_exclude(el);
 		free(stk->filebuf);
 		free(stk);
 	}
@@ -505,80 +690,134 @@ static void prep_exclude(struct dir_struct *dir, const char *base, int baselen)
 	dir->basebuf[baselen] = '\0';
 }
 
-/* Scan the list and let the last match determine the fate.
+/* Does the pattern "x" match the path? */
+static int match_exclude(struct exclude *x, const char *pathname, int pathlen,
+			 const char *basename, int *dtype)
+{
+	const char *name, *exclude = x->pattern;
+	int namelen, prefix = x->nowildcardlen;
+
+	if (x->flags & EXC_FLAG_MUSTBEDIR) {
+		if (*dtype == DT_UNKNOWN)
+			*dtype = get_dtype(NULL, pathname, pathlen);
+		if (*dtype != DT_DIR)
+			return 0;
+	}
+
+	if (x->flags & EXC_FLAG_NODIR) {
+		/* match basename */
+		if (prefix == x->patternlen)
+			return !strcmp_icase(exclude, basename);
+		else if (x->flags & EXC_FLAG_ENDSWITH)
+			return x->patternlen - 1 <= pathlen &&
+				!strcmp_icase(exclude + 1, pathname + pathlen - x->patternlen + 1);
+		else
+			return fnmatch_icase(exclude, basename, 0) == 0;
+	}
+
+	/* match with FNM_PATHNAME:
+	 * exclude has base (baselen long) implicitly in front of it.
+	 */
+	if (*exclude == '/') {
+		exclude++;
+		prefix--;
+	}
+
+	if (pathlen < x->baselen ||
+	    (x->baselen && pathname[x->baselen-1] != '/') ||
+	    strncmp_icase(pathname, x->base, x->baselen))
+		return 0;
+
+	namelen = x->baselen ? pathlen - x->baselen : pathlen;
+	name = pathname + pathlen  - namelen;
+
+	/* if the non-wildcard part is longer than the
+	   remaining pathname, surely it cannot match */
+	if (prefix > namelen)
+		return 0;
+
+	if (prefix) {
+		if (strncmp_icase(exclude, name, prefix))
+			return 0;
+		exclude += prefix;
+		name    += prefix;
+		namelen -= prefix;
+	}
+
+	return !namelen || !fnmatch_icase(exclude, name, FNM_PATHNAME);
+}
+
+/*
+ * The position of the last pattern in the bucket of "table" for "hash"
+ * that matches the path, if it is after "best"; "best" otherwise.
+ */
+static int last_match_in_bucket(struct exclude_table *table,
+				unsigned int hash, int best,
+				const char *pathname, int pathlen,
+				const char *basename, int *dtype)
+{
+	struct exclude_bucket *b = lookup_hash(hash, &table->hash);
+	struct exclude *x;
+
+	for (x = b ? b->last : NULL; x && x->pos > best; x = x->next_same)
+		if (match_exclude(x, pathname, pathlen, basename, dtype))
+			return x->pos;
+	return best;
+}
+
+/* Find the last match in the list and let it determine the fate.
  * Return 1 for exclude, 0 for include and -1 for undecided.
  */
 int excluded_from_list(const char *pathname,
 		       int pathlen, const char *basename, int *dtype,
 		       struct exclude_list *el)
 {
-	int i;
+	int i, basenamelen, best = -1;
 
 	if (!el->nr)
 		return -1;	/* undefined */
 
-	for (i = el->nr - 1; 0 <= i; i--) {
-		struct exclude *x = el->excludes[i];
-		const char *name, *exclude = x->pattern;
-		int to_exclude = x->to_exclude;
-		int namelen, prefix = x->nowildcardlen;
-
-		if (x->flags & EXC_FLAG_MUSTBEDIR) {
-			if (*dtype == DT_UNKNOWN)
-				*dtype = get_dtype(NULL, pathname, pathlen);
-			if (*dtype != DT_DIR)
-				continue;
-		}
+	basenamelen = strlen(basename);
+	best = last_match_in_bucket(&el->basenames,
+			hash_exclude_name(EXCLUDE_HASH_INIT, basename, basenamelen),
+			best, pathname, pathlen, basename, dtype);
 
-		if (x->flags & EXC_FLAG_NODIR) {
-			/* match basename */
-			if (prefix == x->patternlen) {
-				if (!strcmp_icase(exclude, basename))
-					return to_exclude;
-			} else if (x->flags & EXC_FLAG_ENDSWITH) {
-				if (x->patternlen - 1 <= pathlen &&
-				    !strcmp_icase(exclude + 1, pathname + pathlen - x->patternlen + 1))
-					return to_exclude;
-			} else {
-				if (fnmatch_icase(exclude, basename, 0) == 0)
-					return to_exclude;
-			}
-			continue;
-		}
+	for (i = 0; i < el->endswith.lens_nr; i++) {
+		int len = el->endswith.lens[i].len;
 
-		/* match with FNM_PATHNAME:
-		 * exclude has base (baselen long) implicitly in front of it.
-		 */
-		if (*exclude == '/') {
-			exclude++;
-			prefix--;
-		}
+		if (len <= pathlen)
+			best = last_match_in_bucket(&el->endswith,
+				hash_exclude_name(EXCLUDE_HASH_INIT,
+						  pathname + pathlen - len, len),
+				best, pathname, pathlen, basename, dtype);
+	}
 
-		if (pathlen < x->baselen ||
-		    (x->baselen && pathname[x->baselen-1] != '/') ||
-		    strncmp_icase(pathname, x->base, x->baselen))
-			continue;
+	for (i = 0; i < el->basename_prefix.lens_nr; i++) {
+		int len = el->basename_prefix.lens[i].len;
+
+		if (len <= basenamelen)
+			best = last_match_in_bucket(&el->basename_prefix,
+				hash_exclude_name(EXCLUDE_HASH_INIT, basename, len),
+				best, pathname, pathlen, basename, dtype);
+	}
 
-		namelen = x->baselen ? pathlen - x->baselen : pathlen;
-		name = pathname + pathlen  - namelen;
+	for (i = 0; i < el->path_prefix.lens_nr; i++) {
+		int len = el->path_prefix.lens[i].len;
 
-		/* if the non-wildcard part is longer than the
-		   remaining pathname, surely it cannot match */
-		if (prefix > namelen)
-			continue;
+		if (len <= pathlen)
+			best = last_match_in_bucket(&el->path_prefix,
+				hash_exclude_name(EXCLUDE_HASH_INIT, pathname, len),
+				best, pathname, pathlen, basename, dtype);
+	}
 
-		if (prefix) {
-			if (strncmp_icase(exclude, name, prefix))
-				continue;
-			exclude += prefix;
-			name    += prefix;
-			namelen -= prefix;
+	for (i = el->others_nr - 1; 0 <= i && best < el->others[i]; i--)
+		if (match_exclude(el->excludes[el->others[i]],
+				  pathname, pathlen, basename, dtype)) {
+			best = el->others[i];
+			break;
 		}
 
-		if (!namelen || !fnmatch_icase(exclude, name, FNM_PATHNAME))
-			return to_exclude;
-	}
-	return -1; /* undecided */
+	return best < 0 ? -1 : el->excludes[best]->to_exclude;
 }
 
 static int excluded(struct dir_struct *dir, const char *pathname, int *dtype_p)
@@ -688,6 +927,299 @@ struct dir_entry *dir_add_ignored(struct dir_struct *dir, const char *pathname,
 	return dir->ignored[dir->ignored_nr++] = dir_entry_new(pathname, len);
 }
 
+/*
+ * The untracked cache.
+ *
+ * Reading every directory and matching every entry against the
+ * exclude patterns is what makes "git status" slow on a large tree,
+ * even when nothing changed.  The cache keeps a node for each
+ * directory read_directory_recursive() reads, with the stat data of
+ * the directory and of its per-directory exclude file, the untracked
+ * names found directly in it, and the nodes of the subdirectories it
+ * looked into.  When a node and all the nodes below it still match
+ * the filesystem, its result is replayed without reading anything;
+ * otherwise the directory is read again, and the nodes below it that
+ * are still good are reused.
+ *
+ * Adding a path to the index or removing it changes the result
+ * without touching the directory, so the index code invalidates the
+ * node the path lives in.  A change to the flags, the command line
+ * or global exclude patterns, or the work tree drops the whole cache.
+ */
+struct dir_stat {
+	struct cache_time ctime, mtime;
+	unsigned int dev, ino, size;
+};
+
+struct untracked_cache_dir {
+	struct dir_stat stat;		/* of the directory itself */
+	struct dir_stat exclude_stat;	/* of its exclude_per_dir file */
+	unsigned int valid : 1,
+		     check_only : 1,
+		     seen : 1,
+		     checked_valid : 1;
+	unsigned int contents;
+	unsigned int checked;		/* generation of the last check */
+	struct string_list untracked;	/* untracked names directly in it */
+	struct string_list dirs;	/* the util field is the subdirectory */
+};
+
+struct untracked_cache {
+	unsigned char ident[20];
+	struct untracked_cache_dir *root;
+	unsigned int generation;
+	unsigned int dir_read, dir_reused;
+};
+
+static void stat_dir_path(struct dir_stat *sd, const char *path)
+{
+	struct stat st;
+
+	memset(sd, 0, sizeof(*sd));
+	if (lstat(path, &st))
+		return;
+	sd->ctime.sec = (unsigned int)st.st_ctime;
+	sd->ctime.nsec = ST_CTIME_NSEC(st);
+	sd->mtime.sec = (unsigned int)st.st_mtime;
+	sd->mtime.nsec = ST_MTIME_NSEC(st);
+	sd->dev = st.st_dev;
+	sd->ino = st.st_ino;
+	sd->size = st.st_size;
+}
+
+/*
+ * Like ce_match_stat_basic() followed by is_racy_timestamp(): a
+ * directory modified in the same second the index was written may
+ * change again without its stat data showing it.
+ */
+static int dir_stat_changed(const struct dir_stat *old, const struct dir_stat *sd)
+{
+	const struct cache_time *ts = &the_index.timestamp;
+
+	if (old->mtime.sec != sd->mtime.sec ||
+	    (trust_ctime && old->ctime.sec != sd->ctime.sec) ||
+	    old->ino != sd->ino || old->size != sd->size)
+		return 1;
+#ifdef USE_NSEC
+	if (old->mtime.nsec != sd->mtime.nsec ||
+	    (trust_ctime && old->ctime.nsec != sd->ctime.nsec))
+		return 1;
+#endif
+#ifdef USE_STDEV
+	if (old->dev != sd->dev)
+		return 1;
+#endif
+	return (ts->sec &&
+#ifdef USE_NSEC
+		(ts->sec < sd->mtime.sec ||
+		 (ts->sec == sd->mtime.sec && ts->nsec <= sd->mtime.nsec))
+#else
+		ts->sec <= sd->mtime.sec
+#endif
+		);
+}
+
+static struct untracked_cache_dir *new_untracked_dir(void)
+{
+	struct untracked_cache_dir *ucd = xcalloc(1, sizeof(*ucd));
+
+	ucd->untracked.strdup_strings = 1;
+	ucd->dirs.strdup_strings = 1;
+	return ucd;
+}
+
+static void free_untracked_dir(struct untracked_cache_dir *ucd)
+{
+	int i;
+
+	if (!ucd)
+		return;
+	for (i = 0; i < ucd->dirs.nr; i++)
+		free_untracked_dir(ucd->dirs.items[i].util);
+	string_list_clear(&ucd->untracked, 0);
+	string_list_clear(&ucd->dirs, 0);
+	free(ucd);
+}
+
+/*
+ * Find the node of the subdirectory "path" (with its trailing slash)
+ * under "ucd", creating it if needed, and mark it as still there.
+ */
+static struct untracked_cache_dir *lookup_untracked(struct untracked_cache_dir *ucd,
+						    const char *path, int len)
+{
+	struct string_list_item *item;
+	const char *name;
+	char *key;
+
+	if (!ucd)
+		return NULL;
+	len--;
+	for (name = path + len; name > path && name[-1] != '/'; name--)
+		; /* nothing */
+	key = xmemdupz(name, path + len - name);
+	item = string_list_insert(&ucd->dirs, key);
+	free(key);
+	if (!item->util)
+		item->util = new_untracked_dir();
+	ucd = item->util;
+	ucd->seen = 1;
+	return ucd;
+}
+
+static void stat_exclude_file(struct dir_struct *dir, struct dir_stat *sd,
+			      struct strbuf *path)
+{
+	int baselen = path->len;
+
+	if (!dir->exclude_per_dir) {
+		memset(sd, 0, sizeof(*sd));
+		return;
+	}
+	strbuf_addstr(path, dir->exclude_per_dir);
+	stat_dir_path(sd, path->buf);
+	strbuf_setlen(path, baselen);
+}
+
+/*
+ * Can the directory "path" be replayed from "ucd" instead of read?
+ * That is the case when neither it nor its exclude file changed, and
+ * the same holds for every node below it.
+ */
+static int valid_untracked_dir(struct dir_struct *dir,
+			       struct untracked_cache_dir *ucd,
+			       struct strbuf *path, int check_only)
+{
+	struct dir_stat sd;
+	int i, baselen = path->len;
+
+	if (ucd->check_only != check_only)
+		return 0;
+	if (ucd->checked == the_index.untracked->generation)
+		return ucd->checked_valid;
+	ucd->checked = the_index.untracked->generation;
+	ucd->checked_valid = 0;
+	if (!ucd->valid)
+		return 0;
+
+	/*
+	 * When the file system monitor answered, it reported any change
+	 * to the directory or its exclude file, invalidating the entry.
+	 */
+	if (!the_index.fsmonitor_answered) {
+		stat_dir_path(&sd, baselen ? path->buf : ".");
+		if (dir_stat_changed(&ucd->stat, &sd))
+			return 0;
+		stat_exclude_file(dir, &sd, path);
+		if (dir_stat_changed(&ucd->exclude_stat, &sd))
+			return 0;
+	}
+
+	for (i = 0; i < ucd->dirs.nr; i++) {
+		struct untracked_cache_dir *sub = ucd->dirs.items[i].util;
+		int valid;
+
+		strbuf_addf(path, "%s/", ucd->dirs.items[i].string);
+		valid = valid_untracked_dir(dir, sub, path, sub->check_only);
+		strbuf_setlen(path, baselen);
+		if (!valid)
+			return 0;
+	}
+	ucd->checked_valid = 1;
+	return 1;
+}
+
+static int replay_untracked_dir(struct dir_struct *dir,
+				struct untracked_cache_dir *ucd,
+				struct strbuf *path)
+{
+	int i, baselen = path->len;
+
+	for (i = 0; i < ucd->untracked.nr; i++) {
+		strbuf_addstr(path, ucd->untracked.items[i].string);
+		dir_add_name(dir, path->buf, path->len);
+		strbuf_setlen(path, baselen);
+	}
+	for (i = 0; i < ucd->dirs.nr; i++) {
+		struct untracked_cache_dir *sub = ucd->dirs.items[i].util;
+
+		if (sub->check_only)
+			continue;
+		strbuf_addf(path, "%s/", ucd->dirs.items[i].string);
+		replay_untracked_dir(dir, sub, path);
+		strbuf_setlen(path, baselen);
+	}
+	the_index.untracked->dir_reused++;
+	return ucd->contents;
+}
+
+/* The directory "path" is about to be read again into "ucd" */
+static void prepare_untracked_dir(struct dir_struct *dir,
+				  struct untracked_cache_dir *ucd,
+				  struct strbuf *path, int check_only)
+{
+	struct dir_stat sd;
+	int i;
+
+	stat_dir_path(&ucd->stat, path->len ? path->buf : ".");
+	stat_exclude_file(dir, &sd, path);
+	if (dir_stat_changed(&ucd->exclude_stat, &sd)) {
+		/* what is excluded below here may have changed */
+		for (i = 0; i < ucd->dirs.nr; i++)
+			free_untracked_dir(ucd->dirs.items[i].util);
+		string_list_clear(&ucd->dirs, 0);
+	}
+	ucd->exclude_stat = sd;
+
+	for (i = 0; i < ucd->dirs.nr; i++)
+		((struct untracked_cache_dir *)ucd->dirs.items[i].util)->seen = 0;
+	string_list_clear(&ucd->untracked, 0);
+	ucd->check_only = check_only;
+	ucd->valid = 0;
+	the_index.untracked->dir_read++;
+	the_index.cache_changed = 1;
+}
+
+static void finish_untracked_dir(struct untracked_cache_dir *ucd, int contents)
+{
+	int i, j;
+
+	/* forget the subdirectories that were not looked at this time */
+	for (i = j = 0; i < ucd->dirs.nr; i++) {
+		struct untracked_cache_dir *sub = ucd->dirs.items[i].util;
+
+		if (!sub->seen) {
+			free_untracked_dir(sub);
+			free(ucd->dirs.items[i].string);
+			continue;
+		}
+		ucd->dirs.items[j++] = ucd->dirs.items[i];
+	}
+	ucd->dirs.nr = j;
+	ucd->contents = contents;
+	ucd->valid = 1;
+}
+
+/*
+ * A subdirectory that is shown without being read (a repository of
+ * its own) still gets a node, so that the parent is read again when
+ * it stops being one.
+ */
+static void record_untracked_stub(struct dir_struct *dir,
+				  struct untracked_cache_dir *parent,
+				  const char *dirname, int len)
+{
+	struct untracked_cache_dir *ucd = lookup_untracked(parent, dirname, len);
+	struct strbuf path = STRBUF_INIT;
+
+	if (!ucd)
+		return;
+	strbuf_add(&path, dirname, len);
+	prepare_untracked_dir(dir, ucd, &path, 1);
+	finish_untracked_dir(ucd, 0);
+	strbuf_release(&path);
+}
+
 enum exist_status {
 	index_nonexistent = 0,
 	index_directory,
@@ -802,7 +1334,8 @@ enum directory_treatment {
 
 static enum directory_treatment treat_directory(struct dir_struct *dir,
 	const char *dirname, int len,
-	const struct path_simplify *simplify)
+	const struct path_simplify *simplify,
+	struct untracked_cache_dir *untracked)
 {
 	/* The "len-1" is to strip the final '/' */
 	switch (directory_exists_in_index(dirname, len-1)) {
@@ -819,8 +1352,11 @@ static enum directory_treatment treat_directory(struct dir_struct *dir,
 			break;
 		if (!(dir->flags & DIR_NO_GITLINKS)) {
 			unsigned char sha1[20];
-			if (resolve_gitlink_ref(dirname, "HEAD", sha1) == 0)
+			if (resolve_gitlink_ref(dirname, "HEAD", sha1) == 0) {
+				record_untracked_stub(dir, untracked,
+						      dirname, len);
 				return show_directory;
+			}
 		}
 		return recurse_into_directory;
 	}
@@ -828,7 +1364,8 @@ static enum directory_treatment treat_directory(struct dir_struct *dir,
 	/* This is the "show_other_directories" case */
 	if (!(dir->flags & DIR_HIDE_EMPTY_DIRECTORIES))
 		return show_directory;
-	if (!read_directory_recursive(dir, dirname, len, 1, simplify))
+	if (!read_directory_recursive(dir, dirname, len, 1, simplify,
+				      lookup_untracked(untracked, dirname, len)))
 		return ignore_directory;
 	return show_directory;
 }
@@ -954,7 +1491,8 @@ enum path_treatment {
 static enum path_treatment treat_one_path(struct dir_struct *dir,
 					  struct strbuf *path,
 					  const struct path_simplify *simplify,
-					  int dtype, struct dirent *de)
+					  int dtype, struct dirent *de,
+					  struct untracked_cache_dir *untracked)
 {
 	int exclude = excluded(dir, path->buf, &dtype);
 	if (exclude && (dir->flags & DIR_COLLECT_IGNORED)
@@ -987,7 +1525,8 @@ static enum path_treatment treat_one_path(struct dir_struct *dir,
 		return path_ignored;
 	case DT_DIR:
 		strbuf_addch(path, '/');
-		switch (treat_directory(dir, path->buf, path->len, simplify)) {
+		switch (treat_directory(dir, path->buf, path->len, simplify,
+					untracked)) {
 		case show_directory:
 			if (exclude != !!(dir->flags
 					  & DIR_SHOW_IGNORED))
@@ -1010,7 +1549,8 @@ static enum path_treatment treat_path(struct dir_struct *dir,
 				      struct dirent *de,
 				      struct strbuf *path,
 				      int baselen,
-				      const struct path_simplify *simplify)
+				      const struct path_simplify *simplify,
+				      struct untracked_cache_dir *untracked)
 {
 	int dtype;
 
@@ -1022,7 +1562,7 @@ static enum path_treatment treat_path(struct dir_struct *dir,
 		return path_ignored;
 
 	dtype = DTYPE(de);
-	return treat_one_path(dir, path, simplify, dtype, de);
+	return treat_one_path(dir, path, simplify, dtype, de, untracked);
 }
 
 /*
@@ -1033,11 +1573,15 @@ static enum path_treatment treat_path(struct dir_struct *dir,
  *
  * Also, we ignore the name ".git" (even if it is not a directory).
  * That likely will not change.
+ *
+ * With the untracked cache, "untracked" is the node of this directory;
+ * it is replayed when still valid and filled in again otherwise.
  */
 static int read_directory_recursive(struct dir_struct *dir,
 				    const char *base, int baselen,
 				    int check_only,
-				    const struct path_simplify *simplify)
+				    const struct path_simplify *simplify,
+				    struct untracked_cache_dir *untracked)
 {
 	DIR *fdir;
 	int contents = 0;
@@ -1046,16 +1590,26 @@ static int read_directory_recursive(struct dir_struct *dir,
 
 	strbuf_add(&path, base, baselen);
 
+	if (untracked) {
+		if (valid_untracked_dir(dir, untracked, &path, check_only)) {
+			contents = replay_untracked_dir(dir, untracked, &path);
+			goto out;
+		}
+		prepare_untracked_dir(dir, untracked, &path, check_only);
+	}
+
 	fdir = opendir(path.len ? path.buf : ".");
 	if (!fdir)
-		goto out;
+		goto done;
 
 	while ((de = readdir(fdir)) != NULL) {
-		switch (treat_path(dir, de, &path, baselen, simplify)) {
+		switch (treat_path(dir, de, &path, baselen, simplify,
+				   untracked)) {
 		case path_recurse:
 			contents += read_directory_recursive(dir, path.buf,
 							     path.len, 0,
-							     simplify);
+							     simplify,
+				lookup_untracked(untracked, path.buf, path.len));
 			continue;
 		case path_ignored:
 			continue;
@@ -1065,9 +1619,14 @@ static int read_directory_recursive(struct dir_struct *dir,
 		contents++;
 		if (check_only)
 			break;
-		dir_add_name(dir, path.buf, path.len);
+		if (dir_add_name(dir, path.buf, path.len) && untracked)
+			string_list_append(&untracked->untracked,
+					   path.buf + baselen);
 	}
 	closedir(fdir);
+ done:
+	if (untracked)
+		finish_untracked_dir(untracked, contents);
  out:
 	strbuf_release(&path);
 
@@ -1140,7 +1699,7 @@ static int treat_leading_path(struct dir_struct *dir,
 		if (simplify_away(sb.buf, sb.len, simplify))
 			break;
 		if (treat_one_path(dir, &sb, simplify,
-				   DT_DIR, NULL) == path_ignored)
+				   DT_DIR, NULL, NULL) == path_ignored)
 			break; /* do not recurse into it */
 		if (len <= baselen) {
 			rc = 1;
@@ -1151,22 +1710,307 @@ static int treat_leading_path(struct dir_struct *dir,
 	return rc;
 }
 
+static void untracked_cache_ident(struct dir_struct *dir, unsigned char *sha1)
+{
+	const char *work_tree = get_git_work_tree();
+	struct strbuf sb = STRBUF_INIT;
+	git_SHA_CTX c;
+	int i, j;
+
+	strbuf_addf(&sb, "%s\n%d %d\n%s\n", work_tree ? work_tree : "",
+		    dir->flags & (DIR_SHOW_OTHER_DIRECTORIES |
+				  DIR_HIDE_EMPTY_DIRECTORIES |
+				  DIR_NO_GITLINKS),
+		    ignore_case,
+		    dir->exclude_per_dir ? dir->exclude_per_dir : "");
+	for (i = EXC_CMDL; i <= EXC_FILE; i++) {
+		struct exclude_list *el = &dir->exclude_list[i];
+
+		if (i == EXC_DIRS)
+			continue;
+		for (j = 0; j < el->nr; j++) {
+			struct exclude *x = el->excludes[j];
+			strbuf_addf(&sb, "%d %d %d %s %s\n", i, x->to_exclude,
+				    x->flags, x->base ? x->base : "",
+				    x->pattern);
+		}
+	}
+	git_SHA1_Init(&c);
+	git_SHA1_Update(&c, sb.buf, sb.len);
+	git_SHA1_Final(sha1, &c);
+	strbuf_release(&sb);
+}
+
+/*
+ * Return the root of the untracked cache if this walk can use it.
+ * Only walks of the whole tree for untracked files are cached; with
+ * sparse checkout, exclude files may come from the index instead of
+ * the work tree, where their stat data says nothing.
+ */
+static struct untracked_cache_dir *validate_untracked_cache(struct dir_struct *dir,
+							    int len,
+							    const char **pathspec)
+{
+	struct untracked_cache *uc;
+	unsigned char ident[20];
+
+	if (core_untracked_cache > 0)
+		add_untracked_cache(&the_index);
+	else if (!core_untracked_cache)
+		remove_untracked_cache(&the_index);
+
+	uc = the_index.untracked;
+	if (!uc || len || pathspec || core_apply_sparse_checkout ||
+	    (dir->flags & (DIR_SHOW_IGNORED | DIR_COLLECT_IGNORED)))
+		return NULL;
+
+	untracked_cache_ident(dir, ident);
+	if (!uc->root || hashcmp(uc->ident, ident)) {
+		free_untracked_dir(uc->root);
+		uc->root = new_untracked_dir();
+		hashcpy(uc->ident, ident);
+		the_index.cache_changed = 1;
+	}
+	uc->generation++;
+	uc->dir_read = 0;
+	uc->dir_reused = 0;
+	return uc->root;
+}
+
+static void trace_untracked_stats(struct untracked_cache *uc)
+{
+	static const char key[] = "GIT_TRACE_UNTRACKED";
+	struct strbuf sb = STRBUF_INIT;
+
+	if (!trace_want(key))
+		return;
+	strbuf_addf(&sb, "untracked cache: %u read, %u reused\n",
+		    uc->dir_read, uc->dir_reused);
+	trace_strbuf(key, &sb);
+	strbuf_release(&sb);
+}
+
 int read_directory(struct dir_struct *dir, const char *path, int len, const char **pathspec)
 {
 	struct path_simplify *simplify;
+	struct untracked_cache_dir *untracked;
 
 	if (has_symlink_leading_path(path, len))
 		return dir->nr;
 
 	simplify = create_simplify(pathspec);
+	untracked = validate_untracked_cache(dir, len, pathspec);
 	if (!len || treat_leading_path(dir, path, len, simplify))
-		read_directory_recursive(dir, path, len, 0, simplify);
+		read_directory_recursive(dir, path, len, 0, simplify,
+					 untracked);
+	if (untracked)
+		trace_untracked_stats(the_index.untracked);
 	free_simplify(simplify);
 	qsort(dir->entries, dir->nr, sizeof(struct dir_entry *), cmp_name);
 	qsort(dir->ignored, dir->ignored_nr, sizeof(struct dir_entry *), cmp_name);
 	return dir->nr;
 }
 
+void free_untracked_cache(struct untracked_cache *uc)
+{
+	if (!uc)
+		return;
+	free_untracked_dir(uc->root);
+	free(uc);
+}
+
+void add_untracked_cache(struct index_state *istate)
+{
+	if (istate->untracked)
+		return;
+	istate->untracked = xcalloc(1, sizeof(*istate->untracked));
+	istate->cache_changed = 1;
+}
+
+void remove_untracked_cache(struct index_state *istate)
+{
+	if (!istate->untracked)
+		return;
+	free_untracked_cache(istate->untracked);
+	istate->untracked = NULL;
+	istate->cache_changed = 1;
+}
+
+/*
+ * "path" was added to or removed from the index: the directory it
+ * lives in has to be read again, and with it every directory above.
+ */
+void untracked_cache_invalidate_path(struct index_state *istate,
+				     const char *path)
+{
+	struct untracked_cache_dir *ucd;
+	const char *slash;
+
+	if (!istate->untracked || !istate->untracked->root)
+		return;
+	ucd = istate->untracked->root;
+	while ((slash = strchr(path, '/')) != NULL) {
+		struct string_list_item *item;
+		char *name = xmemdupz(path, slash - path);
+
+		item = string_list_lookup(&ucd->dirs, name);
+		free(name);
+		if (!item)
+			break;
+		ucd = item->util;
+		path = slash + 1;
+	}
+	ucd->valid = 0;
+}
+
+static void write_dir_stat(struct strbuf *out, const struct dir_stat *sd)
+{
+	uint32_t data[7];
+
+	data[0] = htonl(sd->ctime.sec);
+	data[1] = htonl(sd->ctime.nsec);
+	data[2] = htonl(sd->mtime.sec);
+	data[3] = htonl(sd->mtime.nsec);
+	data[4] = htonl(sd->dev);
+	data[5] = htonl(sd->ino);
+	data[6] = htonl(sd->size);
+	strbuf_add(out, data, sizeof(data));
+}
+
+static void write_untracked_dir(struct strbuf *out,
+				struct untracked_cache_dir *ucd)
+{
+	unsigned char varint[16];
+	int i;
+
+	write_dir_stat(out, &ucd->stat);
+	write_dir_stat(out, &ucd->exclude_stat);
+	strbuf_add(out, varint,
+		   encode_varint(ucd->valid | ucd->check_only << 1, varint));
+	strbuf_add(out, varint, encode_varint(ucd->contents, varint));
+	strbuf_add(out, varint, encode_varint(ucd->untracked.nr, varint));
+	for (i = 0; i < ucd->untracked.nr; i++) {
+		const char *name = ucd->untracked.items[i].string;
+		strbuf_add(out, name, strlen(name) + 1);
+	}
+	strbuf_add(out, varint, encode_varint(ucd->dirs.nr, varint));
+	for (i = 0; i < ucd->dirs.nr; i++) {
+		const char *name = ucd->dirs.items[i].string;
+		strbuf_add(out, name, strlen(name) + 1);
+		write_untracked_dir(out, ucd->dirs.items[i].util);
+	}
+}
+
+void write_untracked_extension(struct strbuf *out, struct untracked_cache *uc)
+{
+	strbuf_add(out, uc->ident, 20);
+	if (uc->root)
+		write_untracked_dir(out, uc->root);
+}
+
+static int read_dir_stat(struct dir_stat *sd,
+			 const unsigned char **p, const unsigned char *end)
+{
+	uint32_t data[7];
+
+	if (end - *p < sizeof(data))
+		return -1;
+	memcpy(data, *p, sizeof(data));
+	*p += sizeof(data);
+	sd->ctime.sec = ntohl(data[0]);
+	sd->ctime.nsec = ntohl(data[1]);
+	sd->mtime.sec = ntohl(data[2]);
+	sd->mtime.nsec = ntohl(data[3]);
+	sd->dev = ntohl(data[4]);
+	sd->ino = ntohl(data[5]);
+	sd->size = ntohl(data[6]);
+	return 0;
+}
+
+static int read_varint(unsigned int *value,
+		       const unsigned char **p, const unsigned char *end)
+{
+	if (*p >= end)
+		return -1;
+	*value = decode_varint(p);
+	return *p <= end ? 0 : -1;
+}
+
+static const char *read_name(const unsigned char **p, const unsigned char *end)
+{
+	const char *name = (const char *)*p;
+	const unsigned char *nul = memchr(*p, '\0', end - *p);
+
+	if (!nul)
+		return NULL;
+	*p = nul + 1;
+	return name;
+}
+
+static struct untracked_cache_dir *read_untracked_dir(const unsigned char **p,
+						      const unsigned char *end)
+{
+	struct untracked_cache_dir *ucd = new_untracked_dir();
+	unsigned int flags, nr, i;
+
+	if (read_dir_stat(&ucd->stat, p, end) ||
+	    read_dir_stat(&ucd->exclude_stat, p, end) ||
+	    read_varint(&flags, p, end) ||
+	    read_varint(&ucd->contents, p, end) ||
+	    read_varint(&nr, p, end))
+		goto bad;
+	ucd->valid = flags & 1;
+	ucd->check_only = (flags >> 1) & 1;
+
+	for (i = 0; i < nr; i++) {
+		const char *name = read_name(p, end);
+		if (!name)
+			goto bad;
+		string_list_append(&ucd->untracked, name);
+	}
+
+	if (read_varint(&nr, p, end))
+		goto bad;
+	for (i = 0; i < nr; i++) {
+		const char *name = read_name(p, end);
+		struct untracked_cache_dir *sub;
+
+		if (!name || !(sub = read_untracked_dir(p, end)))
+			goto bad;
+		/* written in order, so the list stays sorted */
+		string_list_append(&ucd->dirs, name)->util = sub;
+	}
+	return ucd;
+
+bad:
+	free_untracked_dir(ucd);
+	return NULL;
+}
+
+struct untracked_cache *read_untracked_extension(const void *data, unsigned long sz)
+{
+	const unsigned char *p = data, *end = p + sz;
+	struct untracked_cache *uc;
+
+	if (sz < 20)
+		goto bad;
+	uc = xcalloc(1, sizeof(*uc));
+	hashcpy(uc->ident, p);
+	p += 20;
+	if (p < end) {
+		uc->root = read_untracked_dir(&p, end);
+		if (!uc->root || p != end) {
+			free_untracked_cache(uc);
+			goto bad;
+		}
+	}
+	return uc;
+
+bad:
+	error("Index records invalid untracked cache");
+	return NULL;
+}
+
 int file_exists(const char *f)
 {
 	struct stat sb;
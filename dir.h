@@ -2,6 +2,7 @@
 #define DIR_H
 
 #include "strbuf.h"
+#include "hash.h"
 
 struct dir_entry {
 	unsigned int len;
@@ -12,6 +13,15 @@ struct dir_entry {
 #define EXC_FLAG_ENDSWITH 4
 #define EXC_FLAG_MUSTBEDIR 8
 
+/* Patterns found by the literal they have to match; see dir.c */
+struct exclude_table {
+	struct hash_table hash;
+	struct exclude_table_len {
+		int len, nr;
+	} *lens;			/* lengths of those literals */
+	int lens_nr, lens_alloc;
+};
+
 struct exclude_list {
 	int nr;
 	int alloc;
@@ -23,7 +33,17 @@ struct exclude_list {
 		int baselen;
 		int to_exclude;
 		int flags;
+		int pos;	/* in excludes[] */
+		struct exclude *next_same;	/* earlier one, same hash */
 	} **excludes;
+
+	/* for excluded_from_list() to try only those that may match */
+	struct exclude_table basenames;		/* exact basenames */
+	struct exclude_table endswith;		/* "*<literal>" */
+	struct exclude_table basename_prefix;	/* "<literal>*..." */
+	struct exclude_table path_prefix;	/* "<base><literal>/..." */
+	int *others;				/* positions of the rest */
+	int others_nr, others_alloc;
 };
 
 struct exclude_stack {
@@ -124,6 +144,20 @@ extern int remove_dir_recursively(struct strbuf *path, int flag);
 /* tries to remove the path with empty directories along it, ignores ENOENT */
 extern int remove_path(const char *path);
 
+/*
+ * The untracked cache remembers what read_directory() found in each
+ * directory, so that directories that did not change since can be
+ * skipped.  It is kept in the index.
+ */
+struct index_state;
+struct untracked_cache;
+extern struct untracked_cache *read_untracked_extension(const void *data, unsigned long sz);
+extern void write_untracked_extension(struct strbuf *out, struct untracked_cache *uc);
+extern void free_untracked_cache(struct untracked_cache *uc);
+extern void add_untracked_cache(struct index_state *istate);
+extern void remove_untracked_cache(struct index_state *istate);
+extern void untracked_cache_invalidate_path(struct index_state *istate, const char *path);
+
 extern int strcmp_icase(const char *a, const char *b);
 extern int strncmp_icase(const char *a, const char *b, size_t count);
 extern int fnmatch_icase(const char *pattern, const char *string, int flags);
@@ -231,15 +231,13 @@ static int check_path(const char *path, int len, struct stat *st, int skiplen)
 	return lstat(path, st);
 }
 
-int checkout_entry(struct cache_entry *ce, const struct checkout *state, char *topath)
+static int checkout_entry_1(struct cache_entry *ce,
+			    const struct checkout *state, int write)
 {
 	static char path[PATH_MAX + 1];
 	struct stat st;
 	int len = state->base_dir_len;
 
-	if (topath)
-		return write_entry(ce, topath, state, 1);
-
 	memcpy(path, state->base_dir, len);
 	strcpy(path + len, ce->name);
 	len += ce_namelen(ce);
@@ -272,5 +270,19 @@ int checkout_entry(struct cache_entry *ce, const struct checkout *state, char *t
 	} else if (state->not_new)
 		return 0;
 	create_directories(path, len, state);
+	if (!write)
+		return 1;
 	return write_entry(ce, path, state, 0);
 }
+
+int checkout_entry(struct cache_entry *ce, const struct checkout *state, char *topath)
+{
+	if (topath)
+		return write_entry(ce, topath, state, 1);
+	return checkout_entry_1(ce, state, 1);
+}
+
+int prepare_checkout_entry(struct cache_entry *ce, const struct checkout *state)
+{
+	return checkout_entry_1(ce, state, 0);
+}
@@ -36,6 +36,7 @@ size_t packed_git_window_size = DEFAULT_PACKED_GIT_WINDOW_SIZE;
 size_t packed_git_limit = DEFAULT_PACKED_GIT_LIMIT;
 size_t delta_base_cache_limit = 16 * 1024 * 1024;
 unsigned long big_file_threshold = 512 * 1024 * 1024;
+int loose_object_cache;
 const char *log_pack_access;
 const char *pager_program;
 int pager_use_color = 1;
@@ -64,6 +65,13 @@ unsigned long pack_size_limit_cfg;
 
 /* Parallel index stat data preload? */
 int core_preload_index = 0;
+int core_hash_thread = -1;
+int core_split_index = -1;
+int split_index_max_change = 20;
+int core_untracked_cache = -1;
+const char *core_fsmonitor;
+int checkout_threads = -1;
+int index_threads = -1;
 
 /* This is set by setup_git_dir_gently() and/or git_default_config() */
 char *git_work_tree_cfg;
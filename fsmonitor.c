@@ -0,0 +1,248 @@
+#include "cache.h"
+#include "dir.h"
+#include "fsmonitor.h"
+#include "run-command.h"
+#include "varint.h"
+
+#define FSMONITOR_VERSION 1
+
+/*
+ * The extension is a version number and the time of the last query
+ * in nanoseconds, as three network order 32-bit words, followed by the
+ * positions of the entries that were not known to be clean, each as a
+ * varint of the gap since the position after the previous one.
+ */
+int read_fsmonitor_extension(struct index_state *istate,
+			     const void *data_, unsigned long sz)
+{
+	const unsigned char *data = data_, *end = data + sz;
+	uint32_t word[3];
+	unsigned int pos = 0;
+
+	if (sz < sizeof(word))
+		return error("corrupt fsmonitor extension (too short)");
+	memcpy(word, data, sizeof(word));
+	data += sizeof(word);
+	if (ntohl(word[0]) != FSMONITOR_VERSION)
+		return error("unknown fsmonitor extension version %u",
+			     (unsigned int)ntohl(word[0]));
+	istate->fsmonitor_last_update =
+		(uint64_t)ntohl(word[1]) << 32 | ntohl(word[2]);
+	istate->fsmonitor_dirty_nr = 0;
+	while (data < end) {
+		pos += decode_varint(&data);
+		ALLOC_GROW(istate->fsmonitor_dirty,
+			   istate->fsmonitor_dirty_nr + 1,
+			   istate->fsmonitor_dirty_alloc);
+		istate->fsmonitor_dirty[istate->fsmonitor_dirty_nr++] = pos++;
+	}
+	if (data != end)
+		return error("corrupt fsmonitor extension");
+	return 0;
+}
+
+/*
+ * Remember which entries are not known to be clean.  This looks at the
+ * whole index, before a split index picks the entries it writes out.
+ */
+void fill_fsmonitor_dirty(struct index_state *istate)
+{
+	unsigned int i, pos;
+
+	istate->fsmonitor_dirty_nr = 0;
+	if (!istate->fsmonitor_last_update)
+		return;
+	for (i = pos = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		if (!(ce->ce_flags & CE_FSMONITOR_VALID)) {
+			ALLOC_GROW(istate->fsmonitor_dirty,
+				   istate->fsmonitor_dirty_nr + 1,
+				   istate->fsmonitor_dirty_alloc);
+			istate->fsmonitor_dirty[istate->fsmonitor_dirty_nr++] = pos;
+		}
+		pos++;
+	}
+}
+
+void write_fsmonitor_extension(struct strbuf *sb, struct index_state *istate)
+{
+	uint32_t word[3];
+	unsigned int i, next = 0;
+
+	word[0] = htonl(FSMONITOR_VERSION);
+	word[1] = htonl((uint32_t)(istate->fsmonitor_last_update >> 32));
+	word[2] = htonl((uint32_t)istate->fsmonitor_last_update);
+	strbuf_add(sb, word, sizeof(word));
+	for (i = 0; i < istate->fsmonitor_dirty_nr; i++) {
+		unsigned char buf[16];
+		int len = encode_varint(istate->fsmonitor_dirty[i] - next, buf);
+		strbuf_add(sb, buf, len);
+		next = istate->fsmonitor_dirty[i] + 1;
+	}
+}
+
+void discard_fsmonitor(struct index_state *istate)
+{
+	free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = NULL;
+	istate->fsmonitor_dirty_nr = istate->fsmonitor_dirty_alloc = 0;
+	istate->fsmonitor_last_update = 0;
+	istate->fsmonitor_answered = 0;
+}
+
+/*
+ * Run "<hook> 1 <nanoseconds>"; the hook prints the paths that may have
+ * changed since then, relative to the top of the work tree and each
+ * terminated by a NUL.
+ */
+static int query_fsmonitor(uint64_t since, struct strbuf *out)
+{
+	struct child_process cp;
+	const char *argv[4];
+	char token[32];
+	int ret;
+
+	snprintf(token, sizeof(token), "%"PRIuMAX, (uintmax_t)since);
+	argv[0] = core_fsmonitor;
+	argv[1] = "1";
+	argv[2] = token;
+	argv[3] = NULL;
+
+	memset(&cp, 0, sizeof(cp));
+	cp.argv = argv;
+	cp.use_shell = 1;
+	cp.no_stdin = 1;
+	cp.out = -1;
+	cp.dir = get_git_work_tree();
+	if (start_command(&cp))
+		return -1;
+	ret = strbuf_read(out, cp.out, 1024) < 0 ? -1 : 0;
+	close(cp.out);
+	if (finish_command(&cp))
+		ret = -1;
+	return ret;
+}
+
+/* The path "name" may have changed; so may everything below it */
+static void fsmonitor_refresh_path(struct index_state *istate,
+				   const char *name)
+{
+	struct strbuf dir = STRBUF_INIT;
+	int pos, len = strlen(name);
+
+	if (len && name[len - 1] == '/')
+		len--;
+
+	pos = index_name_pos(istate, name, len);
+	if (pos < 0)
+		pos = -pos - 1;
+	for (; pos < istate->cache_nr; pos++) {
+		struct cache_entry *ce = istate->cache[pos];
+
+		if (ce_namelen(ce) != len || memcmp(ce->name, name, len))
+			break;
+		ce->ce_flags &= ~CE_FSMONITOR_VALID;
+	}
+
+	strbuf_add(&dir, name, len);
+	strbuf_addch(&dir, '/');
+	pos = index_name_pos(istate, dir.buf, dir.len);
+	if (pos < 0)
+		pos = -pos - 1;
+	for (; pos < istate->cache_nr; pos++) {
+		struct cache_entry *ce = istate->cache[pos];
+
+		if (prefixcmp(ce->name, dir.buf))
+			break;
+		ce->ce_flags &= ~CE_FSMONITOR_VALID;
+	}
+
+	/* both the directory listing it is in and its own, if any */
+	strbuf_setlen(&dir, len);
+	untracked_cache_invalidate_path(istate, dir.buf);
+	strbuf_addch(&dir, '/');
+	untracked_cache_invalidate_path(istate, dir.buf);
+	strbuf_release(&dir);
+}
+
+static int fsmonitor_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "core.fsmonitor"))
+		return git_config_pathname(&core_fsmonitor, var, value);
+	return 0;
+}
+
+/*
+ * Called once the index has been read: trust the entries that were
+ * clean when the index was written, except for those the hook reports
+ * as changed since.  When the hook cannot tell, nothing is trusted.
+ */
+void tweak_fsmonitor(struct index_state *istate)
+{
+	uint64_t last_update = istate->fsmonitor_last_update;
+	struct strbuf out = STRBUF_INIT;
+	unsigned int i;
+	int answered = 0;
+	uint64_t now;
+	static int config_read;
+
+	/* the index may be read before the command reads its config */
+	if (!config_read) {
+		git_config(fsmonitor_config, NULL);
+		config_read = 1;
+	}
+	if (!core_fsmonitor) {
+		if (last_update)
+			istate->cache_changed = 1;
+		discard_fsmonitor(istate);
+		return;
+	}
+	if (!get_git_work_tree())
+		return;
+
+	if (last_update) {
+		for (i = 0; i < istate->cache_nr; i++)
+			if (!S_ISGITLINK(istate->cache[i]->ce_mode))
+				istate->cache[i]->ce_flags |= CE_FSMONITOR_VALID;
+		for (i = 0; i < istate->fsmonitor_dirty_nr; i++)
+			if (istate->fsmonitor_dirty[i] < istate->cache_nr)
+				istate->cache[istate->fsmonitor_dirty[i]]->ce_flags &=
+					~CE_FSMONITOR_VALID;
+	}
+	istate->fsmonitor_dirty_nr = 0;
+
+	/* anything that changes from now on is reported next time */
+	now = getnanotime();
+	if (last_update && !query_fsmonitor(last_update, &out)) {
+		const char *p = out.buf, *end = out.buf + out.len;
+
+		answered = 1;
+		while (p < end) {
+			size_t len = strlen(p);
+
+			if (!strcmp(p, "/")) {
+				answered = 0;
+				break;
+			}
+			if (len)
+				fsmonitor_refresh_path(istate, p);
+			p += len + 1;
+		}
+	}
+	strbuf_release(&out);
+
+	/*
+	 * Everything is checked this time; write the index out even when
+	 * nothing else changes, so that the next query starts from here.
+	 */
+	if (!answered) {
+		for (i = 0; i < istate->cache_nr; i++)
+			istate->cache[i]->ce_flags &= ~CE_FSMONITOR_VALID;
+		istate->cache_changed = 1;
+	}
+	istate->fsmonitor_answered = answered;
+	istate->fsmonitor_last_update = now;
+}
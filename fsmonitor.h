@@ -0,0 +1,26 @@
+#ifndef FSMONITOR_H
+#define FSMONITOR_H
+
+/*
+ * With core.fsmonitor set, git asks a hook which paths changed since
+ * the index was last written, instead of lstat()ing every path.  The
+ * index remembers when the hook was last asked, and which entries were
+ * not known to be clean at the time, in the "FSMN" extension.
+ */
+extern int read_fsmonitor_extension(struct index_state *, const void *, unsigned long);
+extern void fill_fsmonitor_dirty(struct index_state *);
+extern void write_fsmonitor_extension(struct strbuf *, struct index_state *);
+extern void discard_fsmonitor(struct index_state *);
+extern void tweak_fsmonitor(struct index_state *);
+
+/* Record that "ce" was found to match the work tree */
+static inline void mark_fsmonitor_valid(struct index_state *istate,
+					struct cache_entry *ce)
+{
+	if (core_fsmonitor && !(ce->ce_flags & CE_FSMONITOR_VALID)) {
+		ce->ce_flags |= CE_FSMONITOR_VALID;
+		istate->cache_changed = 1;
+	}
+}
+
+#endif
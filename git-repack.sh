@@ -16,6 +16,7 @@ n               do not run git-update-server-info
 q,quiet         be quiet
 l               pass --local to git-pack-objects
 unpack-unreachable=  with -A, do not loosen objects older than this
+geometric=      roll up small packs to keep sizes a factor of this apart
  Packing constraints
 window=         size of the window used for delta compression
 window-memory=  same as the above, but limit memory size instead of entries count
@@ -26,7 +27,7 @@ SUBDIRECTORY_OK='Yes'
 . git-sh-setup
 
 no_update_info= all_into_one= remove_redundant= unpack_unreachable=
-local= no_reuse= extra=
+local= no_reuse= extra= geometric=
 while test $# != 0
 do
 	case "$1" in
@@ -41,6 +42,8 @@ do
 	-f)	no_reuse=--no-reuse-delta ;;
 	-F)	no_reuse=--no-reuse-object ;;
 	-l)	local=--local ;;
+	--geometric)
+		geometric=$2; shift ;;
 	--max-pack-size|--window|--window-memory|--depth)
 		extra="$extra $1=$2"; shift ;;
 	--) shift; break;;
@@ -59,6 +62,17 @@ PACKTMP="$PACKDIR/.tmp-$$-pack"
 rm -f "$PACKTMP"-*
 trap 'rm -f "$PACKTMP"-*' 0 1 2 3 15
 
+if test -n "$geometric"
+then
+	case "$geometric" in
+	*[!0-9]*|0|1|'')
+		die "geometric factor must be an integer greater than one: $geometric" ;;
+	esac
+	test -z "$all_into_one" ||
+		die "--geometric cannot be used with -a or -A"
+	all_into_one=g
+fi
+
 # There will be more repacking strategies to come...
 case ",$all_into_one," in
 ,,)
@@ -88,6 +102,52 @@ case ",$all_into_one," in
 		fi
 	fi
 	;;
+,g,)
+	# Sort the packs by size and find the smallest prefix that,
+	# once rolled into one pack, leaves every remaining pack at
+	# least $geometric times larger than the one before it.  Only
+	# that prefix is rewritten; the larger packs are left alone.
+	args=--keep-unreachable existing=
+	if [ -d "$PACKDIR" ]; then
+		rollup=$(
+			cd "$PACKDIR" &&
+			for e in `find . -type f -name '*.pack' \
+				| sed -e 's/^\.\///' -e 's/\.pack$//'`
+			do
+				test -e "$e.keep" ||
+				echo "$(wc -c <"$e.pack") $e"
+			done |
+			sort -n |
+			awk -v factor="$geometric" '
+			{ size[NR] = $1; name[NR] = $2 }
+			END {
+				roll = 0
+				for (i = NR; i > 1; i--)
+					if (size[i] < factor * size[i - 1]) {
+						roll = i
+						break
+					}
+				total = 0
+				for (i = 1; i <= roll; i++)
+					total += size[i]
+				while (roll && roll < NR &&
+				       size[roll + 1] < factor * total) {
+					roll++
+					total += size[roll]
+				}
+				for (i = 1; i <= NR; i++)
+					print (i <= roll ? "+" : "-") name[i]
+			}'
+		) || exit
+		for e in $rollup
+		do
+			case "$e" in
+			+*)	existing="$existing ${e#+}" ;;
+			-*)	args="$args --keep-pack=${e#-}" ;;
+			esac
+		done
+	fi
+	;;
 esac
 
 mkdir -p "$PACKDIR" || exit
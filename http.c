@@ -1356,6 +1356,8 @@ int finish_http_object_request(struct http_object_request *freq)
 	}
 	freq->rename =
 		move_temp_to_file(freq->tmpfile, sha1_file_name(freq->sha1));
+	if (!freq->rename)
+		add_to_loose_object_cache(freq->sha1);
 
 	return freq->rename;
 }
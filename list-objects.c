@@ -7,6 +7,304 @@
 #include "tree-walk.h"
 #include "revision.h"
 #include "list-objects.h"
+#include "decorate.h"
+#include "thread-utils.h"
+
+#ifndef NO_PTHREADS
+
+/*
+ * With revs->traverse_threads > 1, a pool of threads reads trees ahead
+ * of the walk.  The walk itself, object flags and the callbacks all
+ * stay on the main thread, so objects are shown in exactly the same
+ * order as before; the threads only turn tree names into tree buffers.
+ * Pack access is still serialized by the object read lock, but the
+ * inflating and delta application it drops the lock for is where the
+ * time goes.
+ *
+ * Reading a tree queues its subtrees at the front of the queue, so
+ * that the threads work on what the depth-first walk needs next; the
+ * root trees of the commits are queued at the back while the commits
+ * are walked.  If the main thread gets to a tree that nobody has
+ * started on yet, it simply reads it itself.
+ */
+#define PREFETCH_MAX 1024
+
+enum prefetch_state {
+	PREFETCH_QUEUED,
+	PREFETCH_READING,
+	PREFETCH_DONE,
+	PREFETCH_TAKEN
+};
+
+struct prefetch_job {
+	unsigned char sha1[20];
+	enum prefetch_state state;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+};
+
+static struct prefetch_job *prefetch_jobs;
+static int prefetch_free[PREFETCH_MAX], nr_prefetch_free;
+static int prefetch_queue[PREFETCH_MAX], prefetch_head, nr_prefetch_queue;
+static int prefetch_stop;
+static pthread_t *prefetch_threads;
+static unsigned int *prefetch_counts;	/* trees read by each thread */
+static int nr_prefetch_threads;
+static pthread_mutex_t prefetch_mutex;
+static pthread_cond_t prefetch_added;
+static pthread_cond_t prefetch_done;
+
+/* main thread only */
+static struct decoration prefetched;
+static struct tree **prefetch_subtrees;
+static int nr_prefetch_subtrees, alloc_prefetch_subtrees;
+
+static void release_prefetch_job(struct prefetch_job *job)
+{
+	job->buf = NULL;
+	prefetch_free[nr_prefetch_free++] = job - prefetch_jobs;
+}
+
+static void *prefetch_thread(void *data)
+{
+	unsigned int *count = data;
+
+	pthread_mutex_lock(&prefetch_mutex);
+	for (;;) {
+		struct prefetch_job *job;
+		enum object_type type;
+		unsigned long size;
+		void *buf;
+
+		while (!nr_prefetch_queue && !prefetch_stop)
+			pthread_cond_wait(&prefetch_added, &prefetch_mutex);
+		if (prefetch_stop)
+			break;
+		job = prefetch_jobs + prefetch_queue[prefetch_head];
+		prefetch_head = (prefetch_head + 1) % PREFETCH_MAX;
+		nr_prefetch_queue--;
+		if (job->state == PREFETCH_TAKEN) {
+			release_prefetch_job(job);
+			continue;
+		}
+		job->state = PREFETCH_READING;
+		pthread_mutex_unlock(&prefetch_mutex);
+
+		obj_read_lock();
+		buf = read_sha1_file(job->sha1, &type, &size);
+		obj_read_unlock();
+
+		pthread_mutex_lock(&prefetch_mutex);
+		job->buf = buf;
+		job->type = type;
+		job->size = size;
+		job->state = PREFETCH_DONE;
+		(*count)++;
+		pthread_cond_broadcast(&prefetch_done);
+	}
+	pthread_mutex_unlock(&prefetch_mutex);
+	return NULL;
+}
+
+static void start_prefetch_threads(int nr)
+{
+	int i;
+
+	enable_obj_read_lock();
+	pthread_mutex_init(&prefetch_mutex, NULL);
+	pthread_cond_init(&prefetch_added, NULL);
+	pthread_cond_init(&prefetch_done, NULL);
+	prefetch_jobs = xcalloc(PREFETCH_MAX, sizeof(*prefetch_jobs));
+	for (i = 0; i < PREFETCH_MAX; i++)
+		prefetch_free[i] = PREFETCH_MAX - 1 - i;
+	nr_prefetch_free = PREFETCH_MAX;
+	prefetch_head = nr_prefetch_queue = 0;
+	prefetch_stop = 0;
+
+	prefetch_threads = xcalloc(nr, sizeof(*prefetch_threads));
+	prefetch_counts = xcalloc(nr, sizeof(*prefetch_counts));
+	for (i = 0; i < nr; i++) {
+		if (pthread_create(&prefetch_threads[i], NULL,
+				   prefetch_thread, &prefetch_counts[i]))
+			die("unable to create tree reading thread");
+	}
+	nr_prefetch_threads = nr;
+}
+
+static void finish_prefetch_threads(void)
+{
+	int i;
+
+	if (!nr_prefetch_threads)
+		return;
+	pthread_mutex_lock(&prefetch_mutex);
+	prefetch_stop = 1;
+	pthread_cond_broadcast(&prefetch_added);
+	pthread_mutex_unlock(&prefetch_mutex);
+	for (i = 0; i < nr_prefetch_threads; i++) {
+		pthread_join(prefetch_threads[i], NULL);
+		trace_printf("list-objects: tree thread %d: %u trees\n",
+			     i, prefetch_counts[i]);
+	}
+	free(prefetch_threads);
+	prefetch_threads = NULL;
+	free(prefetch_counts);
+	prefetch_counts = NULL;
+	nr_prefetch_threads = 0;
+
+	/* trees we queued but never got to */
+	for (i = 0; i < PREFETCH_MAX; i++)
+		if (prefetch_jobs[i].state == PREFETCH_DONE)
+			free(prefetch_jobs[i].buf);
+	free(prefetch_jobs);
+	prefetch_jobs = NULL;
+	free(prefetched.hash);
+	memset(&prefetched, 0, sizeof(prefetched));
+
+	pthread_cond_destroy(&prefetch_done);
+	pthread_cond_destroy(&prefetch_added);
+	pthread_mutex_destroy(&prefetch_mutex);
+	disable_obj_read_lock();
+}
+
+static int want_prefetch(struct tree *tree)
+{
+	return !tree->object.parsed &&
+		!(tree->object.flags & (UNINTERESTING | SEEN)) &&
+		!lookup_decoration(&prefetched, &tree->object);
+}
+
+/* called with prefetch_mutex held */
+static void queue_prefetch(struct tree *tree, int front)
+{
+	struct prefetch_job *job;
+	int slot = prefetch_free[--nr_prefetch_free];
+
+	job = prefetch_jobs + slot;
+	hashcpy(job->sha1, tree->object.sha1);
+	job->state = PREFETCH_QUEUED;
+	job->buf = NULL;
+	if (front) {
+		prefetch_head = (prefetch_head + PREFETCH_MAX - 1) % PREFETCH_MAX;
+		prefetch_queue[prefetch_head] = slot;
+	} else
+		prefetch_queue[(prefetch_head + nr_prefetch_queue) % PREFETCH_MAX] = slot;
+	nr_prefetch_queue++;
+	add_decoration(&prefetched, &tree->object, job);
+}
+
+/*
+ * Queue the root tree of a commit, leaving half of the slots for the
+ * subtrees the walk is about to need.
+ */
+static void prefetch_root_tree(struct tree *tree)
+{
+	if (!nr_prefetch_threads || !want_prefetch(tree))
+		return;
+	pthread_mutex_lock(&prefetch_mutex);
+	if (nr_prefetch_free > PREFETCH_MAX / 2) {
+		queue_prefetch(tree, 0);
+		pthread_cond_signal(&prefetch_added);
+	}
+	pthread_mutex_unlock(&prefetch_mutex);
+}
+
+/*
+ * Queue the subtrees of a freshly parsed tree in front of everything
+ * else, in the order the walk will visit them.
+ */
+static void prefetch_subtrees_of(struct tree *tree)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	int i;
+
+	if (!nr_prefetch_threads)
+		return;
+	nr_prefetch_subtrees = 0;
+	init_tree_desc(&desc, tree->buffer, tree->size);
+	while (tree_entry(&desc, &entry)) {
+		struct tree *subtree;
+		if (!S_ISDIR(entry.mode))
+			continue;
+		subtree = lookup_tree(entry.sha1);
+		if (!subtree || !want_prefetch(subtree))
+			continue;
+		ALLOC_GROW(prefetch_subtrees, nr_prefetch_subtrees + 1,
+			   alloc_prefetch_subtrees);
+		prefetch_subtrees[nr_prefetch_subtrees++] = subtree;
+	}
+	if (!nr_prefetch_subtrees)
+		return;
+
+	pthread_mutex_lock(&prefetch_mutex);
+	i = nr_prefetch_subtrees < nr_prefetch_free ?
+		nr_prefetch_subtrees : nr_prefetch_free;
+	while (i--)
+		queue_prefetch(prefetch_subtrees[i], 1);
+	pthread_cond_broadcast(&prefetch_added);
+	pthread_mutex_unlock(&prefetch_mutex);
+}
+
+/*
+ * parse_tree(), using the buffer a thread read for us if there is one.
+ * Called with the object read lock held.
+ */
+static int parse_prefetched_tree(struct tree *tree)
+{
+	struct prefetch_job *job;
+	enum object_type type = OBJ_NONE;
+	unsigned long size = 0;
+	void *buf = NULL;
+
+	if (!nr_prefetch_threads || tree->object.parsed)
+		return parse_tree(tree);
+	job = lookup_decoration(&prefetched, &tree->object);
+	if (!job)
+		return parse_tree(tree);
+	add_decoration(&prefetched, &tree->object, NULL);
+
+	pthread_mutex_lock(&prefetch_mutex);
+	if (job->state == PREFETCH_QUEUED)
+		job->state = PREFETCH_TAKEN; /* freed when dequeued */
+	else {
+		if (job->state == PREFETCH_READING) {
+			/* let the reader have the object store */
+			obj_read_unlock();
+			while (job->state == PREFETCH_READING)
+				pthread_cond_wait(&prefetch_done,
+						  &prefetch_mutex);
+			pthread_mutex_unlock(&prefetch_mutex);
+			obj_read_lock();
+			pthread_mutex_lock(&prefetch_mutex);
+		}
+		buf = job->buf;
+		type = job->type;
+		size = job->size;
+		release_prefetch_job(job);
+	}
+	pthread_mutex_unlock(&prefetch_mutex);
+
+	if (!buf)
+		return parse_tree(tree);
+	if (type != OBJ_TREE) {
+		free(buf);
+		return error("Object %s not a tree",
+			     sha1_to_hex(tree->object.sha1));
+	}
+	return parse_tree_buffer(tree, buf, size);
+}
+
+#else
+
+#define start_prefetch_threads(nr)
+#define finish_prefetch_threads()
+#define prefetch_root_tree(tree)
+#define prefetch_subtrees_of(tree)
+#define parse_prefetched_tree(tree) parse_tree(tree)
+
+#endif
 
 static void process_blob(struct rev_info *revs,
 			 struct blob *blob,
@@ -24,7 +322,9 @@ static void process_blob(struct rev_info *revs,
 	if (obj->flags & (UNINTERESTING | SEEN))
 		return;
 	obj->flags |= SEEN;
+	obj_read_lock();
 	show(obj, path, name, cb_data);
+	obj_read_unlock();
 }
 
 /*
@@ -81,10 +381,13 @@ static void process_tree(struct rev_info *revs,
 		die("bad tree object");
 	if (obj->flags & (UNINTERESTING | SEEN))
 		return;
-	if (parse_tree(tree) < 0)
+	obj_read_lock();
+	if (parse_prefetched_tree(tree) < 0)
 		die("bad tree object %s", sha1_to_hex(obj->sha1));
 	obj->flags |= SEEN;
 	show(obj, path, name, cb_data);
+	obj_read_unlock();
+	prefetch_subtrees_of(tree);
 	me.up = path;
 	me.elem = name;
 	me.elem_len = strlen(name);
@@ -175,15 +478,22 @@ void traverse_commit_list(struct rev_info *revs,
 	struct strbuf base;
 
 	strbuf_init(&base, PATH_MAX);
+	if (revs->traverse_threads > 1 && revs->tree_objects &&
+	    !revs->diffopt.pathspec.nr)
+		start_prefetch_threads(revs->traverse_threads);
+	obj_read_lock();
 	while ((commit = get_revision(revs)) != NULL) {
 		/*
 		 * an uninteresting boundary commit may not have its tree
 		 * parsed yet, but we are not going to show them anyway
 		 */
-		if (commit->tree)
+		if (commit->tree) {
 			add_pending_tree(revs, commit->tree);
+			prefetch_root_tree(commit->tree);
+		}
 		show_commit(commit, data);
 	}
+	obj_read_unlock();
 	for (i = 0; i < revs->pending.nr; i++) {
 		struct object_array_entry *pending = revs->pending.objects + i;
 		struct object *obj = pending->item;
@@ -192,7 +502,9 @@ void traverse_commit_list(struct rev_info *revs,
 			continue;
 		if (obj->type == OBJ_TAG) {
 			obj->flags |= SEEN;
+			obj_read_lock();
 			show_object(obj, NULL, name, data);
+			obj_read_unlock();
 			continue;
 		}
 		if (obj->type == OBJ_TREE) {
@@ -214,5 +526,6 @@ void traverse_commit_list(struct rev_info *revs,
 		revs->pending.alloc = 0;
 		revs->pending.objects = NULL;
 	}
+	finish_prefetch_threads();
 	strbuf_release(&base);
 }
@@ -220,6 +220,17 @@ int hold_lock_file_for_append(struct lock_file *lk, const char *path, int flags)
 	return fd;
 }
 
+/* The path of the lock file that is open as "fd", or NULL */
+const char *lock_file_name(int fd)
+{
+	struct lock_file *lk;
+
+	for (lk = lock_file_list; lk; lk = lk->next)
+		if (lk->fd == fd && lk->filename[0])
+			return lk->filename;
+	return NULL;
+}
+
 int close_lock_file(struct lock_file *lk)
 {
 	int fd = lk->fd;
@@ -5,8 +5,19 @@
 #include "commit.h"
 #include "tag.h"
 
-static struct object **obj_hash;
-static int nr_objs, obj_hash_size;
+/*
+ * Open-addressing hash of all objects, sized to a power of two.  Each
+ * slot keeps a second 32-bit word of the object name next to the
+ * pointer, so that probing past a colliding slot rarely has to touch
+ * the object itself.
+ */
+struct obj_hash_entry {
+	uint32_t check;
+	struct object *obj;
+};
+
+static struct obj_hash_entry *obj_hash;
+static unsigned int nr_objs, obj_hash_size;
 
 unsigned int get_max_object_index(void)
 {
@@ -15,7 +26,7 @@ unsigned int get_max_object_index(void)
 
 struct object *get_indexed_object(unsigned int idx)
 {
-	return obj_hash[idx];
+	return obj_hash[idx].obj;
 }
 
 static const char *object_type_strings[] = {
@@ -43,60 +54,52 @@ int type_from_string(const char *str)
 	die("invalid object type \"%s\"", str);
 }
 
-static unsigned int hash_obj(struct object *obj, unsigned int n)
+static inline unsigned int sha1_hash_word(const unsigned char *sha1, int n)
 {
-	unsigned int hash;
-	memcpy(&hash, obj->sha1, sizeof(unsigned int));
-	return hash % n;
+	uint32_t word;
+	memcpy(&word, sha1 + n * sizeof(word), sizeof(word));
+	return word;
 }
 
-static void insert_obj_hash(struct object *obj, struct object **hash, unsigned int size)
+static void insert_obj_hash(struct object *obj, struct obj_hash_entry *hash,
+			    unsigned int size)
 {
-	unsigned int j = hash_obj(obj, size);
+	unsigned int mask = size - 1;
+	unsigned int j = sha1_hash_word(obj->sha1, 0) & mask;
 
-	while (hash[j]) {
-		j++;
-		if (j >= size)
-			j = 0;
-	}
-	hash[j] = obj;
-}
-
-static unsigned int hashtable_index(const unsigned char *sha1)
-{
-	unsigned int i;
-	memcpy(&i, sha1, sizeof(unsigned int));
-	return i % obj_hash_size;
+	while (hash[j].obj)
+		j = (j + 1) & mask;
+	hash[j].check = sha1_hash_word(obj->sha1, 1);
+	hash[j].obj = obj;
 }
 
 struct object *lookup_object(const unsigned char *sha1)
 {
-	unsigned int i;
-	struct object *obj;
+	unsigned int i, mask, check;
+	struct obj_hash_entry *ent;
 
 	if (!obj_hash)
 		return NULL;
 
-	i = hashtable_index(sha1);
-	while ((obj = obj_hash[i]) != NULL) {
-		if (!hashcmp(sha1, obj->sha1))
+	mask = obj_hash_size - 1;
+	check = sha1_hash_word(sha1, 1);
+	i = sha1_hash_word(sha1, 0) & mask;
+	while ((ent = &obj_hash[i])->obj != NULL) {
+		if (ent->check == check && !hashcmp(sha1, ent->obj->sha1))
 			break;
-		i++;
-		if (i == obj_hash_size)
-			i = 0;
+		i = (i + 1) & mask;
 	}
-	return obj;
+	return ent->obj;
 }
 
-static void grow_object_hash(void)
+static void resize_object_hash(unsigned int new_hash_size)
 {
-	int i;
-	int new_hash_size = obj_hash_size < 32 ? 32 : 2 * obj_hash_size;
-	struct object **new_hash;
+	unsigned int i;
+	struct obj_hash_entry *new_hash;
 
-	new_hash = xcalloc(new_hash_size, sizeof(struct object *));
+	new_hash = xcalloc(new_hash_size, sizeof(*new_hash));
 	for (i = 0; i < obj_hash_size; i++) {
-		struct object *obj = obj_hash[i];
+		struct object *obj = obj_hash[i].obj;
 		if (!obj)
 			continue;
 		insert_obj_hash(obj, new_hash, new_hash_size);
@@ -106,6 +109,22 @@ static void grow_object_hash(void)
 	obj_hash_size = new_hash_size;
 }
 
+static void grow_object_hash(void)
+{
+	resize_object_hash(obj_hash_size < 32 ? 32 : 2 * obj_hash_size);
+}
+
+void presize_object_hash(unsigned int nr)
+{
+	unsigned int new_hash_size = 32;
+
+	/* keep the table at most half full, as create_object() does */
+	while (new_hash_size - 1 <= nr * 2)
+		new_hash_size *= 2;
+	if (obj_hash_size < new_hash_size)
+		resize_object_hash(new_hash_size);
+}
+
 void *create_object(const unsigned char *sha1, int type, void *o)
 {
 	struct object *obj = o;
@@ -116,7 +135,7 @@ void *create_object(const unsigned char *sha1, int type, void *o)
 	obj->flags = 0;
 	hashcpy(obj->sha1, sha1);
 
-	if (obj_hash_size - 1 <= nr_objs * 2)
+	if (obj_hash_size <= nr_objs * 2 + 1)
 		grow_object_hash();
 
 	insert_obj_hash(obj, obj_hash, obj_hash_size);
@@ -292,7 +311,7 @@ void clear_object_flags(unsigned flags)
 	int i;
 
 	for (i=0; i < obj_hash_size; i++) {
-		struct object *obj = obj_hash[i];
+		struct object *obj = obj_hash[i].obj;
 		if (obj)
 			obj->flags &= ~flags;
 	}
@@ -54,6 +54,12 @@ struct object *lookup_object(const unsigned char *sha1);
 
 extern void *create_object(const unsigned char *sha1, int type, void *obj);
 
+/*
+ * Make room in the object hash for "nr" objects up front, for callers
+ * that know roughly how many objects they are going to look at.
+ */
+extern void presize_object_hash(unsigned int nr);
+
 /** Returns the object, having parsed it to find out what it is. **/
 struct object *parse_object(const unsigned char *sha1);
 
@@ -42,6 +42,90 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 	return data_crc != ntohl(*index_crc);
 }
 
+/*
+ * Objects whose names are checked together, so that hash_sha1_files()
+ * can work on several of them at once.
+ */
+#define VERIFY_BATCH 32
+#define VERIFY_BATCH_SIZE (8 * 1024 * 1024)
+
+struct verify_batch {
+	struct hash_batch_item item[VERIFY_BATCH];
+	const unsigned char *sha1[VERIFY_BATCH];
+	enum object_type type[VERIFY_BATCH];
+	int nr;
+	unsigned long size;
+};
+
+static int verify_batch(struct packed_git *p, struct verify_batch *b,
+			verify_fn fn)
+{
+	int i, err = 0;
+
+	hash_sha1_files(b->item, b->nr);
+	for (i = 0; i < b->nr; i++) {
+		struct hash_batch_item *item = &b->item[i];
+		const unsigned char *sha1 = b->sha1[i];
+		void *data = (void *)item->buf;
+
+		if (hashcmp(item->sha1, sha1))
+			err = error("packed %s from %s is corrupt",
+				    sha1_to_hex(sha1), p->pack_name);
+		else if (fn) {
+			int eaten = 0;
+			fn(sha1, b->type[i], item->len, data, &eaten);
+			if (eaten)
+				data = NULL;
+		}
+		free(data);
+	}
+	b->nr = 0;
+	b->size = 0;
+	return err;
+}
+
+/*
+ * The objects are read with read_pack_batch(), which inflates them on
+ * several threads when it can, and hands them to verify_object() in
+ * no particular order.
+ */
+struct verify_state {
+	struct packed_git *p;
+	verify_fn fn;
+	struct verify_batch batch;
+	struct progress *progress;
+	uint32_t count;
+	int err;
+};
+
+static int verify_object(const unsigned char *sha1, enum object_type type,
+			 unsigned long size, void *data, void *cb_data)
+{
+	struct verify_state *vs = cb_data;
+	struct verify_batch *batch = &vs->batch;
+
+	if (!data)
+		vs->err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
+				sha1_to_hex(sha1), vs->p->pack_name,
+				(uintmax_t)find_pack_entry_one(sha1, vs->p));
+	else {
+		struct hash_batch_item *item = &batch->item[batch->nr];
+		item->buf = data;
+		item->len = size;
+		item->type = typename(type);
+		batch->sha1[batch->nr] = sha1;
+		batch->type[batch->nr] = type;
+		batch->nr++;
+		batch->size += size;
+	}
+	if (batch->nr == VERIFY_BATCH ||
+	    batch->size >= VERIFY_BATCH_SIZE)
+		vs->err |= verify_batch(vs->p, batch, vs->fn);
+	if ((++vs->count & 1023) == 0)
+		display_progress(vs->progress, vs->count);
+	return 0;
+}
+
 static int verify_packfile(struct packed_git *p,
 			   struct pack_window **w_curs,
 			   verify_fn fn,
@@ -56,6 +140,7 @@ static int verify_packfile(struct packed_git *p,
 	uint32_t nr_objects, i;
 	int err = 0;
 	struct idx_entry *entries;
+	struct verify_state vs;
 
 	/* Note that the pack header checks are actually performed by
 	 * use_pack when it first opens the pack file.  If anything
@@ -101,44 +186,30 @@ static int verify_packfile(struct packed_git *p,
 	}
 	qsort(entries, nr_objects, sizeof(*entries), compare_entries);
 
-	for (i = 0; i < nr_objects; i++) {
-		void *data;
-		enum object_type type;
-		unsigned long size;
-
-		if (p->index_version > 1) {
-			off_t offset = entries[i].offset;
-			off_t len = entries[i+1].offset - offset;
-			unsigned int nr = entries[i].nr;
-			if (check_pack_crc(p, w_curs, offset, len, nr))
-				err = error("index CRC mismatch for object %s "
-					    "from %s at offset %"PRIuMAX"",
-					    sha1_to_hex(entries[i].sha1),
-					    p->pack_name, (uintmax_t)offset);
-		}
-		data = unpack_entry(p, entries[i].offset, &type, &size);
-		if (!data)
-			err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
-				    sha1_to_hex(entries[i].sha1), p->pack_name,
-				    (uintmax_t)entries[i].offset);
-		else if (check_sha1_signature(entries[i].sha1, data, size, typename(type)))
-			err = error("packed %s from %s is corrupt",
-				    sha1_to_hex(entries[i].sha1), p->pack_name);
-		else if (fn) {
-			int eaten = 0;
-			fn(entries[i].sha1, type, size, data, &eaten);
-			if (eaten)
-				data = NULL;
-		}
-		if (((base_count + i) & 1023) == 0)
-			display_progress(progress, base_count + i);
-		free(data);
-
+	for (i = 0; p->index_version > 1 && i < nr_objects; i++) {
+		off_t offset = entries[i].offset;
+		off_t len = entries[i+1].offset - offset;
+		unsigned int nr = entries[i].nr;
+		if (check_pack_crc(p, w_curs, offset, len, nr))
+			err = error("index CRC mismatch for object %s "
+				    "from %s at offset %"PRIuMAX"",
+				    sha1_to_hex(entries[i].sha1),
+				    p->pack_name, (uintmax_t)offset);
 	}
-	display_progress(progress, base_count + i);
 	free(entries);
+	unuse_pack(w_curs);
 
-	return err;
+	memset(&vs, 0, sizeof(vs));
+	vs.p = p;
+	vs.fn = fn;
+	vs.progress = progress;
+	vs.count = base_count;
+	read_pack_batch(p, verify_object, &vs);
+	if (vs.batch.nr)
+		vs.err |= verify_batch(p, &vs.batch, fn);
+	display_progress(progress, vs.count);
+
+	return err | vs.err;
 }
 
 int verify_pack_index(struct packed_git *p)
@@ -84,6 +84,7 @@ const char *write_idx_file(const char *index_name, struct pack_idx_entry **objec
 			die_errno("unable to create '%s'", index_name);
 		f = sha1fd(fd, index_name);
 	}
+	sha1file_background(f);
 
 	/* if last object's offset is >= 2^31 we should use index V2 */
 	index_version = need_large_offset(last_obj_offset, opts) ? 2 : opts->version;
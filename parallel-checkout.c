@@ -0,0 +1,291 @@
+/*
+ * Check out many files at once.
+ *
+ * Checking out a file is mostly waiting: for the blob to be inflated
+ * and for the file system to create and write the file.  The main
+ * thread still goes through the entries in index order and does all
+ * that depends on the order: removing what is in the way, creating the
+ * leading directories and looking up attributes.  Regular files are
+ * then handed to a pool of threads that read, convert and write them.
+ *
+ * The main thread checks out the rest itself once the threads are done:
+ * symlinks, gitlinks, files that need a filter driver or "ident", blobs
+ * large enough to be streamed, and files that collided with another one
+ * written at the same time (as on a case insensitive file system).
+ * Paths that are the same file on disk thus do not end up written in
+ * index order, and which of them is left in the work tree depends on
+ * who got there first.
+ */
+#include "cache.h"
+#include "progress.h"
+#include "parallel-checkout.h"
+
+/* fewer files than this per thread are not worth a thread */
+#define FILES_PER_THREAD 100
+#define MAX_THREADS 32
+
+#ifdef NO_PTHREADS
+
+int parallel_checkout_threads(struct index_state *index)
+{
+	return 1;
+}
+
+int checkout_entries_parallel(struct index_state *index,
+			      const struct checkout *state,
+			      int threads, struct progress *progress,
+			      unsigned *cnt)
+{
+	die("BUG: parallel checkout without thread support");
+}
+
+#else
+
+#include <pthread.h>
+#include "thread-utils.h"
+
+enum item_status {
+	ITEM_PENDING,
+	ITEM_WRITTEN,
+	ITEM_FAILED,
+	ITEM_SERIAL,	/* for the main thread from the start */
+	ITEM_RETRY	/* given back to the main thread */
+};
+
+struct checkout_item {
+	struct cache_entry *ce;
+	struct conv_attrs ca;
+	enum item_status status;
+	int stat_done;
+	struct stat st;
+};
+
+static struct checkout_item *items;
+static unsigned int nr_queued, next_item, nr_done;
+static int queue_closed;
+static const struct checkout *checkout_state;
+static pthread_mutex_t queue_mutex;
+static pthread_cond_t queue_added;
+static pthread_cond_t item_done;
+
+static unsigned int count_updates(struct index_state *index)
+{
+	unsigned int i, nr = 0;
+
+	for (i = 0; i < index->cache_nr; i++)
+		if (index->cache[i]->ce_flags & CE_UPDATE)
+			nr++;
+	return nr;
+}
+
+int parallel_checkout_threads(struct index_state *index)
+{
+	int threads = checkout_threads;
+	unsigned int max;
+
+	if (threads == 1)
+		return 1;
+	if (threads <= 0)
+		threads = online_cpus();
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+	max = count_updates(index) / FILES_PER_THREAD;
+	if (threads > max)
+		threads = max;
+	return threads < 1 ? 1 : threads;
+}
+
+static void write_item(struct checkout_item *item)
+{
+	struct cache_entry *ce = item->ce;
+	struct strbuf buf = STRBUF_INIT;
+	enum object_type type;
+	unsigned long size;
+	size_t wrote, newsize;
+	void *data = NULL;
+	int fd;
+
+	obj_read_lock();
+	type = sha1_object_info(ce->sha1, &size);
+	if (type == OBJ_BLOB && size <= big_file_threshold)
+		data = read_sha1_file(ce->sha1, &type, &size);
+	obj_read_unlock();
+	if (!data || type != OBJ_BLOB) {
+		/* checkout_entry() streams it, or reports the error */
+		free(data);
+		item->status = ITEM_RETRY;
+		return;
+	}
+
+	if (convert_to_working_tree_ca(&item->ca, ce->name, data, size, &buf)) {
+		free(data);
+		data = strbuf_detach(&buf, &newsize);
+		size = newsize;
+	}
+
+	fd = open(ce->name, O_WRONLY | O_CREAT | O_EXCL,
+		  (ce->ce_mode & 0100) ? 0777 : 0666);
+	if (fd < 0) {
+		free(data);
+		if (errno == EEXIST) {
+			/* another entry is there, under a different name */
+			item->status = ITEM_RETRY;
+			return;
+		}
+		error("unable to create file %s (%s)", ce->name, strerror(errno));
+		item->status = ITEM_FAILED;
+		return;
+	}
+	wrote = write_in_full(fd, data, size);
+	if (checkout_state->refresh_cache && fstat_is_reliable())
+		item->stat_done = !fstat(fd, &item->st);
+	close(fd);
+	free(data);
+	if (wrote != size) {
+		error("unable to write file %s", ce->name);
+		item->status = ITEM_FAILED;
+		return;
+	}
+	if (checkout_state->refresh_cache && !item->stat_done)
+		item->stat_done = !lstat(ce->name, &item->st);
+	item->status = ITEM_WRITTEN;
+}
+
+static void *checkout_thread(void *data)
+{
+	pthread_mutex_lock(&queue_mutex);
+	for (;;) {
+		struct checkout_item *item;
+
+		while (next_item == nr_queued && !queue_closed)
+			pthread_cond_wait(&queue_added, &queue_mutex);
+		if (next_item == nr_queued)
+			break;
+		item = items + next_item++;
+		if (item->status != ITEM_PENDING)
+			continue;
+		pthread_mutex_unlock(&queue_mutex);
+
+		write_item(item);
+
+		pthread_mutex_lock(&queue_mutex);
+		nr_done++;
+		pthread_cond_signal(&item_done);
+	}
+	pthread_mutex_unlock(&queue_mutex);
+	return NULL;
+}
+
+int checkout_entries_parallel(struct index_state *index,
+			      const struct checkout *state,
+			      int threads, struct progress *progress,
+			      unsigned *cnt)
+{
+	pthread_t *thread;
+	unsigned int i, nr_items = 0, nr_pending = 0, nr_written = 0, done;
+	int errs = 0;
+
+	if (state->base_dir_len)
+		die("BUG: parallel checkout into a prefix");
+
+	items = xcalloc(count_updates(index), sizeof(*items));
+	nr_queued = next_item = nr_done = 0;
+	queue_closed = 0;
+	checkout_state = state;
+	enable_obj_read_lock();
+	pthread_mutex_init(&queue_mutex, NULL);
+	pthread_cond_init(&queue_added, NULL);
+	pthread_cond_init(&item_done, NULL);
+	thread = xcalloc(threads, sizeof(*thread));
+	for (i = 0; i < threads; i++)
+		if (pthread_create(&thread[i], NULL, checkout_thread, NULL))
+			die("unable to create checkout thread");
+
+	for (i = 0; i < index->cache_nr; i++) {
+		struct cache_entry *ce = index->cache[i];
+		struct checkout_item *item = items + nr_items;
+		int ret;
+
+		if (!(ce->ce_flags & CE_UPDATE))
+			continue;
+		ce->ce_flags &= ~CE_UPDATE;
+		item->ce = ce;
+		if (!S_ISREG(ce->ce_mode)) {
+			item->status = ITEM_SERIAL;
+		} else {
+			/* these may read .gitattributes blobs, among others */
+			obj_read_lock();
+			ret = prepare_checkout_entry(ce, state);
+			if (ret > 0)
+				convert_attrs(&item->ca, ce->name);
+			obj_read_unlock();
+			if (ret <= 0) {
+				errs |= ret;
+				display_progress(progress, ++*cnt);
+				continue;
+			}
+			if (item->ca.drv || item->ca.ident)
+				item->status = ITEM_SERIAL;
+			else
+				nr_pending++;
+		}
+		nr_items++;
+
+		pthread_mutex_lock(&queue_mutex);
+		nr_queued = nr_items;
+		done = nr_done;
+		pthread_cond_signal(&queue_added);
+		pthread_mutex_unlock(&queue_mutex);
+		display_progress(progress, *cnt + done);
+	}
+
+	pthread_mutex_lock(&queue_mutex);
+	queue_closed = 1;
+	pthread_cond_broadcast(&queue_added);
+	while (nr_done < nr_pending) {
+		pthread_cond_wait(&item_done, &queue_mutex);
+		done = nr_done;
+		pthread_mutex_unlock(&queue_mutex);
+		display_progress(progress, *cnt + done);
+		pthread_mutex_lock(&queue_mutex);
+	}
+	pthread_mutex_unlock(&queue_mutex);
+	for (i = 0; i < threads; i++)
+		pthread_join(thread[i], NULL);
+	free(thread);
+	pthread_cond_destroy(&item_done);
+	pthread_cond_destroy(&queue_added);
+	pthread_mutex_destroy(&queue_mutex);
+	disable_obj_read_lock();
+	*cnt += nr_pending;
+
+	for (i = 0; i < nr_items; i++) {
+		struct checkout_item *item = items + i;
+
+		switch (item->status) {
+		case ITEM_WRITTEN:
+			nr_written++;
+			if (item->stat_done)
+				fill_stat_cache_info(item->ce, &item->st);
+			break;
+		case ITEM_FAILED:
+			errs = -1;
+			break;
+		case ITEM_SERIAL:
+			display_progress(progress, ++*cnt);
+			/* fallthrough */
+		case ITEM_RETRY:
+			errs |= checkout_entry(item->ce, state, NULL);
+			break;
+		default:
+			die("BUG: checkout of %s left pending", item->ce->name);
+		}
+	}
+	free(items);
+	items = NULL;
+	trace_printf("parallel-checkout: %u files, %u written on %d threads\n",
+		     nr_items, nr_written, threads);
+	return errs;
+}
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef PARALLEL_CHECKOUT_H
+#define PARALLEL_CHECKOUT_H
+
+struct progress;
+
+/*
+ * How many threads to check out the entries of "index" marked CE_UPDATE
+ * with; 1 means they are better checked out one by one.
+ */
+extern int parallel_checkout_threads(struct index_state *index);
+
+/*
+ * Check out the entries of "index" marked CE_UPDATE and clear the mark,
+ * with the same result as calling checkout_entry() on each in turn,
+ * unless two of them are the same file on disk (as on a case insensitive
+ * file system).  One by one, the last of those in the index would be
+ * left in the work tree; here it can be any of them.  "cnt" counts them
+ * for "progress" as they are done.  Returns non-zero if any of them
+ * failed.
+ */
+extern int checkout_entries_parallel(struct index_state *index,
+				     const struct checkout *state,
+				     int threads, struct progress *progress,
+				     unsigned *cnt);
+
+#endif
@@ -1,5 +1,6 @@
 #include "cache.h"
 #include "pkt-line.h"
+#include "sideband.h"
 
 static const char *packet_trace_prefix = "git";
 static const char trace_key[] = "GIT_TRACE_PACKET";
@@ -135,12 +136,83 @@ void packet_buf_write(struct strbuf *buf, const char *fmt, ...)
 	strbuf_add(buf, buffer, n);
 }
 
+/*
+ * The *_gently() functions are for talking to a process that may go
+ * away or misbehave (e.g. a filter process): they report an error and
+ * return -1 rather than die.
+ */
+int packet_flush_gently(int fd)
+{
+	packet_trace("0000", 4, 1);
+	if (write_in_full(fd, "0000", 4) < 0)
+		return error("flush packet write failed: %s", strerror(errno));
+	return 0;
+}
+
+static int packet_write_data_gently(int fd, const char *data, size_t len)
+{
+	static char packet[LARGE_PACKET_MAX];
+	static char hexchar[] = "0123456789abcdef";
+	size_t n = len + 4;
+
+	if (n > sizeof(packet))
+		return error("protocol error: impossibly long line");
+	packet[0] = hex(n >> 12);
+	packet[1] = hex(n >> 8);
+	packet[2] = hex(n >> 4);
+	packet[3] = hex(n);
+	memcpy(packet + 4, data, len);
+	packet_trace(data, len, 1);
+	if (write_in_full(fd, packet, n) < 0)
+		return error("packet write failed: %s", strerror(errno));
+	return 0;
+}
+
+int packet_write_gently(int fd, const char *fmt, ...)
+{
+	struct strbuf line = STRBUF_INIT;
+	va_list args;
+	int ret;
+
+	va_start(args, fmt);
+	strbuf_vaddf(&line, fmt, args);
+	va_end(args);
+	ret = packet_write_data_gently(fd, line.buf, line.len);
+	strbuf_release(&line);
+	return ret;
+}
+
+int write_packetized_from_buf(const char *src, size_t len, int fd)
+{
+	size_t max = LARGE_PACKET_MAX - 4;
+
+	while (len) {
+		size_t n = len < max ? len : max;
+
+		if (packet_write_data_gently(fd, src, n))
+			return -1;
+		src += n;
+		len -= n;
+	}
+	return packet_flush_gently(fd);
+}
+
+/* How gentle packet_read_internal() is */
+#define PACKET_READ_DIE 0
+#define PACKET_READ_RETURN_ON_EOF 1	/* -1 when the other end hung up */
+#define PACKET_READ_GENTLE 2		/* -1 on any error, with error() */
+
 static int safe_read(int fd, void *buffer, unsigned size, int return_line_fail)
 {
 	ssize_t ret = read_in_full(fd, buffer, size);
-	if (ret < 0)
+	if (ret < 0) {
+		if (return_line_fail == PACKET_READ_GENTLE)
+			return error("read error: %s", strerror(errno));
 		die_errno("read error");
+	}
 	else if (ret < size) {
+		if (return_line_fail == PACKET_READ_GENTLE)
+			return error("the other end hung up unexpectedly");
 		if (return_line_fail)
 			return -1;
 
@@ -184,15 +256,21 @@ static int packet_read_internal(int fd, char *buffer, unsigned size, int return_
 	if (return_line_fail && ret < 0)
 		return ret;
 	len = packet_length(linelen);
-	if (len < 0)
+	if (len < 0) {
+		if (return_line_fail == PACKET_READ_GENTLE)
+			return error("protocol error: bad line length character: %.4s", linelen);
 		die("protocol error: bad line length character: %.4s", linelen);
+	}
 	if (!len) {
 		packet_trace("0000", 4, 0);
 		return 0;
 	}
 	len -= 4;
-	if (len >= size)
+	if (len < 0 || len >= size) {
+		if (return_line_fail == PACKET_READ_GENTLE)
+			return error("protocol error: bad line length %d", len);
 		die("protocol error: bad line length %d", len);
+	}
 	ret = safe_read(fd, buffer, len, return_line_fail);
 	if (return_line_fail && ret < 0)
 		return ret;
@@ -203,12 +281,37 @@ static int packet_read_internal(int fd, char *buffer, unsigned size, int return_
 
 int packet_read(int fd, char *buffer, unsigned size)
 {
-	return packet_read_internal(fd, buffer, size, 1);
+	return packet_read_internal(fd, buffer, size, PACKET_READ_RETURN_ON_EOF);
 }
 
 int packet_read_line(int fd, char *buffer, unsigned size)
 {
-	return packet_read_internal(fd, buffer, size, 0);
+	return packet_read_internal(fd, buffer, size, PACKET_READ_DIE);
+}
+
+int packet_read_gently(int fd, char *buffer, unsigned size)
+{
+	return packet_read_internal(fd, buffer, size, PACKET_READ_GENTLE);
+}
+
+ssize_t read_packetized_to_strbuf(int fd, struct strbuf *sb)
+{
+	size_t orig_len = sb->len;
+	int len;
+
+	for (;;) {
+		strbuf_grow(sb, LARGE_PACKET_MAX);
+		len = packet_read_gently(fd, sb->buf + sb->len,
+					 LARGE_PACKET_MAX);
+		if (len <= 0)
+			break;
+		strbuf_setlen(sb, sb->len + len);
+	}
+	if (len < 0) {
+		strbuf_setlen(sb, orig_len);
+		return -1;
+	}
+	return sb->len - orig_len;
 }
 
 int packet_get_line(struct strbuf *out,
@@ -15,6 +15,21 @@ void packet_buf_write(struct strbuf *buf, const char *fmt, ...) __attribute__((f
 int packet_read_line(int fd, char *buffer, unsigned size);
 int packet_read(int fd, char *buffer, unsigned size);
 int packet_get_line(struct strbuf *out, char **src_buf, size_t *src_len);
+
+/*
+ * Like the above, but report an error and return -1 rather than die
+ * when the other end misbehaves or goes away.
+ */
+int packet_flush_gently(int fd);
+int packet_write_gently(int fd, const char *fmt, ...) __attribute__((format (printf, 2, 3)));
+int packet_read_gently(int fd, char *buffer, unsigned size);
+
+/*
+ * Send "src" as a series of packets followed by a flush packet, and
+ * read such a series into "sb", returning how much was read.
+ */
+int write_packetized_from_buf(const char *src, size_t len, int fd);
+ssize_t read_packetized_to_strbuf(int fd, struct strbuf *sb);
 ssize_t safe_write(int, const void *, ssize_t);
 
 #endif
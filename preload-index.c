@@ -2,48 +2,75 @@
  * Copyright (C) 2008 Linus Torvalds
  */
 #include "cache.h"
+#include "fsmonitor.h"
 
 #ifdef NO_PTHREADS
-static void preload_index(struct index_state *index, const char **pathspec)
+void preload_index(struct index_state *index, const char **pathspec)
 {
 	; /* nothing */
 }
 #else
 
 #include <pthread.h>
+#include "thread-utils.h"
 
 /*
- * Mostly randomly chosen maximum thread counts: we
- * cap the parallelism to 20 threads, and we want
- * to have at least 500 lstat's per thread for it to
- * be worth starting a thread.
+ * The threads take small batches of entries in turn, so that a slow
+ * directory (a huge one, or one on a slow mount) only holds up the
+ * thread that is in it.
+ *
+ * How many threads to start is decided from how long the lstat()s of
+ * the first entries took.  Quick ones are bound by the CPUs, so there
+ * is one thread per CPU at most; slow ones mostly wait for the file
+ * system, and up to MAX_PARALLEL threads can wait at the same time.
+ * Either way, a thread has to have at least THREAD_COST_NS worth of
+ * lstat()s to do to be worth starting.  GIT_FORCE_THREADS starts one
+ * thread per batch that is left, up to MAX_PARALLEL, whatever the cost.
  */
 #define MAX_PARALLEL (20)
-#define THREAD_COST (500)
+#define BATCH_SIZE (64)
+#define SAMPLE_LSTATS (64)
+#define THREAD_COST_NS (500 * 1000)
+#define SLOW_LSTAT_NS (50 * 1000)
 
-struct thread_data {
-	pthread_t pthread;
+struct preload_state {
 	struct index_state *index;
 	const char **pathspec;
-	int offset, nr;
+	pthread_mutex_t mutex;
+	unsigned int next;	/* the first entry nobody took yet */
 };
 
-static void *preload_thread(void *_data)
-{
-	int nr;
-	struct thread_data *p = _data;
-	struct index_state *index = p->index;
-	struct cache_entry **cep = index->cache + p->offset;
-	struct cache_def cache;
+struct thread_data {
+	pthread_t pthread;
+	struct preload_state *state;
 	struct pathspec pathspec;
+	struct cache_def cache;
+	unsigned int batches, lstats;
+};
 
-	init_pathspec(&pathspec, p->pathspec);
-	memset(&cache, 0, sizeof(cache));
-	nr = p->nr;
-	if (nr + p->offset > index->cache_nr)
-		nr = index->cache_nr - p->offset;
+/* Take the next batch; returns how many entries it has */
+static unsigned int next_batch(struct preload_state *state, unsigned int *offset)
+{
+	unsigned int nr;
+
+	pthread_mutex_lock(&state->mutex);
+	*offset = state->next;
+	nr = state->index->cache_nr - state->next;
+	if (nr > BATCH_SIZE)
+		nr = BATCH_SIZE;
+	state->next += nr;
+	pthread_mutex_unlock(&state->mutex);
+	return nr;
+}
+
+static void preload_batch(struct thread_data *p, unsigned int offset,
+			  unsigned int nr)
+{
+	struct index_state *index = p->state->index;
+	struct cache_entry **cep = index->cache + offset;
 
-	do {
+	p->batches++;
+	while (nr--) {
 		struct cache_entry *ce = *cep++;
 		struct stat st;
 
@@ -53,50 +80,117 @@ static void *preload_thread(void *_data)
 			continue;
 		if (ce_uptodate(ce))
 			continue;
-		if (!ce_path_match(ce, &pathspec))
+		if (ce->ce_flags & CE_FSMONITOR_VALID)
 			continue;
-		if (threaded_has_symlink_leading_path(&cache, ce->name, ce_namelen(ce)))
+		if (!ce_path_match(ce, &p->pathspec))
 			continue;
+		if (threaded_has_symlink_leading_path(&p->cache, ce->name, ce_namelen(ce)))
+			continue;
+		p->lstats++;
 		if (lstat(ce->name, &st))
 			continue;
 		if (ie_match_stat(index, ce, &st, CE_MATCH_RACY_IS_DIRTY))
 			continue;
 		ce_mark_uptodate(ce);
-	} while (--nr > 0);
-	free_pathspec(&pathspec);
+		mark_fsmonitor_valid(index, ce);
+	}
+}
+
+static void *preload_thread(void *_data)
+{
+	struct thread_data *p = _data;
+	unsigned int offset, nr;
+
+	while ((nr = next_batch(p->state, &offset)) > 0)
+		preload_batch(p, offset, nr);
 	return NULL;
 }
 
-static void preload_index(struct index_state *index, const char **pathspec)
+static void init_thread_data(struct thread_data *p, struct preload_state *state)
+{
+	memset(p, 0, sizeof(*p));
+	p->state = state;
+	init_pathspec(&p->pathspec, state->pathspec);
+}
+
+static int preload_threads(struct preload_state *state, uint64_t sample_ns,
+			   unsigned int sample_lstats)
+{
+	uint64_t lstat_ns, left_ns;
+	unsigned int left = state->index->cache_nr - state->next;
+	int threads, max;
+
+	if (!left)
+		return 1;
+	if (getenv("GIT_FORCE_THREADS")) {
+		threads = (left + BATCH_SIZE - 1) / BATCH_SIZE;
+		return threads > MAX_PARALLEL ? MAX_PARALLEL : threads;
+	}
+	if (!sample_lstats)
+		return 1;
+	lstat_ns = sample_ns / sample_lstats;
+	left_ns = lstat_ns * left;
+	max = lstat_ns < SLOW_LSTAT_NS ? online_cpus() : MAX_PARALLEL;
+	if (max > MAX_PARALLEL)
+		max = MAX_PARALLEL;
+	threads = max;
+	if (left_ns / THREAD_COST_NS < threads)
+		threads = left_ns / THREAD_COST_NS;
+	return threads < 1 ? 1 : threads;
+}
+
+void preload_index(struct index_state *index, const char **pathspec)
 {
-	int threads, i, work, offset;
+	struct preload_state state;
 	struct thread_data data[MAX_PARALLEL];
+	unsigned int offset, nr, sample_lstats, lstats = 0;
+	uint64_t start, sample_ns;
+	int threads, i;
 
-	if (!core_preload_index)
+	if (!core_preload_index || index->cache_nr < 2 * BATCH_SIZE)
 		return;
 
-	threads = index->cache_nr / THREAD_COST;
-	if (threads < 2)
-		return;
-	if (threads > MAX_PARALLEL)
-		threads = MAX_PARALLEL;
-	offset = 0;
-	work = DIV_ROUND_UP(index->cache_nr, threads);
-	for (i = 0; i < threads; i++) {
-		struct thread_data *p = data+i;
-		p->index = index;
-		p->pathspec = pathspec;
-		p->offset = offset;
-		p->nr = work;
-		offset += work;
+	start = getnanotime();
+	state.index = index;
+	state.pathspec = pathspec;
+	state.next = 0;
+	pthread_mutex_init(&state.mutex, NULL);
+
+	/* time the first lstat()s; this thread is one of the workers */
+	init_thread_data(&data[0], &state);
+	while (data[0].lstats < SAMPLE_LSTATS &&
+	       (nr = next_batch(&state, &offset)) > 0)
+		preload_batch(&data[0], offset, nr);
+	sample_ns = getnanotime() - start;
+	sample_lstats = data[0].lstats;
+	threads = preload_threads(&state, sample_ns, sample_lstats);
+
+	for (i = 1; i < threads; i++) {
+		struct thread_data *p = data + i;
+
+		init_thread_data(p, &state);
 		if (pthread_create(&p->pthread, NULL, preload_thread, p))
 			die("unable to create threaded lstat");
 	}
-	for (i = 0; i < threads; i++) {
-		struct thread_data *p = data+i;
+	preload_thread(&data[0]);
+	for (i = 1; i < threads; i++) {
+		struct thread_data *p = data + i;
 		if (pthread_join(p->pthread, NULL))
 			die("unable to join threaded lstat");
 	}
+
+	for (i = 0; i < threads; i++) {
+		trace_printf("preload-index: thread %d: %u batches, "
+			     "%u lstats\n", i, data[i].batches, data[i].lstats);
+		lstats += data[i].lstats;
+		free_pathspec(&data[i].pathspec);
+	}
+	trace_printf("preload-index: %u entries, %u lstats, %d threads, "
+		     "%"PRIuMAX" ns per lstat sampled, %"PRIuMAX" us in all\n",
+		     index->cache_nr, lstats, threads,
+		     (uintmax_t)(sample_lstats ? sample_ns / sample_lstats : 0),
+		     (uintmax_t)((getnanotime() - start) / 1000));
+	pthread_mutex_destroy(&state.mutex);
 }
 #endif
 
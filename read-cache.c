@@ -14,6 +14,13 @@
 #include "resolve-undo.h"
 #include "strbuf.h"
 #include "varint.h"
+#include "csum-file.h"
+#include "split-index.h"
+#include "fsmonitor.h"
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#include "thread-utils.h"
+#endif
 
 static struct cache_entry *refresh_cache_entry(struct cache_entry *ce, int really);
 
@@ -33,6 +40,11 @@ static struct cache_entry *refresh_cache_entry(struct cache_entry *ce, int reall
 #define CACHE_EXT(s) ( (s[0]<<24)|(s[1]<<16)|(s[2]<<8)|(s[3]) )
 #define CACHE_EXT_TREE 0x54524545	/* "TREE" */
 #define CACHE_EXT_RESOLVE_UNDO 0x52455543 /* "REUC" */
+#define CACHE_EXT_LINK 0x6c696e6b	  /* "link" */
+#define CACHE_EXT_UNTRACKED 0x554e5452	  /* "UNTR" */
+#define CACHE_EXT_FSMONITOR 0x46534d4e	  /* "FSMN" */
+#define CACHE_EXT_ENTRY_OFFSETS 0x49454f54  /* "IEOT" */
+#define CACHE_EXT_END_OF_ENTRIES 0x454f4945 /* "EOIE" */
 
 struct index_state the_index;
 
@@ -63,6 +75,7 @@ void rename_index_entry_at(struct index_state *istate, int nr, const char *new_n
 	memcpy(new->name, new_name, namelen + 1);
 
 	cache_tree_invalidate_path(istate->cache_tree, old->name);
+	untracked_cache_invalidate_path(istate, old->name);
 	remove_index_entry_at(istate, nr);
 	add_index_entry(istate, new, ADD_CACHE_OK_TO_ADD|ADD_CACHE_OK_TO_REPLACE);
 }
@@ -235,7 +248,7 @@ static int ce_match_stat_basic(struct cache_entry *ce, struct stat *st)
 	return changed;
 }
 
-static int is_racy_timestamp(const struct index_state *istate, struct cache_entry *ce)
+int is_racy_timestamp(const struct index_state *istate, struct cache_entry *ce)
 {
 	return (!S_ISGITLINK(ce->ce_mode) &&
 		istate->timestamp.sec &&
@@ -495,6 +508,7 @@ int remove_path_from_index(struct index_state *idx, const char *path) {
 	if (i >= 0) {
 		/* file */
 		cache_tree_invalidate_path(idx->cache_tree, path);
+		untracked_cache_invalidate_path(idx, path);
 		remove_index_entry_at(idx, i);
 		return 0;
 	}
@@ -522,6 +536,7 @@ int remove_path_from_index(struct index_state *idx, const char *path) {
 	if (!ret) return -1;
 
 	cache_tree_invalidate_path(idx->cache_tree, path);
+	untracked_cache_invalidate_path(idx, path);
 	remove_marked_cache_entries(idx);
 	return 0;
 }
@@ -532,6 +547,7 @@ int remove_file_from_index(struct index_state *istate, const char *path)
 	if (pos < 0)
 		pos = -pos-1;
 	cache_tree_invalidate_path(istate->cache_tree, path);
+	untracked_cache_invalidate_path(istate, path);
 	while (pos < istate->cache_nr && !strcmp(istate->cache[pos]->name, path))
 		remove_index_entry_at(istate, pos);
 	return 0;
@@ -958,6 +974,7 @@ static int add_index_entry_with_check(struct index_state *istate, struct cache_e
 	int new_only = option & ADD_CACHE_NEW_ONLY;
 
 	cache_tree_invalidate_path(istate->cache_tree, ce->name);
+	untracked_cache_invalidate_path(istate, ce->name);
 	pos = index_name_stage_pos(istate, ce->name, ce_namelen(ce), ce_stage(ce));
 
 	/* existing match? Just replace it. */
@@ -1066,6 +1083,11 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 		ce_mark_uptodate(ce);
 		return ce;
 	}
+	/* nor does a path the file system monitor saw no change to */
+	if (!ignore_valid && (ce->ce_flags & CE_FSMONITOR_VALID)) {
+		ce_mark_uptodate(ce);
+		return ce;
+	}
 
 	if (lstat(ce->name, &st) < 0) {
 		if (err)
@@ -1093,8 +1115,10 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 			 * because CE_UPTODATE flag is in-core only;
 			 * we are not going to write this change out.
 			 */
-			if (!S_ISGITLINK(ce->ce_mode))
+			if (!S_ISGITLINK(ce->ce_mode)) {
 				ce_mark_uptodate(ce);
+				mark_fsmonitor_valid(istate, ce);
+			}
 			return ce;
 		}
 	}
@@ -1118,6 +1142,7 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 	if (!ignore_valid && assume_unchanged &&
 	    !(ce->ce_flags & CE_VALID))
 		updated->ce_flags &= ~CE_VALID;
+	mark_fsmonitor_valid(istate, updated);
 
 	return updated;
 }
@@ -1315,6 +1340,21 @@ static int read_index_extension(struct index_state *istate,
 	case CACHE_EXT_RESOLVE_UNDO:
 		istate->resolve_undo = resolve_undo_read(data, sz);
 		break;
+	case CACHE_EXT_LINK:
+		if (read_link_extension(istate, data, sz))
+			return -1;
+		break;
+	case CACHE_EXT_UNTRACKED:
+		istate->untracked = read_untracked_extension(data, sz);
+		break;
+	case CACHE_EXT_FSMONITOR:
+		if (read_fsmonitor_extension(istate, data, sz))
+			discard_fsmonitor(istate);
+		break;
+	case CACHE_EXT_ENTRY_OFFSETS:
+	case CACHE_EXT_END_OF_ENTRIES:
+		/* only of use before the entries are read */
+		break;
 	default:
 		if (*ext < 'A' || 'Z' < *ext)
 			return error("index uses %.4s extension, which we do not understand",
@@ -1369,6 +1409,7 @@ static struct cache_entry *cache_entry_from_ondisk(struct ondisk_cache_entry *on
 	ce->ce_size  = ntoh_l(ondisk->size);
 	ce->ce_flags = flags & ~CE_NAMEMASK;
 	ce->ce_namelen = len;
+	ce->index = 0;
 	hashcpy(ce->sha1, ondisk->sha1);
 	memcpy(ce->name, name, len);
 	ce->name[len] = '\0';
@@ -1382,14 +1423,19 @@ static struct cache_entry *cache_entry_from_ondisk(struct ondisk_cache_entry *on
  * number of bytes to be stripped from the end of the previous name,
  * and the bytes to append to the result, to come up with its name.
  */
-static unsigned long expand_name_field(struct strbuf *name, const char *cp_)
+static unsigned long expand_name_field(struct strbuf *name, const char *cp_,
+				       int restart)
 {
 	const unsigned char *ep, *cp = (const unsigned char *)cp_;
 	size_t len = decode_varint(&cp);
 
-	if (name->len < len)
+	/* the first entry of a block of the offset table starts afresh */
+	if (restart)
+		strbuf_reset(name);
+	else if (name->len < len)
 		die("malformed name field in the index");
-	strbuf_remove(name, name->len - len, len);
+	else
+		strbuf_remove(name, name->len - len, len);
 	for (ep = cp; *ep; ep++)
 		; /* find the end */
 	strbuf_add(name, cp, ep - cp);
@@ -1398,7 +1444,8 @@ static unsigned long expand_name_field(struct strbuf *name, const char *cp_)
 
 static struct cache_entry *create_from_disk(struct ondisk_cache_entry *ondisk,
 					    unsigned long *ent_size,
-					    struct strbuf *previous_name)
+					    struct strbuf *previous_name,
+					    int restart)
 {
 	struct cache_entry *ce;
 	size_t len;
@@ -1432,7 +1479,7 @@ static struct cache_entry *create_from_disk(struct ondisk_cache_entry *ondisk,
 		*ent_size = ondisk_ce_size(ce);
 	} else {
 		unsigned long consumed;
-		consumed = expand_name_field(previous_name, name);
+		consumed = expand_name_field(previous_name, name, restart);
 		ce = cache_entry_from_ondisk(ondisk, flags,
 					     previous_name->buf,
 					     previous_name->len);
@@ -1442,16 +1489,377 @@ static struct cache_entry *create_from_disk(struct ondisk_cache_entry *ondisk,
 	return ce;
 }
 
-/* remember to discard_cache() before reading a different cache! */
-int read_index_from(struct index_state *istate, const char *path)
+/* Load "nr" entries starting at "offset"; returns the offset after them */
+static unsigned long load_cache_entry_block(struct index_state *istate,
+					    const char *mmap, unsigned int start,
+					    unsigned int nr, unsigned long offset,
+					    int restart)
+{
+	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	unsigned int i;
+
+	previous_name = (istate->version == 4) ? &previous_name_buf : NULL;
+	for (i = start; i < start + nr; i++) {
+		struct ondisk_cache_entry *disk_ce;
+		struct cache_entry *ce;
+		unsigned long consumed;
+
+		disk_ce = (struct ondisk_cache_entry *)(mmap + offset);
+		ce = create_from_disk(disk_ce, &consumed, previous_name,
+				      restart && i == start);
+		set_index_entry(istate, i, ce);
+		offset += consumed;
+	}
+	strbuf_release(&previous_name_buf);
+	return offset;
+}
+
+static int load_index_extensions(struct index_state *istate, const char *mmap,
+				 size_t mmap_size, unsigned long offset)
+{
+	while (offset <= mmap_size - 20 - 8) {
+		/* After an array of active_nr index entries,
+		 * there can be arbitrary number of extended
+		 * sections, each of which is prefixed with
+		 * extension name (4-byte) and section length
+		 * in 4-byte network byte order.
+		 */
+		uint32_t extsize;
+		memcpy(&extsize, mmap + offset + 4, 4);
+		extsize = ntohl(extsize);
+		if (read_index_extension(istate, mmap + offset,
+					 (char *)mmap + offset + 8,
+					 extsize) < 0)
+			return -1;
+		offset += 8;
+		offset += extsize;
+	}
+	return 0;
+}
+
+/*
+ * A large index records where blocks of its entries start (IEOT), so
+ * that several threads can load them, each from the start of a block.
+ * In a v4 index, the name of the first entry of a block is not
+ * compressed against the entry before it.
+ *
+ * The table is an extension, and extensions come after the entries.
+ * To find it without going through them, the last extension (EOIE)
+ * records where the extensions start, and a hash of the name and size
+ * of each extension to tell that it is right.
+ */
+#define THREAD_COST 10000	/* fewer entries are not worth a thread */
+#define MAX_INDEX_THREADS 32
+#define IEOT_VERSION 1
+#define EOIE_SIZE (4 + 20)
+#define EOIE_SIZE_WITH_HEADER (8 + EOIE_SIZE)
+
+struct index_entry_offset {
+	unsigned int offset;
+	unsigned int nr;
+};
+
+struct index_entry_offset_table {
+	unsigned int nr;
+	struct index_entry_offset entries[FLEX_ARRAY];
+};
+
+/* How many threads would load an index with "nr" entries */
+static int index_read_threads(unsigned int nr)
+{
+#ifdef NO_PTHREADS
+	return 1;
+#else
+	int threads = index_threads;
+
+	if (threads == 1)
+		return 1;
+	if (threads <= 0) {
+		threads = online_cpus();
+		if (threads > nr / THREAD_COST)
+			threads = nr / THREAD_COST;
+	}
+	if (threads > MAX_INDEX_THREADS)
+		threads = MAX_INDEX_THREADS;
+	if (threads > nr)
+		threads = nr;
+	return threads < 1 ? 1 : threads;
+#endif
+}
+
+static void write_eoie_extension(struct strbuf *sb, git_SHA_CTX *eoie_c,
+				 unsigned long offset)
+{
+	uint32_t buffer;
+	unsigned char sha1[20];
+
+	buffer = htonl(offset);
+	strbuf_add(sb, &buffer, sizeof(buffer));
+	git_SHA1_Final(sha1, eoie_c);
+	strbuf_add(sb, sha1, sizeof(sha1));
+}
+
+static void write_ieot_extension(struct strbuf *sb,
+				 struct index_entry_offset_table *ieot)
+{
+	uint32_t buffer;
+	unsigned int i;
+
+	buffer = htonl(IEOT_VERSION);
+	strbuf_add(sb, &buffer, sizeof(buffer));
+	for (i = 0; i < ieot->nr; i++) {
+		buffer = htonl(ieot->entries[i].offset);
+		strbuf_add(sb, &buffer, sizeof(buffer));
+		buffer = htonl(ieot->entries[i].nr);
+		strbuf_add(sb, &buffer, sizeof(buffer));
+	}
+}
+
+#ifndef NO_PTHREADS
+
+/* Where the extensions start, or 0 when there is no (valid) EOIE */
+static unsigned long read_eoie_extension(const char *mmap, size_t mmap_size)
 {
-	int fd, i;
+	unsigned long offset, src_offset, eoie_offset;
+	unsigned char sha1[20];
+	const char *eoie;
+	git_SHA_CTX c;
+	uint32_t word;
+
+	if (mmap_size < sizeof(struct cache_header) + EOIE_SIZE_WITH_HEADER + 20)
+		return 0;
+	eoie_offset = mmap_size - 20 - EOIE_SIZE_WITH_HEADER;
+	eoie = mmap + eoie_offset;
+	if (CACHE_EXT(eoie) != CACHE_EXT_END_OF_ENTRIES)
+		return 0;
+	memcpy(&word, eoie + 4, 4);
+	if (ntohl(word) != EOIE_SIZE)
+		return 0;
+	memcpy(&word, eoie + 8, 4);
+	offset = ntohl(word);
+	if (offset < sizeof(struct cache_header) || offset > eoie_offset)
+		return 0;
+
+	git_SHA1_Init(&c);
+	for (src_offset = offset; src_offset + 8 <= eoie_offset; ) {
+		memcpy(&word, mmap + src_offset + 4, 4);
+		git_SHA1_Update(&c, mmap + src_offset, 8);
+		src_offset += 8;
+		src_offset += ntohl(word);
+	}
+	git_SHA1_Final(sha1, &c);
+	if (src_offset != eoie_offset || hashcmp(sha1, (unsigned char *)eoie + 12))
+		return 0;
+	return offset;
+}
+
+static struct index_entry_offset_table *read_ieot_extension(
+		struct index_state *istate, const char *mmap,
+		size_t mmap_size, unsigned long offset)
+{
+	struct index_entry_offset_table *ieot;
+	const char *index = NULL;
+	unsigned int i, nr, total = 0;
+	unsigned long entries_end = offset, next = sizeof(struct cache_header);
+	uint32_t word, extsize = 0;
+
+	while (offset + 8 <= mmap_size - 20) {
+		memcpy(&word, mmap + offset + 4, 4);
+		extsize = ntohl(word);
+		if (CACHE_EXT((mmap + offset)) == CACHE_EXT_ENTRY_OFFSETS) {
+			index = mmap + offset + 8;
+			break;
+		}
+		offset += 8;
+		offset += extsize;
+	}
+	if (!index || extsize < 4 || (extsize - 4) % 8 ||
+	    offset + 8 + extsize > mmap_size - 20)
+		return NULL;
+	memcpy(&word, index, 4);
+	if (ntohl(word) != IEOT_VERSION)
+		return NULL;
+	index += 4;
+
+	nr = (extsize - 4) / 8;
+	if (!nr)
+		return NULL;
+	ieot = xmalloc(sizeof(*ieot) + nr * sizeof(struct index_entry_offset));
+	ieot->nr = nr;
+	for (i = 0; i < nr; i++) {
+		memcpy(&word, index, 4);
+		ieot->entries[i].offset = ntohl(word);
+		memcpy(&word, index + 4, 4);
+		ieot->entries[i].nr = ntohl(word);
+		index += 8;
+		total += ieot->entries[i].nr;
+		/* the blocks are in order, the first one right at the start */
+		if (i ? ieot->entries[i].offset <= next :
+		    ieot->entries[i].offset != next) {
+			free(ieot);
+			return NULL;
+		}
+		next = ieot->entries[i].offset;
+	}
+	if (total != istate->cache_nr || next >= entries_end) {
+		free(ieot);
+		return NULL;
+	}
+	return ieot;
+}
+
+struct load_entries_thread {
+	pthread_t pthread;
+	struct index_state *istate;
+	const char *mmap;
+	struct index_entry_offset_table *ieot;
+	unsigned int block, nr_blocks;	/* the blocks this thread loads */
+	unsigned int start;		/* the position of the first entry */
+	unsigned long entries_end;	/* where the extensions start */
+	int bad;			/* the blocks did not fit together */
+};
+
+static void *load_entries_thread(void *data)
+{
+	struct load_entries_thread *p = data;
+	unsigned int i, start = p->start;
+
+	for (i = p->block; i < p->block + p->nr_blocks; i++) {
+		struct index_entry_offset *block = p->ieot->entries + i;
+		unsigned long end;
+
+		end = load_cache_entry_block(p->istate, p->mmap, start,
+					     block->nr, block->offset, 1);
+		if (end != (i + 1 < p->ieot->nr ?
+			    block[1].offset : p->entries_end))
+			p->bad = 1;
+		start += block->nr;
+	}
+	return NULL;
+}
+
+static void load_cache_entries_threaded(struct index_state *istate,
+					const char *mmap,
+					struct index_entry_offset_table *ieot,
+					unsigned long entries_end,
+					int nr_threads)
+{
+	struct load_entries_thread *data;
+	unsigned int i, block = 0, start = 0, blocks_per_thread;
+	int bad = 0;
+
+	if (nr_threads > ieot->nr)
+		nr_threads = ieot->nr;
+	blocks_per_thread = DIV_ROUND_UP(ieot->nr, nr_threads);
+	data = xcalloc(nr_threads, sizeof(*data));
+	for (i = 0; i < nr_threads && block < ieot->nr; i++) {
+		struct load_entries_thread *p = data + i;
+		unsigned int j;
+
+		p->istate = istate;
+		p->mmap = mmap;
+		p->ieot = ieot;
+		p->entries_end = entries_end;
+		p->block = block;
+		p->nr_blocks = blocks_per_thread;
+		if (p->nr_blocks > ieot->nr - block)
+			p->nr_blocks = ieot->nr - block;
+		p->start = start;
+		for (j = block; j < block + p->nr_blocks; j++)
+			start += ieot->entries[j].nr;
+		block += p->nr_blocks;
+		if (pthread_create(&p->pthread, NULL, load_entries_thread, p))
+			die("unable to create index loading thread");
+	}
+	nr_threads = i;
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_join(data[i].pthread, NULL))
+			die("unable to join index loading thread");
+		bad |= data[i].bad;
+	}
+	free(data);
+	if (bad)
+		die("index file corrupt");
+}
+
+struct load_extensions_thread {
+	pthread_t pthread;
+	struct index_state *istate;
+	const char *mmap;
+	size_t mmap_size;
+	unsigned long offset;
+	int ret;
+};
+
+static void *load_extensions_thread(void *data)
+{
+	struct load_extensions_thread *p = data;
+
+	p->ret = load_index_extensions(p->istate, p->mmap, p->mmap_size,
+				       p->offset);
+	return NULL;
+}
+
+/*
+ * Load the index on several threads when it says where its extensions
+ * start.  Returns 1 when it did, 0 when it is left to the caller and -1
+ * when an extension is corrupt.
+ */
+static int load_index_threaded(struct index_state *istate, const char *mmap,
+			       size_t mmap_size)
+{
+	struct load_extensions_thread ext;
+	struct index_entry_offset_table *ieot;
+	int nr_threads = index_read_threads(istate->cache_nr);
+
+	if (nr_threads < 2)
+		return 0;
+	memset(&ext, 0, sizeof(ext));
+	ext.offset = read_eoie_extension(mmap, mmap_size);
+	if (!ext.offset)
+		return 0;
+
+	/* the extensions load while the entries do */
+	ext.istate = istate;
+	ext.mmap = mmap;
+	ext.mmap_size = mmap_size;
+	if (pthread_create(&ext.pthread, NULL, load_extensions_thread, &ext))
+		die("unable to create index extension thread");
+
+	ieot = read_ieot_extension(istate, mmap, mmap_size, ext.offset);
+	if (ieot) {
+		load_cache_entries_threaded(istate, mmap, ieot, ext.offset,
+					    nr_threads);
+		free(ieot);
+	} else if (load_cache_entry_block(istate, mmap, 0, istate->cache_nr,
+					  sizeof(struct cache_header), 0) !=
+		   ext.offset)
+		die("index file corrupt");
+
+	if (pthread_join(ext.pthread, NULL))
+		die("unable to join index extension thread");
+	return ext.ret < 0 ? -1 : 1;
+}
+
+#else
+
+static int load_index_threaded(struct index_state *istate, const char *mmap,
+			       size_t mmap_size)
+{
+	return 0;
+}
+
+#endif
+
+static int do_read_index(struct index_state *istate, const char *path,
+			 int must_exist)
+{
+	int fd, ret;
 	struct stat st;
 	unsigned long src_offset;
 	struct cache_header *hdr;
 	void *mmap;
 	size_t mmap_size;
-	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
 
 	if (istate->initialized)
 		return istate->cache_nr;
@@ -1460,9 +1868,9 @@ int read_index_from(struct index_state *istate, const char *path)
 	istate->timestamp.nsec = 0;
 	fd = open(path, O_RDONLY);
 	if (fd < 0) {
-		if (errno == ENOENT)
+		if (!must_exist && errno == ENOENT)
 			return 0;
-		die_errno("index file open failed");
+		die_errno("%s: index file open failed", path);
 	}
 
 	if (fstat(fd, &st))
@@ -1481,51 +1889,26 @@ int read_index_from(struct index_state *istate, const char *path)
 	if (verify_hdr(hdr, mmap_size) < 0)
 		goto unmap;
 
+	hashcpy(istate->sha1, (unsigned char *)hdr + mmap_size - 20);
 	istate->version = ntohl(hdr->hdr_version);
 	istate->cache_nr = ntohl(hdr->hdr_entries);
 	istate->cache_alloc = alloc_nr(istate->cache_nr);
 	istate->cache = xcalloc(istate->cache_alloc, sizeof(struct cache_entry *));
 	istate->initialized = 1;
 
-	if (istate->version == 4)
-		previous_name = &previous_name_buf;
-	else
-		previous_name = NULL;
-
 	src_offset = sizeof(*hdr);
-	for (i = 0; i < istate->cache_nr; i++) {
-		struct ondisk_cache_entry *disk_ce;
-		struct cache_entry *ce;
-		unsigned long consumed;
-
-		disk_ce = (struct ondisk_cache_entry *)((char *)mmap + src_offset);
-		ce = create_from_disk(disk_ce, &consumed, previous_name);
-		set_index_entry(istate, i, ce);
-
-		src_offset += consumed;
+	ret = load_index_threaded(istate, mmap, mmap_size);
+	if (!ret) {
+		src_offset = load_cache_entry_block(istate, mmap, 0,
+						    istate->cache_nr,
+						    src_offset, 0);
+		ret = load_index_extensions(istate, mmap, mmap_size,
+					    src_offset);
 	}
-	strbuf_release(&previous_name_buf);
+	if (ret < 0)
+		goto unmap;
 	istate->timestamp.sec = st.st_mtime;
 	istate->timestamp.nsec = ST_MTIME_NSEC(st);
-
-	while (src_offset <= mmap_size - 20 - 8) {
-		/* After an array of active_nr index entries,
-		 * there can be arbitrary number of extended
-		 * sections, each of which is prefixed with
-		 * extension name (4-byte) and section length
-		 * in 4-byte network byte order.
-		 */
-		uint32_t extsize;
-		memcpy(&extsize, (char *)mmap + src_offset + 4, 4);
-		extsize = ntohl(extsize);
-		if (read_index_extension(istate,
-					 (const char *) mmap + src_offset,
-					 (char *) mmap + src_offset + 8,
-					 extsize) < 0)
-			goto unmap;
-		src_offset += 8;
-		src_offset += extsize;
-	}
 	munmap(mmap, mmap_size);
 	return istate->cache_nr;
 
@@ -1534,6 +1917,65 @@ unmap:
 	die("index file corrupt");
 }
 
+/*
+ * The shared index lives in $GIT_DIR, but an index file elsewhere may
+ * have been written with its shared index next to it.
+ */
+static const char *shared_index_path(const char *index_path,
+				     const unsigned char *sha1)
+{
+	const char *hex = sha1_to_hex(sha1);
+	const char *slash = strrchr(index_path, '/');
+	const char *path = git_path("sharedindex.%s", hex);
+
+	if (slash && access(path, F_OK))
+		path = mkpath("%.*s/sharedindex.%s",
+			      (int)(slash - index_path), index_path, hex);
+	return path;
+}
+
+/* remember to discard_cache() before reading a different cache! */
+int read_index_from(struct index_state *istate, const char *path)
+{
+	struct split_index *si;
+	struct index_state *base;
+	const char *base_path;
+
+	if (istate->initialized)
+		return istate->cache_nr;
+
+	/* left behind by an earlier call that found no index file */
+	discard_split_index(istate);
+
+	do_read_index(istate, path, 0);
+	si = istate->split_index;
+	if (si) {
+		base = xcalloc(1, sizeof(*base));
+		base_path = shared_index_path(path, si->base_sha1);
+		do_read_index(base, base_path, 1);
+		if (base->split_index)
+			die("%s: shared index links to another index", base_path);
+		if (hashcmp(base->sha1, si->base_sha1))
+			die("broken index, expect %s in %s, got %s",
+			    sha1_to_hex(si->base_sha1), base_path,
+			    sha1_to_hex(base->sha1));
+		si->base = base;
+		merge_base_index(istate);
+	}
+
+	/* core.splitIndex, when set, says how the index is written out */
+	if (core_split_index > 0 && !istate->split_index) {
+		init_split_index(istate);
+		istate->cache_changed = 1;
+	} else if (!core_split_index && istate->split_index) {
+		discard_split_index(istate);
+		istate->cache_changed = 1;
+	}
+
+	tweak_fsmonitor(istate);
+	return istate->cache_nr;
+}
+
 int is_index_unborn(struct index_state *istate)
 {
 	return (!istate->cache_nr && !istate->timestamp.sec);
@@ -1553,6 +1995,10 @@ int discard_index(struct index_state *istate)
 	istate->name_hash_initialized = 0;
 	free_hash(&istate->name_hash);
 	cache_tree_free(&(istate->cache_tree));
+	discard_split_index(istate);
+	free_untracked_cache(istate->untracked);
+	istate->untracked = NULL;
+	discard_fsmonitor(istate);
 	istate->initialized = 0;
 
 	/* no need to throw away allocated active_cache */
@@ -1569,73 +2015,17 @@ int unmerged_index(const struct index_state *istate)
 	return 0;
 }
 
-#define WRITE_BUFFER_SIZE 8192
-static unsigned char write_buffer[WRITE_BUFFER_SIZE];
-static unsigned long write_buffer_len;
-
-static int ce_write_flush(git_SHA_CTX *context, int fd)
-{
-	unsigned int buffered = write_buffer_len;
-	if (buffered) {
-		git_SHA1_Update(context, write_buffer, buffered);
-		if (write_in_full(fd, write_buffer, buffered) != buffered)
-			return -1;
-		write_buffer_len = 0;
-	}
-	return 0;
-}
-
-static int ce_write(git_SHA_CTX *context, int fd, void *data, unsigned int len)
-{
-	while (len) {
-		unsigned int buffered = write_buffer_len;
-		unsigned int partial = WRITE_BUFFER_SIZE - buffered;
-		if (partial > len)
-			partial = len;
-		memcpy(write_buffer + buffered, data, partial);
-		buffered += partial;
-		if (buffered == WRITE_BUFFER_SIZE) {
-			write_buffer_len = buffered;
-			if (ce_write_flush(context, fd))
-				return -1;
-			buffered = 0;
-		}
-		write_buffer_len = buffered;
-		len -= partial;
-		data = (char *) data + partial;
-	}
-	return 0;
-}
-
-static int write_index_ext_header(git_SHA_CTX *context, int fd,
-				  unsigned int ext, unsigned int sz)
+static void write_index_ext_header(struct sha1file *f, git_SHA_CTX *eoie_c,
+				   unsigned int ext, unsigned int sz)
 {
 	ext = htonl(ext);
 	sz = htonl(sz);
-	return ((ce_write(context, fd, &ext, 4) < 0) ||
-		(ce_write(context, fd, &sz, 4) < 0)) ? -1 : 0;
-}
-
-static int ce_flush(git_SHA_CTX *context, int fd)
-{
-	unsigned int left = write_buffer_len;
-
-	if (left) {
-		write_buffer_len = 0;
-		git_SHA1_Update(context, write_buffer, left);
+	if (eoie_c) {
+		git_SHA1_Update(eoie_c, &ext, 4);
+		git_SHA1_Update(eoie_c, &sz, 4);
 	}
-
-	/* Flush first if not enough space for SHA1 signature */
-	if (left + 20 > WRITE_BUFFER_SIZE) {
-		if (write_in_full(fd, write_buffer, left) != left)
-			return -1;
-		left = 0;
-	}
-
-	/* Append the SHA1 signature at the end */
-	git_SHA1_Final(write_buffer + left, context);
-	left += 20;
-	return (write_in_full(fd, write_buffer, left) != left) ? -1 : 0;
+	sha1write(f, &ext, 4);
+	sha1write(f, &sz, 4);
 }
 
 static void ce_smudge_racily_clean_entry(struct cache_entry *ce)
@@ -1719,13 +2109,17 @@ static char *copy_cache_entry_to_ondisk(struct ondisk_cache_entry *ondisk,
 	}
 }
 
-static int ce_write_entry(git_SHA_CTX *c, int fd, struct cache_entry *ce,
-			  struct strbuf *previous_name)
+/*
+ * Write out "ce" and return its size.  With "restart", a v4 name is
+ * written as if there were no entry before it, as far as what it has in
+ * common with the previous name goes.
+ */
+static int ce_write_entry(struct sha1file *f, struct cache_entry *ce,
+			  struct strbuf *previous_name, int restart)
 {
 	int size;
 	struct ondisk_cache_entry *ondisk;
 	char *name;
-	int result;
 
 	if (!previous_name) {
 		size = ondisk_ce_size(ce);
@@ -1736,7 +2130,7 @@ static int ce_write_entry(git_SHA_CTX *c, int fd, struct cache_entry *ce,
 		int common, to_remove, prefix_size;
 		unsigned char to_remove_vi[16];
 		for (common = 0;
-		     (ce->name[common] &&
+		     (!restart && ce->name[common] &&
 		      common < previous_name->len &&
 		      ce->name[common] == previous_name->buf[common]);
 		     common++)
@@ -1759,9 +2153,9 @@ static int ce_write_entry(git_SHA_CTX *c, int fd, struct cache_entry *ce,
 			      ce->name + common, ce_namelen(ce) - common);
 	}
 
-	result = ce_write(c, fd, ondisk, size);
+	sha1write(f, ondisk, size);
 	free(ondisk);
-	return result;
+	return size;
 }
 
 static int has_racy_timestamp(struct index_state *istate)
@@ -1789,44 +2183,46 @@ void update_index_if_able(struct index_state *istate, struct lock_file *lockfile
 		rollback_lock_file(lockfile);
 }
 
-int write_index(struct index_state *istate, int newfd)
+static int do_write_index(struct index_state *istate, int newfd,
+			  const char *name)
 {
-	git_SHA_CTX c;
+	struct sha1file *f;
 	struct cache_header hdr;
-	int i, err, removed, extended, hdr_version;
+	int i, removed, hdr_version;
 	struct cache_entry **cache = istate->cache;
 	int entries = istate->cache_nr;
 	struct stat st;
 	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	struct index_entry_offset_table *ieot = NULL;
+	git_SHA_CTX eoie_ctx, *eoie_c = NULL;
+	unsigned long offset;
+	unsigned int nr_written = 0, block_size = 0;
+	int nr_blocks;
 
-	for (i = removed = extended = 0; i < entries; i++) {
+	for (i = removed = 0; i < entries; i++)
 		if (cache[i]->ce_flags & CE_REMOVE)
 			removed++;
 
-		/* reduce extended entries if possible */
-		cache[i]->ce_flags &= ~CE_EXTENDED;
-		if (cache[i]->ce_flags & CE_EXTENDED_FLAGS) {
-			extended++;
-			cache[i]->ce_flags |= CE_EXTENDED;
-		}
+	/* enough blocks for the threads that would load the entries */
+	nr_blocks = index_read_threads(entries - removed);
+	if (nr_blocks > 1) {
+		ieot = xcalloc(1, sizeof(*ieot) +
+			       nr_blocks * sizeof(struct index_entry_offset));
+		block_size = DIV_ROUND_UP(entries - removed, nr_blocks);
+		git_SHA1_Init(&eoie_ctx);
+		eoie_c = &eoie_ctx;
 	}
 
-	if (!istate->version)
-		istate->version = INDEX_FORMAT_DEFAULT;
-
-	/* demote version 3 to version 2 when the latter suffices */
-	if (istate->version == 3 || istate->version == 2)
-		istate->version = extended ? 3 : 2;
-
 	hdr_version = istate->version;
 
 	hdr.hdr_signature = htonl(CACHE_SIGNATURE);
 	hdr.hdr_version = htonl(hdr_version);
 	hdr.hdr_entries = htonl(entries - removed);
 
-	git_SHA1_Init(&c);
-	if (ce_write(&c, newfd, &hdr, sizeof(hdr)) < 0)
-		return -1;
+	f = sha1fd_gently(newfd, name);
+	sha1file_background(f);
+	sha1write(f, &hdr, sizeof(hdr));
+	offset = sizeof(hdr);
 
 	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
 	for (i = 0; i < entries; i++) {
@@ -1835,43 +2231,229 @@ int write_index(struct index_state *istate, int newfd)
 			continue;
 		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
 			ce_smudge_racily_clean_entry(ce);
-		if (is_null_sha1(ce->sha1))
+		if (is_null_sha1(ce->sha1)) {
+			sha1close(f, NULL, 0);
+			strbuf_release(&previous_name_buf);
+			free(ieot);
 			return error("cache entry has null sha1: %s", ce->name);
-		if (ce_write_entry(&c, newfd, ce, previous_name) < 0)
-			return -1;
+		}
+		if (ieot && !(nr_written % block_size)) {
+			ieot->entries[ieot->nr].offset = offset;
+			ieot->nr++;
+		}
+		offset += ce_write_entry(f, ce, previous_name,
+					 ieot && !(nr_written % block_size));
+		if (ieot)
+			ieot->entries[ieot->nr - 1].nr++;
+		nr_written++;
 	}
 	strbuf_release(&previous_name_buf);
 
 	/* Write extension data here */
+	if (ieot) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_ieot_extension(&sb, ieot);
+		write_index_ext_header(f, eoie_c, CACHE_EXT_ENTRY_OFFSETS, sb.len);
+		sha1write(f, sb.buf, sb.len);
+		strbuf_release(&sb);
+		free(ieot);
+	}
+	if (istate->split_index) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_link_extension(&sb, istate);
+		write_index_ext_header(f, eoie_c, CACHE_EXT_LINK, sb.len);
+		sha1write(f, sb.buf, sb.len);
+		strbuf_release(&sb);
+	}
 	if (istate->cache_tree) {
 		struct strbuf sb = STRBUF_INIT;
 
 		cache_tree_write(&sb, istate->cache_tree);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_TREE, sb.len) < 0
-			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		write_index_ext_header(f, eoie_c, CACHE_EXT_TREE, sb.len);
+		sha1write(f, sb.buf, sb.len);
 		strbuf_release(&sb);
-		if (err)
-			return -1;
 	}
 	if (istate->resolve_undo) {
 		struct strbuf sb = STRBUF_INIT;
 
 		resolve_undo_write(&sb, istate->resolve_undo);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_RESOLVE_UNDO,
-					     sb.len) < 0
-			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		write_index_ext_header(f, eoie_c, CACHE_EXT_RESOLVE_UNDO, sb.len);
+		sha1write(f, sb.buf, sb.len);
+		strbuf_release(&sb);
+	}
+	if (istate->untracked) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_untracked_extension(&sb, istate->untracked);
+		write_index_ext_header(f, eoie_c, CACHE_EXT_UNTRACKED, sb.len);
+		sha1write(f, sb.buf, sb.len);
+		strbuf_release(&sb);
+	}
+	if (istate->fsmonitor_last_update) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_fsmonitor_extension(&sb, istate);
+		write_index_ext_header(f, eoie_c, CACHE_EXT_FSMONITOR, sb.len);
+		sha1write(f, sb.buf, sb.len);
 		strbuf_release(&sb);
-		if (err)
-			return -1;
 	}
+	/* this one comes last, for the reader to find it */
+	if (eoie_c) {
+		struct strbuf sb = STRBUF_INIT;
 
-	if (ce_flush(&c, newfd) || fstat(newfd, &st))
+		write_eoie_extension(&sb, eoie_c, offset);
+		write_index_ext_header(f, NULL, CACHE_EXT_END_OF_ENTRIES, sb.len);
+		sha1write(f, sb.buf, sb.len);
+		strbuf_release(&sb);
+	}
+
+	if (sha1close(f, istate->sha1, CSUM_HASH_IN_STREAM) < 0)
+		return -1;
+	if (fstat(newfd, &st))
 		return -1;
 	istate->timestamp.sec = (unsigned int)st.st_mtime;
 	istate->timestamp.nsec = ST_MTIME_NSEC(st);
 	return 0;
 }
 
+#define SHARED_INDEX_EXPIRE (14 * 24 * 60 * 60)
+
+/* Remove the shared index files nobody has used for two weeks */
+static void clean_shared_index_files(const unsigned char *current)
+{
+	const char *dir = get_git_dir();
+	unsigned long expire = time(NULL) - SHARED_INDEX_EXPIRE;
+	struct strbuf path = STRBUF_INIT;
+	struct dirent *de;
+	DIR *d = opendir(dir);
+
+	if (!d)
+		return;
+	while ((de = readdir(d)) != NULL) {
+		struct stat st;
+
+		if (prefixcmp(de->d_name, "sharedindex.") ||
+		    !strcmp(de->d_name + 12, sha1_to_hex(current)))
+			continue;
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/%s", dir, de->d_name);
+		if (!stat(path.buf, &st) && st.st_mtime <= expire)
+			unlink(path.buf);
+	}
+	closedir(d);
+	strbuf_release(&path);
+}
+
+static int write_shared_index(struct index_state *istate)
+{
+	struct index_state shared = *istate;
+	struct cache_entry **list;
+	char tmp[PATH_MAX];
+	char *name;
+	unsigned int i, nr = 0;
+	int fd, ret;
+
+	list = xmalloc((istate->cache_nr + 1) * sizeof(*list));
+	for (i = 0; i < istate->cache_nr; i++)
+		if (!(istate->cache[i]->ce_flags & CE_REMOVE))
+			list[nr++] = istate->cache[i];
+
+	/* the shared index carries the entries and nothing else */
+	shared.cache = list;
+	shared.cache_nr = nr;
+	shared.cache_tree = NULL;
+	shared.resolve_undo = NULL;
+	shared.split_index = NULL;
+	shared.untracked = NULL;
+	shared.fsmonitor_last_update = 0;
+
+	snprintf(tmp, sizeof(tmp), "%s/sharedindex_XXXXXX", get_git_dir());
+	fd = xmkstemp_mode(tmp, 0666);
+	ret = do_write_index(&shared, fd, tmp);
+	if (close(fd))
+		ret = -1;
+	name = git_path("sharedindex.%s", sha1_to_hex(shared.sha1));
+	if (!ret && (adjust_shared_perm(tmp) || rename(tmp, name)))
+		ret = error("unable to write %s: %s", name, strerror(errno));
+	if (ret) {
+		unlink_or_warn(tmp);
+		free(list);
+		return -1;
+	}
+	replace_split_index_base(istate, list, nr, shared.sha1);
+	clean_shared_index_files(shared.sha1);
+	free(list);
+	return 0;
+}
+
+static int write_split_index(struct index_state *istate, int newfd,
+			     const char *name)
+{
+	struct split_index *si = istate->split_index;
+	struct index_state main_index = *istate;
+	struct cache_entry **list = NULL;
+	unsigned int nr = 0, changed = 0;
+	int ret;
+
+	if (si->base)
+		changed = prepare_to_write_split_index(istate, &list, &nr);
+	if (!si->base ||
+	    (unsigned long)changed * 100 >
+	    (unsigned long)si->base->cache_nr * split_index_max_change) {
+		free(list);
+		list = NULL;
+		nr = 0;
+		if (write_shared_index(istate))
+			return -1;
+	} else {
+		/* keep the base we use from expiring */
+		utime(git_path("sharedindex.%s", sha1_to_hex(si->base_sha1)),
+		      NULL);
+	}
+
+	main_index.cache = list;
+	main_index.cache_nr = nr;
+	ret = do_write_index(&main_index, newfd, name);
+	free(list);
+	istate->timestamp = main_index.timestamp;
+	hashcpy(istate->sha1, main_index.sha1);
+	return ret;
+}
+
+int write_index(struct index_state *istate, int newfd)
+{
+	const char *name;
+	int i, extended = 0;
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		/* reduce extended entries if possible */
+		ce->ce_flags &= ~CE_EXTENDED;
+		if (ce->ce_flags & CE_EXTENDED_FLAGS) {
+			extended++;
+			ce->ce_flags |= CE_EXTENDED;
+		}
+	}
+
+	if (!istate->version)
+		istate->version = INDEX_FORMAT_DEFAULT;
+
+	/* demote version 3 to version 2 when the latter suffices */
+	if (istate->version == 3 || istate->version == 2)
+		istate->version = extended ? 3 : 2;
+
+	name = lock_file_name(newfd);
+	if (!name)
+		name = get_index_file();
+	fill_fsmonitor_dirty(istate);
+	if (istate->split_index)
+		return write_split_index(istate, newfd, name);
+	return do_write_index(istate, newfd, name);
+}
+
 /*
  * Read the index file that is potentially unmerged into given
  * index_state, dropping any unmerged entries.  Returns true if
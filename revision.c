@@ -2035,7 +2035,7 @@ static struct commit_list **simplify_one(struct rev_info *revs, struct commit *c
 	if (1 < cnt) {
 		struct commit_list *h = reduce_heads(commit->parents);
 		cnt = commit_list_count(h);
-		free_commit_list(commit->parents);
+		free_commit_parents(commit);
 		commit->parents = h;
 	}
 
@@ -2217,9 +2217,17 @@ static int commit_match(struct commit *commit, struct rev_info *opt)
 {
 	int retval;
 	struct strbuf buf = STRBUF_INIT;
+	int loaded = 0;
 	if (!opt->grep_filter.pattern_list && !opt->grep_filter.header_list)
 		return 1;
 
+	/* With compact_commits the buffer has not been kept */
+	if (!commit->buffer) {
+		if (load_commit_buffer(commit))
+			return 0;
+		loaded = 1;
+	}
+
 	/* Prepend "fake" headers as needed */
 	if (opt->grep_filter.use_reflog_filter) {
 		strbuf_addstr(&buf, "reflog ");
@@ -2246,6 +2254,10 @@ static int commit_match(struct commit *commit, struct rev_info *opt)
 		retval = grep_buffer(&opt->grep_filter,
 				     commit->buffer, strlen(commit->buffer));
 	strbuf_release(&buf);
+	if (loaded && !retval) {
+		free(commit->buffer);
+		commit->buffer = NULL;
+	}
 	return retval;
 }
 
@@ -98,6 +98,9 @@ struct rev_info {
 			ancestry_path:1,
 			first_parent_only:1;
 
+	/* Threads reading trees ahead of traverse_commit_list() */
+	int		traverse_threads;
+
 	/* Diff flags */
 	unsigned int	diff:1,
 			full_diff:1,
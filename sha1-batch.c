@@ -0,0 +1,216 @@
+/*
+ * Hash many small objects at once.
+ *
+ * A single SHA-1 stream is a long chain of dependent operations, so
+ * hashing lots of small objects one after the other leaves most of
+ * the CPU idle.  With SSE2, four independent messages are hashed side
+ * by side, one in each 32-bit lane of the vector registers; a lane
+ * that finishes its message is refilled with the next one.  Without
+ * SSE2, the objects are simply hashed one at a time.
+ */
+#include "cache.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+#define LANES 4
+
+/* objects larger than this are not worth a lane */
+#define BATCH_MAX_LEN (64 * 1024)
+
+struct lane {
+	struct hash_batch_item *item;
+	char hdr[32];
+	unsigned long hdrlen;
+	unsigned long total;
+	unsigned long nr_blocks;
+	unsigned long block;
+};
+
+static inline uint32_t get_be32(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static inline void put_be32(unsigned char *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void start_lane(struct lane *l, struct hash_batch_item *item,
+		       uint32_t state[5][LANES], int i)
+{
+	l->item = item;
+	l->hdrlen = sprintf(l->hdr, "%s %lu", item->type, item->len) + 1;
+	l->total = l->hdrlen + item->len;
+	l->nr_blocks = (l->total + 8) / 64 + 1;
+	l->block = 0;
+
+	state[0][i] = 0x67452301;
+	state[1][i] = 0xefcdab89;
+	state[2][i] = 0x98badcfe;
+	state[3][i] = 0x10325476;
+	state[4][i] = 0xc3d2e1f0;
+}
+
+/* Copy the next 64 bytes of header, data and padding into "out" */
+static void fill_block(struct lane *l, unsigned char *out)
+{
+	unsigned long off = l->block * 64, end = off + 64, n;
+	unsigned char *p = out;
+
+	if (off < l->hdrlen) {
+		n = (end < l->hdrlen ? end : l->hdrlen) - off;
+		memcpy(p, l->hdr + off, n);
+		p += n;
+		off += n;
+	}
+	if (off < end && off < l->total) {
+		n = (end < l->total ? end : l->total) - off;
+		memcpy(p, (const char *)l->item->buf + off - l->hdrlen, n);
+		p += n;
+		off += n;
+	}
+	if (off < end) {
+		memset(p, 0, end - off);
+		if (off == l->total)
+			*p = 0x80;
+	}
+	if (++l->block == l->nr_blocks) {
+		uint64_t bits = (uint64_t)l->total << 3;
+		put_be32(out + 56, bits >> 32);
+		put_be32(out + 60, bits);
+	}
+}
+
+#define ROL(x, n) _mm_or_si128(_mm_slli_epi32((x), (n)), \
+			       _mm_srli_epi32((x), 32 - (n)))
+#define ADD(a, b) _mm_add_epi32((a), (b))
+#define XOR(a, b) _mm_xor_si128((a), (b))
+#define AND(a, b) _mm_and_si128((a), (b))
+#define OR(a, b) _mm_or_si128((a), (b))
+
+#define F1(b, c, d) OR(AND(b, c), _mm_andnot_si128(b, d))
+#define F2(b, c, d) XOR(XOR(b, c), d)
+#define F3(b, c, d) OR(AND(b, c), AND(d, OR(b, c)))
+
+#define ROUND(t, f, k) do { \
+	__m128i tmp; \
+	if (t >= 16) \
+		W[(t) & 15] = ROL(XOR(XOR(W[((t) - 3) & 15], \
+					  W[((t) - 8) & 15]), \
+				      XOR(W[((t) - 14) & 15], \
+					  W[(t) & 15])), 1); \
+	tmp = ADD(ADD(ROL(A, 5), f(B, C, D)), \
+		  ADD(ADD(E, _mm_set1_epi32(k)), W[(t) & 15])); \
+	E = D; \
+	D = C; \
+	C = ROL(B, 30); \
+	B = A; \
+	A = tmp; \
+} while (0)
+
+static void compress_lanes(uint32_t state[5][LANES],
+			   unsigned char block[LANES][64])
+{
+	__m128i W[16], A, B, C, D, E;
+	int t;
+
+	for (t = 0; t < 16; t++)
+		W[t] = _mm_set_epi32(get_be32(block[3] + t * 4),
+				     get_be32(block[2] + t * 4),
+				     get_be32(block[1] + t * 4),
+				     get_be32(block[0] + t * 4));
+	A = _mm_loadu_si128((__m128i *)state[0]);
+	B = _mm_loadu_si128((__m128i *)state[1]);
+	C = _mm_loadu_si128((__m128i *)state[2]);
+	D = _mm_loadu_si128((__m128i *)state[3]);
+	E = _mm_loadu_si128((__m128i *)state[4]);
+
+	for (t = 0; t < 20; t++)
+		ROUND(t, F1, 0x5a827999);
+	for (; t < 40; t++)
+		ROUND(t, F2, 0x6ed9eba1);
+	for (; t < 60; t++)
+		ROUND(t, F3, 0x8f1bbcdc);
+	for (; t < 80; t++)
+		ROUND(t, F2, 0xca62c1d6);
+
+	A = ADD(A, _mm_loadu_si128((__m128i *)state[0]));
+	B = ADD(B, _mm_loadu_si128((__m128i *)state[1]));
+	C = ADD(C, _mm_loadu_si128((__m128i *)state[2]));
+	D = ADD(D, _mm_loadu_si128((__m128i *)state[3]));
+	E = ADD(E, _mm_loadu_si128((__m128i *)state[4]));
+	_mm_storeu_si128((__m128i *)state[0], A);
+	_mm_storeu_si128((__m128i *)state[1], B);
+	_mm_storeu_si128((__m128i *)state[2], C);
+	_mm_storeu_si128((__m128i *)state[3], D);
+	_mm_storeu_si128((__m128i *)state[4], E);
+}
+
+void hash_sha1_files(struct hash_batch_item *item, int nr)
+{
+	struct lane lane[LANES];
+	uint32_t state[5][LANES];
+	unsigned char block[LANES][64];
+	int i, next = 0, active = 0;
+
+	memset(block, 0, sizeof(block));
+	for (i = 0; i < LANES; i++) {
+		lane[i].item = NULL;
+		while (next < nr && item[next].len > BATCH_MAX_LEN) {
+			hash_sha1_file(item[next].buf, item[next].len,
+				       item[next].type, item[next].sha1);
+			next++;
+		}
+		if (next < nr) {
+			start_lane(&lane[i], &item[next++], state, i);
+			active++;
+		}
+	}
+
+	while (active) {
+		for (i = 0; i < LANES; i++)
+			if (lane[i].item)
+				fill_block(&lane[i], block[i]);
+		compress_lanes(state, block);
+
+		for (i = 0; i < LANES; i++) {
+			struct lane *l = &lane[i];
+			int k;
+
+			if (!l->item || l->block < l->nr_blocks)
+				continue;
+			for (k = 0; k < 5; k++)
+				put_be32(l->item->sha1 + k * 4, state[k][i]);
+			l->item = NULL;
+			active--;
+
+			while (next < nr && item[next].len > BATCH_MAX_LEN) {
+				hash_sha1_file(item[next].buf, item[next].len,
+					       item[next].type, item[next].sha1);
+				next++;
+			}
+			if (next < nr) {
+				start_lane(l, &item[next++], state, i);
+				active++;
+			}
+		}
+	}
+}
+
+#else
+
+void hash_sha1_files(struct hash_batch_item *item, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		hash_sha1_file(item[i].buf, item[i].len, item[i].type,
+			       item[i].sha1);
+}
+
+#endif
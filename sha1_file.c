@@ -20,6 +20,8 @@
 #include "sha1-lookup.h"
 #include "bulk-checkin.h"
 #include "streaming.h"
+#include "sha1-array.h"
+#include "thread-utils.h"
 
 #ifndef O_NOATIME
 #if defined(__linux__) && (defined(__i386__) || defined(__PPC__))
@@ -277,6 +279,7 @@ static int link_alt_odb_entry(const char * entry, int len, const char * relative
 	strbuf_release(&pathbuf);
 
 	ent->name = ent->base + pfxlen + 1;
+	ent->loose_cache = NULL;
 	ent->base[pfxlen + 3] = '/';
 	ent->base[pfxlen] = ent->base[entlen-1] = 0;
 
@@ -420,10 +423,156 @@ void prepare_alt_odb(void)
 	read_info_alternates(get_object_directory(), 0);
 }
 
+/*
+ * With core.looseObjectCache, the listing of each objects/xx fan-out
+ * directory is read the first time an object in it is looked up, and
+ * later lookups are answered from memory instead of with a stat() per
+ * object.  Objects we write ourselves are added as we go; the whole
+ * cache is dropped by reprepare_packed_git(), which is what callers do
+ * when they suspect somebody else has touched the object store.  An
+ * object that the cache does not know about in our own object directory
+ * is still looked for with a single access(), as a subprocess or a hook
+ * may have written it since the directory was read.
+ */
+struct loose_object_subdir {
+	unsigned char (*sha1)[20];
+	int nr, alloc;
+	int loaded;
+};
+
+struct loose_object_cache {
+	struct loose_object_subdir subdir[256];
+};
+
+static struct loose_object_cache *local_loose_cache;
+
+static const unsigned char *loose_subdir_access(size_t index, void *table)
+{
+	unsigned char (*sha1)[20] = table;
+	return sha1[index];
+}
+
+static int loose_subdir_cmp(const void *a, const void *b)
+{
+	return hashcmp(a, b);
+}
+
+static void load_loose_subdir(struct loose_object_subdir *sub,
+			      const char *objdir, int subdir_nr)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct dirent *de;
+	DIR *dir;
+
+	strbuf_addf(&path, "%s/%02x", objdir, subdir_nr);
+	dir = opendir(path.buf);
+	strbuf_release(&path);
+	sub->loaded = 1;
+	if (!dir)
+		return;
+
+	while ((de = readdir(dir)) != NULL) {
+		char hex[41];
+
+		if (strlen(de->d_name) != 38)
+			continue;
+		sprintf(hex, "%02x", subdir_nr);
+		memcpy(hex + 2, de->d_name, 38);
+		hex[40] = 0;
+		ALLOC_GROW(sub->sha1, sub->nr + 1, sub->alloc);
+		if (get_sha1_hex(hex, sub->sha1[sub->nr]))
+			continue;
+		sub->nr++;
+	}
+	closedir(dir);
+	qsort(sub->sha1, sub->nr, sizeof(*sub->sha1), loose_subdir_cmp);
+}
+
+static struct loose_object_subdir *loose_cache_subdir(struct loose_object_cache **cachep,
+						      const char *objdir,
+						      const unsigned char *sha1)
+{
+	struct loose_object_subdir *sub;
+
+	if (!*cachep)
+		*cachep = xcalloc(1, sizeof(**cachep));
+	sub = &(*cachep)->subdir[sha1[0]];
+	if (!sub->loaded)
+		load_loose_subdir(sub, objdir, sha1[0]);
+	return sub;
+}
+
+static int loose_cache_has(struct loose_object_cache **cachep,
+			   const char *objdir, const unsigned char *sha1)
+{
+	struct loose_object_subdir *sub = loose_cache_subdir(cachep, objdir, sha1);
+	return sha1_pos(sha1, sub->sha1, sub->nr, loose_subdir_access) >= 0;
+}
+
+void add_to_loose_object_cache(const unsigned char *sha1)
+{
+	struct loose_object_subdir *sub;
+	int pos;
+
+	if (!local_loose_cache || !local_loose_cache->subdir[sha1[0]].loaded)
+		return;
+	sub = &local_loose_cache->subdir[sha1[0]];
+	pos = sha1_pos(sha1, sub->sha1, sub->nr, loose_subdir_access);
+	if (pos >= 0)
+		return;
+	pos = -pos - 1;
+	ALLOC_GROW(sub->sha1, sub->nr + 1, sub->alloc);
+	memmove(sub->sha1 + pos + 1, sub->sha1 + pos,
+		(sub->nr - pos) * sizeof(*sub->sha1));
+	hashcpy(sub->sha1[pos], sha1);
+	sub->nr++;
+}
+
+static void free_loose_cache(struct loose_object_cache **cachep)
+{
+	int i;
+
+	if (!*cachep)
+		return;
+	for (i = 0; i < ARRAY_SIZE((*cachep)->subdir); i++)
+		free((*cachep)->subdir[i].sha1);
+	free(*cachep);
+	*cachep = NULL;
+}
+
+static void clear_loose_object_cache(void)
+{
+	struct alternate_object_database *alt;
+
+	free_loose_cache(&local_loose_cache);
+	for (alt = alt_odb_list; alt; alt = alt->next)
+		free_loose_cache(&alt->loose_cache);
+}
+
+static int alt_loose_cache_has(struct alternate_object_database *alt,
+			       const unsigned char *sha1)
+{
+	int found;
+
+	alt->name[-1] = 0;
+	found = loose_cache_has(&alt->loose_cache, alt->base, sha1);
+	alt->name[-1] = '/';
+	return found;
+}
+
 static int has_loose_object_local(const unsigned char *sha1)
 {
-	char *name = sha1_file_name(sha1);
-	return !access(name, F_OK);
+	char *name;
+
+	if (loose_object_cache &&
+	    loose_cache_has(&local_loose_cache, get_object_directory(), sha1))
+		return 1;
+	name = sha1_file_name(sha1);
+	if (access(name, F_OK))
+		return 0;
+	if (loose_object_cache)
+		add_to_loose_object_cache(sha1);
+	return 1;
 }
 
 int has_loose_object_nonlocal(const unsigned char *sha1)
@@ -431,6 +580,11 @@ int has_loose_object_nonlocal(const unsigned char *sha1)
 	struct alternate_object_database *alt;
 	prepare_alt_odb();
 	for (alt = alt_odb_list; alt; alt = alt->next) {
+		if (loose_object_cache) {
+			if (alt_loose_cache_has(alt, sha1))
+				return 1;
+			continue;
+		}
 		fill_sha1_path(alt->name, sha1);
 		if (!access(alt->base, F_OK))
 			return 1;
@@ -1129,6 +1283,7 @@ void prepare_packed_git(void)
 
 void reprepare_packed_git(void)
 {
+	clear_loose_object_cache();
 	discard_revindex();
 	prepare_packed_git_run_once = 0;
 	prepare_packed_git();
@@ -1224,9 +1379,15 @@ static int git_open_noatime(const char *name)
 static int open_sha1_file(const unsigned char *sha1)
 {
 	int fd;
-	char *name = sha1_file_name(sha1);
+	char *name;
 	struct alternate_object_database *alt;
 
+	/*
+	 * This does not trust the loose object cache: an object that is
+	 * asked for by name is expected to be there, and may well have
+	 * been written by another process since the cache was filled.
+	 */
+	name = sha1_file_name(sha1);
 	fd = git_open_noatime(name);
 	if (fd >= 0)
 		return fd;
@@ -1527,11 +1688,11 @@ unsigned long get_size_from_delta(struct packed_git *p,
 	return get_delta_hdr_size(&data, delta_head+sizeof(delta_head));
 }
 
-static off_t get_delta_base(struct packed_git *p,
-				    struct pack_window **w_curs,
-				    off_t *curpos,
-				    enum object_type type,
-				    off_t delta_obj_offset)
+off_t get_delta_base(struct packed_git *p,
+		     struct pack_window **w_curs,
+		     off_t *curpos,
+		     enum object_type type,
+		     off_t delta_obj_offset)
 {
 	unsigned char *base_info = use_pack(p, w_curs, *curpos, NULL);
 	off_t base_offset;
@@ -1670,14 +1831,118 @@ static int packed_object_info(struct packed_git *p, off_t obj_offset,
 	return type;
 }
 
-static void *unpack_compressed_entry(struct packed_git *p,
-				    struct pack_window **w_curs,
-				    off_t curpos,
-				    unsigned long size)
+#ifndef NO_PTHREADS
+static pthread_mutex_t obj_read_mutex;
+static pthread_key_t obj_read_depth_key;
+static int obj_read_use_lock;
+static try_to_free_t old_obj_read_try_to_free;
+
+static void try_to_free_with_obj_read_lock(size_t size)
+{
+	obj_read_lock();
+	release_pack_memory(size, -1);
+	obj_read_unlock();
+}
+
+/*
+ * While the object read lock is enabled, every thread that touches
+ * packs or the delta base cache has to hold it.  It is dropped around
+ * inflating and applying deltas, which need nothing shared, so that
+ * several readers can do that part at the same time.  The lock is
+ * recursive so that a holder can call back into read_sha1_file().
+ *
+ * Each thread counts how many times it holds the lock.  The lock is
+ * dropped for inflating only when the thread holds it exactly once:
+ * dropping an inner hold would not release it, and a thread that does
+ * not hold it at all must not unlock somebody else's.
+ */
+void enable_obj_read_lock(void)
+{
+	if (obj_read_use_lock++)
+		return;
+	prepare_packed_git();
+	init_recursive_mutex(&obj_read_mutex);
+	pthread_key_create(&obj_read_depth_key, NULL);
+	old_obj_read_try_to_free =
+		set_try_to_free_routine(try_to_free_with_obj_read_lock);
+}
+
+void disable_obj_read_lock(void)
+{
+	if (--obj_read_use_lock)
+		return;
+	set_try_to_free_routine(old_obj_read_try_to_free);
+	pthread_key_delete(obj_read_depth_key);
+	pthread_mutex_destroy(&obj_read_mutex);
+}
+
+static intptr_t obj_read_depth(void)
+{
+	return (intptr_t)pthread_getspecific(obj_read_depth_key);
+}
+
+void obj_read_lock(void)
+{
+	if (!obj_read_use_lock)
+		return;
+	pthread_mutex_lock(&obj_read_mutex);
+	pthread_setspecific(obj_read_depth_key,
+			    (void *)(obj_read_depth() + 1));
+}
+
+void obj_read_unlock(void)
+{
+	if (!obj_read_use_lock)
+		return;
+	pthread_setspecific(obj_read_depth_key,
+			    (void *)(obj_read_depth() - 1));
+	pthread_mutex_unlock(&obj_read_mutex);
+}
+
+/* Let go of the lock for work on private buffers, if we can */
+static int obj_read_pause(void)
+{
+	if (!obj_read_use_lock || obj_read_depth() != 1)
+		return 0;
+	obj_read_unlock();
+	return 1;
+}
+
+static void obj_read_resume(int paused)
+{
+	if (paused)
+		obj_read_lock();
+}
+#else
+void enable_obj_read_lock(void)
+{
+}
+
+void disable_obj_read_lock(void)
+{
+}
+
+void obj_read_lock(void)
+{
+}
+
+void obj_read_unlock(void)
+{
+}
+
+#define obj_read_pause() 0
+#define obj_read_resume(paused)
+#endif
+
+void *unpack_compressed_entry(struct packed_git *p,
+			      struct pack_window **w_curs,
+			      off_t curpos,
+			      unsigned long size)
 {
 	int st;
 	git_zstream stream;
 	unsigned char *buffer, *in;
+	int paused;
 
 	buffer = xmallocz(size);
 	memset(&stream, 0, sizeof(stream));
@@ -1688,7 +1953,9 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	do {
 		in = use_pack(p, w_curs, curpos, &stream.avail_in);
 		stream.next_in = in;
+		paused = obj_read_pause();
 		st = git_inflate(&stream, Z_FINISH);
+		obj_read_resume(paused);
 		if (!stream.avail_out)
 			break; /* the payload is larger than it should be */
 		curpos += stream.next_in - in;
@@ -1829,6 +2096,7 @@ static void *unpack_delta_entry(struct packed_git *p,
 	void *delta_data, *result, *base;
 	unsigned long base_size;
 	off_t base_offset;
+	int paused;
 
 	base_offset = get_delta_base(p, w_curs, &curpos, *type, obj_offset);
 	if (!base_offset) {
@@ -1870,9 +2138,11 @@ static void *unpack_delta_entry(struct packed_git *p,
 		free(base);
 		return NULL;
 	}
+	paused = obj_read_pause();
 	result = patch_delta(base, base_size,
 			     delta_data, delta_size,
 			     sizep);
+	obj_read_resume(paused);
 	if (!result)
 		die("failed to apply delta");
 	free(delta_data);
@@ -2329,6 +2599,362 @@ void *read_sha1_file_extended(const unsigned char *sha1,
 	return NULL;
 }
 
+/*
+ * Batched object reading.
+ *
+ * The requested objects are sorted by their location so that packs
+ * are read sequentially.  With threads, the main thread walks the
+ * sorted list and copies the deflated data of each non-delta packed
+ * object out of the pack, which also faults in the windows ahead of
+ * the consumers, while a pool of threads inflates them.  Deltas,
+ * loose objects and anything unusual are read on the main thread
+ * with the usual read_sha1_file() machinery, where the sorted order
+ * makes the delta base cache effective.
+ *
+ * The inflated objects waiting to be handed to the callback are kept
+ * under BATCH_MAX_BYTES (a single larger object is still read), and
+ * GIT_FORCE_THREADS uses the threads even with a single CPU.
+ */
+struct batch_entry {
+	const unsigned char *sha1;
+	const unsigned char *real;
+	struct packed_git *p;
+	off_t offset;
+	int pack_only;	/* do not look for it elsewhere */
+};
+
+static int batch_entry_cmp(const void *a_, const void *b_)
+{
+	const struct batch_entry *a = a_;
+	const struct batch_entry *b = b_;
+
+	/* loose objects go last */
+	if (!a->p || !b->p)
+		return !a->p - !b->p;
+	if (a->p != b->p)
+		return (uintptr_t)a->p < (uintptr_t)b->p ? -1 : 1;
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return 0;
+}
+
+static int read_batch_entry_directly(struct batch_entry *e,
+				     read_batch_fn fn, void *cb_data)
+{
+	enum object_type type = OBJ_BAD;
+	unsigned long size = 0;
+	void *buf = NULL;
+
+	if (e->p)
+		buf = unpack_entry(e->p, e->offset, &type, &size);
+	if (!buf && !e->pack_only)
+		buf = read_sha1_file(e->sha1, &type, &size);
+	return fn(e->sha1, buf ? type : OBJ_BAD, size, buf, cb_data);
+}
+
+#ifndef NO_PTHREADS
+
+#define BATCH_THREADS 8
+#define BATCH_TODO_SIZE 128
+#define BATCH_MAX_BYTES (32 * 1024 * 1024)
+
+struct batch_item {
+	struct batch_entry *e;
+	enum object_type type;
+	unsigned long size;
+	unsigned char *in;
+	unsigned long in_size;
+	void *buf;
+	int done;
+};
+
+/*
+ * Items in [todo_done, todo_start) have been picked up by a thread
+ * and are waiting to be handed to the callback; items in
+ * [todo_start, todo_end) are waiting for a thread.  All ranges are
+ * modulo BATCH_TODO_SIZE.  "bytes" is the memory the items in
+ * [todo_done, todo_end) take or will take once inflated; only the
+ * main thread looks at it.
+ */
+struct batch_state {
+	struct batch_item todo[BATCH_TODO_SIZE];
+	int todo_start;
+	int todo_end;
+	int todo_done;
+	int all_work_added;
+	unsigned long bytes;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_add;
+	pthread_cond_t cond_done;
+};
+
+/*
+ * The output buffer is allocated by the main thread: xmalloc()
+ * may call try_to_free_routine, which releases pack windows without
+ * taking any lock, so the threads must not allocate through it.
+ */
+static void *inflate_batch_item(struct batch_item *w)
+{
+	git_zstream stream;
+	int st;
+
+	memset(&stream, 0, sizeof(stream));
+	stream.next_in = w->in;
+	stream.avail_in = w->in_size;
+	stream.next_out = w->buf;
+	stream.avail_out = w->size + 1;
+
+	git_inflate_init(&stream);
+	st = git_inflate(&stream, Z_FINISH);
+	git_inflate_end(&stream);
+	if ((st != Z_STREAM_END) || stream.total_out != w->size) {
+		free(w->buf);
+		return NULL;
+	}
+	return w->buf;
+}
+
+static void *batch_thread(void *arg)
+{
+	struct batch_state *bs = arg;
+
+	for (;;) {
+		struct batch_item *w;
+
+		pthread_mutex_lock(&bs->mutex);
+		while (bs->todo_start == bs->todo_end && !bs->all_work_added)
+			pthread_cond_wait(&bs->cond_add, &bs->mutex);
+		if (bs->todo_start == bs->todo_end) {
+			pthread_mutex_unlock(&bs->mutex);
+			break;
+		}
+		w = &bs->todo[bs->todo_start];
+		bs->todo_start = (bs->todo_start + 1) % BATCH_TODO_SIZE;
+		pthread_mutex_unlock(&bs->mutex);
+
+		w->buf = inflate_batch_item(w);
+		free(w->in);
+		w->in = NULL;
+
+		pthread_mutex_lock(&bs->mutex);
+		w->done = 1;
+		pthread_cond_signal(&bs->cond_done);
+		pthread_mutex_unlock(&bs->mutex);
+	}
+	return NULL;
+}
+
+/*
+ * Hand finished items to the callback in the order they were queued.
+ * With "wait", block until at least the oldest item is finished.  Once
+ * the callback has asked us to stop, results are merely discarded.
+ */
+static int deliver_batch_items(struct batch_state *bs, int wait,
+			       read_batch_fn fn, void *cb_data, int ret)
+{
+	pthread_mutex_lock(&bs->mutex);
+	while (wait && bs->todo_done != bs->todo_end &&
+	       !bs->todo[bs->todo_done].done)
+		pthread_cond_wait(&bs->cond_done, &bs->mutex);
+
+	while (bs->todo_done != bs->todo_end &&
+	       bs->todo[bs->todo_done].done) {
+		struct batch_item *w = &bs->todo[bs->todo_done];
+		pthread_mutex_unlock(&bs->mutex);
+
+		bs->bytes -= w->size + w->in_size;
+		if (ret)
+			free(w->buf);
+		else if (w->buf)
+			ret = fn(w->e->sha1, w->type, w->size, w->buf, cb_data);
+		else
+			ret = read_batch_entry_directly(w->e, fn, cb_data);
+
+		pthread_mutex_lock(&bs->mutex);
+		bs->todo_done = (bs->todo_done + 1) % BATCH_TODO_SIZE;
+	}
+	pthread_mutex_unlock(&bs->mutex);
+	return ret;
+}
+
+/*
+ * Copy the deflated data of a non-delta packed object into "w".
+ * Returns -1 if the object has to be read on the main thread.
+ */
+static int prepare_batch_item(struct batch_entry *e, struct batch_item *w)
+{
+	struct pack_window *w_curs = NULL;
+	struct revindex_entry *revidx;
+	off_t curpos = e->offset;
+	unsigned long left;
+
+	if (do_check_packed_object_crc || log_pack_access)
+		return -1;
+
+	w->type = unpack_object_header(e->p, &w_curs, &curpos, &w->size);
+	switch (w->type) {
+	case OBJ_COMMIT:
+	case OBJ_TREE:
+	case OBJ_BLOB:
+	case OBJ_TAG:
+		break;
+	default:
+		unuse_pack(&w_curs);
+		return -1;
+	}
+
+	revidx = find_pack_revindex(e->p, e->offset);
+	w->in_size = revidx[1].offset - curpos;
+	w->in = xmalloc(w->in_size);
+	for (left = w->in_size; left; ) {
+		unsigned long avail;
+		unsigned char *in = use_pack(e->p, &w_curs, curpos, &avail);
+		if (left < avail)
+			avail = left;
+		memcpy(w->in + w->in_size - left, in, avail);
+		curpos += avail;
+		left -= avail;
+	}
+	unuse_pack(&w_curs);
+
+	w->e = e;
+	w->buf = NULL;
+	w->done = 0;
+	return 0;
+}
+
+static int read_batch_threaded(struct batch_entry *entries, int nr,
+			       int nr_threads,
+			       read_batch_fn fn, void *cb_data)
+{
+	struct batch_state *bs = xcalloc(1, sizeof(*bs));
+	pthread_t threads[BATCH_THREADS];
+	int i, ret = 0;
+
+	pthread_mutex_init(&bs->mutex, NULL);
+	pthread_cond_init(&bs->cond_add, NULL);
+	pthread_cond_init(&bs->cond_done, NULL);
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&threads[i], NULL, batch_thread, bs))
+			die("unable to create batch read thread");
+	}
+
+	for (i = 0; i < nr && !ret; i++) {
+		struct batch_entry *e = &entries[i];
+		struct batch_item *w;
+
+		ret = deliver_batch_items(bs, 0, fn, cb_data, ret);
+		while (!ret &&
+		       (bs->todo_end + 1) % BATCH_TODO_SIZE == bs->todo_done)
+			ret = deliver_batch_items(bs, 1, fn, cb_data, ret);
+		if (ret)
+			break;
+
+		/* only the main thread touches todo_end */
+		w = &bs->todo[bs->todo_end];
+		if (!e->p || prepare_batch_item(e, w)) {
+			ret = read_batch_entry_directly(e, fn, cb_data);
+			continue;
+		}
+		while (!ret && bs->bytes &&
+		       bs->bytes + w->size + w->in_size > BATCH_MAX_BYTES)
+			ret = deliver_batch_items(bs, 1, fn, cb_data, ret);
+		if (ret) {
+			free(w->in);
+			break;
+		}
+		bs->bytes += w->size + w->in_size;
+		w->buf = xmallocz(w->size);
+
+		pthread_mutex_lock(&bs->mutex);
+		bs->todo_end = (bs->todo_end + 1) % BATCH_TODO_SIZE;
+		pthread_cond_signal(&bs->cond_add);
+		pthread_mutex_unlock(&bs->mutex);
+	}
+
+	pthread_mutex_lock(&bs->mutex);
+	bs->all_work_added = 1;
+	pthread_cond_broadcast(&bs->cond_add);
+	pthread_mutex_unlock(&bs->mutex);
+
+	while (bs->todo_done != bs->todo_end)
+		ret = deliver_batch_items(bs, 1, fn, cb_data, ret);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&bs->mutex);
+	pthread_cond_destroy(&bs->cond_add);
+	pthread_cond_destroy(&bs->cond_done);
+	free(bs);
+	return ret;
+}
+
+#endif
+
+static int read_batch_entries(struct batch_entry *entries, int nr,
+			      read_batch_fn fn, void *cb_data)
+{
+	int i, nr_threads = 1, ret = 0;
+
+	qsort(entries, nr, sizeof(*entries), batch_entry_cmp);
+
+#ifndef NO_PTHREADS
+	nr_threads = online_cpus();
+	if (nr_threads > BATCH_THREADS)
+		nr_threads = BATCH_THREADS;
+	if ((nr_threads > 1 || getenv("GIT_FORCE_THREADS")) && nr > 1)
+		return read_batch_threaded(entries, nr, nr_threads,
+					   fn, cb_data);
+#endif
+	for (i = 0; i < nr && !ret; i++)
+		ret = read_batch_entry_directly(&entries[i], fn, cb_data);
+	return ret;
+}
+
+int read_sha1_batch(struct sha1_array *list, read_batch_fn fn, void *cb_data)
+{
+	struct batch_entry *entries;
+	int i, ret;
+
+	entries = xcalloc(list->nr, sizeof(*entries));
+	for (i = 0; i < list->nr; i++) {
+		struct batch_entry *e = &entries[i];
+		struct pack_entry pe;
+
+		e->sha1 = list->sha1[i];
+		e->real = lookup_replace_object(e->sha1);
+		if (!find_cached_object(e->real) && find_pack_entry(e->real, &pe)) {
+			e->p = pe.p;
+			e->offset = pe.offset;
+		}
+	}
+	ret = read_batch_entries(entries, list->nr, fn, cb_data);
+	free(entries);
+	return ret;
+}
+
+int read_pack_batch(struct packed_git *p, read_batch_fn fn, void *cb_data)
+{
+	struct batch_entry *entries;
+	uint32_t i;
+	int ret;
+
+	if (open_pack_index(p))
+		return error("packfile %s index not opened", p->pack_name);
+	entries = xcalloc(p->num_objects, sizeof(*entries));
+	for (i = 0; i < p->num_objects; i++) {
+		struct batch_entry *e = &entries[i];
+
+		e->sha1 = e->real = nth_packed_object_sha1(p, i);
+		e->p = p;
+		e->offset = nth_packed_object_offset(p, i);
+		e->pack_only = 1;
+	}
+	ret = read_batch_entries(entries, p->num_objects, fn, cb_data);
+	free(entries);
+	return ret;
+}
+
 void *read_object_with_reference(const unsigned char *sha1,
 				 const char *required_type_name,
 				 unsigned long *size,
@@ -2572,7 +3198,10 @@ static int write_loose_object(const unsigned char *sha1, char *hdr, int hdrlen,
 				tmp_file, strerror(errno));
 	}
 
-	return move_temp_to_file(tmp_file, filename);
+	if (move_temp_to_file(tmp_file, filename))
+		return -1;
+	add_to_loose_object_cache(sha1);
+	return 0;
 }
 
 int write_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *returnsha1)
@@ -2592,6 +3221,18 @@ int write_sha1_file(const void *buf, unsigned long len, const char *type, unsign
 	return write_loose_object(sha1, hdr, hdrlen, buf, len, 0);
 }
 
+int write_hashed_sha1_file(const void *buf, unsigned long len,
+			   const char *type, const unsigned char *sha1)
+{
+	char hdr[32];
+	int hdrlen;
+
+	if (has_sha1_file(sha1))
+		return 0;
+	hdrlen = sprintf(hdr, "%s %lu", type, len) + 1;
+	return write_loose_object(sha1, hdr, hdrlen, buf, len, 0);
+}
+
 int force_object_loose(const unsigned char *sha1, time_t mtime)
 {
 	void *buf;
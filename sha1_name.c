@@ -92,6 +92,7 @@ static void find_short_object_filename(int len, const char *hex_pfx, struct disa
 		memcpy(fakeent->base, objdir, objdir_len);
 		fakeent->name = fakeent->base + objdir_len + 1;
 		fakeent->name[-1] = '/';
+		fakeent->loose_cache = NULL;
 	}
 	fakeent->next = alt_odb_list;
 
@@ -0,0 +1,246 @@
+#include "cache.h"
+#include "split-index.h"
+#include "varint.h"
+
+struct split_index *init_split_index(struct index_state *istate)
+{
+	if (!istate->split_index) {
+		istate->split_index = xcalloc(1, sizeof(*istate->split_index));
+		istate->split_index->refcount = 1;
+	}
+	return istate->split_index;
+}
+
+void discard_split_index(struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+
+	if (!si)
+		return;
+	istate->split_index = NULL;
+	if (--si->refcount)
+		return;
+	if (si->base) {
+		discard_index(si->base);
+		free(si->base->cache);
+		free(si->base);
+	}
+	free(si->drop);
+	free(si);
+}
+
+/*
+ * The extension is the SHA-1 of the base, followed by the dropped
+ * base positions, each encoded as a varint of the gap since the
+ * position after the previous one.
+ */
+int read_link_extension(struct index_state *istate,
+			const void *data_, unsigned long sz)
+{
+	const unsigned char *data = data_, *end = data + sz;
+	struct split_index *si;
+	unsigned int pos = 0;
+
+	if (sz < 20)
+		return error("corrupt link extension (too short)");
+	si = init_split_index(istate);
+	hashcpy(si->base_sha1, data);
+	data += 20;
+	si->drop_nr = 0;
+	while (data < end) {
+		pos += decode_varint(&data);
+		ALLOC_GROW(si->drop, si->drop_nr + 1, si->drop_alloc);
+		si->drop[si->drop_nr++] = pos++;
+	}
+	if (data != end)
+		return error("corrupt link extension");
+	return 0;
+}
+
+void write_link_extension(struct strbuf *sb, struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+	unsigned int i, next = 0;
+
+	strbuf_add(sb, si->base_sha1, 20);
+	for (i = 0; i < si->drop_nr; i++) {
+		unsigned char buf[16];
+		int len = encode_varint(si->drop[i] - next, buf);
+		strbuf_add(sb, buf, len);
+		next = si->drop[i] + 1;
+	}
+}
+
+static int compare_ce_name(const struct cache_entry *a,
+			   const struct cache_entry *b)
+{
+	return cache_name_stage_compare(a->name, ce_namelen(a), ce_stage(a),
+					b->name, ce_namelen(b), ce_stage(b));
+}
+
+/*
+ * istate holds the entries read from the index file; fold in the base
+ * entries that were not dropped.  The merged entries are copies, so
+ * that the base stays as it is on disk for prepare_to_write_split_index()
+ * to compare against.
+ */
+void merge_base_index(struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+	struct index_state *base = si->base;
+	struct cache_entry **main_cache = istate->cache;
+	unsigned int main_nr = istate->cache_nr;
+	unsigned int i, j, d, nr;
+
+	for (d = 0; d < si->drop_nr; d++)
+		if (base->cache_nr <= si->drop[d])
+			die("corrupt link extension: no entry %u in the base",
+			    si->drop[d]);
+
+	nr = base->cache_nr - si->drop_nr + main_nr;
+	istate->cache_alloc = alloc_nr(nr);
+	istate->cache = xcalloc(istate->cache_alloc, sizeof(*istate->cache));
+	istate->cache_nr = 0;
+
+	i = j = d = 0;
+	while (i < base->cache_nr || j < main_nr) {
+		struct cache_entry *ce;
+		int cmp;
+
+		if (i == base->cache_nr)
+			cmp = 1;
+		else if (j == main_nr)
+			cmp = -1;
+		else
+			cmp = compare_ce_name(base->cache[i], main_cache[j]);
+		if (cmp > 0) {
+			ce = main_cache[j++];
+		} else if (d < si->drop_nr && si->drop[d] == i) {
+			/* an entry that replaces this one remembers it */
+			if (!cmp)
+				main_cache[j]->index = i + 1;
+			i++;
+			d++;
+			continue;
+		} else if (!cmp) {
+			die("corrupt split index: '%s' is also in the base",
+			    main_cache[j]->name);
+		} else {
+			ce = xmalloc(ce_size(base->cache[i]));
+			memcpy(ce, base->cache[i], ce_size(base->cache[i]));
+			ce->index = ++i;
+		}
+		if (istate->cache_nr == nr)
+			die("corrupt split index: too many entries");
+		istate->cache[istate->cache_nr++] = ce;
+	}
+	free(main_cache);
+}
+
+#define CE_ONDISK_FLAGS (CE_STAGEMASK | CE_VALID | CE_EXTENDED_FLAGS)
+
+/* Would "ce" be written out exactly as "base" is on disk? */
+static int same_ondisk_entry(const struct cache_entry *ce,
+			     const struct cache_entry *base)
+{
+	return (ce->ce_ctime.sec == base->ce_ctime.sec &&
+		ce->ce_ctime.nsec == base->ce_ctime.nsec &&
+		ce->ce_mtime.sec == base->ce_mtime.sec &&
+		ce->ce_mtime.nsec == base->ce_mtime.nsec &&
+		ce->ce_dev == base->ce_dev &&
+		ce->ce_ino == base->ce_ino &&
+		ce->ce_mode == base->ce_mode &&
+		ce->ce_uid == base->ce_uid &&
+		ce->ce_gid == base->ce_gid &&
+		ce->ce_size == base->ce_size &&
+		(ce->ce_flags & CE_ONDISK_FLAGS) ==
+		(base->ce_flags & CE_ONDISK_FLAGS) &&
+		!hashcmp(ce->sha1, base->sha1) &&
+		ce_namelen(ce) == ce_namelen(base) &&
+		!memcmp(ce->name, base->name, ce_namelen(ce)));
+}
+
+/*
+ * Work out which entries of istate can be taken from the base as they
+ * are.  The others are returned in "entries" to be written to the
+ * index file, and the unused base entries are recorded as dropped.
+ * Returns the number of entries written plus the number dropped, not
+ * counting racily clean entries that only have to be written out
+ * again so that they get smudged.
+ */
+unsigned int prepare_to_write_split_index(struct index_state *istate,
+					  struct cache_entry ***entries,
+					  unsigned int *entries_nr)
+{
+	struct split_index *si = istate->split_index;
+	struct index_state *base = si->base;
+	struct cache_entry **list = NULL;
+	unsigned int i, nr = 0, alloc = 0, racy = 0;
+	char *used = xcalloc(base->cache_nr + 1, 1);
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		unsigned int pos = ce->index;
+
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		if (pos && pos <= base->cache_nr && !used[pos - 1] &&
+		    same_ondisk_entry(ce, base->cache[pos - 1])) {
+			if (ce_uptodate(ce) || !is_racy_timestamp(istate, ce)) {
+				used[pos - 1] = 1;
+				continue;
+			}
+			racy++;
+		}
+		ALLOC_GROW(list, nr + 1, alloc);
+		list[nr++] = ce;
+	}
+
+	si->drop_nr = 0;
+	for (i = 0; i < base->cache_nr; i++) {
+		if (used[i])
+			continue;
+		ALLOC_GROW(si->drop, si->drop_nr + 1, si->drop_alloc);
+		si->drop[si->drop_nr++] = i;
+	}
+	free(used);
+
+	*entries = list;
+	*entries_nr = nr;
+	return nr + si->drop_nr - 2 * racy;
+}
+
+/*
+ * The "nr" entries in "cache" were just written out as a new shared
+ * index whose trailing checksum is "sha1"; make it the base.
+ */
+void replace_split_index_base(struct index_state *istate,
+			      struct cache_entry **cache, unsigned int nr,
+			      const unsigned char *sha1)
+{
+	struct split_index *si = istate->split_index;
+	struct index_state *base = xcalloc(1, sizeof(*base));
+	unsigned int i;
+
+	base->version = istate->version;
+	base->cache_nr = nr;
+	base->cache_alloc = nr;
+	base->cache = xcalloc(nr ? nr : 1, sizeof(*base->cache));
+	base->initialized = 1;
+	hashcpy(base->sha1, sha1);
+	for (i = 0; i < nr; i++) {
+		struct cache_entry *ce = cache[i];
+		base->cache[i] = xmalloc(ce_size(ce));
+		memcpy(base->cache[i], ce, ce_size(ce));
+		ce->index = i + 1;
+	}
+
+	if (si->base) {
+		discard_index(si->base);
+		free(si->base->cache);
+		free(si->base);
+	}
+	si->base = base;
+	hashcpy(si->base_sha1, sha1);
+	si->drop_nr = 0;
+}
@@ -0,0 +1,31 @@
+#ifndef SPLIT_INDEX_H
+#define SPLIT_INDEX_H
+
+/*
+ * A split index keeps most entries in a shared base index file,
+ * $GIT_DIR/sharedindex.<sha1>, which is rarely rewritten.  The index
+ * file itself only stores the entries that differ from the base and
+ * a "link" extension naming the base and the base entries it drops.
+ */
+struct split_index {
+	unsigned char base_sha1[20];
+	struct index_state *base;
+	/* positions of the base entries that are not used, ascending */
+	unsigned int *drop;
+	unsigned int drop_nr, drop_alloc;
+	int refcount;
+};
+
+extern struct split_index *init_split_index(struct index_state *);
+extern void discard_split_index(struct index_state *);
+extern int read_link_extension(struct index_state *, const void *, unsigned long);
+extern void write_link_extension(struct strbuf *, struct index_state *);
+extern void merge_base_index(struct index_state *);
+extern unsigned int prepare_to_write_split_index(struct index_state *,
+						 struct cache_entry ***,
+						 unsigned int *);
+extern void replace_split_index_base(struct index_state *,
+				     struct cache_entry **, unsigned int,
+				     const unsigned char *);
+
+#endif
@@ -3,12 +3,14 @@
  */
 #include "cache.h"
 #include "streaming.h"
+#include "delta.h"
 
 enum input_source {
 	stream_error = -1,
 	incore = 0,
 	loose = 1,
-	pack_non_delta = 2
+	pack_non_delta = 2,
+	pack_delta = 3
 };
 
 typedef int (*open_istream_fn)(struct git_istream *,
@@ -41,6 +43,7 @@ struct stream_vtbl {
 static open_method_decl(incore);
 static open_method_decl(loose);
 static open_method_decl(pack_non_delta);
+static open_method_decl(pack_delta);
 static struct git_istream *attach_stream_filter(struct git_istream *st,
 						struct stream_filter *filter);
 
@@ -49,6 +52,7 @@ static open_istream_fn open_istream_tbl[] = {
 	open_istream_incore,
 	open_istream_loose,
 	open_istream_pack_non_delta,
+	open_istream_pack_delta,
 };
 
 #define FILTER_BUFFER (1024*16)
@@ -63,6 +67,43 @@ struct filtered_istream {
 	int input_finished;
 };
 
+/*
+ * One delta in the chain leading from the requested object down to
+ * its non-delta base.  The (small) delta data is kept in core, together
+ * with a sparse table mapping output offsets to opcodes so that an
+ * arbitrary range of the result can be produced without replaying the
+ * whole delta.
+ */
+struct delta_checkpoint {
+	unsigned long out;
+	const unsigned char *op;
+};
+
+struct delta_layer {
+	unsigned char *delta;
+	unsigned long delta_size;
+	unsigned long base_size;
+	unsigned long result_size;
+	struct delta_checkpoint *ck;
+	int nr_ck;
+};
+
+/*
+ * Saved inflate state for the non-delta base at the bottom of the
+ * chain, so that seeking backwards does not have to inflate it from
+ * the beginning again.
+ */
+struct inflate_checkpoint {
+	git_zstream z;
+	off_t pos;
+	unsigned long out;
+};
+
+#define DELTA_OPS_PER_CHECKPOINT 64
+#define DELTA_BASE_WINDOW (1024*64)
+#define MAX_INFLATE_CHECKPOINTS 32
+#define MIN_INFLATE_CHECKPOINT_INTERVAL (1024*1024)
+
 struct git_istream {
 	const struct stream_vtbl *vtbl;
 	unsigned long size; /* inflated size of full object */
@@ -88,6 +129,26 @@ struct git_istream {
 			off_t pos;
 		} in_pack;
 
+		struct {
+			struct packed_git *pack;
+			struct delta_layer *layer;
+			int nr_layer;
+			unsigned long read_ptr;
+			int failed;
+
+			/* the non-delta object at the bottom of the chain */
+			char *base_buf; /* NULL unless read in core */
+			unsigned long base_size;
+			off_t base_start;
+			off_t base_pos;
+			unsigned long base_out;
+			char *win;
+			unsigned long win_off, win_len;
+			struct inflate_checkpoint *ck;
+			int nr_ck;
+			unsigned long ck_interval;
+		} in_pack_delta;
+
 		struct filtered_istream filtered;
 	} u;
 };
@@ -121,8 +182,8 @@ static enum input_source istream_source(const unsigned char *sha1,
 	case OI_LOOSE:
 		return loose;
 	case OI_PACKED:
-		if (!oi->u.packed.is_delta && big_file_threshold < size)
-			return pack_non_delta;
+		if (big_file_threshold < size)
+			return oi->u.packed.is_delta ? pack_delta : pack_non_delta;
 		/* fallthru */
 	default:
 		return incore;
@@ -450,6 +511,423 @@ static open_method_decl(pack_non_delta)
 }
 
 
+/*****************************************************************
+ *
+ * Deltified packed object stream
+ *
+ *****************************************************************/
+
+/*
+ * Decode the delta opcode at "op".  A copy from the base sets *cp_off;
+ * a literal insert sets *literal.  Returns the next opcode, or NULL if
+ * the delta is corrupt.
+ */
+static const unsigned char *next_delta_op(const unsigned char *op,
+					  const unsigned char *top,
+					  unsigned long *cp_off,
+					  unsigned long *size,
+					  const unsigned char **literal)
+{
+	unsigned char cmd = *op++;
+
+	if (cmd & 0x80) {
+		unsigned long off = 0, sz = 0;
+		int i;
+		for (i = 0; i < 4; i++)
+			if (cmd & (1 << i)) {
+				if (op >= top)
+					return NULL;
+				off |= (unsigned long)*op++ << (i * 8);
+			}
+		for (i = 0; i < 3; i++)
+			if (cmd & (0x10 << i)) {
+				if (op >= top)
+					return NULL;
+				sz |= (unsigned long)*op++ << (i * 8);
+			}
+		if (!sz)
+			sz = 0x10000;
+		*cp_off = off;
+		*size = sz;
+		*literal = NULL;
+	} else if (cmd) {
+		if (top - op < cmd)
+			return NULL;
+		*literal = op;
+		*size = cmd;
+		op += cmd;
+	} else {
+		/* cmd == 0 is reserved for future encoding extensions */
+		return NULL;
+	}
+	return op;
+}
+
+/*
+ * Check the delta for consistency and record a checkpoint every
+ * DELTA_OPS_PER_CHECKPOINT opcodes.
+ */
+static int index_delta_layer(struct delta_layer *l)
+{
+	const unsigned char *op = l->delta;
+	const unsigned char *top = l->delta + l->delta_size;
+	unsigned long out = 0;
+	int nr_ops = 0, alloc_ck = 0;
+
+	if (l->delta_size < DELTA_SIZE_MIN)
+		return -1;
+	l->base_size = get_delta_hdr_size(&op, top);
+	l->result_size = get_delta_hdr_size(&op, top);
+
+	while (op < top) {
+		unsigned long cp_off, size;
+		const unsigned char *literal;
+
+		if (!(nr_ops++ % DELTA_OPS_PER_CHECKPOINT)) {
+			ALLOC_GROW(l->ck, l->nr_ck + 1, alloc_ck);
+			l->ck[l->nr_ck].out = out;
+			l->ck[l->nr_ck].op = op;
+			l->nr_ck++;
+		}
+		op = next_delta_op(op, top, &cp_off, &size, &literal);
+		if (!op)
+			return -1;
+		if (!literal && (cp_off + size < size ||
+				 cp_off + size > l->base_size))
+			return -1;
+		if (l->result_size - out < size)
+			return -1;
+		out += size;
+	}
+	return out == l->result_size ? 0 : -1;
+}
+
+static void free_delta_layers(struct git_istream *st)
+{
+	int i;
+
+	for (i = 0; i < st->u.in_pack_delta.nr_layer; i++) {
+		free(st->u.in_pack_delta.layer[i].delta);
+		free(st->u.in_pack_delta.layer[i].ck);
+	}
+	free(st->u.in_pack_delta.layer);
+}
+
+static void save_base_checkpoint(struct git_istream *st)
+{
+	struct inflate_checkpoint *ck;
+
+	if (!st->u.in_pack_delta.ck)
+		st->u.in_pack_delta.ck = xcalloc(MAX_INFLATE_CHECKPOINTS,
+						 sizeof(*ck));
+	ck = &st->u.in_pack_delta.ck[st->u.in_pack_delta.nr_ck++];
+	git_inflate_copy(&ck->z, &st->z);
+	ck->pos = st->u.in_pack_delta.base_pos;
+	ck->out = st->u.in_pack_delta.base_out;
+}
+
+/*
+ * Position the inflate stream of the base so that the next window it
+ * produces starts at or before "off", restarting from the closest saved
+ * checkpoint (or the beginning) when "off" has already gone past.
+ */
+static void seek_base(struct git_istream *st, unsigned long off)
+{
+	struct inflate_checkpoint *ck = NULL;
+	int i;
+
+	for (i = 0; i < st->u.in_pack_delta.nr_ck; i++) {
+		if (off < st->u.in_pack_delta.ck[i].out)
+			break;
+		ck = &st->u.in_pack_delta.ck[i];
+	}
+
+	if (st->u.in_pack_delta.base_out <= off &&
+	    (!ck || ck->out <= st->u.in_pack_delta.base_out))
+		return; /* keep inflating from where we are */
+
+	if (st->z_state == z_used)
+		git_inflate_end(&st->z);
+	if (ck) {
+		git_inflate_copy(&st->z, &ck->z);
+		st->u.in_pack_delta.base_pos = ck->pos;
+		st->u.in_pack_delta.base_out = ck->out;
+	} else {
+		memset(&st->z, 0, sizeof(st->z));
+		git_inflate_init(&st->z);
+		st->u.in_pack_delta.base_pos = st->u.in_pack_delta.base_start;
+		st->u.in_pack_delta.base_out = 0;
+	}
+	st->z_state = z_used;
+	st->u.in_pack_delta.win_len = 0;
+}
+
+static int fill_base_window(struct git_istream *st)
+{
+	unsigned long want = st->u.in_pack_delta.base_size -
+		st->u.in_pack_delta.base_out;
+	unsigned long total_read = 0;
+
+	if (st->z_state != z_used)
+		return -1;
+	if (DELTA_BASE_WINDOW < want)
+		want = DELTA_BASE_WINDOW;
+
+	while (total_read < want) {
+		int status;
+		struct pack_window *window = NULL;
+		unsigned char *mapped;
+
+		mapped = use_pack(st->u.in_pack_delta.pack, &window,
+				  st->u.in_pack_delta.base_pos, &st->z.avail_in);
+
+		st->z.next_out = (unsigned char *)st->u.in_pack_delta.win + total_read;
+		st->z.avail_out = want - total_read;
+		st->z.next_in = mapped;
+		status = git_inflate(&st->z, Z_FINISH);
+
+		st->u.in_pack_delta.base_pos += st->z.next_in - mapped;
+		total_read = st->z.next_out - (unsigned char *)st->u.in_pack_delta.win;
+		unuse_pack(&window);
+
+		if (status == Z_STREAM_END)
+			break;
+		if (status != Z_OK && status != Z_BUF_ERROR)
+			return -1;
+	}
+	if (total_read != want)
+		return -1;
+
+	st->u.in_pack_delta.win_off = st->u.in_pack_delta.base_out;
+	st->u.in_pack_delta.win_len = total_read;
+	st->u.in_pack_delta.base_out += total_read;
+
+	if (st->u.in_pack_delta.nr_ck < MAX_INFLATE_CHECKPOINTS &&
+	    st->u.in_pack_delta.base_out < st->u.in_pack_delta.base_size &&
+	    (st->u.in_pack_delta.nr_ck + 1) * st->u.in_pack_delta.ck_interval
+	    <= st->u.in_pack_delta.base_out)
+		save_base_checkpoint(st);
+	return 0;
+}
+
+static int read_delta_base(struct git_istream *st, unsigned long off,
+			   char *buf, unsigned long len)
+{
+	if (st->u.in_pack_delta.base_buf) {
+		memcpy(buf, st->u.in_pack_delta.base_buf + off, len);
+		return 0;
+	}
+
+	while (len) {
+		unsigned long win_off = st->u.in_pack_delta.win_off;
+		unsigned long win_len = st->u.in_pack_delta.win_len;
+
+		if (win_off <= off && off < win_off + win_len) {
+			unsigned long n = win_off + win_len - off;
+			if (len < n)
+				n = len;
+			memcpy(buf, st->u.in_pack_delta.win + off - win_off, n);
+			buf += n;
+			off += n;
+			len -= n;
+			continue;
+		}
+		seek_base(st, off);
+		if (fill_base_window(st))
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Produce "len" bytes starting at "off" of the result of applying the
+ * delta at "level" (0 being the object we were asked to stream),
+ * recursively pulling copied ranges out of the layers below it.
+ */
+static int read_delta_layer(struct git_istream *st, int level,
+			    unsigned long off, char *buf, unsigned long len)
+{
+	struct delta_layer *l;
+	const unsigned char *op, *top;
+	unsigned long out;
+	int lo, hi;
+
+	if (level == st->u.in_pack_delta.nr_layer)
+		return read_delta_base(st, off, buf, len);
+
+	l = &st->u.in_pack_delta.layer[level];
+	top = l->delta + l->delta_size;
+
+	/* find the last checkpoint at or before "off" */
+	lo = 0;
+	hi = l->nr_ck;
+	while (hi - lo > 1) {
+		int mi = (lo + hi) / 2;
+		if (l->ck[mi].out <= off)
+			lo = mi;
+		else
+			hi = mi;
+	}
+	op = l->ck[lo].op;
+	out = l->ck[lo].out;
+
+	while (len) {
+		unsigned long cp_off, size, skip, n;
+		const unsigned char *literal;
+
+		op = next_delta_op(op, top, &cp_off, &size, &literal);
+		if (!op)
+			return -1;
+		if (off < out + size) {
+			skip = off - out;
+			n = size - skip;
+			if (len < n)
+				n = len;
+			if (literal)
+				memcpy(buf, literal + skip, n);
+			else if (read_delta_layer(st, level + 1,
+						  cp_off + skip, buf, n))
+				return -1;
+			buf += n;
+			off += n;
+			len -= n;
+		}
+		out += size;
+	}
+	return 0;
+}
+
+static read_method_decl(pack_delta)
+{
+	unsigned long remainder = st->size - st->u.in_pack_delta.read_ptr;
+
+	if (st->u.in_pack_delta.failed)
+		return -1;
+	if (remainder < sz)
+		sz = remainder;
+	if (!sz)
+		return 0;
+	if (read_delta_layer(st, 0, st->u.in_pack_delta.read_ptr, buf, sz)) {
+		st->u.in_pack_delta.failed = 1;
+		return -1;
+	}
+	st->u.in_pack_delta.read_ptr += sz;
+	return sz;
+}
+
+static close_method_decl(pack_delta)
+{
+	int i;
+
+	close_deflated_stream(st);
+	for (i = 0; i < st->u.in_pack_delta.nr_ck; i++)
+		git_inflate_end(&st->u.in_pack_delta.ck[i].z);
+	free(st->u.in_pack_delta.ck);
+	free(st->u.in_pack_delta.win);
+	free(st->u.in_pack_delta.base_buf);
+	free_delta_layers(st);
+	return 0;
+}
+
+static struct stream_vtbl pack_delta_vtbl = {
+	close_istream_pack_delta,
+	read_istream_pack_delta,
+};
+
+static open_method_decl(pack_delta)
+{
+	struct packed_git *p = oi->u.packed.pack;
+	struct pack_window *window = NULL;
+	off_t obj_offset = oi->u.packed.offset;
+	unsigned long size, result_size = 0;
+	enum object_type in_pack_type;
+	int alloc_layer = 0;
+
+	memset(&st->u.in_pack_delta, 0, sizeof(st->u.in_pack_delta));
+	st->u.in_pack_delta.pack = p;
+
+	for (;;) {
+		off_t curpos = obj_offset, base_offset;
+		struct delta_layer *l;
+
+		in_pack_type = unpack_object_header(p, &window, &curpos, &size);
+		if (in_pack_type != OBJ_OFS_DELTA &&
+		    in_pack_type != OBJ_REF_DELTA)
+			break;
+		/* a REF_DELTA loop in a corrupt pack would never end */
+		if (p->num_objects < st->u.in_pack_delta.nr_layer)
+			goto fail;
+		base_offset = get_delta_base(p, &window, &curpos,
+					     in_pack_type, obj_offset);
+		if (!base_offset)
+			goto fail;
+
+		ALLOC_GROW(st->u.in_pack_delta.layer,
+			   st->u.in_pack_delta.nr_layer + 1, alloc_layer);
+		l = &st->u.in_pack_delta.layer[st->u.in_pack_delta.nr_layer++];
+		memset(l, 0, sizeof(*l));
+		l->delta = unpack_compressed_entry(p, &window, curpos, size);
+		l->delta_size = size;
+		if (!l->delta || index_delta_layer(l))
+			goto fail;
+		if (st->u.in_pack_delta.nr_layer == 1)
+			st->size = l->result_size;
+		else if (l->result_size != result_size)
+			goto fail;
+		result_size = l->base_size;
+		obj_offset = base_offset;
+	}
+
+	switch (in_pack_type) {
+	default:
+		goto fail;
+	case OBJ_COMMIT:
+	case OBJ_TREE:
+	case OBJ_BLOB:
+	case OBJ_TAG:
+		break;
+	}
+	unuse_pack(&window);
+	if (!st->u.in_pack_delta.nr_layer || size != result_size)
+		goto fail;
+
+	st->u.in_pack_delta.base_size = size;
+	if (size <= big_file_threshold) {
+		enum object_type base_type;
+		unsigned long base_size;
+
+		st->u.in_pack_delta.base_buf =
+			unpack_entry(p, obj_offset, &base_type, &base_size);
+		if (!st->u.in_pack_delta.base_buf || base_size != size)
+			goto fail;
+		st->z_state = z_unused;
+	} else {
+		off_t curpos = obj_offset;
+
+		unpack_object_header(p, &window, &curpos, &size);
+		unuse_pack(&window);
+		st->u.in_pack_delta.base_start = curpos;
+		st->u.in_pack_delta.base_pos = curpos;
+		st->u.in_pack_delta.win = xmalloc(DELTA_BASE_WINDOW);
+		st->u.in_pack_delta.ck_interval = size / (MAX_INFLATE_CHECKPOINTS + 1);
+		if (st->u.in_pack_delta.ck_interval < MIN_INFLATE_CHECKPOINT_INTERVAL)
+			st->u.in_pack_delta.ck_interval = MIN_INFLATE_CHECKPOINT_INTERVAL;
+		memset(&st->z, 0, sizeof(st->z));
+		git_inflate_init(&st->z);
+		st->z_state = z_used;
+	}
+
+	st->vtbl = &pack_delta_vtbl;
+	return 0;
+
+fail:
+	unuse_pack(&window);
+	free(st->u.in_pack_delta.base_buf);
+	free_delta_layers(st);
+	return -1;
+}
+
+
 /*****************************************************************
  *
  * In-core stream
@@ -57,6 +57,7 @@ static int add_submodule_odb(const char *path)
 
 	alt_odb = xmalloc(objects_directory.len + 42 + sizeof(*alt_odb));
 	alt_odb->next = alt_odb_list;
+	alt_odb->loose_cache = NULL;
 	strcpy(alt_odb->base, objects_directory.buf);
 	alt_odb->name = alt_odb->base + objects_directory.len;
 	alt_odb->name[2] = '/';
@@ -0,0 +1,40 @@
+#!/bin/sh
+
+test_description="Tests performance of end-of-line conversion"
+
+. ./perf-lib.sh
+
+test_perf_default_repo
+test_checkout_worktree
+
+# The files of the test repository are the corpus, with LF line
+# endings as they are checked out, and with CRLF ones in crlf/.
+test_expect_success 'setup' '
+	git ls-files >files &&
+	echo "* text eol=crlf" >.git/info/attributes &&
+	git checkout-index -a -f --prefix=crlf/ &&
+	rm .git/info/attributes
+'
+
+test_perf 'hash LF files, text' '
+	echo "* text" >.git/info/attributes &&
+	git hash-object --stdin-paths <files >/dev/null
+'
+
+test_perf 'hash LF files, text=auto' '
+	echo "* text=auto" >.git/info/attributes &&
+	git hash-object --stdin-paths <files >/dev/null
+'
+
+test_perf 'hash CRLF files, text=auto' '
+	echo "* text=auto" >.git/info/attributes &&
+	sed "s|^|crlf/|" files |
+	git hash-object --stdin-paths >/dev/null
+'
+
+test_perf 'check out with eol=crlf' '
+	echo "* text eol=crlf" >.git/info/attributes &&
+	git checkout-index -a -f --prefix=out/
+'
+
+test_done
@@ -0,0 +1,50 @@
+#!/bin/sh
+
+test_description="Tests performance of matching many exclude patterns"
+
+. ./perf-lib.sh
+
+test_perf_default_repo
+test_checkout_worktree
+
+# A thousand patterns at the top and in each of three subdirectories:
+# exact names, "*.<suffix>" ones, globs and patterns with a slash,
+# negated every now and then.
+test_expect_success 'setup' '
+	for dir in . ignore-a ignore-b ignore-a/deeper
+	do
+		mkdir -p $dir &&
+		for i in $(test_seq 1 250)
+		do
+			echo "name-$i" &&
+			echo "*.ext$i" &&
+			echo "glob-$i-*.tmp" &&
+			if test $((i % 10)) = 0
+			then
+				echo "!keep-$i"
+			else
+				echo "dir-$i/file"
+			fi
+		done >>$dir/.gitignore &&
+		for i in $(test_seq 1 100)
+		do
+			>$dir/untracked-$i.ext$i &&
+			>$dir/glob-$i-x.tmp &&
+			>$dir/other-$i || return 1
+		done
+	done
+'
+
+test_perf 'ls-files -o --exclude-standard' '
+	git ls-files -o --exclude-standard >/dev/null
+'
+
+test_perf 'ls-files -o -i --exclude-standard' '
+	git ls-files -o -i --exclude-standard >/dev/null
+'
+
+test_perf 'status' '
+	git status >/dev/null
+'
+
+test_done
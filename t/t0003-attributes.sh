@@ -196,6 +196,30 @@ test_expect_success 'root subdir attribute test' '
 	attr_check subdir/a/i unspecified
 '
 
+test_expect_success 'the last matching rule wins, whatever its kind' '
+	mkdir -p order/sub &&
+	(
+		echo "x	one=basename two=basename" &&
+		echo "*	one=glob three=glob" &&
+		echo "/sub/x	two=path"
+	) >order/.gitattributes &&
+	echo "x	three=sub" >order/sub/.gitattributes &&
+	printf "%s\n" order/sub/x order/x order/sub/x >stdin-order &&
+	git check-attr --stdin one two three <stdin-order >actual &&
+	cat >expect <<-\EOF &&
+	order/sub/x: one: glob
+	order/sub/x: two: path
+	order/sub/x: three: sub
+	order/x: one: glob
+	order/x: two: basename
+	order/x: three: glob
+	order/sub/x: one: glob
+	order/sub/x: two: path
+	order/sub/x: three: sub
+	EOF
+	test_cmp expect actual
+'
+
 test_expect_success 'setup bare' '
 	git clone --bare . bare.git &&
 	cd bare.git
@@ -0,0 +1,115 @@
+#!/bin/sh
+
+test_description='hashing objects in a batch
+
+hash-object --stdin-paths hashes small files several at a time.  The
+names must be the same as when each file is hashed on its own, whatever
+the lengths, and in particular around the end of a 64-byte SHA-1 block.
+'
+. ./test-lib.sh
+
+# Blob names for "a" repeated that many times.  With the header, the
+# hashed messages of 47, 48, 55 and 56 bytes of content are 55, 56, 63
+# and 64 bytes long.
+test_expect_success 'setup' '
+	cat >known <<-\EOF &&
+	0 e69de29bb2d1d6434b8b29ae775ad8c2e48c5391
+	47 5e3bf7e629b4908cce461530c17a64365cb47303
+	48 12d42395b020f44bb7710113b31f688d0ebeda7c
+	55 d1985ddc2983785702b9a90effd5aff2f7cfdca4
+	56 1f973e890f52da1f22fa7e5620a628bc4ee74cb3
+	63 487e57f9763ebddbed2027c4452510c0ae0f95ff
+	64 71b7a71962774fa5c721e1163f935cb61a0e09e6
+	65 44171c1993ae70a544a8e910b00347eed4b8e8f2
+	119 1325c3d76ea6a66e75dce490a0b8cb8b12233ee0
+	120 253af86ee859905852357aee8bd83b08601364ae
+	1000 a50be72b20f0e3f078d252e8e56b11b4bec67509
+	EOF
+	while read len name
+	do
+		"$PERL_PATH" -e "print \"a\" x $len" >a$len &&
+		echo a$len >>paths &&
+		echo $name >>expect-known || return 1
+	done <known &&
+	for len in 0 1 55 56 63 64 65 127 128 4096 65536 65537 100000
+	do
+		test-genrandom "seed $len" $len >random$len &&
+		echo random$len >>paths || return 1
+	done
+'
+
+test_expect_success 'known names of blobs of many lengths' '
+	sed -e "s/ .*//" -e "s/^/a/" known |
+	git hash-object --stdin-paths >actual &&
+	test_cmp expect-known actual
+'
+
+test_expect_success 'a batch gives the same names as one at a time' '
+	while read path
+	do
+		git hash-object $path || return 1
+	done <paths >expect &&
+	git hash-object --stdin-paths <paths >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'paths that are not batched keep their place' '
+	printf "%s\n" a0 random100000 a64 random65537 a1000 >mixed &&
+	while read path
+	do
+		git hash-object $path || return 1
+	done <mixed >expect &&
+	git hash-object --stdin-paths <mixed >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a batch is written with -w' '
+	git hash-object --stdin-paths <paths >expect &&
+	git hash-object -w --stdin-paths <paths >actual &&
+	test_cmp expect actual &&
+	while read path
+	do
+		git cat-file blob $(git hash-object $path) >content &&
+		test_cmp $path content || return 1
+	done <paths
+'
+
+test_expect_success 'a batch is converted like single files' '
+	printf "one\r\ntwo\r\n" >crlf &&
+	echo "crlf text" >.gitattributes &&
+	git hash-object crlf >expect &&
+	git hash-object --no-filters crlf >>expect &&
+	echo crlf | git hash-object --stdin-paths >actual &&
+	echo crlf | git hash-object --stdin-paths --no-filters >>actual &&
+	test_cmp expect actual &&
+	! test "$(sed -n 1p actual)" = "$(sed -n 2p actual)"
+'
+
+# Git.pm writes one path and waits for its name before the next one.
+test_expect_success 'each name comes back before the next path is read' '
+	printf "%s\n" a0 a47 a1000 random127 >some &&
+	git hash-object --stdin-paths <some >expect &&
+	"$PERL_PATH" -MIPC::Open2 -e "
+		alarm 60;
+		my \$pid = open2(my \$out, my \$in,
+				 qw(git hash-object -w --stdin-paths));
+		for my \$path (@ARGV) {
+			print \$in \"\$path\n\";
+			\$in->flush;
+			print scalar <\$out>;
+		}
+		close \$in;
+		waitpid \$pid, 0;
+		exit(\$? >> 8);
+	" $(cat some) >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the lanes agree with one at a time' '
+	for size in 0 50 64 1000 100000
+	do
+		test-sha1 -b $size 2000 >/dev/null || return 1
+	done
+'
+
+test_done
@@ -506,4 +506,20 @@ test_expect_success 'New CRLF file gets LF in repo' '
 	test_cmp alllf alllf2
 '
 
+test_expect_success 'blanks and CRs at line ends are dropped, in any text' '
+	echo "blanks* text" >.gitattributes &&
+	printf "a  \r\n\t\r\n  b\t \n" >blanks-ascii &&
+	printf "a  \r\n\t\r\n  b\303\251\t \n" >blanks-utf8 &&
+	printf "one\r\ntwo \t" >blanks-no-eol &&
+	printf "a\n\n  b\n" >expect-ascii &&
+	printf "a\n\n  b\303\251\n" >expect-utf8 &&
+	printf "one\ntwo\n" >expect-no-eol &&
+	for f in ascii utf8 no-eol
+	do
+		git -c core.safecrlf=false hash-object -w blanks-$f >sha1 &&
+		git cat-file blob $(cat sha1) >actual &&
+		test_cmp expect-$f actual || return 1
+	done
+'
+
 test_done
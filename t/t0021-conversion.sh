@@ -190,4 +190,143 @@ test_expect_success 'required filter clean failure' '
 	test_must_fail git add test.fc
 '
 
+
+# The long running filter process; t0021/rot13-filter.pl logs what it
+# is asked to do to rot13-filter.log.
+test_expect_success PERL 'setup process filter' '
+	git init process &&
+	(
+		cd process &&
+		git config filter.protocol.process \
+			"\"$PERL_PATH\" \"$TEST_DIRECTORY\"/t0021/rot13-filter.pl clean smudge" &&
+		echo "*.r filter=protocol" >.gitattributes &&
+		git add .gitattributes &&
+		git commit -q -m attributes &&
+		echo hello >one.r &&
+		echo world >two.r &&
+		echo hello >error.r &&
+		echo hello >abort.r &&
+		echo hello >crash.r &&
+		echo hello >nostatus.r &&
+		echo hello >zzz.r
+	)
+'
+
+test_expect_success PERL 'one process cleans and smudges all the files' '
+	(
+		cd process &&
+		rm -f rot13-filter.log &&
+		git add one.r two.r &&
+		cat >expect <<-\EOF &&
+		start
+		clean one.r 6 [OK]
+		clean two.r 6 [OK]
+		stop
+		EOF
+		test_cmp expect rot13-filter.log &&
+		echo uryyb >expect &&
+		git cat-file blob :one.r >actual &&
+		test_cmp expect actual &&
+
+		git commit -q -m "rot13" &&
+		rm -f one.r two.r rot13-filter.log &&
+		git checkout -- one.r two.r &&
+		cat >expect <<-\EOF &&
+		start
+		smudge one.r 6 [OK]
+		smudge two.r 6 [OK]
+		stop
+		EOF
+		test_cmp expect rot13-filter.log &&
+		echo hello >expect &&
+		test_cmp expect one.r
+	)
+'
+
+# Racily clean entries are filtered again when the index is written, so
+# the checks below look for lines in the log rather than compare all of
+# it, and files that upset the filter leave the index again.
+test_expect_success PERL 'a file the process cannot filter is left as it is' '
+	(
+		cd process &&
+		rm -f rot13-filter.log &&
+		echo more >after-error.r &&
+		git add error.r after-error.r &&
+		grep "^clean error.r 6 \[ERROR\]$" rot13-filter.log &&
+		grep "^clean after-error.r 5 \[OK\]$" rot13-filter.log &&
+		test $(grep -c "^start$" rot13-filter.log) = 1 &&
+		git cat-file blob :error.r >actual &&
+		test_cmp error.r actual &&
+		git rm -q --cached error.r
+	)
+'
+
+test_expect_success PERL 'the process is not asked again after an abort' '
+	(
+		cd process &&
+		rm -f rot13-filter.log &&
+		git add abort.r zzz.r &&
+		grep "^clean abort.r 6 \[ABORT\]$" rot13-filter.log &&
+		! grep zzz.r rot13-filter.log &&
+		git cat-file blob :zzz.r >actual &&
+		test_cmp zzz.r actual &&
+		git rm -q --cached abort.r zzz.r
+	)
+'
+
+test_expect_success PERL 'a reply without a status is an error' '
+	(
+		cd process &&
+		rm -f rot13-filter.log &&
+		echo more >after-nostatus.r &&
+		git add nostatus.r after-nostatus.r 2>err &&
+		grep "sent no status for .nostatus.r." err &&
+		grep "^clean nostatus.r 6 \[NOSTATUS\]$" rot13-filter.log &&
+		grep "^clean after-nostatus.r 5 \[OK\]$" rot13-filter.log &&
+		test $(grep -c "^start$" rot13-filter.log) = 1 &&
+		git cat-file blob :nostatus.r >actual &&
+		test_cmp nostatus.r actual &&
+		git rm -q --cached nostatus.r
+	)
+'
+
+test_expect_success PERL 'a process that dies is started again' '
+	(
+		cd process &&
+		rm -f rot13-filter.log &&
+		echo more >later.r &&
+		git add crash.r later.r &&
+		grep "^clean crash.r 6 \[CRASH\]$" rot13-filter.log &&
+		grep "^clean later.r 5 \[OK\]$" rot13-filter.log &&
+		test $(grep -c "^start$" rot13-filter.log) = 2 &&
+		git cat-file blob :crash.r >actual &&
+		test_cmp crash.r actual &&
+		git rm -q --cached crash.r
+	)
+'
+
+test_expect_success PERL 'required process filter failure' '
+	(
+		cd process &&
+		test_must_fail git -c filter.protocol.required=true add crash.r &&
+		test_must_fail git -c filter.protocol.required=true add error.r
+	)
+'
+
+test_expect_success PERL 'process filter without the capability asked for' '
+	(
+		cd process &&
+		clean_only="\"$PERL_PATH\" \"$TEST_DIRECTORY\"/t0021/rot13-filter.pl clean" &&
+		rm -f one.r rot13-filter.log &&
+		git -c filter.protocol.process="$clean_only" checkout -- one.r &&
+		echo uryyb >expect &&
+		test_cmp expect one.r &&
+		! grep smudge rot13-filter.log &&
+
+		rm -f one.r &&
+		test_must_fail git -c filter.protocol.process="$clean_only" \
+			-c filter.protocol.required=true checkout -- one.r
+	)
+'
+
 test_done
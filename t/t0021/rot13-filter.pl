@@ -0,0 +1,132 @@
+#!/usr/bin/perl
+#
+# A filter process for t0021 (see "Long Running Filter Process" in
+# gitattributes(5)) that rot13s the contents both ways.
+#
+# The arguments are the capabilities it claims ("clean", "smudge").
+# What it is asked to do is appended to "rot13-filter.log", one line
+# per file.  It answers "status=error" for "error.r", "status=abort"
+# for "abort.r", nothing but a flush for "nostatus.r", and exits in
+# the middle of a request for "crash.r".
+use 5.008;
+use strict;
+use warnings;
+use IO::Handle;
+
+my @capabilities = @ARGV;
+
+open my $log, '>>', 'rot13-filter.log' or die "cannot open log: $!";
+$log->autoflush(1);
+binmode STDIN;
+binmode STDOUT;
+STDOUT->autoflush(1);
+
+sub rot13 {
+	my ($str) = @_;
+	$str =~ tr/a-zA-Z/n-za-mN-ZA-M/;
+	return $str;
+}
+
+# Returns (-1) at EOF, (1) for a flush packet, and (0, data) otherwise
+sub packet_read {
+	my ($len, $buf);
+	my $bytes = read STDIN, $len, 4;
+	return (-1) if !$bytes;
+	die "bad packet header" if $bytes != 4;
+	return (1) if $len eq '0000';
+	my $size = hex($len) - 4;
+	$bytes = read STDIN, $buf, $size;
+	die "bad packet: expected $size bytes, got $bytes" if $bytes != $size;
+	return (0, $buf);
+}
+
+sub packet_txt_read {
+	my ($res, $buf) = packet_read();
+	die "expected a text packet" if $res != 0 || $buf !~ s/\n$//;
+	return $buf;
+}
+
+sub packet_flush_read {
+	my ($res) = packet_read();
+	die "expected a flush packet" if $res != 1;
+}
+
+sub packet_write {
+	my ($buf) = @_;
+	print STDOUT sprintf("%04x", length($buf) + 4), $buf;
+}
+
+sub packet_flush {
+	print STDOUT '0000';
+}
+
+packet_txt_read() eq 'git-filter-client' or die "bad initialization";
+packet_txt_read() eq 'version=2' or die "bad version";
+packet_flush_read();
+packet_write("git-filter-server\n");
+packet_write("version=2\n");
+packet_flush();
+
+my %offered;
+for (;;) {
+	my ($res, $buf) = packet_read();
+	last if $res == 1;
+	die "bad capability" if $res != 0 || $buf !~ /^capability=(.*)\n$/;
+	$offered{$1} = 1;
+}
+foreach my $cap (@capabilities) {
+	packet_write("capability=$cap\n") if $offered{$cap};
+}
+packet_flush();
+print $log "start\n";
+
+for (;;) {
+	my ($res, $buf) = packet_read();
+	if ($res == -1) {
+		print $log "stop\n";
+		exit 0;
+	}
+	die "bad command" if $res != 0 || $buf !~ /^command=(.*)\n$/;
+	my $command = $1;
+	my $pathname;
+	for (;;) {
+		($res, $buf) = packet_read();
+		last if $res == 1;
+		$pathname = $1 if $buf =~ /^pathname=(.*)\n$/;
+	}
+	my $input = '';
+	for (;;) {
+		($res, $buf) = packet_read();
+		last if $res == 1;
+		die "unexpected EOF" if $res == -1;
+		$input .= $buf;
+	}
+	print $log "$command $pathname ", length($input);
+
+	if ($pathname eq 'crash.r') {
+		print $log " [CRASH]\n";
+		exit 1;
+	}
+	if ($pathname eq 'error.r' || $pathname eq 'abort.r') {
+		my $status = $pathname eq 'error.r' ? 'error' : 'abort';
+		print $log " [\U$status\E]\n";
+		packet_write("status=$status\n");
+		packet_flush();
+		next;
+	}
+	if ($pathname eq 'nostatus.r') {
+		print $log " [NOSTATUS]\n";
+		packet_flush();
+		next;
+	}
+
+	my $output = rot13($input);
+	packet_write("status=success\n");
+	packet_flush();
+	while (length $output) {
+		packet_write(substr($output, 0, 65516, ''));
+	}
+	packet_flush();
+	packet_flush();	# the status stays the same
+	print $log " [OK]\n";
+}
@@ -151,6 +151,39 @@ test_expect_success 'pack-objects with large loose object' '
 	cmp huge actual
 '
 
+test_expect_success 'stream a large deltified blob' '
+	test_create_repo delta &&
+	(
+		cd delta &&
+		test-genrandom "a" $(( 1200 * 1024 )) >p1 &&
+		test-genrandom "b" $(( 1300 * 1024 )) >p2 &&
+		cat p1 p2 >file &&
+		git add file &&
+		git commit -q -m one &&
+		cat p2 p1 >file &&
+		echo change >>file &&
+		git add file &&
+		git commit -q -m two &&
+		cat p1 file >expect &&
+		mv expect file &&
+		git add file &&
+		git commit -q -m three &&
+		GIT_ALLOC_LIMIT=0 git -c core.bigfilethreshold=100m \
+			repack -adf --depth=10 &&
+		GIT_ALLOC_LIMIT=0 git verify-pack -v .git/objects/pack/pack-*.idx >verify &&
+		grep "^chain length = 1:" verify &&
+		for rev in HEAD HEAD^ HEAD^^
+		do
+			GIT_ALLOC_LIMIT=1500 git cat-file blob $rev:file >actual &&
+			git show $rev:file >expect &&
+			cmp expect actual || return 1
+		done &&
+		GIT_ALLOC_LIMIT=1500 git checkout HEAD^ -- file &&
+		git show HEAD^:file >expect &&
+		cmp expect file
+	)
+'
+
 test_expect_success 'tar achiving' '
 	git archive --format=tar HEAD >/dev/null
 '
@@ -0,0 +1,78 @@
+#!/bin/sh
+
+test_description='batched object reading'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		test-genrandom "seed$i" 20000 >file$i &&
+		cat file1 file$i >delta$i &&
+		git add file$i delta$i &&
+		test_tick &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	git repack -a -d &&
+	git verify-pack -v .git/objects/pack/pack-*.idx >verify &&
+	grep "^chain length = 1:" verify &&
+	echo loose >loose &&
+	git add loose &&
+	git commit -q -m loose &&
+	git rev-list --objects --all | cut -c1-40 >objects &&
+	echo 0123456789012345678901234567890123456789 >>objects
+'
+
+test_expect_success 'read all objects in a batch' '
+	while read sha1
+	do
+		if type=$(git cat-file -t $sha1 2>/dev/null)
+		then
+			echo "$sha1 $type $(git cat-file -s $sha1) $sha1"
+		else
+			echo "$sha1 missing"
+		fi
+	done <objects | sort >expect &&
+	test-read-batch <objects >output &&
+	sort <output >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'read all objects in a batch with threads' '
+	GIT_FORCE_THREADS=1 test-read-batch <objects >output &&
+	sort <output >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'verify-pack reads the pack with threads' '
+	git verify-pack -v .git/objects/pack/pack-*.idx |
+	grep -v "^chain length\|^non delta\|: ok$" | sort >expect &&
+	GIT_FORCE_THREADS=1 git verify-pack -v .git/objects/pack/pack-*.idx |
+	grep -v "^chain length\|^non delta\|: ok$" | sort >actual &&
+	test_cmp expect actual &&
+	GIT_FORCE_THREADS=1 git fsck --full
+'
+
+test_expect_success 'fsck notices a corrupt packed object with threads' '
+	git init corrupt &&
+	(
+		cd corrupt &&
+		test-genrandom big 50000 >big &&
+		git add big &&
+		git commit -q -m big &&
+		git repack -a -d &&
+		idx=$(echo .git/objects/pack/pack-*.idx) &&
+		pack=${idx%.idx}.pack &&
+		blob=$(git rev-parse HEAD:big) &&
+		offset=$(git show-index <$idx | grep $blob | cut -d" " -f1) &&
+		chmod +w $pack &&
+		printf "\377\377\377\377" |
+		dd of=$pack bs=1 conv=notrunc seek=$(($offset + 20)) &&
+		GIT_FORCE_THREADS=1 &&
+		export GIT_FORCE_THREADS &&
+		test_must_fail git fsck --full 2>err &&
+		grep "cannot unpack $blob" err
+	)
+'
+
+test_done
@@ -0,0 +1,119 @@
+#!/bin/sh
+
+test_description='core.looseObjectCache'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	git config core.looseObjectCache true &&
+	echo one >one &&
+	git add one &&
+	git commit -q -m one &&
+	one=$(git rev-parse HEAD:one) &&
+	missing=$(echo missing | git hash-object --stdin)
+'
+
+test_expect_success 'existing loose object is found' '
+	git cat-file -e $one &&
+	echo one >expect &&
+	git cat-file blob $one >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'missing loose object is not found' '
+	test_must_fail git cat-file -e $missing
+'
+
+test_expect_success 'objects written by the same process are found' '
+	echo two >two &&
+	git add two &&
+	test_tick &&
+	git commit -q -m two &&
+	git fsck &&
+	git ls-tree HEAD >actual &&
+	grep "	two\$" actual
+'
+
+test_expect_success 'objects from alternates are found' '
+	git clone -q -s . clone &&
+	(
+		cd clone &&
+		git config core.looseObjectCache true &&
+		git cat-file -e $one &&
+		test_must_fail git cat-file -e $missing &&
+		echo three >three &&
+		git add three &&
+		git commit -q -m three &&
+		git fsck
+	)
+'
+
+test_expect_success 'fetch negotiation with the cache' '
+	git init -q other &&
+	(
+		cd other &&
+		git config core.looseObjectCache true &&
+		git fetch -q .. master:refs/heads/one &&
+		git fsck &&
+		git fetch -q ../clone master:refs/heads/clone &&
+		git fsck
+	)
+'
+
+test_expect_success 'unpack-objects with the cache' '
+	git init -q unpacked &&
+	git rev-list --objects HEAD | git pack-objects --stdout >pack &&
+	(
+		cd unpacked &&
+		git config core.looseObjectCache true &&
+		git unpack-objects -q <../pack &&
+		git cat-file -e $one
+	)
+'
+
+
+# receive-pack looks up the objects the refs point at before it runs
+# unpack-objects, which loads their fan-out directories into the cache;
+# a ref to an object next to the pushed commit makes sure that the
+# directory it lands in is one of those.
+test_expect_success 'push unpacked into a repository with the cache' '
+	git init -q --bare server.git &&
+	git --git-dir=server.git config core.looseObjectCache true &&
+	git --git-dir=server.git config receive.unpackLimit 100 &&
+	git push -q server.git master &&
+	echo four >four &&
+	git add four &&
+	test_tick &&
+	git commit -q -m four &&
+	fanout=$(git rev-parse HEAD | cut -c1-2) &&
+	mkdir blobs &&
+	for i in $(test_seq 1 1000)
+	do
+		echo $i >blobs/$i || return 1
+	done &&
+	ls blobs | sed "s|^|blobs/|" |
+	git --git-dir=server.git hash-object -w --stdin-paths >blobs.list &&
+	neighbour=$(grep "^$fanout" blobs.list | head -n 1) &&
+	test -n "$neighbour" &&
+	git --git-dir=server.git update-ref refs/tags/neighbour $neighbour &&
+	git push -q server.git master &&
+	git rev-parse master >expect &&
+	git --git-dir=server.git rev-parse master >actual &&
+	test_cmp expect actual
+'
+
+# fetch looks for the tags it follows after unpack-objects has written
+# them, without dropping the cache in between.
+test_expect_success 'fetch unpacked tags into a repository with the cache' '
+	git tag -a -m five five &&
+	(
+		cd other &&
+		git config fetch.unpackLimit 100 &&
+		git fetch -q .. master:refs/heads/five &&
+		git rev-parse --verify refs/tags/five &&
+		git cat-file -e $(git rev-parse five) &&
+		git fsck
+	)
+'
+
+test_done
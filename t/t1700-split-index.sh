@@ -0,0 +1,101 @@
+#!/bin/sh
+
+test_description='split index mode'
+
+. ./test-lib.sh
+
+# The index is split when it is smaller than the shared index it uses
+index_is_split () {
+	shared=$(ls .git/sharedindex.* | head -n 1) &&
+	test $(wc -c <.git/index) -lt $(wc -c <$shared)
+}
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
+	do
+		echo $i >file$i || return 1
+	done &&
+	test-chmtime -60 file* &&
+	git add file* &&
+	git ls-files -s >expect
+'
+
+test_expect_success 'enable split index' '
+	git update-index --split-index &&
+	test 1 = $(ls .git/sharedindex.* | wc -l) &&
+	git ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'changes go to the index, not the shared index' '
+	echo changed >file3 &&
+	echo new >new &&
+	test-chmtime -60 file3 new &&
+	git update-index file3 &&
+	git update-index --add new &&
+	git update-index --force-remove file5 &&
+	test 1 = $(ls .git/sharedindex.* | wc -l) &&
+	index_is_split &&
+	git ls-files -s >actual &&
+	git ls-files -s file3 new >expect.changed &&
+	grep -v "	file3$" expect | grep -v "	file5$" >expect.kept &&
+	sort -k 4 expect.kept expect.changed >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the index stays split across a commit and checkout' '
+	git commit -q -m split &&
+	git checkout -q -b side &&
+	echo more >file7 &&
+	test-chmtime -60 file7 &&
+	git commit -q -a -m side &&
+	git checkout -q master &&
+	index_is_split &&
+	git ls-files -s >actual &&
+	test_cmp expect actual &&
+	git diff-files --exit-code &&
+	git diff-index --cached --exit-code HEAD
+'
+
+test_expect_success 'too many changes write a new shared index' '
+	ls .git/sharedindex.* >before &&
+	git config splitIndex.maxPercentChange 0 &&
+	echo again >file9 &&
+	test-chmtime -60 file9 &&
+	git update-index file9 &&
+	git config --unset splitIndex.maxPercentChange &&
+	ls .git/sharedindex.* >after &&
+	test $(wc -l <after) = $(($(wc -l <before) + 1)) &&
+	git ls-files -s file9 >actual &&
+	test_cmp actual - <<-EOF
+	100644 $(git hash-object file9) 0	file9
+	EOF
+'
+
+test_expect_success 'a missing shared index is an error' '
+	mkdir .git/saved &&
+	mv .git/sharedindex.* .git/saved/ &&
+	test_must_fail git ls-files &&
+	mv .git/saved/* .git/ &&
+	rmdir .git/saved &&
+	git ls-files
+'
+
+test_expect_success 'disable split index' '
+	git ls-files -s >expect &&
+	git update-index --no-split-index &&
+	! index_is_split &&
+	git ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'core.splitIndex turns split index on and off' '
+	git -c core.splitIndex=true update-index --refresh &&
+	index_is_split &&
+	git -c core.splitIndex=false update-index --refresh &&
+	! index_is_split &&
+	git ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_done
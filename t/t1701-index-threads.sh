@@ -0,0 +1,105 @@
+#!/bin/sh
+
+test_description='loading the index on several threads'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	mkdir -p dir/sub &&
+	for i in $(test_seq 1 100)
+	do
+		echo $i >file$i &&
+		echo $i >dir/sub/a-rather-long-name-$i || return 1
+	done &&
+	git add . &&
+	git commit -q -m initial &&
+	git ls-files -s >expect &&
+	cat >>.git/info/exclude <<-\EOF
+	expect*
+	actual*
+	EOF
+'
+
+for version in 2 4
+do
+	test_expect_success "v$version index written for four threads" '
+		git -c core.indexthreads=4 update-index --index-version $version &&
+		test-chmtime -10 file1 &&
+		git -c core.indexthreads=4 update-index --refresh &&
+		grep IEOT .git/index &&
+		grep EOIE .git/index
+	'
+
+	test_expect_success "v$version index read on four threads" '
+		git -c core.indexthreads=4 ls-files -s >actual &&
+		test_cmp expect actual &&
+		git -c core.indexthreads=4 diff-files --exit-code &&
+		git -c core.indexthreads=4 diff-index --cached --exit-code HEAD
+	'
+
+	test_expect_success "v$version index read in one go" '
+		git -c core.indexthreads=1 ls-files -s >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "v$version index read on fewer threads" '
+		git -c core.indexthreads=3 ls-files -s >actual &&
+		test_cmp expect actual
+	'
+done
+
+test_expect_success 'the extensions are read alongside' '
+	git -c core.indexthreads=4 write-tree &&
+	git -c core.indexthreads=4 update-index --refresh &&
+	grep IEOT .git/index &&
+	grep TREE .git/index &&
+	git -c core.indexthreads=4 ls-files -s >actual &&
+	test_cmp expect actual &&
+	test-dump-cache-tree >expect-tree &&
+	test_line_count = 3 expect-tree &&
+	test_config core.indexthreads 4 &&
+	test-dump-cache-tree >actual-tree &&
+	test_cmp expect-tree actual-tree
+'
+
+test_expect_success 'resolve-undo is read alongside' '
+	git checkout -q -b side &&
+	echo side >file2 &&
+	git commit -q -a -m side &&
+	git checkout -q master &&
+	echo master >file2 &&
+	git commit -q -a -m master &&
+	test_must_fail git merge side &&
+	echo resolved >file2 &&
+	git -c core.indexthreads=4 add file2 &&
+	grep REUC .git/index &&
+	grep EOIE .git/index &&
+	git -c core.indexthreads=1 ls-files --resolve-undo >expect-reuc &&
+	test_line_count = 3 expect-reuc &&
+	git -c core.indexthreads=4 ls-files --resolve-undo >actual-reuc &&
+	test_cmp expect-reuc actual-reuc &&
+	git commit -q -m merged &&
+	git ls-files -s >expect
+'
+
+test_expect_success 'one thread writes no offset table' '
+	test-chmtime -10 file1 &&
+	git -c core.indexthreads=1 update-index --refresh &&
+	! grep IEOT .git/index &&
+	! grep EOIE .git/index &&
+	git -c core.indexthreads=4 ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'split index' '
+	git -c core.indexthreads=4 update-index --split-index &&
+	echo changed >file7 &&
+	git -c core.indexthreads=4 add file7 &&
+	git -c core.indexthreads=4 ls-files -s >actual &&
+	sed "/	file7\$/d" expect >expect-split &&
+	sed "/	file7\$/d" actual >actual-split &&
+	test_cmp expect-split actual-split &&
+	git -c core.indexthreads=4 diff-files --exit-code
+'
+
+test_done
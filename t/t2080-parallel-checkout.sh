@@ -0,0 +1,89 @@
+#!/bin/sh
+
+test_description='checking out files on several threads'
+
+. ./test-lib.sh
+
+# Enough files for four threads, and a few that the main thread has to
+# check out itself.
+test_expect_success 'setup' '
+	mkdir a b &&
+	for i in $(test_seq 1 250)
+	do
+		echo "a $i" >a/file$i &&
+		echo "b $i" >b/file$i || return 1
+	done &&
+	echo "#!/bin/sh" >a/exec &&
+	chmod +x a/exec &&
+	printf "one\ntwo\n" >b/crlf &&
+	echo "\$Id\$" >b/ident &&
+	cat >.gitattributes <<-\EOF &&
+	b/crlf eol=crlf
+	b/ident ident
+	EOF
+	git add . &&
+	link=$(printf a/file1 | git hash-object -w --stdin) &&
+	git update-index --add --cacheinfo 120000 $link link &&
+	git commit -q -m initial &&
+	git checkout -q -b other &&
+	for i in $(test_seq 1 250)
+	do
+		echo "other $i" >a/file$i || return 1
+	done &&
+	echo changed >a/file7 &&
+	git rm -q b/file9 &&
+	git commit -q -a -m other &&
+	git checkout -q master
+'
+
+test_expect_success 'switching branches on several threads' '
+	GIT_TRACE="$(pwd)/trace" git -c core.checkoutthreads=4 checkout -q other &&
+	grep "^parallel-checkout: 250 files, 250 written on 2 threads" trace &&
+	echo changed >expect &&
+	test_cmp expect a/file7 &&
+	echo "other 100" >expect &&
+	test_cmp expect a/file100 &&
+	! test -f b/file9 &&
+	GIT_TRACE="$(pwd)/trace" git -c core.checkoutthreads=4 checkout -q master &&
+	grep "^parallel-checkout: 25[0-9] files, 25[01] written on 2 threads" trace &&
+	echo "a 7" >expect &&
+	test_cmp expect a/file7 &&
+	echo "a 100" >expect &&
+	test_cmp expect a/file100 &&
+	echo "b 9" >expect &&
+	test_cmp expect b/file9 &&
+	git diff-files --exit-code
+'
+
+test_expect_success 'a clone checks out the same files on any number of threads' '
+	git clone -q -c core.checkoutthreads=1 . serial &&
+	git clone -q -c core.checkoutthreads=4 . parallel &&
+	(
+		cd parallel &&
+		git diff-files --exit-code &&
+		git status --porcelain >../actual
+	) &&
+	! test -s actual &&
+	test_cmp serial/a/file100 parallel/a/file100 &&
+	test_cmp serial/b/crlf parallel/b/crlf &&
+	test_cmp serial/b/ident parallel/b/ident &&
+	printf "one\r\ntwo\r\n" >expect &&
+	test_cmp expect parallel/b/crlf &&
+	! grep "^.Id.$" parallel/b/ident &&
+	test -x parallel/a/exec
+'
+
+test_expect_success SYMLINKS 'symlinks are checked out too' '
+	test -h parallel/link &&
+	test "$(readlink parallel/link)" = a/file1
+'
+
+test_expect_success 'files in the way are replaced' '
+	rm -rf a &&
+	echo in the way >a &&
+	git -c core.checkoutthreads=4 reset -q --hard &&
+	test -d a &&
+	git diff-files --exit-code
+'
+
+test_done
@@ -214,4 +214,39 @@ test_expect_success 'subdirectory ignore (l1)' '
 	test_cmp expect actual
 '
 
+test_expect_success 'the last matching pattern wins, whatever its kind' '
+	mkdir -p order/sub order/zzz &&
+	(
+		cd order &&
+		git init -q &&
+		cat >.gitignore <<-\EOF &&
+		/.gitignore
+		*.o
+		!keep.o
+		!kept.o
+		k*p.o
+		foo*
+		!foobar
+		/top.c
+		*.c
+		!main.c
+		EOF
+		for f in a.o keep.o kept.o b.c main.c top.c foobar foox \
+			sub/a.o sub/b.o zzz/a.o zzz/keep.o
+		do
+			>$f || return 1
+		done &&
+		echo "!a.o" >sub/.gitignore &&
+		git ls-files -o --exclude-standard
+	) >actual &&
+	cat >expect <<-\EOF &&
+	foobar
+	kept.o
+	main.c
+	sub/.gitignore
+	sub/a.o
+	EOF
+	test_cmp expect actual
+'
+
 test_done
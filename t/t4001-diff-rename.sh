@@ -102,4 +102,37 @@ test_expect_success 'setup for many rename source candidates' '
 	grep warning actual.err
 '
 
+test_expect_success 'rename candidates are read in a batch' '
+	git reset --hard &&
+	mkdir batch &&
+	for i in $(test_seq 100)
+	do
+		test_seq $i $((i + 200)) >batch/file$i || return 1
+	done &&
+	git add batch &&
+	test_tick &&
+	git commit -m "batch" &&
+	git mv batch moved &&
+	for i in $(test_seq 100)
+	do
+		echo changed >>moved/file$i || return 1
+	done &&
+	git add moved &&
+	test_tick &&
+	git commit -m "moved" &&
+	git repack -a -d &&
+	git checkout -q HEAD~2 &&
+	git diff -M --name-status master^ master >expect &&
+	test_line_count = 100 expect &&
+	! grep -v "^R" expect &&
+	(
+		GIT_FORCE_THREADS=1 &&
+		GIT_TRACE="$(pwd)/trace" &&
+		export GIT_FORCE_THREADS GIT_TRACE &&
+		git diff -M --name-status master^ master >actual
+	) &&
+	test_cmp expect actual &&
+	grep "diff: 200 of 200 blobs read in a batch" trace
+'
+
 test_done
@@ -380,6 +380,81 @@ test_expect_success 'index-pack with --strict' '
 	)
 '
 
+test_expect_success 'threaded write phase produces identical packs' '
+	git pack-objects --window=0 --threads=1 --stdout <obj-list >serial.pack &&
+	git pack-objects --window=0 --threads=4 --stdout <obj-list >threaded.pack &&
+	test_cmp serial.pack threaded.pack &&
+	git pack-objects --threads=1 --stdout <obj-list >serial.pack &&
+	git pack-objects --threads=4 --stdout <obj-list >threaded.pack &&
+	test_cmp serial.pack threaded.pack &&
+	git pack-objects --threads=1 test-serial <obj-list >serial.name &&
+	git pack-objects --threads=4 test-threaded <obj-list >threaded.name &&
+	test_cmp serial.name threaded.name &&
+	test_cmp test-serial-$(cat serial.name).pack \
+		 test-threaded-$(cat threaded.name).pack
+'
+
+test_expect_success 'delta search threads report their share of the work' '
+	GIT_TRACE=$(pwd)/trace git pack-objects --threads=2 --stdout \
+		<obj-list >/dev/null &&
+	grep "delta thread 0:" trace &&
+	grep "delta thread 1:" trace
+'
+
+# Forty large versions of one path and forty small ones of another,
+# whose name sorts it first in the delta list: the thread with the
+# small ones is done early and has to steal from the other, inside its
+# single path.
+test_expect_success 'delta search threads steal work on skewed input' '
+	mkdir skewed &&
+	test-genrandom big 200000 >skewed/big &&
+	test-genrandom med 2000 >skewed/med &&
+	for i in $(test_seq 1 40)
+	do
+		for name in big med
+		do
+			{ cat skewed/$name && echo $i; } >skewed/$name.$i &&
+			echo "$(git hash-object -w skewed/$name.$i) $name" ||
+			return 1
+		done
+	done >skewed.list &&
+	git pack-objects --threads=1 skewed-1 <skewed.list >skewed-1.name &&
+	GIT_TRACE=$(pwd)/skewed.trace \
+		git pack-objects --threads=8 skewed-8 <skewed.list >skewed-8.name &&
+	grep "delta thread [0-9]*:.* [1-9][0-9]* steals" skewed.trace &&
+	for t in 1 8
+	do
+		git verify-pack skewed-$t-$(cat skewed-$t.name).idx &&
+		git show-index <skewed-$t-$(cat skewed-$t.name).idx |
+		cut -d" " -f2 | sort >skewed-$t.objects || return 1
+	done &&
+	cut -d" " -f1 skewed.list | sort >expect &&
+	test_cmp expect skewed-1.objects &&
+	test_cmp expect skewed-8.objects
+'
+
+test_expect_success 'a wholly wanted pack is copied verbatim' '
+	git init reuse &&
+	(
+		cd reuse &&
+		cp ../a ../b ../c ../d . &&
+		git add a b c d &&
+		git commit -m one &&
+		echo more >>d &&
+		git commit -a -m two &&
+		git repack -a -d &&
+		git rev-list --objects --all >objects &&
+		GIT_TRACE=$(pwd)/trace git pack-objects --stdout \
+			--delta-base-offset <objects >out.pack &&
+		grep "pack-objects: reusing" trace &&
+		test_cmp .git/objects/pack/pack-*.pack out.pack &&
+		rm -f trace &&
+		GIT_TRACE=$(pwd)/trace git -c pack.allowPackReuse=false \
+			pack-objects --stdout <objects >/dev/null &&
+		! grep "pack-objects: reusing" trace
+	)
+'
+
 test_expect_success 'honor pack.packSizeLimit' '
 	git config pack.packSizeLimit 3m &&
 	packname_10=$(git pack-objects test-10 <obj-list) &&
@@ -400,6 +475,17 @@ test_expect_success 'verify resulting packs' '
 	git verify-pack test-11-*.pack
 '
 
+test_expect_success 'pack and index written by the hashing thread' '
+	git config --unset pack.packSizeLimit &&
+	packname_12=$(git -c core.hashthread=false pack-objects test-12 <obj-list) &&
+	packname_13=$(git -c core.hashthread=true pack-objects test-13 <obj-list) &&
+	test $packname_12 = $packname_13 &&
+	cmp test-12-$packname_12.pack test-13-$packname_13.pack &&
+	cmp test-12-$packname_12.idx test-13-$packname_13.idx &&
+	git -c core.hashthread=true index-pack -o test-13.idx test-13-$packname_13.pack &&
+	cmp test-12-$packname_12.idx test-13.idx
+'
+
 #
 # WARNING!
 #
@@ -423,4 +509,14 @@ test_expect_success \
     'test_must_fail git -c core.bigfilethreshold=1 index-pack -o bad.idx test-3.pack 2>msg &&
      test_i18ngrep "SHA1 COLLISION FOUND" msg'
 
+test_expect_success 'deltas with long matches round-trip' '
+	test-genrandom "delta a" 100000 >delta-a &&
+	test-genrandom "delta b" 3000 >delta-b &&
+	cat delta-a delta-b delta-a delta-b delta-b >delta-src &&
+	cat delta-b delta-a delta-a delta-b >delta-dst &&
+	test-delta -d delta-src delta-dst delta-out &&
+	test-delta -p delta-src delta-out delta-rt &&
+	test_cmp delta-dst delta-rt
+'
+
 test_done
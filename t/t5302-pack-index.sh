@@ -65,6 +65,23 @@ test_expect_success \
     'cmp "test-1-${pack1}.idx" "1.idx" &&
      cmp "test-2-${pack2}.idx" "2.idx"'
 
+test_expect_success 'threaded first pass gives the same index' '
+	git index-pack --threads=4 --index-version=2 -o 4.idx \
+		"test-1-${pack1}.pack" &&
+	cmp "test-2-${pack2}.idx" 4.idx &&
+	git index-pack --threads=4 --strict --index-version=2 \
+		--stdin <"test-1-${pack1}.pack" &&
+	cmp "test-2-${pack2}.idx" .git/objects/pack/pack-${pack1}.idx &&
+	rm -f .git/objects/pack/pack-${pack1}.*
+'
+
+test_expect_success 'deltas resolved while reading keep their depth' '
+	git index-pack --threads=1 --verify-stat "test-2-${pack2}.pack" >stat1 &&
+	git index-pack --threads=4 --verify-stat "test-2-${pack2}.pack" >stat4 &&
+	grep "chain length = 2" stat1 &&
+	test_cmp stat1 stat4
+'
+
 test_expect_success 'index-pack --verify on index version 1' '
 	git index-pack --verify "test-1-${pack1}.pack"
 '
@@ -48,4 +48,86 @@ test_expect_success 'rev-list --objects with pathspecs and copied files' '
 	! grep one output
 '
 
+test_expect_success 'rev-list --objects --threads keeps the order' '
+	for i in 1 2 3 4 5
+	do
+		mkdir -p dir$i/sub &&
+		echo $i >dir$i/file &&
+		echo $i >dir$i/sub/file &&
+		git add dir$i &&
+		test_tick &&
+		git commit -m dir$i || return 1
+	done &&
+	git repack -a -d &&
+	git rev-list --objects --all >expect &&
+	git rev-list --objects --all --threads=4 >actual &&
+	test_cmp expect actual
+'
+
+# Forty directories changed in each of sixty commits, packed with deep
+# deltas, gives the threads enough trees to all take some, even when
+# they have to share a single CPU with the walk.
+test_expect_success 'rev-list --objects --threads on a wide history' '
+	git init wide &&
+	(
+		cd wide &&
+		for c in $(test_seq 1 60)
+		do
+			for d in $(test_seq 1 40)
+			do
+				mkdir -p dir$d/sub$(($c % 3)) &&
+				echo "$c $d" >dir$d/sub$(($c % 3))/file &&
+				echo $c >>dir$d/log || return 1
+			done &&
+			git add . &&
+			test_tick &&
+			git commit -q -m $c || return 1
+		done &&
+		git repack -a -d -q --depth=50 --window=50 &&
+		git rev-list --objects --all >expect &&
+		GIT_TRACE="$(pwd)/trace" \
+			git rev-list --objects --all --threads=4 >actual &&
+		grep "^list-objects: tree thread [0-9]*: [1-9]" trace >busy &&
+		test_line_count -ge 2 busy &&
+		sort expect >expect.sorted &&
+		sort actual >actual.sorted &&
+		test_cmp expect.sorted actual.sorted &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'rev-list --compact-commits gives the same output' '
+	(
+		cd wide &&
+		for opts in "--parents --topo-order" "--pretty=raw --topo-order" \
+			"--header --date-order" "--grep=1 --pretty=oneline" \
+			"--objects" "--bisect-all" "--children" \
+			"--graph --pretty=oneline"
+		do
+			git rev-list $opts --all >expect &&
+			git rev-list --compact-commits $opts --all >actual &&
+			test_cmp expect actual || return 1
+		done &&
+		git rev-list --parents --simplify-merges --all -- dir1 >expect &&
+		git rev-list --compact-commits --parents --simplify-merges \
+			--all -- dir1 >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'pack-objects --compact-commits packs the same objects' '
+	(
+		cd wide &&
+		git pack-objects --revs --all --stdout </dev/null >expect.pack &&
+		git pack-objects --revs --all --compact-commits --stdout \
+			</dev/null >actual.pack &&
+		git index-pack -o expect.idx expect.pack &&
+		git index-pack -o actual.idx actual.pack &&
+		git show-index <expect.idx | cut -d" " -f2 | sort >expect &&
+		git show-index <actual.idx | cut -d" " -f2 | sort >actual &&
+		test_line_count -gt 30 expect &&
+		test_cmp expect actual
+	)
+'
+
 test_done
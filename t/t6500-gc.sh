@@ -25,4 +25,33 @@ test_expect_success 'gc -h with invalid configuration' '
 	test_i18ngrep "[Uu]sage" broken/usage
 '
 
+test_expect_success 'gc --auto with gc.autogeometric rolls up small packs' '
+	git init geometric &&
+	(
+		cd geometric &&
+		test-genrandom big 100000 >big &&
+		git add big &&
+		test_tick &&
+		git commit -m big &&
+		git repack -d &&
+		large=$(ls .git/objects/pack/*.pack) &&
+		for i in 1 2 3
+		do
+			echo $i >file &&
+			git add file &&
+			test_tick &&
+			git commit -m $i &&
+			git repack -d || exit 1
+		done &&
+		test 4 = $(ls .git/objects/pack/*.pack | wc -l) &&
+		git config gc.autopacklimit 3 &&
+		git config gc.autogeometric 2 &&
+		git gc --auto &&
+		ls .git/objects/pack/*.pack >packs &&
+		test_line_count = 2 packs &&
+		grep "^$large\$" packs &&
+		git fsck
+	)
+'
+
 test_done
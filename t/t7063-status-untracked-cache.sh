@@ -0,0 +1,226 @@
+#!/bin/sh
+
+test_description='status with the untracked cache'
+
+. ./test-lib.sh
+
+# Give paths an old mtime that no earlier call handed out, so that the
+# cache sees them as changed without them looking racily clean.
+mtime=1000000000
+settle () {
+	mtime=$(($mtime + 100)) &&
+	test-chmtime =$mtime "$@"
+}
+
+# Run status in "repo", recording how many directories were read
+status_read () {
+	: >trace &&
+	(
+		cd repo &&
+		GIT_TRACE_UNTRACKED="$TRASH_DIRECTORY/trace" \
+		git status --porcelain >../actual
+	) &&
+	sed -n -e "s/^untracked cache: \([0-9]*\) read.*/\1/p" trace >read
+}
+
+test_expect_success 'setup' '
+	git init repo &&
+	(
+		cd repo &&
+		git config core.trustctime false &&
+		mkdir dir1 dir2 dir3 dir3/sub empty &&
+		echo "*.o" >.gitignore &&
+		echo two >dir3/.gitignore &&
+		for f in tracked one dir1/tracked dir1/one dir1/ignored.o \
+			 dir2/one dir3/tracked dir3/two dir3/sub/three
+		do
+			echo $f >$f || return 1
+		done &&
+		git add .gitignore tracked dir1/tracked \
+			dir3/.gitignore dir3/tracked &&
+		git commit -q -m initial &&
+		git update-index --untracked-cache
+	) &&
+	settle $(find repo -name .git -prune -o -print) &&
+	cat >expect <<-\EOF
+	?? dir1/one
+	?? dir2/
+	?? dir3/sub/
+	?? one
+	EOF
+'
+
+test_expect_success 'the first status reads every directory' '
+	status_read &&
+	test_cmp expect actual &&
+	echo 6 >expect.read &&
+	test_cmp expect.read read
+'
+
+test_expect_success 'an unchanged tree is not read again' '
+	status_read &&
+	test_cmp expect actual &&
+	echo 0 >expect.read &&
+	test_cmp expect.read read
+'
+
+test_expect_success 'a new untracked file is seen' '
+	echo two >repo/dir1/two &&
+	settle repo/dir1 repo/dir1/two &&
+	status_read &&
+	cat >expect <<-\EOF &&
+	?? dir1/one
+	?? dir1/two
+	?? dir2/
+	?? dir3/sub/
+	?? one
+	EOF
+	test_cmp expect actual &&
+	echo 2 >expect.read &&
+	test_cmp expect.read read
+'
+
+test_expect_success 'a removed untracked file is gone' '
+	rm repo/dir1/two &&
+	settle repo/dir1 &&
+	status_read &&
+	cat >expect <<-\EOF &&
+	?? dir1/one
+	?? dir2/
+	?? dir3/sub/
+	?? one
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'a path removed from the index shows up' '
+	(cd repo && git rm -q --cached dir1/tracked) &&
+	status_read &&
+	cat >expect <<-\EOF &&
+	D  dir1/tracked
+	?? dir1/
+	?? dir2/
+	?? dir3/sub/
+	?? one
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'a path added to the index goes away' '
+	(cd repo && git add dir1/tracked dir1/one) &&
+	status_read &&
+	cat >expect <<-\EOF &&
+	A  dir1/one
+	?? dir2/
+	?? dir3/sub/
+	?? one
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'reset brings back paths that left the index' '
+	(cd repo && git reset -q) &&
+	status_read &&
+	cat >expect <<-\EOF &&
+	?? dir1/one
+	?? dir2/
+	?? dir3/sub/
+	?? one
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'a changed per-directory exclude file is honoured' '
+	echo nothing >repo/dir3/.gitignore &&
+	settle repo/dir3/.gitignore &&
+	status_read &&
+	cat >expect <<-\EOF &&
+	 M dir3/.gitignore
+	?? dir1/one
+	?? dir2/
+	?? dir3/sub/
+	?? dir3/two
+	?? one
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'an untracked directory that becomes empty is hidden' '
+	rm repo/dir2/one &&
+	settle repo/dir2 &&
+	status_read &&
+	cat >expect <<-\EOF &&
+	 M dir3/.gitignore
+	?? dir1/one
+	?? dir3/sub/
+	?? dir3/two
+	?? one
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'an empty directory that gets a file is shown' '
+	echo file >repo/empty/file &&
+	settle repo/empty repo/empty/file &&
+	status_read &&
+	cat >expect <<-\EOF &&
+	 M dir3/.gitignore
+	?? dir1/one
+	?? dir3/sub/
+	?? dir3/two
+	?? empty/
+	?? one
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'a change to info/exclude reads everything again' '
+	echo one >>repo/.git/info/exclude &&
+	status_read &&
+	cat >expect <<-\EOF &&
+	 M dir3/.gitignore
+	?? dir3/sub/
+	?? dir3/two
+	?? empty/
+	EOF
+	test_cmp expect actual &&
+	echo 6 >expect.read &&
+	test_cmp expect.read read
+'
+
+test_expect_success 'a different mode of status does not use stale results' '
+	(cd repo && git status --porcelain -uall >../actual) &&
+	cat >expect <<-\EOF &&
+	 M dir3/.gitignore
+	?? dir3/sub/three
+	?? dir3/two
+	?? empty/file
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'the cache can be turned off' '
+	(cd repo && git update-index --no-untracked-cache) &&
+	status_read &&
+	cat >expect <<-\EOF &&
+	 M dir3/.gitignore
+	?? dir3/sub/
+	?? dir3/two
+	?? empty/
+	EOF
+	test_cmp expect actual &&
+	! test -s read
+'
+
+test_expect_success 'core.untrackedCache turns the cache on' '
+	(cd repo && git config core.untrackedCache true) &&
+	status_read &&
+	test_cmp expect actual &&
+	test -s read &&
+	status_read &&
+	test_cmp expect actual &&
+	echo 0 >expect.read &&
+	test_cmp expect.read read
+'
+
+test_done
@@ -1298,4 +1298,36 @@ test_expect_failure '.git/config ignore=all suppresses submodule summary' '
 	git config -f .gitmodules  --remove-section submodule.subname
 '
 
+
+test_lazy_prereq FILE_SIZE_LIMIT '
+	(ulimit -f 0 && trap "" XFSZ && ! echo x >too-large) 2>/dev/null
+'
+
+test_expect_success FILE_SIZE_LIMIT 'status quietly skips an index it cannot write' '
+	cat >expect <<-\EOF &&
+	A  file
+	A  file
+	done
+	EOF
+	git init unwritable &&
+	(
+		cd unwritable &&
+		echo content >file &&
+		git add file &&
+		test-chmtime =-60 file &&
+		cp .git/index ../index.before &&
+		(
+			ulimit -f 0 &&
+			trap "" XFSZ &&
+			git status --porcelain 2>&1 &&
+			git -c core.hashThread=true status --porcelain 2>&1 &&
+			test_must_fail git add file 2>/dev/null &&
+			echo done
+		) | cat >../actual &&
+		test_cmp ../index.before .git/index &&
+		test_path_is_missing .git/index.lock
+	) &&
+	test_cmp expect actual
+'
+
 test_done
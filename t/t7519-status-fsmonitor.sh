@@ -0,0 +1,119 @@
+#!/bin/sh
+
+test_description='status with a file system monitor'
+
+. ./test-lib.sh
+
+# The hook reports the paths listed in .git/fsmonitor-changed, and
+# fails when there is no such file.  Like a real monitor asked about
+# an index that was not written out again, it keeps reporting them.
+test_expect_success 'setup' '
+	mkdir dir &&
+	echo one >one &&
+	echo two >two &&
+	echo three >dir/three &&
+	git add one two dir/three &&
+	git commit -q -m initial &&
+	test-chmtime -60 one two dir/three &&
+	cat >>.git/info/exclude <<-\EOF &&
+	expect*
+	actual*
+	EOF
+	write_script .git/fsmonitor-hook <<-\EOF &&
+	test "$1" = 1 &&
+	test -f .git/fsmonitor-changed &&
+	tr "\012" "\000" <.git/fsmonitor-changed
+	EOF
+	: >.git/fsmonitor-changed &&
+	git config core.fsmonitor .git/fsmonitor-hook &&
+	git status --porcelain >actual &&
+	! test -s actual
+'
+
+test_expect_success 'an unreported change is not seen' '
+	echo changed >one &&
+	test-chmtime -30 one &&
+	git status --porcelain -uno >actual &&
+	! test -s actual &&
+	git diff-files --name-only >actual &&
+	! test -s actual
+'
+
+test_expect_success 'a reported change is seen' '
+	echo one >.git/fsmonitor-changed &&
+	git status --porcelain -uno >actual &&
+	echo " M one" >expect &&
+	test_cmp expect actual &&
+	git diff-files --name-only >actual &&
+	echo one >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a reported directory covers the paths in it' '
+	echo changed >dir/three &&
+	test-chmtime -30 dir/three &&
+	echo dir >>.git/fsmonitor-changed &&
+	git status --porcelain -uno >actual &&
+	cat >expect <<-\EOF &&
+	 M dir/three
+	 M one
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'everything is checked when the hook fails' '
+	echo changed >two &&
+	test-chmtime -30 two &&
+	rm .git/fsmonitor-changed &&
+	git status --porcelain -uno >actual &&
+	cat >expect <<-\EOF &&
+	 M dir/three
+	 M one
+	 M two
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'paths found changed are checked until they are clean' '
+	: >.git/fsmonitor-changed &&
+	git status --porcelain -uno >actual &&
+	test_cmp expect actual &&
+	git checkout -- one two &&
+	git status --porcelain -uno >actual &&
+	echo " M dir/three" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the untracked cache trusts the monitor' '
+	git update-index --untracked-cache &&
+	git status --porcelain >actual &&
+	test_cmp expect actual &&
+	echo new >dir/new &&
+	git status --porcelain >actual &&
+	test_cmp expect actual &&
+	echo dir/new >>.git/fsmonitor-changed &&
+	git status --porcelain >actual &&
+	cat >expect <<-\EOF &&
+	 M dir/three
+	?? dir/new
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'unsetting core.fsmonitor checks everything again' '
+	: >.git/fsmonitor-changed &&
+	echo changed >one &&
+	test-chmtime -30 one &&
+	git status --porcelain -uno >actual &&
+	echo " M dir/three" >expect &&
+	test_cmp expect actual &&
+	git config --unset core.fsmonitor &&
+	git status --porcelain -uno >actual &&
+	cat >expect <<-\EOF &&
+	 M dir/three
+	 M one
+	EOF
+	test_cmp expect actual
+'
+
+test_done
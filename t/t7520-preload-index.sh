@@ -0,0 +1,90 @@
+#!/bin/sh
+
+test_description='comparing the index with the work tree on several threads'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	mkdir -p big small &&
+	for i in $(test_seq 1 300)
+	do
+		echo $i >big/file$i || return 1
+	done &&
+	echo one >small/one &&
+	echo two >small/two &&
+	git add . &&
+	git commit -q -m initial &&
+	git config core.preloadindex true &&
+	test-chmtime -60 big/file7 small/one &&
+	echo changed >big/file7 &&
+	echo changed >small/one &&
+	rm big/file9 &&
+	cat >.git/info/exclude <<-\EOF
+	expect*
+	actual*
+	trace
+	EOF
+'
+
+test_expect_success 'ls-files shows modified and deleted files' '
+	GIT_TRACE="$(pwd)/trace" git ls-files -m -d >actual &&
+	grep "^preload-index: 302 entries" trace &&
+	cat >expect <<-\EOF &&
+	big/file7
+	big/file9
+	big/file9
+	small/one
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'ls-files with a pathspec' '
+	git ls-files -m small >actual &&
+	echo small/one >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'diff-files' '
+	git diff-files --name-only >actual &&
+	cat >expect <<-\EOF &&
+	big/file7
+	big/file9
+	small/one
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'add -u' '
+	git add -u &&
+	git diff-files --name-only >actual &&
+	! test -s actual &&
+	git diff-index --cached --name-only HEAD >actual &&
+	test_cmp expect actual
+'
+
+# Enough entries that the forced threads cannot all be done before
+# the others get a turn, even on a single CPU.
+test_expect_success 'several threads take batches' '
+	git init many &&
+	(
+		cd many &&
+		mkdir dir &&
+		for i in $(test_seq 1 5000)
+		do
+			echo $i >dir/file$i || return 1
+		done &&
+		git add dir &&
+		git config core.preloadindex true &&
+		test-chmtime -60 dir/file4321 &&
+		echo changed >dir/file4321 &&
+		GIT_FORCE_THREADS=1 GIT_TRACE="$(pwd)/../trace-many" \
+			git ls-files -m >../actual
+	) &&
+	echo dir/file4321 >expect &&
+	test_cmp expect actual &&
+	grep "^preload-index: 5000 entries, 5000 lstats, 20 threads" trace-many &&
+	grep "^preload-index: thread [0-9]*: [1-9][0-9]* batches" trace-many >busy &&
+	test_line_count -ge 2 busy
+'
+
+test_done
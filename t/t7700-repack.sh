@@ -164,5 +164,40 @@ test_expect_success 'objects made unreachable by grafts only are kept' '
 	git cat-file -t $H1
 	'
 
-test_done
+test_expect_success 'geometric repack rolls up only the small packs' '
+	git init geometric &&
+	(
+		cd geometric &&
+		test-genrandom big 100000 >big &&
+		git add big &&
+		git commit -m big &&
+		git repack -d &&
+		big=$(ls .git/objects/pack/*.pack) &&
+		for i in 1 2 3
+		do
+			echo $i >small &&
+			git add small &&
+			git commit -m small$i &&
+			git repack -d || exit 1
+		done &&
+		test 4 = $(ls .git/objects/pack/*.pack | wc -l) &&
+		git repack -d --geometric=2 &&
+		test 2 = $(ls .git/objects/pack/*.pack | wc -l) &&
+		test -f "$big" &&
+		git fsck &&
+		git repack -d --geometric=2 &&
+		test 2 = $(ls .git/objects/pack/*.pack | wc -l) &&
+		test -f "$big"
+	)
+'
 
+test_expect_success 'geometric repack refuses -a and bad factors' '
+	(
+		cd geometric &&
+		test_must_fail git repack -a -d --geometric=2 &&
+		test_must_fail git repack -d --geometric=1 &&
+		test_must_fail git repack -d --geometric=x
+	)
+'
+
+test_done
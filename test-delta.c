@@ -13,7 +13,64 @@
 #include "cache.h"
 
 static const char usage_str[] =
-	"test-delta (-d|-p) <from_file> <data_file> <out_file>";
+	"test-delta (-d|-p) <from_file> <data_file> <out_file>\n"
+	"   or: test-delta -b <from_file> <data_file> [<rounds>]";
+
+static double elapsed(struct timeval *start)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_usec - start->tv_usec) / 1e6;
+}
+
+/*
+ * Time create_delta_index() and create_delta() separately over a few
+ * rounds, so that changes to either can be measured on real data.
+ */
+static int bench_delta(void *from_buf, unsigned long from_size,
+		       void *data_buf, unsigned long data_size, int rounds)
+{
+	struct delta_index *index = NULL;
+	void *out_buf = NULL;
+	unsigned long out_size = 0;
+	struct timeval start;
+	double t_index, t_delta;
+	int i;
+
+	if (rounds < 1)
+		rounds = 1;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < rounds; i++) {
+		free_delta_index(index);
+		index = create_delta_index(from_buf, from_size);
+	}
+	t_index = elapsed(&start);
+	if (!index) {
+		fprintf(stderr, "cannot index the reference buffer\n");
+		return 1;
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < rounds; i++) {
+		free(out_buf);
+		out_buf = create_delta(index, data_buf, data_size, &out_size, 0);
+	}
+	t_delta = elapsed(&start);
+	if (!out_buf) {
+		fprintf(stderr, "delta operation failed (returned NULL)\n");
+		return 1;
+	}
+
+	printf("delta size: %lu\n", out_size);
+	printf("index: %.3f ms/round (%.1f MB/s)\n", t_index * 1e3 / rounds,
+	       from_size * rounds / t_index / 1e6);
+	printf("delta: %.3f ms/round (%.1f MB/s)\n", t_delta * 1e3 / rounds,
+	       data_size * rounds / t_delta / 1e6);
+	free(out_buf);
+	free_delta_index(index);
+	return 0;
+}
 
 int main(int argc, char *argv[])
 {
@@ -21,8 +78,10 @@ int main(int argc, char *argv[])
 	struct stat st;
 	void *from_buf, *data_buf, *out_buf;
 	unsigned long from_size, data_size, out_size;
+	int bench = (argc == 4 || argc == 5) && !strcmp(argv[1], "-b");
 
-	if (argc != 5 || (strcmp(argv[1], "-d") && strcmp(argv[1], "-p"))) {
+	if (!bench &&
+	    (argc != 5 || (strcmp(argv[1], "-d") && strcmp(argv[1], "-p")))) {
 		fprintf(stderr, "Usage: %s\n", usage_str);
 		return 1;
 	}
@@ -55,6 +114,10 @@ int main(int argc, char *argv[])
 	}
 	close(fd);
 
+	if (bench)
+		return bench_delta(from_buf, from_size, data_buf, data_size,
+				   argc == 5 ? atoi(argv[4]) : 10);
+
 	if (argv[1][1] == 'd')
 		out_buf = diff_delta(from_buf, from_size,
 				     data_buf, data_size,
@@ -57,6 +57,7 @@ static int dump_cache_tree(struct cache_tree *it,
 int main(int ac, char **av)
 {
 	struct cache_tree *another = cache_tree();
+	git_config(git_default_config, NULL);
 	if (read_cache() < 0)
 		die("unable to read index file");
 	cache_tree_update(another, active_cache, active_nr, WRITE_TREE_DRY_RUN);
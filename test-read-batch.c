@@ -0,0 +1,43 @@
+/*
+ * test-read-batch.c: test the batched object reading API.
+ *
+ * Reads object names from stdin, one per line, and prints the type,
+ * size and recomputed name of each object as it is delivered.
+ */
+
+#include "cache.h"
+#include "object.h"
+#include "sha1-array.h"
+
+static int show_object(const unsigned char *sha1, enum object_type type,
+		       unsigned long size, void *buf, void *cb_data)
+{
+	unsigned char real[20];
+
+	if (!buf) {
+		printf("%s missing\n", sha1_to_hex(sha1));
+		return 0;
+	}
+	hash_sha1_file(buf, size, typename(type), real);
+	printf("%s %s %lu", sha1_to_hex(sha1), typename(type), size);
+	printf(" %s\n", sha1_to_hex(real));
+	free(buf);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct sha1_array list = SHA1_ARRAY_INIT;
+	struct strbuf line = STRBUF_INIT;
+
+	setup_git_directory();
+	while (strbuf_getline(&line, stdin, '\n') != EOF) {
+		unsigned char sha1[20];
+		if (get_sha1_hex(line.buf, sha1))
+			die("not an object name: %s", line.buf);
+		sha1_array_append(&list, sha1);
+	}
+	strbuf_release(&line);
+
+	return read_sha1_batch(&list, show_object, NULL);
+}
@@ -1,5 +1,65 @@
 #include "cache.h"
 
+static double elapsed(struct timeval *start)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_usec - start->tv_usec) / 1e6;
+}
+
+/*
+ * Hash "count" pseudo-random blobs of up to "size" bytes, one at a time
+ * and then as a batch, and check that both give the same names.
+ */
+static int bench_batch(unsigned long size, int count)
+{
+	struct hash_batch_item *item = xcalloc(count, sizeof(*item));
+	unsigned char *data = xmalloc(size + count);
+	unsigned char (*sha1)[20] = xmalloc(count * sizeof(*sha1));
+	unsigned long total = 0, i;
+	unsigned int seed = 1;
+	struct timeval start;
+	double t_one, t_batch;
+	int n;
+
+	for (i = 0; i < size + count; i++) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = seed >> 16;
+	}
+	for (n = 0; n < count; n++) {
+		seed = seed * 1103515245 + 12345;
+		item[n].buf = data + n;
+		item[n].len = size ? (seed >> 8) % (size + 1) : 0;
+		item[n].type = "blob";
+		total += item[n].len;
+	}
+
+	hash_sha1_files(item, count); /* warm up */
+	gettimeofday(&start, NULL);
+	hash_sha1_files(item, count);
+	t_batch = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (n = 0; n < count; n++)
+		hash_sha1_file(item[n].buf, item[n].len, item[n].type,
+			       sha1[n]);
+	t_one = elapsed(&start);
+
+	for (n = 0; n < count; n++)
+		if (hashcmp(sha1[n], item[n].sha1))
+			die("batch hash of object %d (%lu bytes) differs",
+			    n, item[n].len);
+
+	printf("%d objects, %lu bytes\n", count, total);
+	printf("one at a time: %.1f MB/s\n", total / t_one / 1e6);
+	printf("batched: %.1f MB/s\n", total / t_batch / 1e6);
+	free(sha1);
+	free(data);
+	free(item);
+	return 0;
+}
+
 int main(int ac, char **av)
 {
 	git_SHA_CTX ctx;
@@ -7,6 +67,10 @@ int main(int ac, char **av)
 	unsigned bufsz = 8192;
 	char *buffer;
 
+	if (ac >= 2 && !strcmp(av[1], "-b"))
+		return bench_batch(ac > 2 ? strtoul(av[2], NULL, 10) : 1024,
+				   ac > 3 ? atoi(av[3]) : 100000);
+
 	if (ac == 2)
 		bufsz = strtoul(av[1], NULL, 10) * 1024 * 1024;
 
@@ -3,6 +3,16 @@
 dd if=/dev/zero bs=1048576 count=100 2>/dev/null |
 /usr/bin/time ./test-sha1 >/dev/null
 
+# hashing objects in a batch must give the same names as one at a time
+for size in 0 50 64 1000 100000
+do
+	./test-sha1 -b $size 2000 >/dev/null || {
+		echo >&2 "OOPS: batch of objects up to $size bytes"
+		exit 1
+	}
+	echo "OK: batch of objects up to $size bytes"
+done
+
 while read expect cnt pfx
 do
 	case "$expect" in '#'*) continue ;; esac
@@ -177,6 +177,15 @@ void trace_repo_setup(const char *prefix)
 	trace_printf_key(key, "setup: prefix: %s\n", quote_crnl(prefix));
 }
 
+/* Nanoseconds since the epoch, for timing what a trace reports */
+uint64_t getnanotime(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+}
+
 int trace_want(const char *key)
 {
 	const char *trace = getenv(key);
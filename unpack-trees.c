@@ -8,6 +8,8 @@
 #include "progress.h"
 #include "refs.h"
 #include "attr.h"
+#include "split-index.h"
+#include "parallel-checkout.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -188,7 +190,7 @@ static int check_updates(struct unpack_trees_options *o)
 	unsigned cnt = 0, total = 0;
 	struct progress *progress = NULL;
 	struct index_state *index = &o->result;
-	int i;
+	int i, threads;
 	int errs = 0;
 
 	if (o->update && o->verbose_update) {
@@ -218,6 +220,11 @@ static int check_updates(struct unpack_trees_options *o)
 	remove_marked_cache_entries(&o->result);
 	remove_scheduled_dirs();
 
+	if (o->update && !o->dry_run &&
+	    (threads = parallel_checkout_threads(index)) > 1)
+		errs |= checkout_entries_parallel(index, &state, threads,
+						  progress, &cnt);
+
 	for (i = 0; i < index->cache_nr; i++) {
 		struct cache_entry *ce = index->cache[i];
 
@@ -1033,6 +1040,9 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	o->result.timestamp.sec = o->src_index->timestamp.sec;
 	o->result.timestamp.nsec = o->src_index->timestamp.nsec;
 	o->result.version = o->src_index->version;
+	o->result.split_index = o->src_index->split_index;
+	if (o->result.split_index)
+		o->result.split_index->refcount++;
 	o->merge_size = len;
 	mark_all_ce_unused(o->src_index);
 
@@ -1146,6 +1156,14 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 		}
 	}
 
+	if (o->dst_index == o->src_index) {
+		/* the untracked cache and fsmonitor state go with the index */
+		o->result.untracked = o->src_index->untracked;
+		o->src_index->untracked = NULL;
+		o->result.fsmonitor_last_update =
+			o->src_index->fsmonitor_last_update;
+		o->result.fsmonitor_answered = o->src_index->fsmonitor_answered;
+	}
 	o->src_index = NULL;
 	ret = check_updates(o) ? (-2) : 0;
 	if (o->dst_index)
@@ -1250,8 +1268,10 @@ static int verify_uptodate_sparse(struct cache_entry *ce,
 
 static void invalidate_ce_path(struct cache_entry *ce, struct unpack_trees_options *o)
 {
-	if (ce)
-		cache_tree_invalidate_path(o->src_index->cache_tree, ce->name);
+	if (!ce)
+		return;
+	cache_tree_invalidate_path(o->src_index->cache_tree, ce->name);
+	untracked_cache_invalidate_path(o->src_index, ce->name);
 }
 
 /*
@@ -108,6 +108,18 @@ void git_inflate_end(git_zstream *strm)
 	      strm->z.msg ? strm->z.msg : "no message");
 }
 
+void git_inflate_copy(git_zstream *dst, git_zstream *src)
+{
+	int status;
+
+	*dst = *src;
+	status = inflateCopy(&dst->z, &src->z);
+	if (status == Z_OK)
+		return;
+	die("inflateCopy: %s (%s)", zerr_to_string(status),
+	    src->z.msg ? src->z.msg : "no message");
+}
+
 int git_inflate(git_zstream *strm, int flush)
 {
 	int status;